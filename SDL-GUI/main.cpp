@@ -1,13 +1,95 @@
 #include "sdl.hpp"
 #include "emulator/emulator.hpp"
+#include "emulator/engine.hpp"
+#include "emulator/lockstep.hpp"
+#include "emulator/snapshot_file.hpp"
+#include "static_invaders/static_invaders.hpp"
 #include <SDL2/SDL.h>
 #include <iostream>
+#include <string>
 using namespace std;
 
+// usage: Main [-engine name] [-lockstep] [-diagnostics] [-load file] [-checkpoint file]
 int main(int argc, char **argv)
 {
+  string engine_name = "interpreter";
+  bool lockstep = false;
+  bool diagnostics = false;
+  string load_path;
+  string checkpoint_path;
+  for (int i = 1; i < argc; i++)
+  {
+    string arg = argv[i];
+    if (arg == "-engine" && i + 1 < argc)
+    {
+      engine_name = argv[++i];
+    }
+    else if (arg == "-lockstep")
+    {
+      lockstep = true;
+    }
+    else if (arg == "-diagnostics")
+    {
+      diagnostics = true;
+    }
+    else if (arg == "-load" && i + 1 < argc)
+    {
+      load_path = argv[++i];
+    }
+    else if (arg == "-checkpoint" && i + 1 < argc)
+    {
+      checkpoint_path = argv[++i];
+    }
+    else
+    {
+      cout << "usage: " << argv[0] << " [-engine name] [-lockstep] [-diagnostics]"
+           << " [-load file] [-checkpoint file]" << endl;
+      return 1;
+    }
+  }
+  StaticInvaders::Register();
+  const Engine *engine = EngineRegistry::Find(engine_name);
+  if (engine == nullptr)
+  {
+    cout << "Unknown engine " << engine_name << endl;
+    return 1;
+  }
+
   // Initialize emulator and SDL objects and run game
   Emulator e;
+  if (!load_path.empty())
+  {
+    // carry on from a saved game, e.g. the last checkpoint
+    SnapshotFile snapshot;
+    if (!snapshot.Open(load_path) || !snapshot.Restore(&e))
+    {
+      cout << "Unable to load " << snapshot.Error() << endl;
+      return 1;
+    }
+  }
   SDL s(&e);
+  s.engine = engine;
+
+  // save the game now and then without holding up the frame
+  CheckpointWriter checkpoint;
+  if (!checkpoint_path.empty())
+  {
+    checkpoint.Start(checkpoint_path);
+    s.checkpoint = &checkpoint;
+  }
+
+  // check the engine against the interpreter, one frame behind on a
+  // second thread
+  LockstepChecker checker(*engine, *EngineRegistry::Find("interpreter"));
+  if (lockstep)
+  {
+    checker.Start(e);
+    s.lockstep = &checker;
+  }
+  // print invalid instructions and writes as they happen
+  if (diagnostics)
+  {
+    e.Diagnostics().StartPrinting(cout);
+  }
   s.RunGame();
 }
@@ -1,4 +1,8 @@
 #include "emulator/emulator.hpp"
+#include "emulator/engine.hpp"
+#include "emulator/lockstep.hpp"
+#include "emulator/snapshot_file.hpp"
+#include "emulator/video.hpp"
 #include "sdl.hpp"
 #include <SDL2/SDL.h>
 #include <fstream>
@@ -22,54 +26,28 @@ SDL::SDL(Emulator* i8080) : this_cpu(i8080)
     SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO);
     SDL_CreateWindowAndRenderer(224 * 3, 256 * 3, 0, &window, &renderer);
     SDL_RenderSetScale(renderer, 3, 3);
-    SDL_RenderSetLogicalSize(renderer, 224, 256);
+    SDL_RenderSetLogicalSize(renderer, Video::kWidth, Video::kHeight);
+    texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING,
+                                Video::kWidth, Video::kHeight);
+}
+
+// Release the texture before the renderer it belongs to
+SDL::~SDL()
+{
+    SDL_DestroyTexture(texture);
+    SDL_DestroyRenderer(renderer);
+    SDL_DestroyWindow(window);
 }
 
 // Draw pixels to screen from Space Invaders video RAM
 void SDL::DrawGraphic()
 {
+    Video::ConvertVram(this_cpu->GetMemory() + Video::kVramStart, pixels);
+    SDL_UpdateTexture(texture, nullptr, pixels, Video::kWidth * sizeof(uint32_t));
+
     SDL_SetRenderDrawColor(renderer, 0, 0, 0, 0);
     SDL_RenderClear(renderer);
-    for (uint16_t v = 0; v < 224; v++)
-    {
-        for (int16_t h = 0; h < 256; h++)
-        {
-            uint16_t base_offset = 0x2400;
-            uint16_t vertical_offset = 0x20 * v;
-            uint16_t horizontal_offset = (h >> 3);
-            uint16_t current_byte = base_offset + vertical_offset + horizontal_offset;
-            uint8_t current_bit = (h % 8);
-
-            bool thisPixel = (this_cpu->ReadFromMem(current_byte) & (1 << current_bit)) != 0;
-
-            // retrieve the current pixel color
-            if (thisPixel)
-            {
-                if (h < 64 && (h >= 16 || (v >= 16 && v < 128)))
-                {
-                    // green in player area
-                    SDL_SetRenderDrawColor(renderer, 0, 255, 0, 255);
-                }
-                else if (h >= 192 && h < 224)
-                {
-                    // red for UFO area
-                    SDL_SetRenderDrawColor(renderer, 255, 0, 0, 255);
-                }
-                else
-                {
-                    // white everywhere else
-                    SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
-                }
-            }
-            else
-            {
-                SDL_SetRenderDrawColor(renderer, 0, 0, 0, 0);
-            }
-
-            // Rotate coordinates counter clockwise
-            SDL_RenderDrawPoint(renderer, v, 256 - h - 1);
-        }
-    }
+    SDL_RenderCopy(renderer, texture, nullptr, nullptr);
     SDL_RenderPresent(renderer);
 }
 
@@ -260,20 +238,82 @@ void SDL::RunGame()
         {
             lastFrameTime = currentTime;
 
-            this_cpu->Emulate(emu_cycles);
+            RunCpu(emu_cycles);
 
             // Interrupt 1 to update top half of screen
             GetInput();
-            this_cpu->Interrupt(1);
-            this_cpu->Emulate(emu_cycles);
+            InterruptCpu(1);
+            RunCpu(emu_cycles);
 
             // Interrupt 2 to update bottom half of screen
             GetInput();
-            this_cpu->Interrupt(2);
+            InterruptCpu(2);
+            EndFrame();
 
             DrawGraphic();
         }
+        else
+        {
+            // nothing to emulate until the next frame is due, so give the
+            // host CPU back rather than spin
+            SDL_Delay(1);
+        }
         GetInput();
         GetSound();
     }
 }
+
+// Run the selected engine, through the lockstep checker if there is one
+void SDL::RunCpu(int cycles)
+{
+    if (lockstep != nullptr)
+    {
+        lockstep->Emulate(this_cpu, cycles);
+    }
+    else if (engine != nullptr)
+    {
+        engine->run(this_cpu, cycles);
+    }
+    else
+    {
+        this_cpu->Emulate(cycles);
+    }
+}
+
+// Send an interrupt, through the lockstep checker if there is one
+void SDL::InterruptCpu(int interrupt_num)
+{
+    if (lockstep != nullptr)
+    {
+        lockstep->Interrupt(this_cpu, interrupt_num);
+    }
+    else
+    {
+        this_cpu->Interrupt(interrupt_num);
+    }
+}
+
+// frames between checkpoints, ten seconds of play
+static const long kCheckpointFrames = 600;
+
+// Frame boundary: hand the frame to the lockstep checker and report the
+// first mismatch it finds, the game keeps running on the engine
+void SDL::EndFrame()
+{
+    frames++;
+    if (checkpoint != nullptr && frames % kCheckpointFrames == 0)
+    {
+        checkpoint->Submit(*this_cpu);
+    }
+    if (lockstep == nullptr || lockstep->EndFrame(*this_cpu) || lockstep_reported)
+    {
+        return;
+    }
+    lockstep_reported = true;
+    lockstep->Report(cout);
+    string snapshot_path = "lockstep_frame_" + to_string(lockstep->Mismatch().frame) + ".snap";
+    if (lockstep->WriteSnapshot(snapshot_path))
+    {
+        cout << "Machine at the start of the frame written to " << snapshot_path << endl;
+    }
+}
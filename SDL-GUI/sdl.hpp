@@ -6,10 +6,14 @@
 #include <string>
 #include <iostream>
 #include "sound.hpp"
+#include "emulator/video.hpp"
 
 using namespace std;
 
 class Emulator;
+class LockstepChecker;
+class CheckpointWriter;
+struct Engine;
 
 // create struct to use sounds within gameplay
 struct Sounds {
@@ -32,19 +36,30 @@ class SDL
 {
 public:
     explicit SDL(Emulator* i8080);
+    ~SDL();
     void DrawGraphic();
     void GetInput();
     void RunGame();
     void GetSound();
     void PlaySound(Sound* sound, int pause = 0);
     void LoadSounds();
+    void RunCpu(int cycles);
+    void InterruptCpu(int interrupt_num);
+    void EndFrame();
 
 public:
     SDL_Window *window;
     SDL_Renderer *renderer;
+    SDL_Texture *texture;
+    uint32_t pixels[Video::kWidth * Video::kHeight];
     Emulator* this_cpu;
     Sounds sounds;
     bool ufo_playing = false;
+    const Engine *engine = nullptr;     // runs the game instead of Emulate if set
+    LockstepChecker *lockstep = nullptr; // checks engine against the interpreter if set
+    bool lockstep_reported = false;
+    CheckpointWriter *checkpoint = nullptr; // saves the game every kCheckpointFrames if set
+    long frames = 0;
 };
 
 #endif // SDL_GUI_SDL_HPP_
@@ -0,0 +1,269 @@
+#include <algorithm>
+#include <cstring>
+#include "disassembler/chunk_reader.hpp"
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+const size_t ChunkReader::kDefaultChunkSize;
+
+namespace
+{
+// fseek and ftell with 64-bit offsets; long is only 32 bits on Windows
+int Seek(FILE *file, uint64_t offset, int origin)
+{
+#ifdef _WIN32
+    return _fseeki64(file, static_cast<__int64>(offset), origin);
+#else
+    return fseeko(file, static_cast<off_t>(offset), origin);
+#endif
+}
+
+int64_t Tell(FILE *file)
+{
+#ifdef _WIN32
+    return _ftelli64(file);
+#else
+    return ftello(file);
+#endif
+}
+} // namespace
+
+ChunkReader::ChunkReader()
+{
+    file = nullptr;
+    fd = -1;
+    mapped = false;
+    failed = false;
+    region_end = 0;
+    position = 0;
+    chunk_size = kDefaultChunkSize;
+    buffer_start = 0;
+    buffer_end = 0;
+    map_base = nullptr;
+    map_length = 0;
+    map_offset = 0;
+}
+
+ChunkReader::~ChunkReader()
+{
+    Close();
+}
+
+// Open length bytes of the file at path starting at offset
+// Memory mapping is used if requested and supported, otherwise reads go
+// through a buffer of chunk_size bytes. Returns false if the file can't be opened.
+bool ChunkReader::Open(const string &path, uint64_t offset, uint64_t length,
+                       bool use_mmap, size_t chunk_size)
+{
+    Close();
+    this->chunk_size = max(chunk_size, static_cast<size_t>(16));
+
+    file = fopen(path.c_str(), "rb");
+    if (file == nullptr)
+    {
+        return false;
+    }
+
+    // determine size of file to clamp the region
+    uint64_t file_size = 0;
+    if (Seek(file, 0, SEEK_END) == 0)
+    {
+        int64_t end = Tell(file);
+        file_size = end < 0 ? 0 : static_cast<uint64_t>(end);
+    }
+    offset = min(offset, file_size);
+    region_end = offset + min(length, file_size - offset);
+    position = offset;
+
+#ifndef _WIN32
+    if (use_mmap)
+    {
+        fd = fileno(file);
+        mapped = MapWindow(position);
+    }
+#endif
+
+    if (!mapped)
+    {
+        buffer.resize(this->chunk_size);
+        buffer_start = 0;
+        buffer_end = 0;
+        if (Seek(file, offset, SEEK_SET) != 0)
+        {
+            Close();
+            return false;
+        }
+        Refill(this->chunk_size);
+    }
+    return true;
+}
+
+// Release the file and any buffer or mapping
+void ChunkReader::Close()
+{
+    Unmap();
+    if (file != nullptr)
+    {
+        fclose(file);
+        file = nullptr;
+    }
+    fd = -1;
+    mapped = false;
+    failed = false;
+    vector<uint8_t>().swap(buffer);
+    buffer_start = 0;
+    buffer_end = 0;
+}
+
+// Pointer to the next unconsumed byte
+const uint8_t *ChunkReader::Data() const
+{
+    if (mapped)
+    {
+        return map_base + (position - map_offset);
+    }
+    return buffer.data() + buffer_start;
+}
+
+// Number of contiguous bytes available at Data()
+size_t ChunkReader::Available() const
+{
+    if (mapped)
+    {
+        return static_cast<size_t>(min(map_offset + map_length, region_end) - position);
+    }
+    return buffer_end - buffer_start;
+}
+
+// Mark count bytes at Data() as read
+void ChunkReader::Consume(size_t count)
+{
+    count = min(count, Available());
+    position += count;
+    if (!mapped)
+    {
+        buffer_start += count;
+    }
+}
+
+// Make at least wanted bytes contiguous at Data(), or everything that is left
+// Returns false once the region has been fully consumed, or if the next
+// window could not be mapped or read, which sets Failed()
+bool ChunkReader::Refill(size_t wanted)
+{
+    wanted = min(wanted, chunk_size);
+    if (failed)
+    {
+        return false;
+    }
+    if (Available() >= wanted || IsLastWindow())
+    {
+        return Available() > 0;
+    }
+
+    if (mapped)
+    {
+        failed = !MapWindow(position);
+        return !failed && Available() > 0;
+    }
+
+    // move the unconsumed tail to the front and top up the buffer
+    size_t tail = buffer_end - buffer_start;
+    memmove(buffer.data(), buffer.data() + buffer_start, tail);
+    buffer_start = 0;
+    buffer_end = tail;
+
+    uint64_t left_in_region = region_end - (position + tail);
+    size_t to_read = static_cast<size_t>(min(static_cast<uint64_t>(buffer.size() - tail), left_in_region));
+    size_t count = fread(buffer.data() + tail, 1, to_read, file);
+    buffer_end += count;
+    if (count < to_read)
+    {
+        // the region was clamped to the file's size, so a short read is an
+        // error or a file truncated while it was being read
+        failed = true;
+        return false;
+    }
+    return Available() > 0;
+}
+
+// True once every byte of the region has been consumed
+bool ChunkReader::AtEnd() const
+{
+    return position >= region_end;
+}
+
+// True if Data() holds everything left in the region
+bool ChunkReader::IsLastWindow() const
+{
+    return position + Available() >= region_end;
+}
+
+// True if a window could not be mapped or read, ending the stream early
+bool ChunkReader::Failed() const
+{
+    return failed;
+}
+
+// File offset of Data()
+uint64_t ChunkReader::Position() const
+{
+    return position;
+}
+
+// True if the file is read through a memory mapped window
+bool ChunkReader::IsMapped() const
+{
+    return mapped;
+}
+
+// Map a window of the file that starts at or before offset at
+bool ChunkReader::MapWindow(uint64_t at)
+{
+#ifndef _WIN32
+    Unmap();
+    uint64_t page = static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+    map_offset = at - at % page;
+
+    // round the window up to whole pages, plus one for the straddling tail
+    uint64_t window = (chunk_size + page - 1) / page * page + page;
+    map_length = static_cast<size_t>(min(window, region_end - map_offset));
+    if (map_length == 0)
+    {
+        return true;
+    }
+
+    void *view = mmap(nullptr, map_length, PROT_READ, MAP_PRIVATE, fd, static_cast<off_t>(map_offset));
+    if (view == MAP_FAILED)
+    {
+        // an empty window at at, so that Available() is 0
+        map_base = nullptr;
+        map_length = 0;
+        map_offset = at;
+        return false;
+    }
+    map_base = static_cast<uint8_t *>(view);
+    madvise(map_base, map_length, MADV_SEQUENTIAL);
+    return true;
+#else
+    return false;
+#endif
+}
+
+// Drop the current mapped window
+void ChunkReader::Unmap()
+{
+#ifndef _WIN32
+    if (map_base != nullptr)
+    {
+        munmap(map_base, map_length);
+    }
+#endif
+    map_base = nullptr;
+    map_length = 0;
+}
@@ -0,0 +1,70 @@
+#ifndef DISASSEMBLER_CHUNK_READER_HPP_
+#define DISASSEMBLER_CHUNK_READER_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Sequential reader over a region of a file using constant memory
+//
+// The region is exposed one window at a time, either from a fixed size
+// buffer or from a memory mapped view of chunk_size bytes. Refill() keeps
+// the unconsumed tail of the current window so a record that straddles a
+// chunk boundary (e.g. a three byte instruction) is always contiguous.
+// Offsets are 64-bit throughout, so regions past 2 GiB can be read. A
+// window that cannot be mapped or read part way through ends the stream
+// with Failed() set, so that a caller can tell it from the end of the input.
+class ChunkReader
+{
+public:
+    static const size_t kDefaultChunkSize = 64 * 1024;
+
+    ChunkReader();
+    ~ChunkReader();
+
+    bool Open(const std::string &path, uint64_t offset = 0, uint64_t length = UINT64_MAX,
+              bool use_mmap = false, size_t chunk_size = kDefaultChunkSize);
+    void Close();
+
+    const uint8_t *Data() const;
+    size_t Available() const;
+    void Consume(size_t count);
+    bool Refill(size_t wanted);
+    bool AtEnd() const;
+    bool IsLastWindow() const;
+    bool Failed() const;
+
+    uint64_t Position() const;
+    bool IsMapped() const;
+
+private:
+    bool MapWindow(uint64_t at);
+    void Unmap();
+
+    FILE *file;
+    int fd;
+    bool mapped;
+    bool failed;
+
+    // file offsets of the region being read
+    uint64_t region_end;
+
+    // file offset of Data()
+    uint64_t position;
+
+    size_t chunk_size;
+
+    // buffered mode
+    std::vector<uint8_t> buffer;
+    size_t buffer_start;
+    size_t buffer_end;
+
+    // mapped mode
+    uint8_t *map_base;
+    size_t map_length;
+    uint64_t map_offset;
+};
+
+#endif // DISASSEMBLER_CHUNK_READER_HPP_
@@ -0,0 +1,453 @@
+#include <iomanip>
+#include <iostream>
+#include <algorithm>
+#include "disassembler/control_flow.hpp"
+using namespace std;
+
+/*
+
+Recursive descent disassembly as described in
+C. Cifuentes, "Reverse Compilation Techniques", 1994, chapter 4
+
+Instruction lengths and flow follow the Emulator - the undocumented
+opcodes (0x08, 0xcb, 0xd9, 0xdd, 0xed, 0xfd, ...) are single byte no-ops there.
+
+*/
+
+ControlFlowGraph::ControlFlowGraph()
+{
+    image = nullptr;
+    image_size = 0;
+    image_origin = 0;
+}
+
+// Reset vector and the two interrupt vectors used by Space Invaders
+vector<uint16_t> ControlFlowGraph::DefaultEntryPoints()
+{
+    vector<uint16_t> entries;
+    entries.push_back(0x0000);
+    entries.push_back(0x0008);
+    entries.push_back(0x0010);
+    return entries;
+}
+
+// Append the count addresses stored as little endian words at address,
+// address + stride, ... of an image loaded at origin, such as the handlers
+// of a table of records; fails if a word or an address it holds lies
+// outside the image
+bool ControlFlowGraph::TableEntryPoints(const uint8_t *code, int size, uint16_t origin, uint16_t address,
+                                        int count, int stride, vector<uint16_t> *entries)
+{
+    for (int i = 0; i < count; i++)
+    {
+        uint32_t at = address + static_cast<uint32_t>(i) * stride;
+        if (at < origin || at + 2 > origin + static_cast<uint32_t>(size))
+        {
+            return false;
+        }
+        uint16_t entry = static_cast<uint16_t>(code[at - origin] | code[at - origin + 1] << 8);
+        if (entry < origin || entry >= origin + static_cast<uint32_t>(size))
+        {
+            return false;
+        }
+        entries->push_back(entry);
+    }
+    return true;
+}
+
+// Number of bytes taken by the instruction starting with opcode
+int ControlFlowGraph::InstructionLength(uint8_t opcode)
+{
+    switch (opcode)
+    {
+    // LXI, SHLD, LHLD, STA, LDA
+    case 0x01:
+    case 0x11:
+    case 0x21:
+    case 0x31:
+    case 0x22:
+    case 0x2a:
+    case 0x32:
+    case 0x3a:
+    // JMP and Jcc
+    case 0xc2:
+    case 0xc3:
+    case 0xca:
+    case 0xd2:
+    case 0xda:
+    case 0xe2:
+    case 0xea:
+    case 0xf2:
+    case 0xfa:
+    // CALL and Ccc
+    case 0xc4:
+    case 0xcc:
+    case 0xcd:
+    case 0xd4:
+    case 0xdc:
+    case 0xe4:
+    case 0xec:
+    case 0xf4:
+    case 0xfc:
+        return 3;
+
+    // MVI
+    case 0x06:
+    case 0x0e:
+    case 0x16:
+    case 0x1e:
+    case 0x26:
+    case 0x2e:
+    case 0x36:
+    case 0x3e:
+    // immediate arithmetic and logic
+    case 0xc6:
+    case 0xce:
+    case 0xd6:
+    case 0xde:
+    case 0xe6:
+    case 0xee:
+    case 0xf6:
+    case 0xfe:
+    // IN and OUT
+    case 0xd3:
+    case 0xdb:
+        return 2;
+
+    default:
+        return 1;
+    }
+}
+
+// Classify how the instruction starting with opcode transfers control
+FlowType ControlFlowGraph::GetFlowType(uint8_t opcode)
+{
+    switch (opcode)
+    {
+    case 0xc3:
+        return kFlowJump;
+    case 0xc2:
+    case 0xca:
+    case 0xd2:
+    case 0xda:
+    case 0xe2:
+    case 0xea:
+    case 0xf2:
+    case 0xfa:
+        return kFlowBranch;
+    case 0xcd:
+        return kFlowCall;
+    case 0xc4:
+    case 0xcc:
+    case 0xd4:
+    case 0xdc:
+    case 0xe4:
+    case 0xec:
+    case 0xf4:
+    case 0xfc:
+        return kFlowCondCall;
+    case 0xc7:
+    case 0xcf:
+    case 0xd7:
+    case 0xdf:
+    case 0xe7:
+    case 0xef:
+    case 0xf7:
+    case 0xff:
+        return kFlowRestart;
+    case 0xc9:
+        return kFlowReturn;
+    case 0xc0:
+    case 0xc8:
+    case 0xd0:
+    case 0xd8:
+    case 0xe0:
+    case 0xe8:
+    case 0xf0:
+    case 0xf8:
+        return kFlowCondReturn;
+    case 0xe9:
+        return kFlowIndirect;
+    case 0x76:
+        return kFlowHalt;
+    default:
+        return kFlowNext;
+    }
+}
+
+// Find the statically known target of a jump, call or restart
+// Returns false if the instruction has no such target
+bool ControlFlowGraph::BranchTarget(const uint8_t *instruction, uint16_t *target)
+{
+    switch (GetFlowType(instruction[0]))
+    {
+    case kFlowJump:
+    case kFlowBranch:
+    case kFlowCall:
+    case kFlowCondCall:
+        *target = (instruction[2] << 8) | instruction[1];
+        return true;
+    case kFlowRestart:
+        *target = instruction[0] & 0x38;
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Analyze image starting from the reset and interrupt vectors
+void ControlFlowGraph::Analyze(const uint8_t *code, int size, uint16_t origin)
+{
+    Analyze(code, size, origin, DefaultEntryPoints());
+}
+
+// Analyze image loaded at origin starting from the given entry points
+void ControlFlowGraph::Analyze(const uint8_t *code, int size, uint16_t origin,
+                               const vector<uint16_t> &entry_points)
+{
+    image = code;
+    image_size = size;
+    image_origin = origin;
+    byte_types.assign(size, kByteData);
+    blocks.clear();
+    subroutines.clear();
+
+    set<uint16_t> leaders;
+    for (size_t i = 0; i < entry_points.size(); i++)
+    {
+        if (InImage(entry_points[i]))
+        {
+            subroutines.insert(entry_points[i]);
+            leaders.insert(entry_points[i]);
+            Explore(entry_points[i], &leaders);
+        }
+    }
+
+    BuildBlocks(leaders);
+
+    // the image is only borrowed for the duration of the analysis
+    image = nullptr;
+}
+
+// Check that address lies within the analyzed image
+bool ControlFlowGraph::InImage(uint32_t address) const
+{
+    return address >= image_origin && address < image_origin + static_cast<uint32_t>(image_size);
+}
+
+// Follow every path reachable from entry, marking instructions and leaders
+void ControlFlowGraph::Explore(uint16_t entry, set<uint16_t> *leaders)
+{
+    vector<uint16_t> worklist;
+    worklist.push_back(entry);
+
+    while (!worklist.empty())
+    {
+        uint32_t pc = worklist.back();
+        worklist.pop_back();
+
+        while (InImage(pc) && byte_types[pc - image_origin] != kByteOpcode)
+        {
+            const uint8_t *code = &image[pc - image_origin];
+            int length = InstructionLength(code[0]);
+
+            // stop at an instruction cut off by the end of the image
+            if (!InImage(pc + length - 1))
+            {
+                break;
+            }
+
+            byte_types[pc - image_origin] = kByteOpcode;
+            for (int i = 1; i < length; i++)
+            {
+                if (byte_types[pc - image_origin + i] == kByteData)
+                {
+                    byte_types[pc - image_origin + i] = kByteOperand;
+                }
+            }
+
+            FlowType flow = GetFlowType(code[0]);
+            uint16_t target;
+            if (BranchTarget(code, &target) && InImage(target))
+            {
+                leaders->insert(target);
+                worklist.push_back(target);
+                if (flow == kFlowCall || flow == kFlowCondCall || flow == kFlowRestart)
+                {
+                    subroutines.insert(target);
+                }
+            }
+
+            if (flow == kFlowNext)
+            {
+                pc += length;
+                continue;
+            }
+
+            // the instruction after any transfer of control starts a block
+            if (flow != kFlowJump && flow != kFlowReturn && flow != kFlowIndirect)
+            {
+                leaders->insert(pc + length);
+                worklist.push_back(pc + length);
+            }
+            break;
+        }
+    }
+}
+
+// Split the reached instructions into basic blocks and link them
+void ControlFlowGraph::BuildBlocks(const set<uint16_t> &leaders)
+{
+    for (set<uint16_t>::const_iterator it = leaders.begin(); it != leaders.end(); ++it)
+    {
+        if (!InImage(*it) || byte_types[*it - image_origin] != kByteOpcode)
+        {
+            continue;
+        }
+
+        BasicBlock block;
+        block.start = *it;
+        uint32_t pc = *it;
+        while (true)
+        {
+            const uint8_t *code = &image[pc - image_origin];
+            uint32_t next = pc + InstructionLength(code[0]);
+            block.last = pc;
+            block.num_instructions++;
+            block.exit = GetFlowType(code[0]);
+
+            uint16_t target;
+            if (BranchTarget(code, &target) && InImage(target))
+            {
+                block.successors.push_back(target);
+            }
+            if (block.exit != kFlowJump && block.exit != kFlowReturn &&
+                block.exit != kFlowIndirect && InImage(next) &&
+                byte_types[next - image_origin] == kByteOpcode)
+            {
+                if (block.exit != kFlowNext || leaders.count(next))
+                {
+                    block.successors.push_back(next);
+                }
+            }
+
+            pc = next;
+            if (block.exit != kFlowNext || !InImage(pc) ||
+                byte_types[pc - image_origin] != kByteOpcode || leaders.count(pc))
+            {
+                break;
+            }
+        }
+        block.end = pc;
+
+        // a RST or call to the following instruction gives a duplicate edge
+        sort(block.successors.begin(), block.successors.end());
+        block.successors.erase(unique(block.successors.begin(), block.successors.end()),
+                               block.successors.end());
+        blocks[block.start] = block;
+    }
+
+    for (map<uint16_t, BasicBlock>::iterator it = blocks.begin(); it != blocks.end(); ++it)
+    {
+        const vector<uint16_t> &successors = it->second.successors;
+        for (size_t i = 0; i < successors.size(); i++)
+        {
+            map<uint16_t, BasicBlock>::iterator succ = blocks.find(successors[i]);
+            if (succ != blocks.end())
+            {
+                succ->second.predecessors.push_back(it->first);
+            }
+        }
+    }
+}
+
+// Return all basic blocks keyed by start address
+const map<uint16_t, BasicBlock> &ControlFlowGraph::GetBlocks() const
+{
+    return blocks;
+}
+
+// Return the block starting at address, or nullptr
+const BasicBlock *ControlFlowGraph::BlockAt(uint16_t address) const
+{
+    map<uint16_t, BasicBlock>::const_iterator it = blocks.find(address);
+    return it == blocks.end() ? nullptr : &it->second;
+}
+
+// Return the block whose instructions cover address, or nullptr
+const BasicBlock *ControlFlowGraph::BlockContaining(uint16_t address) const
+{
+    map<uint16_t, BasicBlock>::const_iterator it = blocks.upper_bound(address);
+    if (it == blocks.begin())
+    {
+        return nullptr;
+    }
+    --it;
+    return address < it->second.end ? &it->second : nullptr;
+}
+
+// Return the entry points plus every CALL and RST target
+const set<uint16_t> &ControlFlowGraph::GetSubroutines() const
+{
+    return subroutines;
+}
+
+// Return whether address was reached as code, and if so which byte it is
+ByteType ControlFlowGraph::GetByteType(uint16_t address) const
+{
+    if (address < image_origin || address - image_origin >= static_cast<int>(byte_types.size()))
+    {
+        return kByteData;
+    }
+    return static_cast<ByteType>(byte_types[address - image_origin]);
+}
+
+// Return whether address is part of a reachable instruction
+bool ControlFlowGraph::IsCode(uint16_t address) const
+{
+    return GetByteType(address) != kByteData;
+}
+
+// Return whether a basic block starts at address
+bool ControlFlowGraph::IsBlockStart(uint16_t address) const
+{
+    return blocks.count(address) != 0;
+}
+
+// Return number of image bytes that belong to reachable instructions
+int ControlFlowGraph::CodeBytes() const
+{
+    int count = 0;
+    for (size_t i = 0; i < byte_types.size(); i++)
+    {
+        if (byte_types[i] != kByteData)
+        {
+            count++;
+        }
+    }
+    return count;
+}
+
+// Print one line per block with its edges
+void ControlFlowGraph::Print(ostream &out) const
+{
+    ios_base::fmtflags saved = out.flags();
+    out << hex << setfill('0');
+    for (map<uint16_t, BasicBlock>::const_iterator it = blocks.begin(); it != blocks.end(); ++it)
+    {
+        const BasicBlock &block = it->second;
+        out << "block " << setw(4) << block.start << '-' << setw(4) << (block.end - 1)
+            << (subroutines.count(block.start) ? " sub" : "    ") << " succ:";
+        for (size_t i = 0; i < block.successors.size(); i++)
+        {
+            out << ' ' << setw(4) << block.successors[i];
+        }
+        out << " pred:";
+        for (size_t i = 0; i < block.predecessors.size(); i++)
+        {
+            out << ' ' << setw(4) << block.predecessors[i];
+        }
+        out << endl;
+    }
+    out.flags(saved);
+}
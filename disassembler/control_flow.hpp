@@ -0,0 +1,96 @@
+#ifndef DISASSEMBLER_CONTROL_FLOW_HPP_
+#define DISASSEMBLER_CONTROL_FLOW_HPP_
+
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <set>
+#include <vector>
+
+// How an instruction passes control to the next one
+enum FlowType
+{
+    kFlowNext,       // falls through to the following instruction
+    kFlowJump,       // JMP - always goes to its target
+    kFlowBranch,     // Jcc - target or fall through
+    kFlowCall,       // CALL - target, then returns to the following instruction
+    kFlowCondCall,   // Ccc - target or fall through
+    kFlowRestart,    // RST n - call to a fixed low memory vector
+    kFlowReturn,     // RET - target comes from the stack
+    kFlowCondReturn, // Rcc - return or fall through
+    kFlowIndirect,   // PCHL - target comes from HL
+    kFlowHalt        // HLT - resumes at the following instruction after an interrupt
+};
+
+// What a byte of the image was found to be during analysis
+enum ByteType
+{
+    kByteData = 0,   // never reached from an entry point
+    kByteOpcode,     // first byte of an instruction
+    kByteOperand     // second or third byte of an instruction
+};
+
+// Straight-line run of instructions with a single entry and exit
+struct BasicBlock
+{
+    uint16_t start = 0;         // address of the first instruction
+    uint16_t end = 0;           // address one past the last byte
+    uint16_t last = 0;          // address of the last instruction
+    int num_instructions = 0;
+    FlowType exit = kFlowNext;  // flow type of the last instruction
+    std::vector<uint16_t> successors;
+    std::vector<uint16_t> predecessors;
+};
+
+// Recursive descent analysis of an 8080 image
+//
+// Starting from the given entry points, every reachable JMP/Jcc/CALL/Ccc/RST
+// target is followed so that code and data can be told apart, then the
+// reached instructions are split into basic blocks linked by their
+// predecessor and successor edges. Indirect transfers (RET, PCHL) end a block
+// without successors since their target is only known at run time.
+class ControlFlowGraph
+{
+public:
+    ControlFlowGraph();
+
+    void Analyze(const uint8_t *code, int size, uint16_t origin = 0x0000);
+    void Analyze(const uint8_t *code, int size, uint16_t origin,
+                 const std::vector<uint16_t> &entry_points);
+
+    static std::vector<uint16_t> DefaultEntryPoints();
+    static bool TableEntryPoints(const uint8_t *code, int size, uint16_t origin, uint16_t address, int count,
+                                 int stride, std::vector<uint16_t> *entries);
+    static int InstructionLength(uint8_t opcode);
+    static FlowType GetFlowType(uint8_t opcode);
+    static bool BranchTarget(const uint8_t *instruction, uint16_t *target);
+
+    const std::map<uint16_t, BasicBlock> &GetBlocks() const;
+    const BasicBlock *BlockAt(uint16_t address) const;
+    const BasicBlock *BlockContaining(uint16_t address) const;
+    const std::set<uint16_t> &GetSubroutines() const;
+
+    ByteType GetByteType(uint16_t address) const;
+    bool IsCode(uint16_t address) const;
+    bool IsBlockStart(uint16_t address) const;
+    int CodeBytes() const;
+
+    void Print(std::ostream &out) const;
+
+private:
+    bool InImage(uint32_t address) const;
+    void Explore(uint16_t entry, std::set<uint16_t> *leaders);
+    void BuildBlocks(const std::set<uint16_t> &leaders);
+
+    const uint8_t *image;
+    int image_size;
+    uint16_t image_origin;
+
+    // one entry per byte of the image
+    std::vector<uint8_t> byte_types;
+
+    std::map<uint16_t, BasicBlock> blocks;
+    std::set<uint16_t> subroutines;
+};
+
+#endif // DISASSEMBLER_CONTROL_FLOW_HPP_
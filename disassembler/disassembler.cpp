@@ -1,8 +1,15 @@
 #include <iomanip>
 #include <iostream>
+#include <sstream>
 #include <locale>
 #include <fstream>
+#include <cstdlib>
+#include <algorithm>
+#include <string>
+#include <vector>
 #include "disassembler/disassembler.hpp"
+#include "disassembler/control_flow.hpp"
+#include "disassembler/chunk_reader.hpp"
 using namespace std;
 
 /*
@@ -16,1000 +23,1146 @@ Intel, “8080 Assembly Language Programming Manual”, 1975
 */
 
 // Disassemble opcodes from Space Invaders ROM to human readable instructions
-int Disassembler::Disassemble(char *codebuffer, int pc)
+// Reads no further than the size bytes of codebuffer
+int Disassembler::Disassemble(char *codebuffer, int pc, int size)
 {
-    char *code = &codebuffer[pc];
+    return Disassemble(cout, reinterpret_cast<uint8_t *>(&codebuffer[pc]), min(size - pc, 3), pc);
+}
+
+// Disassemble one instruction to out, labelled with address
+// Reads at most available bytes; an instruction cut off by the end of the
+// input is listed as data. Returns the number of bytes consumed.
+int Disassembler::Disassemble(ostream &out, const uint8_t *bytes, int available, uint64_t address)
+{
+    if (available < 3)
+    {
+        // decode from a padded copy so operands are never read past the end
+        uint8_t padded[3] = {0, 0, 0};
+        for (int i = 0; i < available; i++)
+        {
+            padded[i] = bytes[i];
+        }
+
+        ostringstream line;
+        int opbytes = Disassemble(line, padded, 3, address);
+        if (opbytes <= available)
+        {
+            out << line.str();
+            return opbytes;
+        }
+
+        ios_base::fmtflags saved = out.flags();
+        char fill = out.fill();
+        for (int i = 0; i < available; i++)
+        {
+            out << hex << setfill('0') << setw(4) << (address + i) << " DB #$"
+                << setw(2) << static_cast<unsigned>(bytes[i]) << '\n';
+        }
+        out.flags(saved);
+        out.fill(fill);
+        return available;
+    }
+
+    const uint8_t *code = bytes;
     int opbytes = 1;
 
-    cout << setfill('0') << setw(4) << pc << ' ';
+    ios_base::fmtflags saved = out.flags();
+    char fill = out.fill();
+    out << hex << setfill('0') << setw(4) << address << ' ';
     switch ((unsigned char)*code)
     {
     // 0x00 - 0x0f
     case 0x00:
-        cout << "NOP" << endl;
+        out << "NOP" << '\n';
         break;
     case 0x01:
-        cout << "LXI B,#$" << hex << setfill('0') << setw(2)
-             << static_cast<unsigned>((unsigned char)code[2])
-             << setfill('0') << setw(2)
-             << static_cast<unsigned>((unsigned char)code[1]) << endl;
+        out << "LXI B,#$" << hex << setfill('0') << setw(2)
+            << static_cast<unsigned>((unsigned char)code[2])
+            << setfill('0') << setw(2)
+            << static_cast<unsigned>((unsigned char)code[1]) << '\n';
         opbytes = 3;
         break;
     case 0x02:
-        cout << "STAX B" << endl;
+        out << "STAX B" << '\n';
         break;
     case 0x03:
-        cout << "INX B" << endl;
+        out << "INX B" << '\n';
         break;
     case 0x04:
-        cout << "INR B" << endl;
+        out << "INR B" << '\n';
         break;
     case 0x05:
-        cout << "DCR B" << endl;
+        out << "DCR B" << '\n';
         break;
     case 0x06:
-        cout << "MVI B,#$" << hex << setfill('0') << setw(2)
-             << static_cast<unsigned>((unsigned char)code[1]) << endl;
+        out << "MVI B,#$" << hex << setfill('0') << setw(2)
+            << static_cast<unsigned>((unsigned char)code[1]) << '\n';
         opbytes = 2;
         break;
     case 0x07:
-        cout << "RLC" << endl;
+        out << "RLC" << '\n';
         break;
     case 0x08:
-        cout << "NOP" << endl;
+        out << "NOP" << '\n';
         break;
     case 0x09:
-        cout << "DAD B" << endl;
+        out << "DAD B" << '\n';
         break;
     case 0x0a:
-        cout << "LDAX B" << endl;
+        out << "LDAX B" << '\n';
         break;
     case 0x0b:
-        cout << "DCX B" << endl;
+        out << "DCX B" << '\n';
         break;
     case 0x0c:
-        cout << "INR C" << endl;
+        out << "INR C" << '\n';
         break;
     case 0x0d:
-        cout << "DCR C" << endl;
+        out << "DCR C" << '\n';
         break;
     case 0x0e:
-        cout << "MVI C,#$" << hex << setfill('0') << setw(2)
-             << static_cast<unsigned>((unsigned char)code[1]) << endl;
+        out << "MVI C,#$" << hex << setfill('0') << setw(2)
+            << static_cast<unsigned>((unsigned char)code[1]) << '\n';
         opbytes = 2;
         break;
     case 0x0f:
-        cout << "RRC" << endl;
+        out << "RRC" << '\n';
         break;
 
     // 0x10 - 0x1f
     case 0x10:
-        cout << "NOP" << endl;
+        out << "NOP" << '\n';
         break;
     case 0x11:
-        cout << "LXI D #$" << hex << setfill('0') << setw(2)
-             << static_cast<unsigned>((unsigned char)code[2])
-             << setfill('0') << setw(2)
-             << static_cast<unsigned>((unsigned char)code[1]) << endl;
+        out << "LXI D #$" << hex << setfill('0') << setw(2)
+            << static_cast<unsigned>((unsigned char)code[2])
+            << setfill('0') << setw(2)
+            << static_cast<unsigned>((unsigned char)code[1]) << '\n';
         opbytes = 3;
         break;
     case 0x12:
-        cout << "STAX D" << endl;
+        out << "STAX D" << '\n';
         break;
     case 0x13:
-        cout << "INX D" << endl;
+        out << "INX D" << '\n';
         break;
     case 0x14:
-        cout << "INR D" << endl;
+        out << "INR D" << '\n';
         break;
     case 0x15:
-        cout << "DEC D" << endl;
+        out << "DCR D" << '\n';
         break;
     case 0x16:
-        cout << "MVI D, $" << hex << setfill('0') << setw(2)
-             << static_cast<unsigned>((unsigned char)code[1]) << endl;
+        out << "MVI D, $" << hex << setfill('0') << setw(2)
+            << static_cast<unsigned>((unsigned char)code[1]) << '\n';
         opbytes = 2;
         break;
     case 0x17:
-        cout << "RAL" << endl;
+        out << "RAL" << '\n';
         break;
     case 0x18:
-        cout << "NOP" << endl;
+        out << "NOP" << '\n';
         break;
     case 0x19:
-        cout << "DAD D" << endl;
+        out << "DAD D" << '\n';
         break;
     case 0x1a:
-        cout << "LDAX D" << endl;
+        out << "LDAX D" << '\n';
         break;
     case 0x1b:
-        cout << "DCX D" << endl;
+        out << "DCX D" << '\n';
         break;
     case 0x1c:
-        cout << "INR E" << endl;
+        out << "INR E" << '\n';
         break;
     case 0x1d:
-        cout << "DEC E" << endl;
+        out << "DEC E" << '\n';
         break;
     case 0x1e:
-        cout << "MVI E, $" << hex << setfill('0') << setw(2)
-             << static_cast<unsigned>((unsigned char)code[1]) << endl;
+        out << "MVI E, $" << hex << setfill('0') << setw(2)
+            << static_cast<unsigned>((unsigned char)code[1]) << '\n';
         opbytes = 2;
         break;
     case 0x1f:
-        cout << "RAR" << endl;
+        out << "RAR" << '\n';
         break;
 
     // 0x20 - 0x2f
     case 0x20:
-        cout << "NOP" << endl;
+        out << "NOP" << '\n';
         break;
     case 0x21:
-        cout << "LXI H, #$" << hex << setfill('0') << setw(2)
-             << static_cast<unsigned>((unsigned char)code[2])
-             << setfill('0') << setw(2)
-             << static_cast<unsigned>((unsigned char)code[1]) << endl;
+        out << "LXI H, #$" << hex << setfill('0') << setw(2)
+            << static_cast<unsigned>((unsigned char)code[2])
+            << setfill('0') << setw(2)
+            << static_cast<unsigned>((unsigned char)code[1]) << '\n';
         opbytes = 3;
         break;
     case 0x22:
-        cout << "SHLD $" << hex << setfill('0') << setw(2)
-             << static_cast<unsigned>((unsigned char)code[2])
-             << setfill('0') << setw(2)
-             << static_cast<unsigned>((unsigned char)code[1]) << endl;
+        out << "SHLD $" << hex << setfill('0') << setw(2)
+            << static_cast<unsigned>((unsigned char)code[2])
+            << setfill('0') << setw(2)
+            << static_cast<unsigned>((unsigned char)code[1]) << '\n';
         opbytes = 3;
         break;
     case 0x23:
-        cout << "INX H" << endl;
+        out << "INX H" << '\n';
         break;
     case 0x24:
-        cout << "INR H" << endl;
+        out << "INR H" << '\n';
         break;
     case 0x25:
-        cout << "DCR H" << endl;
+        out << "DCR H" << '\n';
         break;
     case 0x26:
-        cout << "MVI H, #$" << hex << setfill('0') << setw(2)
-             << static_cast<unsigned>((unsigned char)code[1]) << endl;
+        out << "MVI H, #$" << hex << setfill('0') << setw(2)
+            << static_cast<unsigned>((unsigned char)code[1]) << '\n';
         opbytes = 2;
         break;
     case 0x27:
-        cout << "DAA" << endl;
+        out << "DAA" << '\n';
         break;
     case 0x28:
-        cout << "NOP" << endl;
+        out << "NOP" << '\n';
         break;
     case 0x29:
-        cout << "DAD H" << endl;
+        out << "DAD H" << '\n';
         break;
     case 0x2a:
-        cout << "LHLD $" << hex << setfill('0') << setw(2)
-             << static_cast<unsigned>((unsigned char)code[2])
-             << setfill('0') << setw(2)
-             << static_cast<unsigned>((unsigned char)code[1]) << endl;
+        out << "LHLD $" << hex << setfill('0') << setw(2)
+            << static_cast<unsigned>((unsigned char)code[2])
+            << setfill('0') << setw(2)
+            << static_cast<unsigned>((unsigned char)code[1]) << '\n';
         opbytes = 3;
         break;
     case 0x2b:
-        cout << "DCX H" << endl;
+        out << "DCX H" << '\n';
         break;
     case 0x2c:
-        cout << "INR L" << endl;
+        out << "INR L" << '\n';
         break;
     case 0x2d:
-        cout << "DCR L" << endl;
+        out << "DCR L" << '\n';
         break;
     case 0x2e:
-        cout << "MVI L, #$" << hex << setfill('0') << setw(2)
-             << static_cast<unsigned>((unsigned char)code[1]) << endl;
+        out << "MVI L, #$" << hex << setfill('0') << setw(2)
+            << static_cast<unsigned>((unsigned char)code[1]) << '\n';
         opbytes = 2;
         break;
     case 0x2f:
-        cout << "CMA" << endl;
+        out << "CMA" << '\n';
         break;
 
     // 0x30 - 0x3f
     case 0x30:
-        cout << "NOP" << endl;
+        out << "NOP" << '\n';
         break;
     case 0x31:
-        cout << "LXI SP, #$" << hex << setfill('0') << setw(2)
-             << static_cast<unsigned>((unsigned char)code[2])
-             << setfill('0') << setw(2)
-             << static_cast<unsigned>((unsigned char)code[1]) << endl;
+        out << "LXI SP, #$" << hex << setfill('0') << setw(2)
+            << static_cast<unsigned>((unsigned char)code[2])
+            << setfill('0') << setw(2)
+            << static_cast<unsigned>((unsigned char)code[1]) << '\n';
         opbytes = 3;
         break;
     case 0x32:
-        cout << "STA $" << hex << setfill('0') << setw(2)
-             << static_cast<unsigned>((unsigned char)code[2])
-             << setfill('0') << setw(2)
-             << static_cast<unsigned>((unsigned char)code[1]) << endl;
+        out << "STA $" << hex << setfill('0') << setw(2)
+            << static_cast<unsigned>((unsigned char)code[2])
+            << setfill('0') << setw(2)
+            << static_cast<unsigned>((unsigned char)code[1]) << '\n';
         opbytes = 3;
         break;
     case 0x33:
-        cout << "INX SP" << endl;
+        out << "INX SP" << '\n';
         break;
     case 0x34:
-        cout << "INR M" << endl;
+        out << "INR M" << '\n';
         break;
     case 0x35:
-        cout << "DCR M" << endl;
+        out << "DCR M" << '\n';
         break;
     case 0x36:
-        cout << "MVI M, #$" << hex << setfill('0') << setw(2)
-             << static_cast<unsigned>((unsigned char)code[1]) << endl;
+        out << "MVI M, #$" << hex << setfill('0') << setw(2)
+            << static_cast<unsigned>((unsigned char)code[1]) << '\n';
         opbytes = 2;
         break;
     case 0x37:
-        cout << "STC" << endl;
+        out << "STC" << '\n';
         break;
     case 0x38:
-        cout << "NOP" << endl;
+        out << "NOP" << '\n';
         break;
     case 0x39:
-        cout << "DAD SP" << endl;
+        out << "DAD SP" << '\n';
         break;
     case 0x3a:
-        cout << "LDA $" << hex << setfill('0') << setw(2)
-             << static_cast<unsigned>((unsigned char)code[2])
-             << setfill('0') << setw(2)
-             << static_cast<unsigned>((unsigned char)code[1]) << endl;
+        out << "LDA $" << hex << setfill('0') << setw(2)
+            << static_cast<unsigned>((unsigned char)code[2])
+            << setfill('0') << setw(2)
+            << static_cast<unsigned>((unsigned char)code[1]) << '\n';
         opbytes = 3;
         break;
     case 0x3b:
-        cout << "DCX SP" << endl;
+        out << "DCX SP" << '\n';
         break;
     case 0x3c:
-        cout << "INR A" << endl;
+        out << "INR A" << '\n';
         break;
     case 0x3d:
-        cout << "DCR A" << endl;
+        out << "DCR A" << '\n';
         break;
     case 0x3e:
-        cout << "MVI A, #$" << hex
-             << static_cast<unsigned>((unsigned char)code[1]) << endl;
+        out << "MVI A, #$" << hex
+            << static_cast<unsigned>((unsigned char)code[1]) << '\n';
         opbytes = 2;
         break;
     case 0x3f:
-        cout << "CMC" << endl;
+        out << "CMC" << '\n';
         break;
 
     // 0x40 - 0x4f
     case 0x40:
-        cout << "MOV B,B" << endl;
+        out << "MOV B,B" << '\n';
         break;
     case 0x41:
-        cout << "MOV B,C" << endl;
+        out << "MOV B,C" << '\n';
         break;
     case 0x42:
-        cout << "MOV B,D" << endl;
+        out << "MOV B,D" << '\n';
         break;
     case 0x43:
-        cout << "MOV B,E" << endl;
+        out << "MOV B,E" << '\n';
         break;
     case 0x44:
-        cout << "MOV B,H" << endl;
+        out << "MOV B,H" << '\n';
         break;
     case 0x45:
-        cout << "MOV B,L" << endl;
+        out << "MOV B,L" << '\n';
         break;
     case 0x46:
-        cout << "MOV B,M" << endl;
+        out << "MOV B,M" << '\n';
         break;
     case 0x47:
-        cout << "MOV B,A" << endl;
+        out << "MOV B,A" << '\n';
         break;
     case 0x48:
-        cout << "MOV C,B" << endl;
+        out << "MOV C,B" << '\n';
         break;
     case 0x49:
-        cout << "MOV C,C" << endl;
+        out << "MOV C,C" << '\n';
         break;
     case 0x4a:
-        cout << "MOV C,D" << endl;
+        out << "MOV C,D" << '\n';
         break;
     case 0x4b:
-        cout << "MOV C,E" << endl;
+        out << "MOV C,E" << '\n';
         break;
     case 0x4c:
-        cout << "MOV C,H" << endl;
+        out << "MOV C,H" << '\n';
         break;
     case 0x4d:
-        cout << "MOV C,L" << endl;
+        out << "MOV C,L" << '\n';
         break;
     case 0x4e:
-        cout << "MOV C,M" << endl;
+        out << "MOV C,M" << '\n';
         break;
     case 0x4f:
-        cout << "MOV C,A" << endl;
+        out << "MOV C,A" << '\n';
         break;
 
     // 0x50 - 0x5f
     case 0x50:
-        cout << "MOV D, B" << endl;
+        out << "MOV D, B" << '\n';
         break;
     case 0x51:
-        cout << "MOV D, C" << endl;
+        out << "MOV D, C" << '\n';
         break;
     case 0x52:
-        cout << "MOV D, D" << endl;
+        out << "MOV D, D" << '\n';
         break;
     case 0x53:
-        cout << "MOV D, E" << endl;
+        out << "MOV D, E" << '\n';
         break;
     case 0x54:
-        cout << "MOV D, H" << endl;
+        out << "MOV D, H" << '\n';
         break;
     case 0x55:
-        cout << "MOV D, L" << endl;
+        out << "MOV D, L" << '\n';
         break;
     case 0x56:
-        cout << "MOV D, M" << endl;
+        out << "MOV D, M" << '\n';
         break;
     case 0x57:
-        cout << "MOV D, A" << endl;
+        out << "MOV D, A" << '\n';
         break;
     case 0x58:
-        cout << "MOV E, B" << endl;
+        out << "MOV E, B" << '\n';
         break;
     case 0x59:
-        cout << "MOV E, C" << endl;
+        out << "MOV E, C" << '\n';
         break;
     case 0x5a:
-        cout << "MOV E, D" << endl;
+        out << "MOV E, D" << '\n';
         break;
     case 0x5b:
-        cout << "MOV E, E" << endl;
+        out << "MOV E, E" << '\n';
         break;
     case 0x5c:
-        cout << "MOV E, H" << endl;
+        out << "MOV E, H" << '\n';
         break;
     case 0x5d:
-        cout << "MOV E, L" << endl;
+        out << "MOV E, L" << '\n';
         break;
     case 0x5e:
-        cout << "MOV E, M" << endl;
+        out << "MOV E, M" << '\n';
         break;
     case 0x5f:
-        cout << "MOV E, A" << endl;
+        out << "MOV E, A" << '\n';
         break;
 
     // 0x60 - 0x6f
     case 0x60:
-        cout << "MOV H, B" << endl;
+        out << "MOV H, B" << '\n';
         break;
     case 0x61:
-        cout << "MOV H, C" << endl;
+        out << "MOV H, C" << '\n';
         break;
     case 0x62:
-        cout << "MOV H, D" << endl;
+        out << "MOV H, D" << '\n';
         break;
     case 0x63:
-        cout << "MOV H, E" << endl;
+        out << "MOV H, E" << '\n';
         break;
     case 0x64:
-        cout << "MOV H, H" << endl;
+        out << "MOV H, H" << '\n';
         break;
     case 0x65:
-        cout << "MOV H, L" << endl;
+        out << "MOV H, L" << '\n';
         break;
     case 0x66:
-        cout << "MOV H, M" << endl;
+        out << "MOV H, M" << '\n';
         break;
     case 0x67:
-        cout << "MOV H, A" << endl;
+        out << "MOV H, A" << '\n';
         break;
     case 0x68:
-        cout << "MOV L, B" << endl;
+        out << "MOV L, B" << '\n';
         break;
     case 0x69:
-        cout << "MOV L, C" << endl;
+        out << "MOV L, C" << '\n';
         break;
     case 0x6a:
-        cout << "MOV L, D" << endl;
+        out << "MOV L, D" << '\n';
         break;
     case 0x6b:
-        cout << "MOV L, E" << endl;
+        out << "MOV L, E" << '\n';
         break;
     case 0x6c:
-        cout << "MOV L, H" << endl;
+        out << "MOV L, H" << '\n';
         break;
     case 0x6d:
-        cout << "MOV L, L" << endl;
+        out << "MOV L, L" << '\n';
         break;
     case 0x6e:
-        cout << "MOV L, M" << endl;
+        out << "MOV L, M" << '\n';
         break;
     case 0x6f:
-        cout << "MOV L, A" << endl;
+        out << "MOV L, A" << '\n';
         break;
 
     // 0x70 - 0x7f
     case 0x70:
-        cout << "MOV M, B" << endl;
+        out << "MOV M, B" << '\n';
         break;
     case 0x71:
-        cout << "MOV M, C" << endl;
+        out << "MOV M, C" << '\n';
         break;
     case 0x72:
-        cout << "MOV M, D" << endl;
+        out << "MOV M, D" << '\n';
         break;
     case 0x73:
-        cout << "MOV M, E" << endl;
+        out << "MOV M, E" << '\n';
         break;
     case 0x74:
-        cout << "MOV M, H" << endl;
+        out << "MOV M, H" << '\n';
         break;
     case 0x75:
-        cout << "MOV M, L" << endl;
+        out << "MOV M, L" << '\n';
         break;
     case 0x76:
-        cout << "HLT" << endl;
+        out << "HLT" << '\n';
         break;
     case 0x77:
-        cout << "MOV M, A" << endl;
+        out << "MOV M, A" << '\n';
         break;
     case 0x78:
-        cout << "MOV A, B" << endl;
+        out << "MOV A, B" << '\n';
         break;
     case 0x79:
-        cout << "MOV A, C" << endl;
+        out << "MOV A, C" << '\n';
         break;
     case 0x7a:
-        cout << "MOV A, D" << endl;
+        out << "MOV A, D" << '\n';
         break;
     case 0x7b:
-        cout << "MOV A, E" << endl;
+        out << "MOV A, E" << '\n';
         break;
     case 0x7c:
-        cout << "MOV A, H" << endl;
+        out << "MOV A, H" << '\n';
         break;
     case 0x7d:
-        cout << "MOV A, L" << endl;
+        out << "MOV A, L" << '\n';
         break;
     case 0x7e:
-        cout << "MOV A, M" << endl;
+        out << "MOV A, M" << '\n';
         break;
     case 0x7f:
-        cout << "MOV A, A" << endl;
+        out << "MOV A, A" << '\n';
         break;
 
     // 0x80 - 0x8f
     case 0x80:
-        cout << "ADD B" << endl;
+        out << "ADD B" << '\n';
         break;
     case 0x81:
-        cout << "ADD C" << endl;
+        out << "ADD C" << '\n';
         break;
     case 0x82:
-        cout << "ADD D" << endl;
+        out << "ADD D" << '\n';
         break;
     case 0x83:
-        cout << "ADD E" << endl;
+        out << "ADD E" << '\n';
         break;
     case 0x84:
-        cout << "ADD H" << endl;
+        out << "ADD H" << '\n';
         break;
     case 0x85:
-        cout << "ADD L" << endl;
+        out << "ADD L" << '\n';
         break;
     case 0x86:
-        cout << "ADD M" << endl;
+        out << "ADD M" << '\n';
         break;
     case 0x87:
-        cout << "ADD A" << endl;
+        out << "ADD A" << '\n';
         break;
     case 0x88:
-        cout << "ADC B" << endl;
+        out << "ADC B" << '\n';
         break;
     case 0x89:
-        cout << "ADC C" << endl;
+        out << "ADC C" << '\n';
         break;
     case 0x8a:
-        cout << "ADC D" << endl;
+        out << "ADC D" << '\n';
         break;
     case 0x8b:
-        cout << "ADC E" << endl;
+        out << "ADC E" << '\n';
         break;
     case 0x8c:
-        cout << "ADC H" << endl;
+        out << "ADC H" << '\n';
         break;
     case 0x8d:
-        cout << "ADC L" << endl;
+        out << "ADC L" << '\n';
         break;
     case 0x8e:
-        cout << "ADC M" << endl;
+        out << "ADC M" << '\n';
         break;
     case 0x8f:
-        cout << "ADC A" << endl;
+        out << "ADC A" << '\n';
         break;
 
     // 0x90 - 0x9f
     case 0x90:
-        cout << "SUB B" << endl;
+        out << "SUB B" << '\n';
         break;
     case 0x91:
-        cout << "SUB C" << endl;
+        out << "SUB C" << '\n';
         break;
     case 0x92:
-        cout << "SUB D" << endl;
+        out << "SUB D" << '\n';
         break;
     case 0x93:
-        cout << "SUB E" << endl;
+        out << "SUB E" << '\n';
         break;
     case 0x94:
-        cout << "SUB H" << endl;
+        out << "SUB H" << '\n';
         break;
     case 0x95:
-        cout << "SUB L" << endl;
+        out << "SUB L" << '\n';
         break;
     case 0x96:
-        cout << "SUB M" << endl;
+        out << "SUB M" << '\n';
         break;
     case 0x97:
-        cout << "SUB A" << endl;
+        out << "SUB A" << '\n';
         break;
     case 0x98:
-        cout << "SBB B" << endl;
+        out << "SBB B" << '\n';
         break;
     case 0x99:
-        cout << "SUB C" << endl;
+        out << "SUB C" << '\n';
         break;
     case 0x9a:
-        cout << "SUB D" << endl;
+        out << "SUB D" << '\n';
         break;
     case 0x9b:
-        cout << "SUB E" << endl;
+        out << "SUB E" << '\n';
         break;
     case 0x9c:
-        cout << "SUB H" << endl;
+        out << "SUB H" << '\n';
         break;
     case 0x9d:
-        cout << "SUB L" << endl;
+        out << "SUB L" << '\n';
         break;
     case 0x9e:
-        cout << "SUB M" << endl;
+        out << "SUB M" << '\n';
         break;
     case 0x9f:
-        cout << "SUB A" << endl;
+        out << "SBB A" << '\n';
         break;
 
     // 0xa0 - 0xaf
     case 0xa0:
-        cout << "ANA B" << endl;
+        out << "ANA B" << '\n';
         break;
     case 0xa1:
-        cout << "ANA C" << endl;
+        out << "ANA C" << '\n';
         break;
     case 0xa2:
-        cout << "ANA D" << endl;
+        out << "ANA D" << '\n';
         break;
     case 0xa3:
-        cout << "ANA E" << endl;
+        out << "ANA E" << '\n';
         break;
     case 0xa4:
-        cout << "ANA H" << endl;
+        out << "ANA H" << '\n';
         break;
     case 0xa5:
-        cout << "ANA L" << endl;
+        out << "ANA L" << '\n';
         break;
     case 0xa6:
-        cout << "ANA M" << endl;
+        out << "ANA M" << '\n';
         break;
     case 0xa7:
-        cout << "ANA A" << endl;
+        out << "ANA A" << '\n';
         break;
     case 0xa8:
-        cout << "XRA B" << endl;
+        out << "XRA B" << '\n';
         break;
     case 0xa9:
-        cout << "XRA C" << endl;
+        out << "XRA C" << '\n';
         break;
     case 0xaa:
-        cout << "XRA D" << endl;
+        out << "XRA D" << '\n';
         break;
     case 0xab:
-        cout << "XRA E" << endl;
+        out << "XRA E" << '\n';
         break;
     case 0xac:
-        cout << "XRA H" << endl;
+        out << "XRA H" << '\n';
         break;
     case 0xad:
-        cout << "XRA L" << endl;
+        out << "XRA L" << '\n';
         break;
     case 0xae:
-        cout << "XRA M" << endl;
+        out << "XRA M" << '\n';
         break;
     case 0xaf:
-        cout << "XRA A" << endl;
+        out << "XRA A" << '\n';
         break;
 
     // 0xb0 - 0xbf
     case 0xb0:
-        cout << "ORA B" << endl;
+        out << "ORA B" << '\n';
         break;
     case 0xb1:
-        cout << "ORA C" << endl;
+        out << "ORA C" << '\n';
         break;
     case 0xb2:
-        cout << "ORA D" << endl;
+        out << "ORA D" << '\n';
         break;
     case 0xb3:
-        cout << "ORA E" << endl;
+        out << "ORA E" << '\n';
         break;
     case 0xb4:
-        cout << "ORA H" << endl;
+        out << "ORA H" << '\n';
         break;
     case 0xb5:
-        cout << "ORA L" << endl;
+        out << "ORA L" << '\n';
         break;
     case 0xb6:
-        cout << "ORA M" << endl;
+        out << "ORA M" << '\n';
         break;
     case 0xb7:
-        cout << "ORA A" << endl;
+        out << "ORA A" << '\n';
         break;
     case 0xb8:
-        cout << "CMP B" << endl;
+        out << "CMP B" << '\n';
         break;
     case 0xb9:
-        cout << "CMP C" << endl;
+        out << "CMP C" << '\n';
         break;
     case 0xba:
-        cout << "CMP D" << endl;
+        out << "CMP D" << '\n';
         break;
     case 0xbb:
-        cout << "CMP E" << endl;
+        out << "CMP E" << '\n';
         break;
     case 0xbc:
-        cout << "CMP H" << endl;
+        out << "CMP H" << '\n';
         break;
     case 0xbd:
-        cout << "CMP L" << endl;
+        out << "CMP L" << '\n';
         break;
     case 0xbe:
-        cout << "CMP M" << endl;
+        out << "CMP M" << '\n';
         break;
     case 0xbf:
-        cout << "CMP A" << endl;
+        out << "CMP A" << '\n';
         break;
 
     // 0xc0 - 0xcf
     case 0xc0:
-        cout << "RNZ" << endl;
+        out << "RNZ" << '\n';
         break;
     case 0xc1:
-        cout << "POP B" << endl;
+        out << "POP B" << '\n';
         break;
     case 0xc2:
-        cout << "JNZ $" << hex << setfill('0') << setw(2)
-             << static_cast<unsigned>((unsigned char)code[2])
-             << setfill('0') << setw(2)
-             << static_cast<unsigned>((unsigned char)code[1]) << endl;
+        out << "JNZ $" << hex << setfill('0') << setw(2)
+            << static_cast<unsigned>((unsigned char)code[2])
+            << setfill('0') << setw(2)
+            << static_cast<unsigned>((unsigned char)code[1]) << '\n';
         opbytes = 3;
         break;
     case 0xc3:
-        cout << "JMP $" << hex << setfill('0') << setw(2)
-             << static_cast<unsigned>((unsigned char)code[2])
-             << setfill('0') << setw(2)
-             << static_cast<unsigned>((unsigned char)code[1]) << endl;
+        out << "JMP $" << hex << setfill('0') << setw(2)
+            << static_cast<unsigned>((unsigned char)code[2])
+            << setfill('0') << setw(2)
+            << static_cast<unsigned>((unsigned char)code[1]) << '\n';
         opbytes = 3;
         break;
     case 0xc4:
-        cout << "CNZ $" << hex << setfill('0') << setw(2)
-             << static_cast<unsigned>((unsigned char)code[2])
-             << setfill('0') << setw(2)
-             << static_cast<unsigned>((unsigned char)code[1]) << endl;
+        out << "CNZ $" << hex << setfill('0') << setw(2)
+            << static_cast<unsigned>((unsigned char)code[2])
+            << setfill('0') << setw(2)
+            << static_cast<unsigned>((unsigned char)code[1]) << '\n';
         opbytes = 3;
         break;
     case 0xc5:
-        cout << "PUSH B" << endl;
+        out << "PUSH B" << '\n';
         break;
     case 0xc6:
-        cout << "ADI #$" << hex << setfill('0') << setw(2)
-             << static_cast<unsigned>((unsigned char)code[1]) << endl;
+        out << "ADI #$" << hex << setfill('0') << setw(2)
+            << static_cast<unsigned>((unsigned char)code[1]) << '\n';
         opbytes = 2;
         break;
     case 0xc7:
-        cout << "RST 0" << endl;
+        out << "RST 0" << '\n';
         break;
     case 0xc8:
-        cout << "RZ" << endl;
+        out << "RZ" << '\n';
         break;
     case 0xc9:
-        cout << "RET" << endl;
+        out << "RET" << '\n';
         break;
     case 0xca:
-        cout << "JZ $" << hex << setfill('0') << setw(2)
-             << static_cast<unsigned>((unsigned char)code[2])
-             << setfill('0') << setw(2)
-             << static_cast<unsigned>((unsigned char)code[1]) << endl;
+        out << "JZ $" << hex << setfill('0') << setw(2)
+            << static_cast<unsigned>((unsigned char)code[2])
+            << setfill('0') << setw(2)
+            << static_cast<unsigned>((unsigned char)code[1]) << '\n';
         opbytes = 3;
         break;
     case 0xcb:
-        cout << "NOP" << endl;
+        out << "NOP" << '\n';
         break;
     case 0xcc:
-        cout << "CZ $" << hex << setfill('0') << setw(2)
-             << static_cast<unsigned>((unsigned char)code[2])
-             << setfill('0') << setw(2)
-             << static_cast<unsigned>((unsigned char)code[1]) << endl;
+        out << "CZ $" << hex << setfill('0') << setw(2)
+            << static_cast<unsigned>((unsigned char)code[2])
+            << setfill('0') << setw(2)
+            << static_cast<unsigned>((unsigned char)code[1]) << '\n';
         opbytes = 3;
         break;
     case 0xcd:
-        cout << "CALL $" << hex << setfill('0') << setw(2)
-             << static_cast<unsigned>((unsigned char)code[2])
-             << setfill('0') << setw(2)
-             << static_cast<unsigned>((unsigned char)code[1]) << endl;
+        out << "CALL $" << hex << setfill('0') << setw(2)
+            << static_cast<unsigned>((unsigned char)code[2])
+            << setfill('0') << setw(2)
+            << static_cast<unsigned>((unsigned char)code[1]) << '\n';
         opbytes = 3;
         break;
     case 0xce:
-        cout << "ACI #$" << hex << setfill('0') << setw(2)
-             << static_cast<unsigned>((unsigned char)code[1]) << endl;
+        out << "ACI #$" << hex << setfill('0') << setw(2)
+            << static_cast<unsigned>((unsigned char)code[1]) << '\n';
         opbytes = 2;
         break;
     case 0xcf:
-        cout << "RST 1" << endl;
+        out << "RST 1" << '\n';
         break;
 
     // 0xd0 - 0xdf
     case 0xd0:
-        cout << "RNC" << endl;
+        out << "RNC" << '\n';
         break;
     case 0xd1:
-        cout << "POP D" << endl;
+        out << "POP D" << '\n';
         break;
     case 0xd2:
-        cout << "JNC $" << hex << setfill('0') << setw(2)
-             << static_cast<unsigned>((unsigned char)code[2])
-             << setfill('0') << setw(2)
-             << static_cast<unsigned>((unsigned char)code[1]) << endl;
+        out << "JNC $" << hex << setfill('0') << setw(2)
+            << static_cast<unsigned>((unsigned char)code[2])
+            << setfill('0') << setw(2)
+            << static_cast<unsigned>((unsigned char)code[1]) << '\n';
         opbytes = 3;
         break;
     case 0xd3:
-        cout << "OUT $" << hex << setfill('0') << setw(2)
-             << static_cast<unsigned>((unsigned char)code[1]) << endl;
+        out << "OUT $" << hex << setfill('0') << setw(2)
+            << static_cast<unsigned>((unsigned char)code[1]) << '\n';
         opbytes = 2;
         break;
     case 0xd4:
-        cout << "CNC $" << hex << setfill('0') << setw(2)
-             << static_cast<unsigned>((unsigned char)code[2])
-             << setfill('0') << setw(2)
-             << static_cast<unsigned>((unsigned char)code[1]) << endl;
+        out << "CNC $" << hex << setfill('0') << setw(2)
+            << static_cast<unsigned>((unsigned char)code[2])
+            << setfill('0') << setw(2)
+            << static_cast<unsigned>((unsigned char)code[1]) << '\n';
         opbytes = 3;
         break;
     case 0xd5:
-        cout << "PUSH D" << endl;
+        out << "PUSH D" << '\n';
         break;
     case 0xd6:
-        cout << "SUI $" << hex << setfill('0') << setw(2)
-             << static_cast<unsigned>((unsigned char)code[1]) << endl;
+        out << "SUI $" << hex << setfill('0') << setw(2)
+            << static_cast<unsigned>((unsigned char)code[1]) << '\n';
         opbytes = 2;
         break;
     case 0xd7:
-        cout << "RST 2 (CALL $0010)" << endl;
+        out << "RST 2 (CALL $0010)" << '\n';
         break;
     case 0xd8:
-        cout << "RC" << endl;
+        out << "RC" << '\n';
         break;
     case 0xd9:
-        cout << "NOP" << endl;
+        out << "NOP" << '\n';
         break;
     case 0xda:
-        cout << "JC $" << hex << setfill('0') << setw(2)
-             << static_cast<unsigned>((unsigned char)code[2])
-             << setfill('0') << setw(2)
-             << static_cast<unsigned>((unsigned char)code[1]) << endl;
+        out << "JC $" << hex << setfill('0') << setw(2)
+            << static_cast<unsigned>((unsigned char)code[2])
+            << setfill('0') << setw(2)
+            << static_cast<unsigned>((unsigned char)code[1]) << '\n';
         opbytes = 3;
         break;
     case 0xdb:
-        cout << "IN $" << hex << setfill('0') << setw(2)
-             << static_cast<unsigned>((unsigned char)code[1]) << endl;
+        out << "IN $" << hex << setfill('0') << setw(2)
+            << static_cast<unsigned>((unsigned char)code[1]) << '\n';
         opbytes = 2;
         break;
     case 0xdc:
-        cout << "CC $" << hex << setfill('0') << setw(2)
-             << static_cast<unsigned>((unsigned char)code[2])
-             << setfill('0') << setw(2)
-             << static_cast<unsigned>((unsigned char)code[1]) << endl;
+        out << "CC $" << hex << setfill('0') << setw(2)
+            << static_cast<unsigned>((unsigned char)code[2])
+            << setfill('0') << setw(2)
+            << static_cast<unsigned>((unsigned char)code[1]) << '\n';
         opbytes = 3;
         break;
     case 0xdd:
-        cout << "NOP" << endl;
+        out << "NOP" << '\n';
         break;
     case 0xde:
-        cout << "SBI $" << hex << setfill('0') << setw(2)
-             << static_cast<unsigned>((unsigned char)code[1]) << endl;
+        out << "SBI $" << hex << setfill('0') << setw(2)
+            << static_cast<unsigned>((unsigned char)code[1]) << '\n';
         opbytes = 2;
         break;
     case 0xdf:
-        cout << "RST 3 (CALL $0018)" << endl;
+        out << "RST 3 (CALL $0018)" << '\n';
         break;
 
     // 0xe0 - 0xef
     case 0xe0:
-        cout << "RPO" << endl;
+        out << "RPO" << '\n';
         break;
     case 0xe1:
-        cout << "POP H" << endl;
+        out << "POP H" << '\n';
         break;
     case 0xe2:
-        cout << "JPO $" << hex << setfill('0') << setw(2)
-             << static_cast<unsigned>((unsigned char)code[2])
-             << setfill('0') << setw(2)
-             << static_cast<unsigned>((unsigned char)code[1]) << endl;
+        out << "JPO $" << hex << setfill('0') << setw(2)
+            << static_cast<unsigned>((unsigned char)code[2])
+            << setfill('0') << setw(2)
+            << static_cast<unsigned>((unsigned char)code[1]) << '\n';
         opbytes = 3;
         break;
     case 0xe3:
-        cout << "XTHL" << endl;
+        out << "XTHL" << '\n';
         break;
     case 0xe4:
-        cout << "CPO $" << hex << setfill('0') << setw(2)
-             << static_cast<unsigned>((unsigned char)code[2])
-             << setfill('0') << setw(2)
-             << static_cast<unsigned>((unsigned char)code[1]) << endl;
+        out << "CPO $" << hex << setfill('0') << setw(2)
+            << static_cast<unsigned>((unsigned char)code[2])
+            << setfill('0') << setw(2)
+            << static_cast<unsigned>((unsigned char)code[1]) << '\n';
         opbytes = 3;
         break;
     case 0xe5:
-        cout << "PUSH H" << endl;
+        out << "PUSH H" << '\n';
         break;
     case 0xe6:
-        cout << "ANI #$" << hex << setfill('0') << setw(2)
-             << static_cast<unsigned>((unsigned char)code[1]) << endl;
+        out << "ANI #$" << hex << setfill('0') << setw(2)
+            << static_cast<unsigned>((unsigned char)code[1]) << '\n';
         opbytes = 2;
         break;
     case 0xe7:
-        cout << "RST 4" << endl;
+        out << "RST 4" << '\n';
         break;
     case 0xe8:
-        cout << "RPE" << endl;
+        out << "RPE" << '\n';
         break;
     case 0xe9:
-        cout << "PCHL" << endl;
+        out << "PCHL" << '\n';
         break;
     case 0xea:
-        cout << "JPE $" << hex << setfill('0') << setw(2)
-             << static_cast<unsigned>((unsigned char)code[2])
-             << setfill('0') << setw(2)
-             << static_cast<unsigned>((unsigned char)code[1]) << endl;
+        out << "JPE $" << hex << setfill('0') << setw(2)
+            << static_cast<unsigned>((unsigned char)code[2])
+            << setfill('0') << setw(2)
+            << static_cast<unsigned>((unsigned char)code[1]) << '\n';
         opbytes = 3;
         break;
     case 0xeb:
-        cout << "XCHG" << endl;
+        out << "XCHG" << '\n';
         break;
     case 0xec:
-        cout << "CPE $" << hex << setfill('0') << setw(2)
-             << static_cast<unsigned>((unsigned char)code[2])
-             << setfill('0') << setw(2)
-             << static_cast<unsigned>((unsigned char)code[1]) << endl;
+        out << "CPE $" << hex << setfill('0') << setw(2)
+            << static_cast<unsigned>((unsigned char)code[2])
+            << setfill('0') << setw(2)
+            << static_cast<unsigned>((unsigned char)code[1]) << '\n';
         opbytes = 3;
         break;
     case 0xed:
-        cout << "CALL $" << hex << setfill('0') << setw(2)
-             << static_cast<unsigned>((unsigned char)code[2])
-             << setfill('0') << setw(2)
-             << static_cast<unsigned>((unsigned char)code[1]) << endl;
+        out << "CALL $" << hex << setfill('0') << setw(2)
+            << static_cast<unsigned>((unsigned char)code[2])
+            << setfill('0') << setw(2)
+            << static_cast<unsigned>((unsigned char)code[1]) << '\n';
         opbytes = 3;
         break;
     case 0xee:
-        cout << "XRI #$" << hex << setfill('0') << setw(2)
-             << static_cast<unsigned>((unsigned char)code[1]) << endl;
+        out << "XRI #$" << hex << setfill('0') << setw(2)
+            << static_cast<unsigned>((unsigned char)code[1]) << '\n';
         opbytes = 2;
         break;
     case 0xef:
-        cout << "RST 5" << endl;
+        out << "RST 5" << '\n';
         break;
 
     // 0xf0 - 0xff
     case 0xf0:
-        cout << "RP" << endl;
+        out << "RP" << '\n';
         break;
     case 0xf1:
-        cout << "POP PSW" << endl;
+        out << "POP PSW" << '\n';
         break;
     case 0xf2:
-        cout << "JP $" << hex << setfill('0') << setw(2)
-             << static_cast<unsigned>((unsigned char)code[2])
-             << setfill('0') << setw(2)
-             << static_cast<unsigned>((unsigned char)code[1]) << endl;
+        out << "JP $" << hex << setfill('0') << setw(2)
+            << static_cast<unsigned>((unsigned char)code[2])
+            << setfill('0') << setw(2)
+            << static_cast<unsigned>((unsigned char)code[1]) << '\n';
         opbytes = 3;
         break;
     case 0xf3:
-        cout << "DI" << endl;
+        out << "DI" << '\n';
         break;
     case 0xf4:
-        cout << "CP $" << hex << setfill('0') << setw(2)
-             << static_cast<unsigned>((unsigned char)code[2])
-             << setfill('0') << setw(2)
-             << static_cast<unsigned>((unsigned char)code[1]) << endl;
+        out << "CP $" << hex << setfill('0') << setw(2)
+            << static_cast<unsigned>((unsigned char)code[2])
+            << setfill('0') << setw(2)
+            << static_cast<unsigned>((unsigned char)code[1]) << '\n';
         opbytes = 3;
         break;
     case 0xf5:
-        cout << "PUSH PSW" << endl;
+        out << "PUSH PSW" << '\n';
         break;
     case 0xf6:
-        cout << "ORI #$" << hex << setfill('0') << setw(2)
-             << static_cast<unsigned>((unsigned char)code[1]) << endl;
+        out << "ORI #$" << hex << setfill('0') << setw(2)
+            << static_cast<unsigned>((unsigned char)code[1]) << '\n';
         opbytes = 2;
         break;
     case 0xf7:
-        cout << "RST 6" << endl;
+        out << "RST 6" << '\n';
         break;
     case 0xf8:
-        cout << "RM" << endl;
+        out << "RM" << '\n';
         break;
     case 0xf9:
-        cout << "SPHL" << endl;
+        out << "SPHL" << '\n';
         break;
     case 0xfa:
-        cout << "JM $" << hex << setfill('0') << setw(2)
-             << static_cast<unsigned>((unsigned char)code[2])
-             << setfill('0') << setw(2)
-             << static_cast<unsigned>((unsigned char)code[1]) << endl;
+        out << "JM $" << hex << setfill('0') << setw(2)
+            << static_cast<unsigned>((unsigned char)code[2])
+            << setfill('0') << setw(2)
+            << static_cast<unsigned>((unsigned char)code[1]) << '\n';
         opbytes = 3;
         break;
     case 0xfb:
-        cout << "EI" << endl;
+        out << "EI" << '\n';
         break;
     case 0xfc:
-        cout << "CM $" << hex << setfill('0') << setw(2)
-             << static_cast<unsigned>((unsigned char)code[2])
-             << setfill('0') << setw(2)
-             << static_cast<unsigned>((unsigned char)code[1]) << endl;
+        out << "CM $" << hex << setfill('0') << setw(2)
+            << static_cast<unsigned>((unsigned char)code[2])
+            << setfill('0') << setw(2)
+            << static_cast<unsigned>((unsigned char)code[1]) << '\n';
         opbytes = 3;
         break;
     case 0xfd:
-        cout << "CALL $" << hex << setfill('0') << setw(2)
-             << static_cast<unsigned>((unsigned char)code[2])
-             << setfill('0') << setw(2)
-             << static_cast<unsigned>((unsigned char)code[1]) << endl;
+        out << "CALL $" << hex << setfill('0') << setw(2)
+            << static_cast<unsigned>((unsigned char)code[2])
+            << setfill('0') << setw(2)
+            << static_cast<unsigned>((unsigned char)code[1]) << '\n';
         opbytes = 3;
         break;
     case 0xfe:
-        cout << "CPI #$" << hex << setfill('0') << setw(2)
-             << static_cast<unsigned>((unsigned char)code[1]) << endl;
+        out << "CPI #$" << hex << setfill('0') << setw(2)
+            << static_cast<unsigned>((unsigned char)code[1]) << '\n';
         opbytes = 2;
         break;
     case 0xff:
-        cout << "RST 7" << endl;
+        out << "RST 7" << '\n';
         break;
     default:
-        cout << "NOT IMPLEMENTED YET" << endl;
+        out << "NOT IMPLEMENTED YET" << '\n';
         break;
     }
 
+    out.flags(saved);
+    out.fill(fill);
     return opbytes;
 }
 
+// Disassemble everything left in reader, numbering the first byte load_address
+// Only a few bytes of the input are held at a time, so any size can be listed.
+// Returns the number of bytes consumed.
+uint64_t Disassembler::DisassembleStream(ostream &out, ChunkReader *reader, uint64_t load_address)
+{
+    uint64_t start = reader->Position();
+
+    while (reader->Refill(3))
+    {
+        const uint8_t *data = reader->Data();
+        size_t available = reader->Available();
+
+        // leave the last two bytes of a window for the next one, unless the
+        // input ends there, so an instruction never straddles two windows
+        size_t limit = reader->IsLastWindow() ? available : available - 2;
+        size_t used = 0;
+        while (used < limit)
+        {
+            int left = static_cast<int>(min(available - used, static_cast<size_t>(3)));
+            used += Disassemble(out, data + used, left, load_address + (reader->Position() - start) + used);
+        }
+        reader->Consume(used);
+    }
+
+    return reader->Position() - start;
+}
+
+// Command line entry point
+// usage: da <file> [-cfg] [-mmap] [-offset n] [-length n] [-origin n] [-chunk n]
+// -offset/-length select a region of the file, -origin is the address the
+// region is loaded at. Numbers may be given in decimal or with a 0x prefix.
 int Disassembler::main(int argc, char **argv)
 {
     cout << "Starting Disassembler\n";
 
-    streampos size;
-    char *memblock;
-
-    ifstream file(argv[1], ios::in | ios::binary | ios::ate);
-    if (file.is_open())
+    if (argc < 2)
     {
-        size = file.tellg();
-        memblock = new char[size];
-        file.seekg(0, ios::beg);
-        file.read(memblock, size);
-        file.close();
+        cout << "usage: " << argv[0]
+             << " <file> [-cfg] [-mmap] [-offset n] [-length n] [-origin n] [-chunk n]" << endl;
+        return 1;
+    }
+
+    bool cfg_mode = false;
+    bool use_mmap = false;
+    uint64_t offset = 0;
+    uint64_t length = UINT64_MAX;
+    uint64_t origin = 0;
+    size_t chunk_size = ChunkReader::kDefaultChunkSize;
 
-        cout << "the entire file content is in memory\n";
+    for (int i = 2; i < argc; i++)
+    {
+        string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "-cfg")
+        {
+            cfg_mode = true;
+        }
+        else if (arg == "-mmap")
+        {
+            use_mmap = true;
+        }
+        else if (arg == "-offset" && has_value)
+        {
+            offset = strtoull(argv[++i], nullptr, 0);
+        }
+        else if (arg == "-length" && has_value)
+        {
+            length = strtoull(argv[++i], nullptr, 0);
+        }
+        else if (arg == "-origin" && has_value)
+        {
+            origin = strtoull(argv[++i], nullptr, 0);
+        }
+        else if (arg == "-chunk" && has_value)
+        {
+            chunk_size = static_cast<size_t>(strtoull(argv[++i], nullptr, 0));
+        }
+        else
+        {
+            cout << "Unknown option " << arg << endl;
+            return 1;
+        }
     }
-    else
+
+    ChunkReader reader;
+    if (!reader.Open(argv[1], offset, length, use_mmap, chunk_size))
     {
         cout << "Unable to open file" << argv[1];
         exit(1);
     }
 
-    int pc = 0;
-
-    while (pc < size)
+    if (cfg_mode)
     {
-        pc += Disassemble(memblock, pc);
+        // recursive descent needs random access, which is bounded by the
+        // 64 KB address space of the 8080
+        vector<uint8_t> image;
+        while (reader.Refill(1) && image.size() < 0x10000)
+        {
+            size_t count = min(reader.Available(), 0x10000 - image.size());
+            image.insert(image.end(), reader.Data(), reader.Data() + count);
+            reader.Consume(count);
+        }
+        if (reader.Failed())
+        {
+            cout << "Unable to read " << argv[1] << endl;
+            return 1;
+        }
+
+        ControlFlowGraph cfg;
+        cfg.Analyze(image.data(), static_cast<int>(image.size()), static_cast<uint16_t>(origin));
+        cfg.Print(cout);
+
+        size_t i = 0;
+        while (i < image.size())
+        {
+            uint16_t address = static_cast<uint16_t>(origin + i);
+            if (cfg.IsCode(address))
+            {
+                i += Disassemble(cout, &image[i], static_cast<int>(min(image.size() - i, static_cast<size_t>(3))), address);
+            }
+            else
+            {
+                cout << hex << setfill('0') << setw(4) << address << " DB #$"
+                     << setw(2) << static_cast<unsigned>(image[i]) << '\n';
+                i++;
+            }
+        }
+        return 0;
     }
 
-    delete[] memblock;
+    DisassembleStream(cout, &reader, origin);
+    if (reader.Failed())
+    {
+        cout << "Unable to read " << argv[1] << " past " << hex << reader.Position() << endl;
+        return 1;
+    }
     return 0;
 }
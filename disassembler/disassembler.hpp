@@ -1,10 +1,17 @@
 #ifndef DISASSEMBLER_DISASSEMBLER_HPP_
 #define DISASSEMBLER_DISASSEMBLER_HPP_
 
+#include <cstdint>
+#include <ostream>
+
+class ChunkReader;
+
 class Disassembler
 {
 public:
-    static int Disassemble(char *codebuffer, int pc);
+    static int Disassemble(char *codebuffer, int pc, int size);
+    static int Disassemble(std::ostream &out, const uint8_t *code, int available, uint64_t address);
+    static uint64_t DisassembleStream(std::ostream &out, ChunkReader *reader, uint64_t load_address);
 
     int main(int argc, char **argv);
 };
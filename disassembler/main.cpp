@@ -0,0 +1,8 @@
+#include "disassembler/disassembler.hpp"
+
+int main(int argc, char **argv)
+{
+  // Run the disassembler over the file named on the command line
+  Disassembler d;
+  return d.main(argc, argv);
+}
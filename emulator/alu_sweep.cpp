@@ -0,0 +1,532 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <utility>
+#include "emulator/alu_sweep.hpp"
+#include "emulator/opcode_bench.hpp"
+
+using namespace std;
+
+/*
+
+8080 ALU semantics, from the Intel 8080 Assembly Language Programming Manual
+
+Additions set CY on a carry out of bit 7 and AC on a carry out of bit 3.
+Subtractions add the two's complement of the operand (and of the borrow)
+and then complement CY, so CY means borrow, while AC is the carry out of
+bit 3 of that addition and is not complemented. ANA sets AC to the OR of
+bit 3 of both operands; XRA and ORA clear it. INR and DCR set AC like the
+addition of 1 and 0xff, and leave CY alone. Rotates only change CY.
+
+*/
+
+// Even parity of value
+static bool Parity(uint8_t value)
+{
+    value ^= value >> 4;
+    value ^= value >> 2;
+    value ^= value >> 1;
+    return (value & 1) == 0;
+}
+
+// Set zero, sign and parity flags for value
+static void SetZsp(Flags *flags, uint8_t value)
+{
+    flags->z = value == 0;
+    flags->s = (value & 0x80) != 0;
+    flags->p = Parity(value);
+}
+
+// a + b + carry, setting CY and AC
+static uint8_t Add(uint8_t a, uint8_t b, bool carry, Flags *flags)
+{
+    int sum = a + b + (carry ? 1 : 0);
+    flags->cy = sum > 0xff;
+    flags->ac = (a & 0x0f) + (b & 0x0f) + (carry ? 1 : 0) > 0x0f;
+    return static_cast<uint8_t>(sum);
+}
+
+// a - b - borrow, setting CY (borrow) and AC
+static uint8_t Subtract(uint8_t a, uint8_t b, bool borrow, Flags *flags)
+{
+    uint8_t difference = Add(a, static_cast<uint8_t>(~b), !borrow, flags);
+    flags->cy = !flags->cy;
+    return difference;
+}
+
+// Flags before the instruction: CY and AC from input, and z, s and p the
+// complement of CY, so that instructions which must keep them are checked too
+static Flags IncomingFlags(const AluCase &input)
+{
+    Flags flags;
+    flags.cy = input.cy;
+    flags.ac = input.ac;
+    flags.z = !input.cy;
+    flags.s = !input.cy;
+    flags.p = !input.cy;
+    return flags;
+}
+
+// Register an instruction field selects, nullptr for M (memory at HL)
+static uint8_t *RegisterField(Registers *registers, int field)
+{
+    switch (field)
+    {
+    case 0:
+        return &registers->B;
+    case 1:
+        return &registers->C;
+    case 2:
+        return &registers->D;
+    case 3:
+        return &registers->E;
+    case 4:
+        return &registers->H;
+    case 5:
+        return &registers->L;
+    case 7:
+        return &registers->A;
+    default:
+        return nullptr;
+    }
+}
+
+// True for INR r and DCR r
+static bool IsIncrement(uint8_t opcode)
+{
+    return opcode < 0x40 && ((opcode & 0x07) == 0x04 || (opcode & 0x07) == 0x05);
+}
+
+// True for the accumulator-only instructions: rotates, DAA, CMA, STC, CMC
+static bool IsUnary(uint8_t opcode)
+{
+    return opcode < 0x40 && (opcode & 0x07) == 0x07;
+}
+
+// True for the opcodes AluSweep checks
+bool AluReference::IsAluOpcode(uint8_t opcode)
+{
+    return (opcode >= 0x80 && opcode < 0xc0) || (opcode >= 0xc0 && (opcode & 0x07) == 0x06) ||
+           IsIncrement(opcode) || IsUnary(opcode);
+}
+
+// Result of one ALU instruction on input
+AluResult AluReference::Execute(const AluCase &input)
+{
+    AluResult result;
+    result.flags = IncomingFlags(input);
+    Flags *flags = &result.flags;
+    uint8_t a = input.a;
+    uint8_t b = input.operand;
+    uint8_t opcode = input.opcode;
+
+    if (IsIncrement(opcode))
+    {
+        bool cy = flags->cy;
+        result.value = Add(b, (opcode & 0x01) ? 0xff : 0x01, false, flags);
+        flags->cy = cy;
+        SetZsp(flags, result.value);
+        return result;
+    }
+
+    if (IsUnary(opcode))
+    {
+        result.value = a;
+        switch (opcode)
+        {
+        case 0x07: // RLC
+            flags->cy = (a & 0x80) != 0;
+            result.value = static_cast<uint8_t>((a << 1) | (a >> 7));
+            break;
+        case 0x0f: // RRC
+            flags->cy = (a & 0x01) != 0;
+            result.value = static_cast<uint8_t>((a >> 1) | (a << 7));
+            break;
+        case 0x17: // RAL
+            result.value = static_cast<uint8_t>((a << 1) | (input.cy ? 0x01 : 0));
+            flags->cy = (a & 0x80) != 0;
+            break;
+        case 0x1f: // RAR
+            result.value = static_cast<uint8_t>((a >> 1) | (input.cy ? 0x80 : 0));
+            flags->cy = (a & 0x01) != 0;
+            break;
+        case 0x27: // DAA
+        {
+            uint8_t correction = 0;
+            bool cy = input.cy;
+            if ((a & 0x0f) > 9 || input.ac)
+            {
+                correction |= 0x06;
+            }
+            if ((a >> 4) > 9 || input.cy || ((a >> 4) >= 9 && (a & 0x0f) > 9))
+            {
+                correction |= 0x60;
+                cy = true;
+            }
+            result.value = Add(a, correction, false, flags);
+            flags->cy = cy;
+            SetZsp(flags, result.value);
+            break;
+        }
+        case 0x2f: // CMA
+            result.value = static_cast<uint8_t>(~a);
+            break;
+        case 0x37: // STC
+            flags->cy = true;
+            break;
+        case 0x3f: // CMC
+            flags->cy = !input.cy;
+            break;
+        }
+        return result;
+    }
+
+    // ADD ADC SUB SBB ANA XRA ORA CMP, on a register, M or an immediate
+    switch ((opcode >> 3) & 0x07)
+    {
+    case 0: // ADD
+        result.value = Add(a, b, false, flags);
+        break;
+    case 1: // ADC
+        result.value = Add(a, b, input.cy, flags);
+        break;
+    case 2: // SUB
+        result.value = Subtract(a, b, false, flags);
+        break;
+    case 3: // SBB
+        result.value = Subtract(a, b, input.cy, flags);
+        break;
+    case 4: // ANA
+        result.value = a & b;
+        flags->cy = false;
+        flags->ac = ((a | b) & 0x08) != 0;
+        break;
+    case 5: // XRA
+        result.value = a ^ b;
+        flags->cy = false;
+        flags->ac = false;
+        break;
+    case 6: // ORA
+        result.value = a | b;
+        flags->cy = false;
+        flags->ac = false;
+        break;
+    case 7: // CMP
+        Subtract(a, b, false, flags);
+        SetZsp(flags, static_cast<uint8_t>(a - b));
+        result.value = a;
+        return result;
+    }
+    SetZsp(flags, result.value);
+    return result;
+}
+
+// Constructor
+AluSweep::AluSweep(const Engine &engine)
+    : engine(engine), threads(static_cast<int>(thread::hardware_concurrency())), opcodes(Opcodes())
+{
+    if (threads < 1)
+    {
+        threads = 1;
+    }
+}
+
+// Number of threads to split the sweep across
+void AluSweep::SetThreads(int new_threads)
+{
+    threads = max(1, new_threads);
+}
+
+// Only sweep these opcodes
+void AluSweep::SetOpcodes(const vector<uint8_t> &new_opcodes)
+{
+    opcodes = new_opcodes;
+}
+
+// Every opcode AluReference models
+vector<uint8_t> AluSweep::Opcodes()
+{
+    vector<uint8_t> all;
+    for (int opcode = 0; opcode < 0x100; opcode++)
+    {
+        if (AluReference::IsAluOpcode(static_cast<uint8_t>(opcode)))
+        {
+            all.push_back(static_cast<uint8_t>(opcode));
+        }
+    }
+    return all;
+}
+
+// Whether opcode reads A, and whether it has an operand besides A
+static void Inputs(uint8_t opcode, bool *uses_a, bool *uses_operand)
+{
+    if (IsIncrement(opcode))
+    {
+        // INR A and DCR A work on A itself, the others ignore it
+        *uses_a = ((opcode >> 3) & 0x07) == 7;
+        *uses_operand = !*uses_a;
+    }
+    else if (IsUnary(opcode))
+    {
+        *uses_a = true;
+        *uses_operand = false;
+    }
+    else
+    {
+        // ADD A and friends use A for both
+        *uses_a = true;
+        *uses_operand = opcode >= 0xc0 || (opcode & 0x07) != 7;
+    }
+}
+
+// Number of cases the sweep runs for opcode
+uint64_t AluSweep::CaseCount(uint8_t opcode)
+{
+    bool uses_a;
+    bool uses_operand;
+    Inputs(opcode, &uses_a, &uses_operand);
+    return (uses_a ? 256 : 1) * (uses_operand ? 256 : 1) * 4;
+}
+
+// Load input into e and run its instruction through run, returning what it
+// left behind. e must have all of memory writable.
+AluResult AluSweep::Execute(Emulator *e, EngineFunction run, const AluCase &input)
+{
+    Registers registers;
+    registers.A = input.a;
+    registers.H = kDataAddress >> 8;
+    registers.L = kDataAddress & 0xff;
+
+    // the register, memory location or immediate byte holding the operand
+    int field = -1;
+    if (IsIncrement(input.opcode))
+    {
+        field = (input.opcode >> 3) & 0x07;
+    }
+    else if (input.opcode >= 0x80 && input.opcode < 0xc0)
+    {
+        field = input.opcode & 0x07;
+    }
+    uint8_t *operand = field >= 0 ? RegisterField(&registers, field) : nullptr;
+    if (operand != nullptr && field != 7)
+    {
+        *operand = input.operand;
+    }
+    e->WriteToMem(kDataAddress, input.operand);
+    e->WriteToMem(kCodeAddress, input.opcode);
+    e->WriteToMem(kCodeAddress + 1, input.operand);
+
+    e->SetRegisters(registers);
+    e->SetFlags(IncomingFlags(input));
+    e->SetPC(kCodeAddress);
+    run(e, 1);
+
+    AluResult result;
+    result.flags = e->GetFlags();
+    registers = e->GetRegisters();
+    if (IsIncrement(input.opcode))
+    {
+        operand = RegisterField(&registers, field);
+        result.value = operand != nullptr ? *operand : e->GetMemory()[kDataAddress];
+    }
+    else
+    {
+        result.value = registers.A;
+    }
+    return result;
+}
+
+// Instruction and inputs of a case, e.g. "ADC M a=0x3c operand=0x0f cy=1 ac=0"
+string AluSweep::Describe(const AluCase &input)
+{
+    bool uses_a;
+    bool uses_operand;
+    Inputs(input.opcode, &uses_a, &uses_operand);
+    ostringstream out;
+    out << OpcodeBench::Mnemonic(input.opcode) << hex << setfill('0');
+    if (uses_a)
+    {
+        out << " a=0x" << setw(2) << static_cast<unsigned>(input.a);
+    }
+    if (uses_operand)
+    {
+        out << " operand=0x" << setw(2) << static_cast<unsigned>(input.operand);
+    }
+    out << " cy=" << input.cy << " ac=" << input.ac;
+    return out.str();
+}
+
+// True if case x comes before y in sweep order
+static bool SweepsBefore(const AluCase &x, const AluCase &y)
+{
+    return make_pair(make_pair(x.a, x.operand), make_pair(x.cy, x.ac)) <
+           make_pair(make_pair(y.a, y.operand), make_pair(y.cy, y.ac));
+}
+
+// Sweep all cases of the opcodes, on all threads
+AluSweepReport AluSweep::Run() const
+{
+    // one job per opcode and value of A
+    vector<pair<uint8_t, int> > jobs;
+    for (size_t i = 0; i < opcodes.size(); i++)
+    {
+        bool uses_a;
+        bool uses_operand;
+        Inputs(opcodes[i], &uses_a, &uses_operand);
+        for (int a = 0; a < (uses_a ? 256 : 1); a++)
+        {
+            jobs.push_back(make_pair(opcodes[i], a));
+        }
+    }
+
+    AluSweepReport report;
+    report.threads = threads;
+    vector<AluMismatch> first(0x100);
+    atomic<size_t> next(0);
+    mutex merge;
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    vector<thread> pool;
+    for (int t = 0; t < threads; t++)
+    {
+        pool.push_back(thread([&]() {
+            Emulator e;
+            Snapshot blank;
+            blank.memory.assign(0x10000, 0);
+            e.LoadState(blank);
+            e.SetRamRange(0, 0x10000);
+
+            AluSweepReport local;
+            vector<AluMismatch> local_first(0x100);
+            for (size_t job = next++; job < jobs.size(); job = next++)
+            {
+                AluCase input;
+                input.opcode = jobs[job].first;
+                input.a = static_cast<uint8_t>(jobs[job].second);
+                bool uses_a;
+                bool uses_operand;
+                Inputs(input.opcode, &uses_a, &uses_operand);
+                for (int operand = 0; operand < (uses_operand ? 256 : 1); operand++)
+                {
+                    input.operand = static_cast<uint8_t>(uses_operand ? operand : input.a);
+                    for (int carries = 0; carries < 4; carries++)
+                    {
+                        input.cy = (carries & 1) != 0;
+                        input.ac = (carries & 2) != 0;
+                        AluResult expected = AluReference::Execute(input);
+                        AluResult actual = Execute(&e, engine.run, input);
+                        local.cases++;
+
+                        bool flag_differs[5] = {expected.flags.z != actual.flags.z,
+                                                expected.flags.s != actual.flags.s,
+                                                expected.flags.p != actual.flags.p,
+                                                expected.flags.cy != actual.flags.cy,
+                                                expected.flags.ac != actual.flags.ac};
+                        bool differs = expected.value != actual.value;
+                        if (differs)
+                        {
+                            local.value_mismatches++;
+                        }
+                        for (int f = 0; f < 5; f++)
+                        {
+                            local.flag_mismatches[f] += flag_differs[f];
+                            differs = differs || flag_differs[f];
+                        }
+                        if (differs)
+                        {
+                            if (local.opcode_mismatches[input.opcode]++ == 0)
+                            {
+                                AluMismatch mismatch = {input, expected, actual};
+                                local_first[input.opcode] = mismatch;
+                            }
+                            local.mismatches++;
+                        }
+                    }
+                }
+            }
+
+            lock_guard<mutex> lock(merge);
+            report.cases += local.cases;
+            report.mismatches += local.mismatches;
+            report.value_mismatches += local.value_mismatches;
+            for (int f = 0; f < 5; f++)
+            {
+                report.flag_mismatches[f] += local.flag_mismatches[f];
+            }
+            for (int op = 0; op < 0x100; op++)
+            {
+                if (local.opcode_mismatches[op] == 0)
+                {
+                    continue;
+                }
+                // keep the earliest case in sweep order, whichever thread ran it
+                if (report.opcode_mismatches[op] == 0 || SweepsBefore(local_first[op].input, first[op].input))
+                {
+                    first[op] = local_first[op];
+                }
+                report.opcode_mismatches[op] += local.opcode_mismatches[op];
+            }
+        }));
+    }
+    for (size_t t = 0; t < pool.size(); t++)
+    {
+        pool[t].join();
+    }
+    report.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    for (int op = 0; op < 0x100; op++)
+    {
+        if (report.opcode_mismatches[op] > 0)
+        {
+            report.examples.push_back(first[op]);
+        }
+    }
+    return report;
+}
+
+// Flags of a result as a string, e.g. "z=1 s=0 p=1 cy=0 ac=1"
+static string FlagString(const Flags &flags)
+{
+    ostringstream out;
+    out << "z=" << flags.z << " s=" << flags.s << " p=" << flags.p << " cy=" << flags.cy << " ac=" << flags.ac;
+    return out.str();
+}
+
+// Summary of a sweep, followed by up to examples failing opcodes with their
+// mismatch count and first failing case
+void AluSweep::Print(ostream &out, const AluSweepReport &report, int examples)
+{
+    out << report.cases << " cases on " << report.threads << " threads in " << fixed << setprecision(3)
+        << report.seconds << " s, " << report.mismatches << " mismatches" << endl;
+    if (report.mismatches == 0)
+    {
+        return;
+    }
+
+    static const char *const kFlagNames[5] = {"z", "s", "p", "cy", "ac"};
+    out << "  value: " << report.value_mismatches;
+    for (int f = 0; f < 5; f++)
+    {
+        out << "  " << kFlagNames[f] << ": " << report.flag_mismatches[f];
+    }
+    out << endl;
+
+    for (size_t i = 0; i < report.examples.size() && static_cast<int>(i) < examples; i++)
+    {
+        const AluMismatch &m = report.examples[i];
+        out << "  " << left << setw(8) << OpcodeBench::Mnemonic(m.input.opcode) << right << setw(8)
+            << report.opcode_mismatches[m.input.opcode] << "  first: " << Describe(m.input) << endl
+            << hex << setfill('0') << "      expected 0x" << setw(2) << static_cast<unsigned>(m.expected.value)
+            << ' ' << FlagString(m.expected.flags) << endl
+            << "      actual   0x" << setw(2) << static_cast<unsigned>(m.actual.value) << ' '
+            << FlagString(m.actual.flags) << dec << setfill(' ') << endl;
+    }
+    if (static_cast<int>(report.examples.size()) > examples)
+    {
+        out << "  ... and " << report.examples.size() - examples << " more opcodes" << endl;
+    }
+}
@@ -0,0 +1,89 @@
+#ifndef EMULATOR_ALU_SWEEP_HPP_
+#define EMULATOR_ALU_SWEEP_HPP_
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "emulator/emulator.hpp"
+#include "emulator/engine.hpp"
+
+// Inputs of one ALU instruction: the accumulator, the other operand (a
+// register, memory at HL or the immediate byte) and the incoming flags
+struct AluCase
+{
+    uint8_t opcode = 0;
+    uint8_t a = 0;
+    uint8_t operand = 0;
+    bool cy = false;
+    bool ac = false;
+};
+
+// What an ALU instruction leaves behind: the byte it writes (A, or the
+// register or memory INR and DCR change) and all five flags
+struct AluResult
+{
+    uint8_t value = 0;
+    Flags flags;
+};
+
+// Independent model of the 8080 ALU, written from the Intel manual rather
+// than from the interpreter, so that the two do not share mistakes
+class AluReference
+{
+public:
+    static bool IsAluOpcode(uint8_t opcode);
+    static AluResult Execute(const AluCase &input);
+};
+
+// One case on which an engine and the reference disagree
+struct AluMismatch
+{
+    AluCase input;
+    AluResult expected;
+    AluResult actual;
+};
+
+// Outcome of a sweep
+struct AluSweepReport
+{
+    uint64_t cases = 0;
+    uint64_t mismatches = 0;
+    uint64_t value_mismatches = 0;
+    uint64_t flag_mismatches[5] = {0, 0, 0, 0, 0}; // z, s, p, cy, ac
+    uint64_t opcode_mismatches[0x100] = {};
+    std::vector<AluMismatch> examples; // first mismatch of each failing opcode
+    int threads = 0;
+    double seconds = 0;
+};
+
+// Runs every ALU opcode on every combination of A, operand, CY and AC
+// through an engine and compares the outcome with AluReference
+//
+// The cases are split by opcode and accumulator value across a pool of
+// threads, each with its own RAM-only machine.
+class AluSweep
+{
+public:
+    static const uint16_t kCodeAddress = 0x1000;
+    static const uint16_t kDataAddress = 0x3000;
+
+    explicit AluSweep(const Engine &engine);
+
+    void SetThreads(int threads);
+    void SetOpcodes(const std::vector<uint8_t> &opcodes);
+    AluSweepReport Run() const;
+
+    static std::vector<uint8_t> Opcodes();
+    static uint64_t CaseCount(uint8_t opcode);
+    static AluResult Execute(Emulator *e, EngineFunction run, const AluCase &input);
+    static std::string Describe(const AluCase &input);
+    static void Print(std::ostream &out, const AluSweepReport &report, int examples);
+
+private:
+    Engine engine;
+    int threads;
+    std::vector<uint8_t> opcodes;
+};
+
+#endif // EMULATOR_ALU_SWEEP_HPP_
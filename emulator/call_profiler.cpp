@@ -0,0 +1,325 @@
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include "emulator/call_profiler.hpp"
+#include "disassembler/control_flow.hpp"
+
+using namespace std;
+
+/*
+
+Folded stack output is the format read by flamegraph.pl from
+https://github.com/brendangregg/FlameGraph - one line per call path,
+frames separated by ';', followed by the cycles spent in that path.
+
+*/
+
+const size_t CallGraphProfiler::kMaxDepth;
+
+CallGraphProfiler::CallGraphProfiler()
+{
+    // classify the opcodes that move the shadow stack
+    for (int op = 0; op < 0x100; op++)
+    {
+        switch (ControlFlowGraph::GetFlowType(op))
+        {
+        case kFlowCall:
+        case kFlowCondCall:
+            flow_table[op] = kShadowCall;
+            break;
+        case kFlowRestart:
+            flow_table[op] = kShadowRestart;
+            break;
+        case kFlowReturn:
+            flow_table[op] = kShadowReturn;
+            break;
+        case kFlowCondReturn:
+            flow_table[op] = kShadowCondReturn;
+            break;
+        default:
+            flow_table[op] = kShadowNone;
+            break;
+        }
+    }
+    Reset();
+}
+
+// Drop all samples; code running outside any call is charged to root_function
+void CallGraphProfiler::Reset(uint16_t root_function)
+{
+    nodes.clear();
+    children.clear();
+    stack.clear();
+    Node root = {-1, root_function, 0, 1};
+    nodes.push_back(root);
+    current = 0;
+}
+
+// Update the shadow stack after a call, restart or return instruction
+void CallGraphProfiler::Transfer(const Emulator &e, uint16_t pc, uint8_t opcode)
+{
+    uint16_t new_pc = e.GetPC();
+    switch (flow_table[opcode])
+    {
+    case kShadowCall:
+        // a conditional call that is not taken continues after the operand
+        if (new_pc != static_cast<uint16_t>(pc + 3))
+        {
+            Enter(new_pc, e.GetSP());
+        }
+        break;
+    case kShadowRestart:
+        Enter(new_pc, e.GetSP());
+        break;
+    case kShadowCondReturn:
+        if (new_pc == static_cast<uint16_t>(pc + 1))
+        {
+            break;
+        }
+        Leave(e.GetSP());
+        break;
+    case kShadowReturn:
+        Leave(e.GetSP());
+        break;
+    }
+}
+
+// Push a frame for an interrupt that was taken
+void CallGraphProfiler::Interrupt(const Emulator &e, int interrupt_num)
+{
+    (void)interrupt_num;
+    Enter(e.GetPC(), e.GetSP());
+}
+
+// Push a frame for a call to function
+void CallGraphProfiler::Enter(uint16_t function, uint16_t sp)
+{
+    if (stack.size() >= kMaxDepth)
+    {
+        return;
+    }
+
+    uint64_t key = (static_cast<uint64_t>(current) << 16) | function;
+    unordered_map<uint64_t, int>::iterator it = children.find(key);
+    int child;
+    if (it == children.end())
+    {
+        Node node = {current, function, 0, 0};
+        child = static_cast<int>(nodes.size());
+        nodes.push_back(node);
+        children[key] = child;
+    }
+    else
+    {
+        child = it->second;
+    }
+
+    nodes[child].calls++;
+    Frame frame = {child, sp};
+    stack.push_back(frame);
+    current = child;
+}
+
+// Pop every frame whose return address is now above the stack pointer
+void CallGraphProfiler::Leave(uint16_t sp)
+{
+    while (!stack.empty() && stack.back().return_sp < sp)
+    {
+        stack.pop_back();
+    }
+    current = stack.empty() ? 0 : stack.back().node;
+}
+
+// Read "address name" lines, address in hex; '#' starts a comment
+// Returns the number of symbols read
+int CallGraphProfiler::LoadSymbols(const string &path)
+{
+    ifstream file(path);
+    string line;
+    int count = 0;
+    while (getline(file, line))
+    {
+        line = line.substr(0, line.find('#'));
+        istringstream fields(line);
+        unsigned address;
+        string name;
+        if (fields >> hex >> address >> name)
+        {
+            symbols[static_cast<uint16_t>(address)] = name;
+            count++;
+        }
+    }
+    return count;
+}
+
+// Name the routine starting at address
+void CallGraphProfiler::SetSymbol(uint16_t address, const string &name)
+{
+    symbols[address] = name;
+}
+
+// Symbol for address, or sub_xxxx if it has none
+string CallGraphProfiler::SymbolName(uint16_t address) const
+{
+    map<uint16_t, string>::const_iterator it = symbols.find(address);
+    if (it != symbols.end())
+    {
+        return it->second;
+    }
+    ostringstream name;
+    name << "sub_" << hex << setfill('0') << setw(4) << address;
+    return name.str();
+}
+
+// Number of calls currently on the shadow stack
+int CallGraphProfiler::Depth() const
+{
+    return static_cast<int>(stack.size());
+}
+
+// Cycles recorded since the last reset
+uint64_t CallGraphProfiler::TotalCycles() const
+{
+    uint64_t total = 0;
+    for (size_t i = 0; i < nodes.size(); i++)
+    {
+        total += nodes[i].exclusive;
+    }
+    return total;
+}
+
+// Sum up inclusive and exclusive cycles and calls per function
+// Recursive calls are only counted once towards inclusive cycles
+void CallGraphProfiler::Totals(vector<uint64_t> *inclusive, vector<uint64_t> *exclusive,
+                               vector<uint64_t> *calls) const
+{
+    inclusive->assign(0x10000, 0);
+    exclusive->assign(0x10000, 0);
+    calls->assign(0x10000, 0);
+
+    // children are always created after their parent, so a reverse sweep
+    // accumulates the inclusive cycles of every path
+    vector<uint64_t> path_inclusive(nodes.size());
+    for (size_t i = nodes.size(); i-- > 0;)
+    {
+        path_inclusive[i] += nodes[i].exclusive;
+        if (nodes[i].parent >= 0)
+        {
+            path_inclusive[nodes[i].parent] += path_inclusive[i];
+        }
+    }
+
+    for (size_t i = 0; i < nodes.size(); i++)
+    {
+        uint16_t function = nodes[i].function;
+        (*exclusive)[function] += nodes[i].exclusive;
+        (*calls)[function] += nodes[i].calls;
+
+        bool recursive = false;
+        for (int parent = nodes[i].parent; parent >= 0; parent = nodes[parent].parent)
+        {
+            if (nodes[parent].function == function)
+            {
+                recursive = true;
+                break;
+            }
+        }
+        if (!recursive)
+        {
+            (*inclusive)[function] += path_inclusive[i];
+        }
+    }
+}
+
+// Cycles spent in function and everything it called
+uint64_t CallGraphProfiler::InclusiveCycles(uint16_t function) const
+{
+    vector<uint64_t> inclusive, exclusive, calls;
+    Totals(&inclusive, &exclusive, &calls);
+    return inclusive[function];
+}
+
+// Cycles spent in function itself
+uint64_t CallGraphProfiler::ExclusiveCycles(uint16_t function) const
+{
+    vector<uint64_t> inclusive, exclusive, calls;
+    Totals(&inclusive, &exclusive, &calls);
+    return exclusive[function];
+}
+
+// Number of times function was called or interrupted to
+uint64_t CallGraphProfiler::Calls(uint16_t function) const
+{
+    vector<uint64_t> inclusive, exclusive, calls;
+    Totals(&inclusive, &exclusive, &calls);
+    return calls[function];
+}
+
+// Frames from the root down to node, separated by ';'
+string CallGraphProfiler::Path(int node) const
+{
+    vector<int> frames;
+    for (; node >= 0; node = nodes[node].parent)
+    {
+        frames.push_back(node);
+    }
+    string path;
+    for (size_t i = frames.size(); i-- > 0;)
+    {
+        path += SymbolName(nodes[frames[i]].function);
+        if (i > 0)
+        {
+            path += ';';
+        }
+    }
+    return path;
+}
+
+// Write one folded stack line per call path that spent cycles
+void CallGraphProfiler::WriteFolded(ostream &out) const
+{
+    for (size_t i = 0; i < nodes.size(); i++)
+    {
+        if (nodes[i].exclusive != 0)
+        {
+            out << Path(static_cast<int>(i)) << ' ' << nodes[i].exclusive << '\n';
+        }
+    }
+}
+
+// Print the functions with the most inclusive cycles
+void CallGraphProfiler::Report(ostream &out, int top) const
+{
+    vector<uint64_t> inclusive, exclusive, calls;
+    Totals(&inclusive, &exclusive, &calls);
+    uint64_t total = TotalCycles();
+
+    vector<pair<uint64_t, int> > order;
+    for (int function = 0; function < 0x10000; function++)
+    {
+        if (inclusive[function] != 0 || calls[function] != 0)
+        {
+            order.push_back(make_pair(inclusive[function], function));
+        }
+    }
+    sort(order.rbegin(), order.rend());
+
+    ios_base::fmtflags saved = out.flags();
+    char fill_char = out.fill();
+    out << "Call graph (" << dec << nodes.size() << " paths, " << total << " cycles)" << endl
+        << "addr        calls    inclusive      %    exclusive      %  routine" << endl;
+    for (size_t i = 0; i < order.size() && static_cast<int>(i) < top; i++)
+    {
+        int function = order[i].second;
+        out << hex << setfill('0') << setw(4) << function << dec << setfill(' ')
+            << setw(13) << calls[function]
+            << setw(13) << inclusive[function] << setw(7) << fixed << setprecision(2)
+            << (total ? 100.0 * inclusive[function] / total : 0.0)
+            << setw(13) << exclusive[function] << setw(7)
+            << (total ? 100.0 * exclusive[function] / total : 0.0)
+            << "  " << SymbolName(function) << endl;
+    }
+    out.flags(saved);
+    out.fill(fill_char);
+}
@@ -0,0 +1,95 @@
+#ifndef EMULATOR_CALL_PROFILER_HPP_
+#define EMULATOR_CALL_PROFILER_HPP_
+
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "emulator/emulator.hpp"
+
+// Profiling policy that attributes cycles to call paths
+//
+// A shadow call stack is kept from the CALL/Ccc, RST and RET/Rcc
+// instructions that are taken and from interrupts. Cycles go to the node of
+// the call path that is current when they are spent (exclusive time);
+// inclusive time is the sum over a node and everything it called. A frame is
+// popped once SP moves above its return address, so code that discards a
+// return address from the stack is unwound at the next RET below it.
+class CallGraphProfiler
+{
+public:
+    CallGraphProfiler();
+
+    void Instruction(const Emulator &e, uint16_t pc, uint8_t opcode, int cycles)
+    {
+        nodes[current].exclusive += cycles;
+        if (flow_table[opcode] != kShadowNone)
+        {
+            Transfer(e, pc, opcode);
+        }
+    }
+    void Interrupt(const Emulator &e, int interrupt_num);
+
+    void Reset(uint16_t root_function = 0x0000);
+
+    int LoadSymbols(const std::string &path);
+    void SetSymbol(uint16_t address, const std::string &name);
+    std::string SymbolName(uint16_t address) const;
+
+    int Depth() const;
+    uint64_t TotalCycles() const;
+    uint64_t InclusiveCycles(uint16_t function) const;
+    uint64_t ExclusiveCycles(uint16_t function) const;
+    uint64_t Calls(uint16_t function) const;
+
+    void WriteFolded(std::ostream &out) const;
+    void Report(std::ostream &out, int top = 25) const;
+
+private:
+    enum ShadowFlow
+    {
+        kShadowNone = 0,
+        kShadowCall,
+        kShadowRestart,
+        kShadowReturn,
+        kShadowCondReturn
+    };
+
+    // one node per distinct call path
+    struct Node
+    {
+        int parent;
+        uint16_t function;
+        uint64_t exclusive;
+        uint64_t calls;
+    };
+
+    // one entry per active call
+    struct Frame
+    {
+        int node;
+        uint16_t return_sp; // SP just after the return address was pushed
+    };
+
+    static const size_t kMaxDepth = 512;
+
+    void Transfer(const Emulator &e, uint16_t pc, uint8_t opcode);
+    void Enter(uint16_t function, uint16_t sp);
+    void Leave(uint16_t sp);
+    std::string Path(int node) const;
+    void Totals(std::vector<uint64_t> *inclusive, std::vector<uint64_t> *exclusive,
+                std::vector<uint64_t> *calls) const;
+
+    uint8_t flow_table[0x100];
+
+    std::vector<Node> nodes;
+    std::unordered_map<uint64_t, int> children;
+    std::vector<Frame> stack;
+    int current;
+
+    std::map<uint16_t, std::string> symbols;
+};
+
+#endif // EMULATOR_CALL_PROFILER_HPP_
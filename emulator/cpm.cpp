@@ -0,0 +1,190 @@
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <fstream>
+#include "emulator/cpm.hpp"
+#include "emulator/emulator.hpp"
+#include "emulator/profiler.hpp"
+
+using namespace std;
+
+namespace
+{
+// cycles per call into the engine between checks for the end of the
+// program, below what the 16 bit cycle counter of one Emulate call can hold
+const int kChunkCycles = 50000;
+
+// What the output handler updates while a program runs
+struct CpmConsole
+{
+    CpmRun *result;
+    const InstructionCounter *counter;
+};
+
+// Service the BDOS trap and the warm boot signal
+void ConsoleOutput(void *context, Emulator *e, uint8_t port, uint8_t)
+{
+    CpmConsole *console = static_cast<CpmConsole *>(context);
+    CpmRun *result = console->result;
+    if (port == CpmMachine::kBootPort && !result->finished)
+    {
+        result->finished = true;
+        result->cycles = e->GetCycles();
+        result->instructions = console->counter != nullptr ? console->counter->instructions : 0;
+        return;
+    }
+    if (port != CpmMachine::kBdosPort)
+    {
+        return;
+    }
+
+    Registers r = e->GetRegisters();
+    if (r.C == 0x00)
+    {
+        // system reset
+        ConsoleOutput(context, e, CpmMachine::kBootPort, 0);
+    }
+    else if (r.C == 0x02)
+    {
+        // console output of E
+        result->output += static_cast<char>(r.E);
+    }
+    else if (r.C == 0x09)
+    {
+        // print the string at DE up to '$'
+        const uint8_t *memory = e->GetMemory();
+        for (uint16_t address = static_cast<uint16_t>(r.D << 8 | r.E); memory[address] != '$'; address++)
+        {
+            result->output += static_cast<char>(memory[address]);
+            if (result->output.size() > (1 << 20))
+            {
+                break;
+            }
+        }
+    }
+}
+
+// Run e until the program ends or max_cycles have passed
+template <class Step>
+void RunProgram(Emulator *e, CpmRun *result, uint64_t max_cycles, Step step)
+{
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    while (!result->finished && e->GetCycles() < max_cycles)
+    {
+        step(e);
+    }
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+    result->seconds = elapsed.count();
+    if (!result->finished)
+    {
+        result->cycles = e->GetCycles();
+    }
+    result->memory.assign(e->GetMemory(), e->GetMemory() + e->GetMemorySize());
+}
+
+// Engine step for RunProgram
+struct EngineStep
+{
+    EngineFunction run;
+    void operator()(Emulator *e) const { run(e, kChunkCycles); }
+};
+
+// Interpreter step for RunProgram that counts instructions
+struct CountingStep
+{
+    InstructionCounter *counter;
+    void operator()(Emulator *e) const { e->EmulateProfiled(kChunkCycles, *counter); }
+};
+} // namespace
+
+const uint16_t CpmMachine::kLoadAddress;
+const uint16_t CpmMachine::kBdosAddress;
+const uint8_t CpmMachine::kBdosPort;
+const uint8_t CpmMachine::kBootPort;
+
+// Read a .COM file, returns false if it is missing or does not fit in the TPA
+bool CpmMachine::Load(const string &path)
+{
+    ifstream file(path, ios::in | ios::binary);
+    if (!file.is_open())
+    {
+        return false;
+    }
+    vector<uint8_t> code((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+    if (code.empty() || code.size() > static_cast<size_t>(kBdosAddress - kLoadAddress - 0x100))
+    {
+        return false;
+    }
+    program.swap(code);
+    return true;
+}
+
+// Use the size bytes at code as the program
+void CpmMachine::LoadProgram(const uint8_t *code, int size)
+{
+    program.assign(code, code + size);
+}
+
+// Run the program on an engine, for at most max_cycles
+CpmRun CpmMachine::Run(EngineFunction run, uint64_t max_cycles) const
+{
+    CpmRun result;
+    CpmConsole console = {&result, nullptr};
+    Emulator e;
+    Start(&e);
+    e.SetOutputHandler(ConsoleOutput, &console);
+    EngineStep step = {run};
+    RunProgram(&e, &result, max_cycles, step);
+    return result;
+}
+
+// Run the program on the interpreter, counting the instructions it executes
+CpmRun CpmMachine::Count(uint64_t max_cycles) const
+{
+    CpmRun result;
+    InstructionCounter counter;
+    CpmConsole console = {&result, &counter};
+    Emulator e;
+    Start(&e);
+    e.SetOutputHandler(ConsoleOutput, &console);
+    CountingStep step = {&counter};
+    RunProgram(&e, &result, max_cycles, step);
+    if (!result.finished)
+    {
+        result.instructions = counter.instructions;
+    }
+    return result;
+}
+
+// True if the program ended by itself without reporting an error
+// The exercisers print "ERROR" or "FAIL" in some form for every failed test
+bool CpmMachine::Passed(const CpmRun &run)
+{
+    string output = run.output;
+    transform(output.begin(), output.end(), output.begin(), ::toupper);
+    return run.finished && output.find("ERROR") == string::npos && output.find("FAIL") == string::npos;
+}
+
+// Set up memory and registers to enter the program
+void CpmMachine::Start(Emulator *e) const
+{
+    Snapshot snapshot;
+    snapshot.memory.assign(0x10000, 0);
+    vector<uint8_t> &memory = snapshot.memory;
+
+    // 0000 OUT kBootPort / JMP 0000, 0005 JMP kBdosAddress
+    const uint8_t page_zero[] = {0xd3, kBootPort, 0xc3, 0x00, 0x00, 0xc3, kBdosAddress & 0xff, kBdosAddress >> 8};
+    copy(page_zero, page_zero + sizeof(page_zero), memory.begin());
+    // kBdosAddress OUT kBdosPort / RET
+    memory[kBdosAddress] = 0xd3;
+    memory[kBdosAddress + 1] = kBdosPort;
+    memory[kBdosAddress + 2] = 0xc9;
+    copy(program.begin(), program.end(), memory.begin() + kLoadAddress);
+
+    // return address 0000 for programs that end with RET
+    snapshot.sp = kBdosAddress - 2;
+    snapshot.pc = kLoadAddress;
+
+    e->LoadState(snapshot);
+    e->SetRamRange(0, 0x10000);
+}
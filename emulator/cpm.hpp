@@ -0,0 +1,52 @@
+#ifndef EMULATOR_CPM_HPP_
+#define EMULATOR_CPM_HPP_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "emulator/engine.hpp"
+
+class Emulator;
+
+// Outcome of running a CP/M program
+struct CpmRun
+{
+    bool finished = false;      // the program jumped back to CP/M at address 0
+    uint64_t cycles = 0;        // up to the jump back, or the limit
+    uint64_t instructions = 0;  // only counted by CpmMachine::Count
+    double seconds = 0;
+    std::string output;         // everything printed through the BDOS
+    std::vector<uint8_t> memory; // all of memory when the run ended
+};
+
+// Just enough of a CP/M system to run the 8080 exerciser programs
+//
+// Memory is a flat 64K of RAM with the .COM program loaded at 0x100. The
+// BDOS entry at 0x0005 jumps to a stub that traps out through an OUT to
+// kBdosPort, where console output (functions 2 and 9) is collected; the
+// warm boot entry at 0x0000 signals the end of the program through an OUT
+// to kBootPort. The stack starts below the stub with a return address of
+// 0x0000 on it, so a program may also end with RET.
+class CpmMachine
+{
+public:
+    static const uint16_t kLoadAddress = 0x0100;
+    static const uint16_t kBdosAddress = 0xfe00;
+    static const uint8_t kBdosPort = 0xff;
+    static const uint8_t kBootPort = 0xfe;
+
+    bool Load(const std::string &path);
+    void LoadProgram(const uint8_t *code, int size);
+
+    CpmRun Run(EngineFunction run, uint64_t max_cycles) const;
+    CpmRun Count(uint64_t max_cycles) const;
+
+    static bool Passed(const CpmRun &run);
+
+private:
+    void Start(Emulator *e) const;
+
+    std::vector<uint8_t> program;
+};
+
+#endif // EMULATOR_CPM_HPP_
@@ -0,0 +1,216 @@
+#include <chrono>
+#include <cstddef>
+#include <iomanip>
+#include <sstream>
+#include "emulator/diagnostics.hpp"
+
+using namespace std;
+
+const size_t DiagnosticLog::kDefaultCapacity;
+const uint32_t DiagnosticLog::kDefaultRateLimit;
+const uint64_t DiagnosticLog::kCyclesPerSecond;
+
+// every Emulator holds a log, and emulators are allocated with plain new
+static_assert(alignof(DiagnosticLog) <= alignof(max_align_t), "DiagnosticLog must not be over-aligned");
+
+namespace
+{
+// how often the background printer looks at the ring
+const chrono::milliseconds kPrintInterval(50);
+
+// records moved out of the ring at a time
+const size_t kDrainBatch = 64;
+} // namespace
+
+DiagnosticLog::DiagnosticLog(size_t capacity) : ring(capacity), printing(false)
+{
+    for (int kind = 0; kind < kDiagnosticKindCount; kind++)
+    {
+        counts[kind].store(0, memory_order_relaxed);
+        suppressed[kind].store(0, memory_order_relaxed);
+        limit[kind] = kDefaultRateLimit;
+        window_start[kind] = 0;
+        in_window[kind] = 0;
+    }
+    dropped.store(0, memory_order_relaxed);
+}
+
+DiagnosticLog::~DiagnosticLog()
+{
+    StopPrinting();
+}
+
+// Emulation thread: count an event and queue it unless its kind is over
+// its rate limit or the ring is full
+void DiagnosticLog::Record(DiagnosticKind kind, uint16_t pc, uint16_t address, uint8_t value, uint64_t cycle)
+{
+    Increment(&counts[kind]);
+    if (cycle - window_start[kind] >= kCyclesPerSecond)
+    {
+        window_start[kind] = cycle;
+        in_window[kind] = 0;
+    }
+    if (limit[kind] != 0 && in_window[kind] >= limit[kind])
+    {
+        Increment(&suppressed[kind]);
+        return;
+    }
+    in_window[kind]++;
+
+    DiagnosticEvent event;
+    event.cycle = cycle;
+    event.pc = pc;
+    event.address = address;
+    event.value = value;
+    event.kind = static_cast<uint8_t>(kind);
+    if (!ring.TryPush(event))
+    {
+        Increment(&dropped);
+    }
+}
+
+// Keep at most events_per_second events of kind per emulated second, or all
+// of them if it is 0; set before emulating
+void DiagnosticLog::SetRateLimit(DiagnosticKind kind, uint32_t events_per_second)
+{
+    limit[kind] = events_per_second;
+}
+
+// Consumer: move the queued events to the end of events, returns how many
+size_t DiagnosticLog::Drain(vector<DiagnosticEvent> *events)
+{
+    size_t total = 0;
+    DiagnosticEvent batch[kDrainBatch];
+    size_t count;
+    while ((count = ring.TryPopBulk(batch, kDrainBatch)) > 0)
+    {
+        events->insert(events->end(), batch, batch + count);
+        total += count;
+    }
+    return total;
+}
+
+// Consumer: drain the queued events and print them one per line
+size_t DiagnosticLog::Print(ostream &out)
+{
+    vector<DiagnosticEvent> events;
+    Drain(&events);
+    for (size_t i = 0; i < events.size(); i++)
+    {
+        Format(out, events[i]);
+        out << '\n';
+    }
+    if (!events.empty())
+    {
+        out.flush();
+    }
+    return events.size();
+}
+
+// Print events to out from a background thread until StopPrinting
+void DiagnosticLog::StartPrinting(ostream &out)
+{
+    StopPrinting();
+    printing = true;
+    printer = thread(&DiagnosticLog::PrintLoop, this, &out);
+}
+
+// Stop the background printer, printing whatever it had not got to
+void DiagnosticLog::StopPrinting()
+{
+    if (!printer.joinable())
+    {
+        return;
+    }
+    {
+        lock_guard<mutex> lock(printer_mutex);
+        printing = false;
+    }
+    printer_wake.notify_one();
+    printer.join();
+}
+
+// Events of kind reported, kept or not; safe to call from any thread
+uint64_t DiagnosticLog::Count(DiagnosticKind kind) const
+{
+    return counts[kind].load(memory_order_relaxed);
+}
+
+// Events of kind left out by the rate limit
+uint64_t DiagnosticLog::Suppressed(DiagnosticKind kind) const
+{
+    return suppressed[kind].load(memory_order_relaxed);
+}
+
+// Events lost because the ring was full
+uint64_t DiagnosticLog::Dropped() const
+{
+    return dropped.load(memory_order_relaxed);
+}
+
+// One line per kind seen, with how many were reported and left out
+void DiagnosticLog::Summary(ostream &out) const
+{
+    for (int kind = 0; kind < kDiagnosticKindCount; kind++)
+    {
+        if (Count(static_cast<DiagnosticKind>(kind)) > 0)
+        {
+            out << KindName(static_cast<DiagnosticKind>(kind)) << ": "
+                << Count(static_cast<DiagnosticKind>(kind)) << " ("
+                << Suppressed(static_cast<DiagnosticKind>(kind)) << " over the rate limit)" << endl;
+        }
+    }
+    if (Dropped() > 0)
+    {
+        out << Dropped() << " diagnostics dropped with the log full" << endl;
+    }
+}
+
+const char *DiagnosticLog::KindName(DiagnosticKind kind)
+{
+    switch (kind)
+    {
+    case kDiagnosticInvalidInstruction:
+        return "invalid instruction";
+    case kDiagnosticInvalidWrite:
+        return "invalid write";
+    default:
+        return "unknown";
+    }
+}
+
+// Write event as text, leaving the formatting flags of out alone
+void DiagnosticLog::Format(ostream &out, const DiagnosticEvent &event)
+{
+    ostringstream text;
+    text << hex << setfill('0');
+    if (event.kind == kDiagnosticInvalidInstruction)
+    {
+        text << "Invalid instruction 0x" << setw(2) << static_cast<unsigned>(event.value) << " at 0x" << setw(4)
+             << event.address;
+    }
+    else
+    {
+        text << "Invalid write of 0x" << setw(2) << static_cast<unsigned>(event.value) << " to 0x" << setw(4)
+             << event.address << " at 0x" << setw(4) << event.pc;
+    }
+    text << dec << ", cycle " << event.cycle;
+    out << text.str();
+}
+
+// Counters are written by one thread only, so a plain load and store will do
+void DiagnosticLog::Increment(atomic<uint64_t> *counter)
+{
+    counter->store(counter->load(memory_order_relaxed) + 1, memory_order_relaxed);
+}
+
+void DiagnosticLog::PrintLoop(ostream *out)
+{
+    unique_lock<mutex> lock(printer_mutex);
+    while (printing)
+    {
+        printer_wake.wait_for(lock, kPrintInterval);
+        Print(*out);
+    }
+    Print(*out);
+}
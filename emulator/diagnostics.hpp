@@ -0,0 +1,90 @@
+#ifndef EMULATOR_DIAGNOSTICS_HPP_
+#define EMULATOR_DIAGNOSTICS_HPP_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <thread>
+#include <vector>
+#include "emulator/spsc_ring.hpp"
+
+// Things the emulator reports about the program it runs
+enum DiagnosticKind
+{
+    kDiagnosticInvalidInstruction,
+    kDiagnosticInvalidWrite,
+    kDiagnosticKindCount
+};
+
+// One report, as it is stored in the ring
+struct DiagnosticEvent
+{
+    uint64_t cycle = 0;   // cycles executed before the report
+    uint16_t pc = 0;
+    uint16_t address = 0; // of the instruction, or of the write
+    uint8_t value = 0;    // opcode, or value written
+    uint8_t kind = kDiagnosticInvalidInstruction;
+};
+
+// Log of diagnostics from the emulation thread
+//
+// Record only counts the event and pushes a small binary record into a
+// lock-free ring, so a program that misbehaves in a tight loop runs at full
+// speed. Nothing is printed unless another thread drains the ring, either
+// on demand with Drain or Print, or in the background after StartPrinting;
+// use one or the other, the ring has a single consumer. Each kind keeps at
+// most its rate limit of events per emulated second and counts the rest as
+// suppressed, and events that find the ring full are counted as dropped.
+class DiagnosticLog
+{
+public:
+    static const size_t kDefaultCapacity = 1024;
+    static const uint32_t kDefaultRateLimit = 100;
+    static const uint64_t kCyclesPerSecond = 2000000;
+
+    explicit DiagnosticLog(size_t capacity = kDefaultCapacity);
+    ~DiagnosticLog();
+    DiagnosticLog(const DiagnosticLog &) = delete;
+    DiagnosticLog &operator=(const DiagnosticLog &) = delete;
+
+    void Record(DiagnosticKind kind, uint16_t pc, uint16_t address, uint8_t value, uint64_t cycle);
+    void SetRateLimit(DiagnosticKind kind, uint32_t events_per_second);
+
+    size_t Drain(std::vector<DiagnosticEvent> *events);
+    size_t Print(std::ostream &out);
+    void StartPrinting(std::ostream &out);
+    void StopPrinting();
+
+    uint64_t Count(DiagnosticKind kind) const;
+    uint64_t Suppressed(DiagnosticKind kind) const;
+    uint64_t Dropped() const;
+    void Summary(std::ostream &out) const;
+
+    static const char *KindName(DiagnosticKind kind);
+    static void Format(std::ostream &out, const DiagnosticEvent &event);
+
+private:
+    static void Increment(std::atomic<uint64_t> *counter);
+    void PrintLoop(std::ostream *out);
+
+    SpscRing<DiagnosticEvent> ring;
+
+    // written by the emulation thread only, read from anywhere
+    std::atomic<uint64_t> counts[kDiagnosticKindCount];
+    std::atomic<uint64_t> suppressed[kDiagnosticKindCount];
+    std::atomic<uint64_t> dropped;
+
+    // rate limiting, emulation thread only
+    uint32_t limit[kDiagnosticKindCount];
+    uint64_t window_start[kDiagnosticKindCount];
+    uint32_t in_window[kDiagnosticKindCount];
+
+    std::thread printer;
+    std::mutex printer_mutex;
+    std::condition_variable printer_wake;
+    bool printing;
+};
+
+#endif // EMULATOR_DIAGNOSTICS_HPP_
@@ -0,0 +1,485 @@
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include "emulator/divergence.hpp"
+#include "emulator/movie.hpp"
+#include "disassembler/disassembler.hpp"
+
+using namespace std;
+
+namespace
+{
+// number of steps kept for the report
+const size_t kHistorySteps = 16;
+
+// Run count frames on one emulator, applying movie input
+void RunEngineFrames(Emulator *e, EngineFunction run, const InputMovie *movie,
+                     uint64_t first_frame, uint64_t count)
+{
+    for (uint64_t frame = first_frame; frame < first_frame + count; frame++)
+    {
+        if (movie != nullptr)
+        {
+            movie->Apply(e, frame);
+        }
+        EngineRegistry::RunFrame(e, run);
+    }
+}
+
+// One checkpoint interval, for a worker to run the candidate over
+struct IntervalCheck
+{
+    uint64_t first_frame = 0;
+    uint64_t count = 0;
+    Snapshot start;              // the reference's state at first_frame
+    uint64_t reference_hash = 0; // and its state hash count frames later
+    bool finished = false;
+    bool diverged = false;
+};
+
+// Intervals waiting for a worker
+struct CheckQueue
+{
+    mutex lock;
+    condition_variable queued; // an interval was queued, or stopping is set
+    condition_variable done;   // an interval was finished
+    deque<IntervalCheck *> waiting;
+    bool stopping = false;
+};
+
+// Worker thread: run the candidate over intervals until the queue stops
+void CheckIntervals(CheckQueue *queue, EngineFunction run, const InputMovie *movie)
+{
+    Emulator e;
+    for (;;)
+    {
+        IntervalCheck *check;
+        {
+            unique_lock<mutex> lock(queue->lock);
+            while (queue->waiting.empty() && !queue->stopping)
+            {
+                queue->queued.wait(lock);
+            }
+            if (queue->stopping)
+            {
+                return;
+            }
+            check = queue->waiting.front();
+            queue->waiting.pop_front();
+        }
+
+        e.LoadState(check->start);
+        RunEngineFrames(&e, run, movie, check->first_frame, check->count);
+        bool diverged = DivergenceFinder::StateHash(e) != check->reference_hash;
+        {
+            lock_guard<mutex> lock(queue->lock);
+            check->diverged = diverged;
+            check->finished = true;
+        }
+        queue->done.notify_all();
+    }
+}
+
+// Execute a single instruction, returns the cycles it took
+int Step(Emulator *e, EngineFunction run)
+{
+    uint64_t cycles = e->GetCycles();
+    run(e, 1);
+    return static_cast<int>(e->GetCycles() - cycles);
+}
+
+bool SamePorts(const Ports &a, const Ports &b)
+{
+    return a.port1 == b.port1 && a.port2 == b.port2 && a.port3 == b.port3 && a.port5 == b.port5;
+}
+
+void PrintRow(ostream &out, const char *name, unsigned reference, unsigned candidate, int width)
+{
+    out << "  " << left << setw(10) << name << right << setw(width) << reference
+        << setw(12) << candidate << (reference != candidate ? "  <--" : "") << '\n';
+}
+} // namespace
+
+DivergenceFinder::DivergenceFinder(const Engine &reference, const Engine &candidate)
+    : reference(reference), candidate(candidate), movie(nullptr), interval(64),
+      threads(static_cast<int>(thread::hardware_concurrency())), frames_emulated(0)
+{
+    if (threads < 1)
+    {
+        threads = 1;
+    }
+}
+
+// Replay movie input in both engines
+void DivergenceFinder::SetMovie(const InputMovie *new_movie)
+{
+    movie = new_movie;
+}
+
+// Compare the engines every frames frames
+void DivergenceFinder::SetCheckpointInterval(int frames)
+{
+    interval = max(frames, 1);
+}
+
+// Number of worker threads running the candidate
+void DivergenceFinder::SetThreads(int new_threads)
+{
+    threads = max(1, new_threads);
+}
+
+// Run both engines for frames frames from start, which is the state at the
+// beginning of frame first_frame of the movie
+// Returns true if they diverge
+bool DivergenceFinder::Run(const Snapshot &start, uint64_t first_frame, uint64_t frames)
+{
+    result = Divergence();
+    frames_emulated = 0;
+
+    CheckQueue queue;
+    vector<thread> workers;
+    for (int t = 0; t < threads; t++)
+    {
+        workers.push_back(thread(CheckIntervals, &queue, candidate.run, movie));
+    }
+
+    // intervals handed to the workers, in frame order; the reference runs
+    // at most two per worker ahead of the oldest unfinished one, which
+    // bounds both the memory held in checkpoints and the frames run past a
+    // divergence
+    deque<unique_ptr<IntervalCheck>> checks;
+    const size_t max_checks = 2 * static_cast<size_t>(threads);
+    unique_ptr<IntervalCheck> diverged;
+
+    Emulator reference_emulator;
+    reference_emulator.LoadState(start);
+    uint64_t lo = first_frame;
+    uint64_t end = first_frame + frames;
+    for (;;)
+    {
+        {
+            unique_lock<mutex> lock(queue.lock);
+            for (;;)
+            {
+                while (!checks.empty() && checks.front()->finished && !checks.front()->diverged)
+                {
+                    checks.pop_front();
+                }
+                if (!checks.empty() && checks.front()->finished)
+                {
+                    diverged = move(checks.front());
+                    checks.pop_front();
+                    break;
+                }
+                if ((lo < end && checks.size() < max_checks) || (lo >= end && checks.empty()))
+                {
+                    break;
+                }
+                queue.done.wait(lock);
+            }
+        }
+        if (diverged || lo >= end)
+        {
+            break;
+        }
+
+        unique_ptr<IntervalCheck> check(new IntervalCheck);
+        check->first_frame = lo;
+        check->count = min(static_cast<uint64_t>(interval), end - lo);
+        reference_emulator.SaveState(&check->start);
+        RunEngineFrames(&reference_emulator, reference.run, movie, lo, check->count);
+        check->reference_hash = StateHash(reference_emulator);
+        lo += check->count;
+        frames_emulated += check->count;
+        {
+            lock_guard<mutex> lock(queue.lock);
+            queue.waiting.push_back(check.get());
+            checks.push_back(move(check));
+        }
+        queue.queued.notify_one();
+    }
+
+    // intervals still queued past a divergence are dropped
+    {
+        lock_guard<mutex> lock(queue.lock);
+        queue.stopping = true;
+    }
+    queue.queued.notify_all();
+    for (size_t t = 0; t < workers.size(); t++)
+    {
+        workers[t].join();
+    }
+    if (!diverged)
+    {
+        return false;
+    }
+
+    // the states agree at the start of frame lo and differ at the start
+    // of frame hi - halve the range until a single frame is left
+    Emulator candidate_emulator;
+    Snapshot good = diverged->start;
+    lo = diverged->first_frame;
+    uint64_t hi = lo + diverged->count;
+    while (hi - lo > 1)
+    {
+        uint64_t mid = lo + (hi - lo) / 2;
+        reference_emulator.LoadState(good);
+        candidate_emulator.LoadState(good);
+        RunFrames(&reference_emulator, &candidate_emulator, lo, mid - lo);
+        if (StateHash(reference_emulator) == StateHash(candidate_emulator))
+        {
+            reference_emulator.SaveState(&good);
+            lo = mid;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    StepFrame(good, lo);
+    return true;
+}
+
+// Advance both emulators by count frames, one after the other
+void DivergenceFinder::RunFrames(Emulator *reference_emulator, Emulator *candidate_emulator,
+                                 uint64_t first_frame, uint64_t count)
+{
+    RunEngineFrames(reference_emulator, reference.run, movie, first_frame, count);
+    RunEngineFrames(candidate_emulator, candidate.run, movie, first_frame, count);
+    frames_emulated += count;
+}
+
+// Step both engines through frame from start until their states differ
+void DivergenceFinder::StepFrame(const Snapshot &start, uint64_t frame)
+{
+    Emulator reference_emulator;
+    Emulator candidate_emulator;
+    reference_emulator.LoadState(start);
+    candidate_emulator.LoadState(start);
+    if (movie != nullptr)
+    {
+        movie->Apply(&reference_emulator, frame);
+        movie->Apply(&candidate_emulator, frame);
+    }
+
+    result.found = true;
+    result.frame = frame;
+    result.before = start;
+
+    uint64_t step = 0;
+    for (int half = 1; half <= 2; half++)
+    {
+        int spent = 0;
+        while (spent < EngineRegistry::kHalfFrameCycles)
+        {
+            reference_emulator.SaveState(&result.before);
+            result.history.push_back(static_cast<uint16_t>(reference_emulator.GetPC()));
+            if (result.history.size() > kHistorySteps)
+            {
+                result.history.erase(result.history.begin());
+            }
+
+            spent += Step(&reference_emulator, reference.run);
+            Step(&candidate_emulator, candidate.run);
+            if (!SameState(reference_emulator, candidate_emulator))
+            {
+                break;
+            }
+            step++;
+        }
+
+        if (SameState(reference_emulator, candidate_emulator))
+        {
+            reference_emulator.SaveState(&result.before);
+            reference_emulator.Interrupt(half);
+            candidate_emulator.Interrupt(half);
+        }
+        if (!SameState(reference_emulator, candidate_emulator))
+        {
+            result.stepped = true;
+            result.step = step;
+            reference_emulator.SaveState(&result.reference);
+            candidate_emulator.SaveState(&result.candidate);
+            return;
+        }
+    }
+
+    // the frame only differs when run whole, e.g. an engine that does not
+    // stop after one instruction - report the states at the end of the frame
+    result.history.clear();
+    result.before = start;
+    reference_emulator.LoadState(start);
+    candidate_emulator.LoadState(start);
+    RunFrames(&reference_emulator, &candidate_emulator, frame, 1);
+    reference_emulator.SaveState(&result.reference);
+    candidate_emulator.SaveState(&result.candidate);
+}
+
+// What Run found
+const Divergence &DivergenceFinder::Result() const
+{
+    return result;
+}
+
+// Frames run by each engine during the last Run, bisection included
+uint64_t DivergenceFinder::FramesEmulated() const
+{
+    return frames_emulated;
+}
+
+// Describe the divergence: the code leading up to it, then both states
+void DivergenceFinder::Report(ostream &out) const
+{
+    ios_base::fmtflags saved = out.flags();
+    char fill_char = out.fill();
+
+    if (!result.found)
+    {
+        out << reference.name << " and " << candidate.name << " agree after "
+            << frames_emulated << " frames" << endl;
+        return;
+    }
+
+    out << "First divergence between " << reference.name << " and " << candidate.name
+        << " in frame " << result.frame;
+    if (result.stepped)
+    {
+        out << ", step " << result.step << " (cycle " << result.before.cycles << ")";
+    }
+    out << endl;
+
+    const vector<uint8_t> &memory = result.before.memory;
+    for (size_t i = 0; i < result.history.size(); i++)
+    {
+        uint16_t pc = result.history[i];
+        out << (i + 1 == result.history.size() ? "> " : "  ");
+        if (pc < memory.size())
+        {
+            Disassembler::Disassemble(out, &memory[pc], static_cast<int>(min<size_t>(3, memory.size() - pc)), pc);
+        }
+        else
+        {
+            out << hex << setfill('0') << setw(4) << pc << dec << setfill(' ') << " ???" << '\n';
+        }
+    }
+
+    PrintStates(out, result.reference, result.candidate);
+
+    out.flags(saved);
+    out.fill(fill_char);
+}
+
+// Print the registers, flags and cycles of two states side by side, marking
+// the differences, followed by up to 16 differing memory bytes
+void DivergenceFinder::PrintStates(ostream &out, const Snapshot &r, const Snapshot &c)
+{
+    ios_base::fmtflags saved = out.flags();
+    char fill_char = out.fill();
+
+    out << "  " << left << setw(10) << "" << right << setw(12) << "reference" << setw(12) << "candidate"
+        << '\n' << hex << setfill(' ');
+    PrintRow(out, "A", r.registers.A, c.registers.A, 12);
+    PrintRow(out, "B", r.registers.B, c.registers.B, 12);
+    PrintRow(out, "C", r.registers.C, c.registers.C, 12);
+    PrintRow(out, "D", r.registers.D, c.registers.D, 12);
+    PrintRow(out, "E", r.registers.E, c.registers.E, 12);
+    PrintRow(out, "H", r.registers.H, c.registers.H, 12);
+    PrintRow(out, "L", r.registers.L, c.registers.L, 12);
+    PrintRow(out, "SP", r.sp, c.sp, 12);
+    PrintRow(out, "PC", r.pc, c.pc, 12);
+    out << dec;
+    PrintRow(out, "Z", r.flags.z, c.flags.z, 12);
+    PrintRow(out, "S", r.flags.s, c.flags.s, 12);
+    PrintRow(out, "P", r.flags.p, c.flags.p, 12);
+    PrintRow(out, "CY", r.flags.cy, c.flags.cy, 12);
+    PrintRow(out, "AC", r.flags.ac, c.flags.ac, 12);
+    PrintRow(out, "INTE", r.interrupt_enable, c.interrupt_enable, 12);
+    out << hex;
+    PrintRow(out, "port 3", r.ports.port3, c.ports.port3, 12);
+    PrintRow(out, "port 5", r.ports.port5, c.ports.port5, 12);
+    out << dec;
+    out << "  " << left << setw(10) << "cycles" << right << setw(12) << r.cycles << setw(12) << c.cycles
+        << (r.cycles != c.cycles ? "  <--" : "") << '\n';
+
+    size_t size = min(r.memory.size(), c.memory.size());
+    int differences = 0;
+    for (size_t address = 0; address < size; address++)
+    {
+        if (r.memory[address] != c.memory[address])
+        {
+            if (differences < 16)
+            {
+                ostringstream name;
+                name << "[" << hex << setfill('0') << setw(4) << address << "]";
+                out << hex;
+                PrintRow(out, name.str().c_str(), r.memory[address], c.memory[address], 12);
+                out << dec;
+            }
+            differences++;
+        }
+    }
+    if (differences > 0)
+    {
+        out << "  " << differences << " memory bytes differ" << endl;
+    }
+
+    out.flags(saved);
+    out.fill(fill_char);
+}
+
+// 64 bit FNV-1a style hash of memory, registers, flags and cycle count
+uint64_t DivergenceFinder::StateHash(const Emulator &e)
+{
+    const uint64_t kPrime = 0x100000001b3ull;
+    uint64_t hash = 0xcbf29ce484222325ull;
+
+    const uint8_t *memory = e.GetMemory();
+    int size = e.GetMemorySize();
+    int i = 0;
+    for (; i + 8 <= size; i += 8)
+    {
+        uint64_t word;
+        memcpy(&word, memory + i, sizeof(word));
+        hash = (hash ^ word) * kPrime;
+    }
+    for (; i < size; i++)
+    {
+        hash = (hash ^ memory[i]) * kPrime;
+    }
+
+    Registers r = e.GetRegisters();
+    Flags f = e.GetFlags();
+    uint64_t registers = static_cast<uint64_t>(r.A) | r.B << 8 | r.C << 16 | static_cast<uint64_t>(r.D) << 24 |
+                         static_cast<uint64_t>(r.E) << 32 | static_cast<uint64_t>(r.H) << 40 |
+                         static_cast<uint64_t>(r.L) << 48;
+    uint64_t machine = static_cast<uint64_t>(e.GetPC()) | static_cast<uint64_t>(e.GetSP()) << 16 |
+                       static_cast<uint64_t>(f.z | f.s << 1 | f.p << 2 | f.cy << 3 | f.ac << 4) << 32 |
+                       static_cast<uint64_t>(e.interrupt_enable) << 40;
+    hash = (hash ^ registers) * kPrime;
+    hash = (hash ^ machine) * kPrime;
+    hash = (hash ^ e.GetCycles()) * kPrime;
+    return hash;
+}
+
+// True if a and b hold exactly the same machine state
+bool DivergenceFinder::SameState(const Emulator &a, const Emulator &b)
+{
+    Registers ra = a.GetRegisters();
+    Registers rb = b.GetRegisters();
+    Flags fa = a.GetFlags();
+    Flags fb = b.GetFlags();
+    return ra.A == rb.A && ra.B == rb.B && ra.C == rb.C && ra.D == rb.D && ra.E == rb.E &&
+           ra.H == rb.H && ra.L == rb.L && fa.z == fb.z && fa.s == fb.s && fa.p == fb.p &&
+           fa.cy == fb.cy && fa.ac == fb.ac && a.GetPC() == b.GetPC() && a.GetSP() == b.GetSP() &&
+           a.interrupt_enable == b.interrupt_enable && a.Halted() == b.Halted() &&
+           a.GetCycles() == b.GetCycles() &&
+           SamePorts(a.GetPorts(), b.GetPorts()) &&
+           a.GetMemorySize() == b.GetMemorySize() &&
+           memcmp(a.GetMemory(), b.GetMemory(), a.GetMemorySize()) == 0;
+}
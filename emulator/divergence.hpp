@@ -0,0 +1,72 @@
+#ifndef EMULATOR_DIVERGENCE_HPP_
+#define EMULATOR_DIVERGENCE_HPP_
+
+#include <cstdint>
+#include <ostream>
+#include <vector>
+#include "emulator/emulator.hpp"
+#include "emulator/engine.hpp"
+
+class InputMovie;
+
+// The first point at which two engines disagree
+struct Divergence
+{
+    bool found = false;
+    bool stepped = false;           // narrowed down to a single step
+    uint64_t frame = 0;             // frame in which the states first differ
+    uint64_t step = 0;              // steps into that frame, if stepped
+    Snapshot before;                // last state both engines agreed on
+    Snapshot reference;             // states right after the difference
+    Snapshot candidate;
+    std::vector<uint16_t> history;  // pcs of the steps leading up to it
+};
+
+// Finds the first instruction where a candidate engine departs from a
+// reference engine
+//
+// The reference engine runs the input movie once, saving a checkpoint
+// every few frames. A fixed pool of worker threads runs the candidate over
+// each checkpoint interval from the reference's checkpoint and compares a
+// hash of the state at its end, so the candidate's share of the work is
+// spread over all cores while the reference runs ahead. At the first
+// interval whose hashes differ, the finder bisects over frames from that
+// interval's checkpoint, then steps both engines one instruction at a time
+// through the first differing frame. The cost is one pass of the reference
+// over the run, plus a few checkpoint intervals, independent of where the
+// divergence is; the reference's pass is serial, so a long run is bounded
+// by the reference engine's speed on one core.
+class DivergenceFinder
+{
+public:
+    DivergenceFinder(const Engine &reference, const Engine &candidate);
+
+    void SetMovie(const InputMovie *movie);
+    void SetCheckpointInterval(int frames);
+    void SetThreads(int threads);
+
+    bool Run(const Snapshot &start, uint64_t first_frame, uint64_t frames);
+    const Divergence &Result() const;
+    uint64_t FramesEmulated() const;
+    void Report(std::ostream &out) const;
+
+    static void PrintStates(std::ostream &out, const Snapshot &reference, const Snapshot &candidate);
+    static uint64_t StateHash(const Emulator &e);
+    static bool SameState(const Emulator &a, const Emulator &b);
+
+private:
+    void RunFrames(Emulator *reference_emulator, Emulator *candidate_emulator,
+                   uint64_t first_frame, uint64_t count);
+    void StepFrame(const Snapshot &start, uint64_t frame);
+
+    Engine reference;
+    Engine candidate;
+    const InputMovie *movie;
+    int interval;
+    int threads;
+
+    Divergence result;
+    uint64_t frames_emulated;
+};
+
+#endif // EMULATOR_DIVERGENCE_HPP_
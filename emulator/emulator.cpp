@@ -1,8 +1,11 @@
+#include <algorithm>
 #include <iostream>
 #include <iomanip>
 #include <fstream>
 #include <cstdint>
 #include "emulator.hpp"
+#include "emulator/hle.hpp"
+#include "emulator/profiler.hpp"
 #include "disassembler/disassembler.hpp"
 
 using namespace std;
@@ -17,6 +20,10 @@ Intel, “8080 Assembly Language Programming Manual”, 1975
 
 */
 
+// jumps back that CheckIdleLoop passes over after finding a loop that is
+// not idle
+static const int kIdleBackoff = 16;
+
 // Constructor
 Emulator::Emulator()
 {
@@ -25,10 +32,33 @@ Emulator::Emulator()
     interrupt_enable = false;
     memory = nullptr;
     mem_size = 0;
+    cycle_budget = 0;
+    idle_skipping = true;
+    skip_idle = false;
+    halted = false;
+    idle_branch = 0;
+    idle_clean = false;
+    idle_backoff = 0;
+    idle_skipped = 0;
+    hle_table = nullptr;
+    rom_hash = 0;
+    rom_hash_valid = false;
+    hle_entries = nullptr;
+    hle_entries_valid = false;
+    hle_active = nullptr;
+    hle_calls = 0;
     LoadRom("./space_invaders_rom/invaders");
     num_cycles = 0;
+    total_cycles = 0;
+    ram_start = 0x2000;
+    ram_end = 0x4000;
+    output_handler = nullptr;
+    output_context = nullptr;
+    fill(watched_pages, watched_pages + 256, 0);
+    next_watch_id = 1;
 
     ports.port2 = 0x00; // reset tilt
+    PublishState();
 
     // GAME SETTINGS:
     // number of lives - 0x00:3 lives, 0x01:4 lives, 0x02:5 lives, 0x03:6 lives
@@ -59,6 +89,8 @@ void Emulator::AllocateMemory(int size)
     for (int i = 0; i < size; i++)
         memory[i] = 0;
     mem_size = size;
+    MarkAllPagesDirty();
+    idle_clean = false;
 }
 
 // Copy contents of file specified by file_path into memory
@@ -80,6 +112,8 @@ int Emulator::LoadRom(string file_path)
         file.seekg(0, ios::beg);
         file.read(reinterpret_cast<char *>(memory), size);
         file.close();
+        MarkAllPagesDirty();
+        idle_clean = false;
 
         return size;
     }
@@ -135,20 +169,22 @@ void Emulator::ZSPFlags(uint8_t value)
 // Handle invalid instruction input
 void Emulator::InvalidInstruction(uint8_t byte, uint16_t addr)
 {
-    cout << "Invalid instruction:" << endl;
-    cout << "opcode 0x" << hex << setfill('0') << setw(2)
-         << static_cast<unsigned>(byte) << endl;
-    cout << "at memory location 0x" << hex << setfill('0') << setw(4)
-         << static_cast<unsigned>(addr) << endl;
+    diagnostics.Record(kDiagnosticInvalidInstruction, addr, addr, byte, GetCycles());
+    idle_clean = false;
     pc++;
 }
 
 // Write value to memory address
 void Emulator::WriteToMem(uint16_t address, uint8_t value)
 {
-    if (address < 0x2000 || address >= 0x4000)
+    if (watched_pages[address >> 8] & kWatchWrite)
+    {
+        CheckWatches(address, value, kWatchWrite);
+    }
+    if (address < ram_start || address >= ram_end)
     {
-        cout << "Invalid write location " << address << endl;
+        diagnostics.Record(kDiagnosticInvalidWrite, pc, address, value, GetCycles());
+        idle_clean = false;
         return;
     }
 
@@ -157,12 +193,22 @@ void Emulator::WriteToMem(uint16_t address, uint8_t value)
         // printf("VIDEO MEM WRITE -------- %04x %04x\n", address, value);
     }
 
+    int page = address / kDirtyPageSize;
+    dirty_pages[page / 64] |= uint64_t(1) << (page % 64);
+    if (memory[address] != value)
+    {
+        idle_clean = false;
+    }
     memory[address] = value;
 }
 
 // Read value from memory address
 uint8_t Emulator::ReadFromMem(uint16_t address)
 {
+    if (watched_pages[address >> 8] & kWatchRead)
+    {
+        CheckWatches(address, memory[address], kWatchRead);
+    }
     return memory[address];
 }
 
@@ -180,6 +226,34 @@ uint8_t Emulator::ReadFromHL()
     return ReadFromMem(offset);
 }
 
+// Jump to address, once the cycles of the jump are counted
+// A jump backwards may go round a ROM routine's loop, see SetHleHooks, or
+// close an idle loop, see CheckIdleLoop
+void Emulator::Jump(uint8_t addr_high, uint8_t addr_low)
+{
+    uint16_t branch_pc = pc;
+    pc = (addr_high << 8) | addr_low;
+    if (pc >= branch_pc)
+    {
+        return;
+    }
+    if (hle_active != nullptr && RunHleHook())
+    {
+        return;
+    }
+    if (skip_idle)
+    {
+        if (idle_backoff > 0)
+        {
+            idle_backoff--;
+        }
+        else
+        {
+            CheckIdleLoop(branch_pc);
+        }
+    }
+}
+
 // Call address, store return address and update SP
 void Emulator::Call(uint8_t addr_high, uint8_t addr_low)
 {
@@ -187,6 +261,10 @@ void Emulator::Call(uint8_t addr_high, uint8_t addr_low)
     Push((ret >> 8) & 0xff, (ret & 0xff));
     pc = (addr_high << 8) | addr_low;
     num_cycles += 17;
+    if (hle_active != nullptr)
+    {
+        RunHleHook();
+    }
 }
 
 // Return from call to address stored on stack
@@ -210,17 +288,30 @@ void Emulator::Push(uint8_t high, uint8_t low)
 // Pop from stack
 void Emulator::Pop(uint8_t *high, uint8_t *low)
 {
-    *low = memory[sp];
-    *high = memory[sp + 1];
+    *low = ReadFromMem(sp);
+    *high = ReadFromMem(sp + 1);
     sp += 2;
 }
 
-// Subtract value from accummulator
-void Emulator::SubtractFromA(uint8_t operand)
+// Add operand (plus carry) to accumulator
+// AC is the carry out of bit 3, which DAA needs to correct the low digit
+void Emulator::AddToA(uint8_t operand, bool carry)
+{
+    uint16_t res = (uint16_t)registers.A + operand + carry;
+    flags.ac = ((registers.A & 0x0f) + (operand & 0x0f) + carry) > 0x0f;
+    ArithFlagsA(res);
+    registers.A = (uint8_t)res;
+}
+
+// Subtract value (plus borrow) from accummulator
+// The 8080 adds the complement of the operand and of the borrow, so AC is
+// the carry out of bit 3 of that addition and CY is the inverted carry
+void Emulator::SubtractFromA(uint8_t operand, bool borrow)
 {
     uint16_t num1 = registers.A;
     uint16_t num2 = ~operand & 0x00ff;
-    uint16_t result = num1 + num2 + 0x0001;
+    uint16_t result = num1 + num2 + !borrow;
+    flags.ac = ((num1 & 0x0f) + (num2 & 0x0f) + !borrow) > 0x0f;
     registers.A = result & 0x00ff;
 
     // Set flags
@@ -230,18 +321,88 @@ void Emulator::SubtractFromA(uint8_t operand)
     flags.cy = !(result & 0x0100);
 }
 
+// Set flags as for subtracting operand from accumulator, leaving A unchanged
+void Emulator::CompareWithA(uint8_t operand)
+{
+    uint8_t a = registers.A;
+    SubtractFromA(operand);
+    registers.A = a;
+}
+
+// AND operand into accumulator
+// Unlike the other logic operations, ANA sets AC to the OR of bit 3 of both
+void Emulator::AndWithA(uint8_t operand)
+{
+    bool ac = ((registers.A | operand) & 0x08) != 0;
+    registers.A &= operand;
+    LogicFlagsA();
+    flags.ac = ac;
+}
+
+// Return value + 1, setting all flags but carry (INR)
+uint8_t Emulator::Increment(uint8_t value)
+{
+    value++;
+    flags.ac = (value & 0x0f) == 0x00;
+    ZSPFlags(value);
+    return value;
+}
+
+// Return value - 1, setting all flags but carry (DCR)
+uint8_t Emulator::Decrement(uint8_t value)
+{
+    value--;
+    flags.ac = (value & 0x0f) != 0x0f;
+    ZSPFlags(value);
+    return value;
+}
+
 // Emulate opcodes for designated number of cycles
+// The run loop itself lives in EmulateProfiled, without a profiler attached
 void Emulator::Emulate(int cycles)
 {
-    num_cycles = 0;
-    while (num_cycles < cycles)
-    {
-        uint8_t opcode = memory[pc];
+    NullProfiler no_profiler;
+    EmulateProfiled(cycles, no_profiler);
+}
 
-        // uncomment to print each instruction as it is executed
-        // Disassembler::Disassemble(reinterpret_cast<char *>(memory), pc);
-        EmulateOpcode(opcode, memory[pc + 1], memory[pc + 2]);
+// Called after a jump back to an earlier address, without a profiler
+// attached. If the machine is in exactly the state it was in when it last
+// took the same jump, and changed nothing in memory or outside since, it
+// will go round the same loop until an interrupt, which only comes between
+// calls to Emulate. Skip the whole turns of the loop that fit in what is
+// left of this call; executing them would end in the same state.
+void Emulator::CheckIdleLoop(uint16_t branch_pc)
+{
+    const Registers &r = idle.registers;
+    const Flags &f = idle.flags;
+    const Ports &p = idle.ports;
+    if (idle_clean && branch_pc == idle_branch && registers.A == r.A && registers.B == r.B &&
+        registers.C == r.C && registers.D == r.D && registers.E == r.E && registers.H == r.H &&
+        registers.L == r.L && flags.z == f.z && flags.s == f.s && flags.p == f.p && flags.cy == f.cy &&
+        flags.ac == f.ac && sp == idle.sp && interrupt_enable == idle.interrupt_enable &&
+        ports.port1 == p.port1 && ports.port2 == p.port2 && ports.port3 == p.port3 && ports.port5 == p.port5 &&
+        watches.empty())
+    {
+        uint64_t period = GetCycles() - idle.cycles;
+        if (num_cycles < cycle_budget)
+        {
+            // the last turn is emulated, so that it stops where it would have
+            uint64_t skipped = (cycle_budget - 1 - num_cycles) / period * period;
+            num_cycles = static_cast<uint16_t>(num_cycles + skipped);
+            idle_skipped += skipped;
+        }
+        idle.cycles = GetCycles();
+        return;
     }
+    // a loop that counts or scans something comes round in a different
+    // state every time; look at it again only now and then
+    if (branch_pc == idle_branch)
+    {
+        idle_backoff = kIdleBackoff;
+    }
+    idle_branch = branch_pc;
+    SaveCpu(&idle);
+    idle_clean = true;
 }
 
 // Emulate opcodes determined by parameters
@@ -291,8 +452,7 @@ void Emulator::EmulateOpcode(uint8_t opcode, uint8_t operand1, uint8_t operand2)
     case 0x04:
         // INR B
         {
-            registers.B++;
-            ZSPFlags(registers.B);
+            registers.B = Increment(registers.B);
             pc++;
             num_cycles += 5;
         }
@@ -301,8 +461,7 @@ void Emulator::EmulateOpcode(uint8_t opcode, uint8_t operand1, uint8_t operand2)
     case 0x05:
         // DCR B
         {
-            registers.B--;
-            ZSPFlags(registers.B);
+            registers.B = Decrement(registers.B);
             pc++;
             num_cycles += 5;
         }
@@ -357,7 +516,7 @@ void Emulator::EmulateOpcode(uint8_t opcode, uint8_t operand1, uint8_t operand2)
         // LDAX B
         {
             uint16_t offset = (registers.B << 8) | registers.C;
-            registers.A = memory[offset];
+            registers.A = ReadFromMem(offset);
             pc++;
             num_cycles += 7;
         }
@@ -378,8 +537,7 @@ void Emulator::EmulateOpcode(uint8_t opcode, uint8_t operand1, uint8_t operand2)
     case 0x0c:
         // INR C
         {
-            registers.C++;
-            ZSPFlags(registers.C);
+            registers.C = Increment(registers.C);
             pc++;
             num_cycles += 5;
         }
@@ -388,8 +546,7 @@ void Emulator::EmulateOpcode(uint8_t opcode, uint8_t operand1, uint8_t operand2)
     case 0x0d:
         // DCR C
         {
-            registers.C--;
-            ZSPFlags(registers.C);
+            registers.C = Decrement(registers.C);
             pc++;
             num_cycles += 5;
         }
@@ -462,8 +619,7 @@ void Emulator::EmulateOpcode(uint8_t opcode, uint8_t operand1, uint8_t operand2)
     case 0x14:
         // INR D
         {
-            registers.D++;
-            ZSPFlags(registers.D);
+            registers.D = Increment(registers.D);
 
             pc++;
             num_cycles += 5;
@@ -473,8 +629,7 @@ void Emulator::EmulateOpcode(uint8_t opcode, uint8_t operand1, uint8_t operand2)
         // DCR D
         // Decrement D
         {
-            registers.D--;
-            ZSPFlags(registers.D);
+            registers.D = Decrement(registers.D);
 
             pc++;
             num_cycles += 5;
@@ -531,7 +686,7 @@ void Emulator::EmulateOpcode(uint8_t opcode, uint8_t operand1, uint8_t operand2)
         // Load register A with byte at the memory address stored in the DE register pair
         {
             uint16_t mem_addr = (registers.D << 8) | registers.E;
-            registers.A = memory[mem_addr];
+            registers.A = ReadFromMem(mem_addr);
 
             pc++;
             num_cycles += 7;
@@ -552,8 +707,7 @@ void Emulator::EmulateOpcode(uint8_t opcode, uint8_t operand1, uint8_t operand2)
     case 0x1c:
         // INR E
         {
-            registers.E++;
-            ZSPFlags(registers.E);
+            registers.E = Increment(registers.E);
             pc++;
             num_cycles += 5;
         }
@@ -562,8 +716,7 @@ void Emulator::EmulateOpcode(uint8_t opcode, uint8_t operand1, uint8_t operand2)
         // DCR E
         // Decrement register E and
         {
-            registers.E--;
-            ZSPFlags(registers.E);
+            registers.E = Decrement(registers.E);
             pc++;
             num_cycles += 5;
         }
@@ -613,8 +766,8 @@ void Emulator::EmulateOpcode(uint8_t opcode, uint8_t operand1, uint8_t operand2)
         // SHLD $
         {
             uint16_t address = (operand2 << 8) | operand1;
-            memory[address] = registers.L;
-            memory[address + 1] = registers.H;
+            WriteToMem(address, registers.L);
+            WriteToMem(address + 1, registers.H);
             pc += 3;
             num_cycles += 16;
         }
@@ -635,8 +788,7 @@ void Emulator::EmulateOpcode(uint8_t opcode, uint8_t operand1, uint8_t operand2)
     case 0x24:
         // INR H
         {
-            registers.H++;
-            ZSPFlags(registers.H);
+            registers.H = Increment(registers.H);
             pc++;
             num_cycles += 5;
         }
@@ -644,8 +796,7 @@ void Emulator::EmulateOpcode(uint8_t opcode, uint8_t operand1, uint8_t operand2)
     case 0x25:
         // DCR H
         {
-            registers.H--;
-            ZSPFlags(registers.H);
+            registers.H = Decrement(registers.H);
             pc++;
             num_cycles += 5;
         }
@@ -663,20 +814,24 @@ void Emulator::EmulateOpcode(uint8_t opcode, uint8_t operand1, uint8_t operand2)
         {
             uint8_t lowNibble = registers.A & 0x0F;
             uint8_t highNibble = registers.A >> 4;
+            uint8_t correction = 0;
 
             if (lowNibble > 9 || flags.ac)
             {
-                registers.A += 6;
-                flags.ac = 1;
+                correction = 0x06;
             }
 
-            if (highNibble > 9 || flags.cy)
+            // the high digit is checked after the low digit's correction,
+            // which carries into it when the low digit is above 9
+            if (highNibble > 9 || flags.cy || (highNibble == 9 && lowNibble > 9))
             {
-                registers.A += 0x60; // Increment most significant bits by 6
+                correction |= 0x60; // Increment most significant bits by 6
                 flags.cy = 1;
             }
 
-            flags.p = parity(registers.A);
+            flags.ac = (lowNibble + (correction & 0x0F)) > 0x0F;
+            registers.A += correction;
+            ZSPFlags(registers.A);
             pc++;
             num_cycles += 4;
         }
@@ -704,8 +859,8 @@ void Emulator::EmulateOpcode(uint8_t opcode, uint8_t operand1, uint8_t operand2)
         // LHLD $
         {
             uint16_t address = (operand2 << 8) | operand1;
-            registers.L = memory[address];
-            registers.H = memory[address + 1];
+            registers.L = ReadFromMem(address);
+            registers.H = ReadFromMem(address + 1);
             pc += 3;
             num_cycles += 16;
         }
@@ -724,8 +879,7 @@ void Emulator::EmulateOpcode(uint8_t opcode, uint8_t operand1, uint8_t operand2)
     case 0x2c:
         // INR L
         {
-            registers.L++;
-            ZSPFlags(registers.L);
+            registers.L = Increment(registers.L);
             pc++;
             num_cycles += 5;
         }
@@ -733,8 +887,7 @@ void Emulator::EmulateOpcode(uint8_t opcode, uint8_t operand1, uint8_t operand2)
     case 0x2d:
         // DCR L
         {
-            registers.L--;
-            ZSPFlags(registers.L);
+            registers.L = Decrement(registers.L);
             pc++;
             num_cycles += 5;
         }
@@ -790,9 +943,7 @@ void Emulator::EmulateOpcode(uint8_t opcode, uint8_t operand1, uint8_t operand2)
     case 0x34:
         // INR M
         {
-            uint8_t res = ReadFromHL() + 1;
-            ZSPFlags(res);
-            WriteToHL(res);
+            WriteToHL(Increment(ReadFromHL()));
             pc++;
             num_cycles += 10;
         }
@@ -800,9 +951,7 @@ void Emulator::EmulateOpcode(uint8_t opcode, uint8_t operand1, uint8_t operand2)
     case 0x35:
         // DCR M
         {
-            uint8_t res = ReadFromHL() - 1;
-            ZSPFlags(res);
-            WriteToHL(res);
+            WriteToHL(Decrement(ReadFromHL()));
             pc++;
             num_cycles += 10;
         }
@@ -843,7 +992,7 @@ void Emulator::EmulateOpcode(uint8_t opcode, uint8_t operand1, uint8_t operand2)
         // LDA (word)
         {
             uint16_t offset = (operand2 << 8) | operand1;
-            registers.A = memory[offset];
+            registers.A = ReadFromMem(offset);
             pc += 3;
             num_cycles += 13;
         }
@@ -859,8 +1008,7 @@ void Emulator::EmulateOpcode(uint8_t opcode, uint8_t operand1, uint8_t operand2)
     case 0x3c:
         // INR A
         {
-            registers.A++;
-            ZSPFlags(registers.A);
+            registers.A = Increment(registers.A);
             pc++;
             num_cycles += 5;
         }
@@ -868,8 +1016,7 @@ void Emulator::EmulateOpcode(uint8_t opcode, uint8_t operand1, uint8_t operand2)
     case 0x3d:
         // DCR A
         {
-            registers.A--;
-            ZSPFlags(registers.A);
+            registers.A = Decrement(registers.A);
             pc++;
             num_cycles += 5;
         }
@@ -1029,8 +1176,6 @@ void Emulator::EmulateOpcode(uint8_t opcode, uint8_t operand1, uint8_t operand2)
         // MOV C,A
         {
             registers.C = registers.A;
-
-            flags.cy = 0;
             pc++;
             num_cycles += 5;
         }
@@ -1088,7 +1233,7 @@ void Emulator::EmulateOpcode(uint8_t opcode, uint8_t operand1, uint8_t operand2)
         // MOV D, M
         {
             uint16_t mem_addr = (registers.H << 8) | (registers.L);
-            registers.D = memory[mem_addr];
+            registers.D = ReadFromMem(mem_addr);
             pc++;
             num_cycles += 7;
         }
@@ -1344,9 +1489,16 @@ void Emulator::EmulateOpcode(uint8_t opcode, uint8_t operand1, uint8_t operand2)
         break;
     case 0x76:
         // HLT
+        // Stop until the next interrupt; the rest of this call to Emulate
+        // passes without executing anything
         {
             pc++;
             num_cycles += 7;
+            halted = true;
+            if (num_cycles < cycle_budget)
+            {
+                num_cycles = static_cast<uint16_t>(cycle_budget);
+            }
         }
         break;
     case 0x77:
@@ -1425,9 +1577,7 @@ void Emulator::EmulateOpcode(uint8_t opcode, uint8_t operand1, uint8_t operand2)
     case 0x80:
         // ADD B
         {
-            uint16_t res = (uint16_t)registers.A + (uint16_t)registers.B;
-            ArithFlagsA(res);
-            registers.A = (uint8_t)res;
+            AddToA(registers.B, false);
             pc++;
             num_cycles += 4;
         }
@@ -1436,9 +1586,7 @@ void Emulator::EmulateOpcode(uint8_t opcode, uint8_t operand1, uint8_t operand2)
     case 0x81:
         // ADD C
         {
-            uint16_t res = (uint16_t)registers.A + (uint16_t)registers.C;
-            ArithFlagsA(res);
-            registers.A = (uint8_t)res;
+            AddToA(registers.C, false);
             pc++;
             num_cycles += 4;
         }
@@ -1447,9 +1595,7 @@ void Emulator::EmulateOpcode(uint8_t opcode, uint8_t operand1, uint8_t operand2)
     case 0x82:
         // ADD D
         {
-            uint16_t res = (uint16_t)registers.A + (uint16_t)registers.D;
-            ArithFlagsA(res);
-            registers.A = (uint8_t)res;
+            AddToA(registers.D, false);
             pc++;
             num_cycles += 4;
         }
@@ -1458,9 +1604,7 @@ void Emulator::EmulateOpcode(uint8_t opcode, uint8_t operand1, uint8_t operand2)
     case 0x83:
         // ADD E
         {
-            uint16_t res = (uint16_t)registers.A + (uint16_t)registers.E;
-            ArithFlagsA(res);
-            registers.A = (uint8_t)res;
+            AddToA(registers.E, false);
             pc++;
             num_cycles += 4;
         }
@@ -1469,9 +1613,7 @@ void Emulator::EmulateOpcode(uint8_t opcode, uint8_t operand1, uint8_t operand2)
     case 0x84:
         // ADD H
         {
-            uint16_t res = (uint16_t)registers.A + (uint16_t)registers.H;
-            ArithFlagsA(res);
-            registers.A = (uint8_t)res;
+            AddToA(registers.H, false);
             pc++;
             num_cycles += 4;
         }
@@ -1480,9 +1622,7 @@ void Emulator::EmulateOpcode(uint8_t opcode, uint8_t operand1, uint8_t operand2)
     case 0x85:
         // ADD L
         {
-            uint16_t res = (uint16_t)registers.A + (uint16_t)registers.L;
-            ArithFlagsA(res);
-            registers.A = (uint8_t)res;
+            AddToA(registers.L, false);
             pc++;
             num_cycles += 4;
         }
@@ -1491,9 +1631,7 @@ void Emulator::EmulateOpcode(uint8_t opcode, uint8_t operand1, uint8_t operand2)
     case 0x86:
         // ADD M
         {
-            uint16_t res = (uint16_t)registers.A + ReadFromHL();
-            ArithFlagsA(res);
-            registers.A = (uint8_t)res;
+            AddToA(ReadFromHL(), false);
             pc++;
             num_cycles += 7;
         }
@@ -1502,9 +1640,7 @@ void Emulator::EmulateOpcode(uint8_t opcode, uint8_t operand1, uint8_t operand2)
     case 0x87:
         // ADD A
         {
-            uint16_t res = (uint16_t)registers.A + (uint16_t)registers.A;
-            ArithFlagsA(res);
-            registers.A = (uint8_t)res;
+            AddToA(registers.A, false);
             pc++;
             num_cycles += 4;
         }
@@ -1513,10 +1649,7 @@ void Emulator::EmulateOpcode(uint8_t opcode, uint8_t operand1, uint8_t operand2)
     case 0x88:
         // ADC B
         {
-            uint16_t res = (uint16_t)registers.A +
-                           (uint16_t)registers.B + flags.cy;
-            ArithFlagsA(res);
-            registers.A = (uint8_t)res;
+            AddToA(registers.B, flags.cy);
             pc++;
             num_cycles += 4;
         }
@@ -1525,10 +1658,7 @@ void Emulator::EmulateOpcode(uint8_t opcode, uint8_t operand1, uint8_t operand2)
     case 0x89:
         // ADC C
         {
-            uint16_t res = (uint16_t)registers.A +
-                           (uint16_t)registers.C + flags.cy;
-            ArithFlagsA(res);
-            registers.A = (uint8_t)res;
+            AddToA(registers.C, flags.cy);
             pc++;
             num_cycles += 4;
         }
@@ -1537,10 +1667,7 @@ void Emulator::EmulateOpcode(uint8_t opcode, uint8_t operand1, uint8_t operand2)
     case 0x8a:
         // ADC D
         {
-            uint16_t res = (uint16_t)registers.A +
-                           (uint16_t)registers.D + flags.cy;
-            ArithFlagsA(res);
-            registers.A = (uint8_t)res;
+            AddToA(registers.D, flags.cy);
             pc++;
             num_cycles += 4;
         }
@@ -1549,10 +1676,7 @@ void Emulator::EmulateOpcode(uint8_t opcode, uint8_t operand1, uint8_t operand2)
     case 0x8b:
         // ADC E
         {
-            uint16_t res = (uint16_t)registers.A +
-                           (uint16_t)registers.E + flags.cy;
-            ArithFlagsA(res);
-            registers.A = (uint8_t)res;
+            AddToA(registers.E, flags.cy);
             pc++;
             num_cycles += 4;
         }
@@ -1561,10 +1685,7 @@ void Emulator::EmulateOpcode(uint8_t opcode, uint8_t operand1, uint8_t operand2)
     case 0x8c:
         // ADC H
         {
-            uint16_t res = (uint16_t)registers.A +
-                           (uint16_t)registers.H + flags.cy;
-            ArithFlagsA(res);
-            registers.A = (uint8_t)res;
+            AddToA(registers.H, flags.cy);
             pc++;
             num_cycles += 4;
         }
@@ -1573,10 +1694,7 @@ void Emulator::EmulateOpcode(uint8_t opcode, uint8_t operand1, uint8_t operand2)
     case 0x8d:
         // ADC L
         {
-            uint16_t res = (uint16_t)registers.A +
-                           (uint16_t)registers.L + flags.cy;
-            ArithFlagsA(res);
-            registers.A = (uint8_t)res;
+            AddToA(registers.L, flags.cy);
             pc++;
             num_cycles += 4;
         }
@@ -1585,9 +1703,7 @@ void Emulator::EmulateOpcode(uint8_t opcode, uint8_t operand1, uint8_t operand2)
     case 0x8e:
         // ADC M
         {
-            uint32_t res = (uint16_t)registers.A + ReadFromHL() + flags.cy;
-            ArithFlagsA(res);
-            registers.A = (uint8_t)res;
+            AddToA(ReadFromHL(), flags.cy);
             pc++;
             num_cycles += 7;
         }
@@ -1596,10 +1712,7 @@ void Emulator::EmulateOpcode(uint8_t opcode, uint8_t operand1, uint8_t operand2)
     case 0x8f:
         // ADC A
         {
-            uint16_t res = (uint16_t)registers.A +
-                           (uint16_t)registers.A + flags.cy;
-            ArithFlagsA(res);
-            registers.A = (uint8_t)res;
+            AddToA(registers.A, flags.cy);
             pc++;
             num_cycles += 4;
         }
@@ -1683,7 +1796,7 @@ void Emulator::EmulateOpcode(uint8_t opcode, uint8_t operand1, uint8_t operand2)
         // SBB B
         // Subtract register B (plus carry) from register A and store result in A
         {
-            SubtractFromA(registers.B + flags.cy);
+            SubtractFromA(registers.B, flags.cy);
             pc++;
             num_cycles += 4;
         }
@@ -1692,7 +1805,7 @@ void Emulator::EmulateOpcode(uint8_t opcode, uint8_t operand1, uint8_t operand2)
         // SBB C
         // Subtract register C (plus carry) from register A and store result in A
         {
-            SubtractFromA(registers.C + flags.cy);
+            SubtractFromA(registers.C, flags.cy);
             pc++;
             num_cycles += 4;
         }
@@ -1701,7 +1814,7 @@ void Emulator::EmulateOpcode(uint8_t opcode, uint8_t operand1, uint8_t operand2)
         // SBB D
         // Subtract register D (plus carry) from register A and store result in A
         {
-            SubtractFromA(registers.D + flags.cy);
+            SubtractFromA(registers.D, flags.cy);
             pc++;
             num_cycles += 4;
         }
@@ -1710,7 +1823,7 @@ void Emulator::EmulateOpcode(uint8_t opcode, uint8_t operand1, uint8_t operand2)
         // SBB E
         // Subtract register E (plus carry) from register A and store result in A
         {
-            SubtractFromA(registers.E + flags.cy);
+            SubtractFromA(registers.E, flags.cy);
             pc++;
             num_cycles += 4;
         }
@@ -1719,7 +1832,7 @@ void Emulator::EmulateOpcode(uint8_t opcode, uint8_t operand1, uint8_t operand2)
         // SBB H
         // Subtract register H (plus carry) from register A and store result in A
         {
-            SubtractFromA(registers.H + flags.cy);
+            SubtractFromA(registers.H, flags.cy);
             pc++;
             num_cycles += 4;
         }
@@ -1728,7 +1841,7 @@ void Emulator::EmulateOpcode(uint8_t opcode, uint8_t operand1, uint8_t operand2)
         // SBB L
         // Subtract register L (plus carry) from register A and store result in A
         {
-            SubtractFromA(registers.L + flags.cy);
+            SubtractFromA(registers.L, flags.cy);
             pc++;
             num_cycles += 4;
         }
@@ -1738,7 +1851,7 @@ void Emulator::EmulateOpcode(uint8_t opcode, uint8_t operand1, uint8_t operand2)
         // Subtract byte in memory (location in HL) from register A and store result in A
         {
             uint8_t operand = ReadFromHL();
-            SubtractFromA(operand + flags.cy);
+            SubtractFromA(operand, flags.cy);
             pc++;
             num_cycles += 7;
         }
@@ -1747,7 +1860,7 @@ void Emulator::EmulateOpcode(uint8_t opcode, uint8_t operand1, uint8_t operand2)
         // SBB A
         // Subtract register A (plus carry) from register A and store result in A
         {
-            SubtractFromA(registers.A + flags.cy);
+            SubtractFromA(registers.A, flags.cy);
             pc++;
             num_cycles += 4;
         }
@@ -1757,8 +1870,7 @@ void Emulator::EmulateOpcode(uint8_t opcode, uint8_t operand1, uint8_t operand2)
     case 0xa0:
         // ANA B
         {
-            registers.A &= registers.B;
-            LogicFlagsA();
+            AndWithA(registers.B);
             pc++;
             num_cycles += 4;
         }
@@ -1766,8 +1878,7 @@ void Emulator::EmulateOpcode(uint8_t opcode, uint8_t operand1, uint8_t operand2)
     case 0xa1:
         // ANA C
         {
-            registers.A &= registers.C;
-            LogicFlagsA();
+            AndWithA(registers.C);
             pc++;
             num_cycles += 4;
         }
@@ -1775,8 +1886,7 @@ void Emulator::EmulateOpcode(uint8_t opcode, uint8_t operand1, uint8_t operand2)
     case 0xa2:
         // ANA D
         {
-            registers.A &= registers.D;
-            LogicFlagsA();
+            AndWithA(registers.D);
             pc++;
             num_cycles += 4;
         }
@@ -1784,8 +1894,7 @@ void Emulator::EmulateOpcode(uint8_t opcode, uint8_t operand1, uint8_t operand2)
     case 0xa3:
         // ANA E
         {
-            registers.A &= registers.E;
-            LogicFlagsA();
+            AndWithA(registers.E);
             pc++;
             num_cycles += 4;
         }
@@ -1793,8 +1902,7 @@ void Emulator::EmulateOpcode(uint8_t opcode, uint8_t operand1, uint8_t operand2)
     case 0xa4:
         // ANA H
         {
-            registers.A &= registers.H;
-            LogicFlagsA();
+            AndWithA(registers.H);
             pc++;
             num_cycles += 4;
         }
@@ -1802,8 +1910,7 @@ void Emulator::EmulateOpcode(uint8_t opcode, uint8_t operand1, uint8_t operand2)
     case 0xa5:
         // ANA L
         {
-            registers.A &= registers.L;
-            LogicFlagsA();
+            AndWithA(registers.L);
             pc++;
             num_cycles += 4;
         }
@@ -1811,8 +1918,7 @@ void Emulator::EmulateOpcode(uint8_t opcode, uint8_t operand1, uint8_t operand2)
     case 0xa6:
         // ANA M
         {
-            registers.A &= ReadFromHL();
-            LogicFlagsA();
+            AndWithA(ReadFromHL());
             pc++;
             num_cycles += 7;
         }
@@ -1820,7 +1926,7 @@ void Emulator::EmulateOpcode(uint8_t opcode, uint8_t operand1, uint8_t operand2)
     case 0xa7:
         // ANA A
         {
-            LogicFlagsA();
+            AndWithA(registers.A);
             pc++;
             num_cycles += 4;
         }
@@ -1973,8 +2079,7 @@ void Emulator::EmulateOpcode(uint8_t opcode, uint8_t operand1, uint8_t operand2)
     case 0xb8:
         // CMP B
         {
-            uint16_t res = (uint16_t)registers.A - (uint16_t)registers.B;
-            ArithFlagsA(res);
+            CompareWithA(registers.B);
             pc++;
             num_cycles += 4;
         }
@@ -1982,8 +2087,7 @@ void Emulator::EmulateOpcode(uint8_t opcode, uint8_t operand1, uint8_t operand2)
     case 0xb9:
         // CMP C
         {
-            uint16_t res = (uint16_t)registers.A - (uint16_t)registers.C;
-            ArithFlagsA(res);
+            CompareWithA(registers.C);
             pc++;
             num_cycles += 4;
         }
@@ -1991,8 +2095,7 @@ void Emulator::EmulateOpcode(uint8_t opcode, uint8_t operand1, uint8_t operand2)
     case 0xba:
         // CMP D
         {
-            uint16_t res = (uint16_t)registers.A - (uint16_t)registers.D;
-            ArithFlagsA(res);
+            CompareWithA(registers.D);
             pc++;
             num_cycles += 4;
         }
@@ -2000,8 +2103,7 @@ void Emulator::EmulateOpcode(uint8_t opcode, uint8_t operand1, uint8_t operand2)
     case 0xbb:
         // CMP E
         {
-            uint16_t res = (uint16_t)registers.A - (uint16_t)registers.E;
-            ArithFlagsA(res);
+            CompareWithA(registers.E);
             pc++;
             num_cycles += 4;
         }
@@ -2009,8 +2111,7 @@ void Emulator::EmulateOpcode(uint8_t opcode, uint8_t operand1, uint8_t operand2)
     case 0xbc:
         // CMP H
         {
-            uint16_t res = (uint16_t)registers.A - (uint16_t)registers.H;
-            ArithFlagsA(res);
+            CompareWithA(registers.H);
             pc++;
             num_cycles += 4;
         }
@@ -2018,8 +2119,7 @@ void Emulator::EmulateOpcode(uint8_t opcode, uint8_t operand1, uint8_t operand2)
     case 0xbd:
         // CMP L
         {
-            uint16_t res = (uint16_t)registers.A - (uint16_t)registers.L;
-            ArithFlagsA(res);
+            CompareWithA(registers.L);
             pc++;
             num_cycles += 4;
         }
@@ -2027,8 +2127,7 @@ void Emulator::EmulateOpcode(uint8_t opcode, uint8_t operand1, uint8_t operand2)
     case 0xbe:
         // CMP HL
         {
-            uint16_t res = (uint16_t)registers.A - (uint16_t)ReadFromHL();
-            ArithFlagsA(res);
+            CompareWithA(ReadFromHL());
             pc++;
             num_cycles += 7;
         }
@@ -2036,8 +2135,7 @@ void Emulator::EmulateOpcode(uint8_t opcode, uint8_t operand1, uint8_t operand2)
     case 0xbf:
         // CMP A
         {
-            uint16_t res = (uint16_t)registers.A - (uint16_t)registers.A;
-            ArithFlagsA(res);
+            CompareWithA(registers.A);
             pc++;
             num_cycles += 4;
         }
@@ -2072,23 +2170,23 @@ void Emulator::EmulateOpcode(uint8_t opcode, uint8_t operand1, uint8_t operand2)
     case 0xc2:
         // JNZ adr
         {
+            num_cycles += 10;
             if (flags.z == 0)
             {
-                pc = (operand2 << 8) | operand1;
+                Jump(operand2, operand1);
             }
             else
             {
                 pc += 3;
             }
-            num_cycles += 10;
         }
         break;
 
     case 0xc3:
         // JMP
         {
-            pc = (operand2 << 8) | operand1;
             num_cycles += 10;
+            Jump(operand2, operand1);
         }
         break;
 
@@ -2119,9 +2217,7 @@ void Emulator::EmulateOpcode(uint8_t opcode, uint8_t operand1, uint8_t operand2)
     case 0xc6:
         // ADI D8
         {
-            uint16_t res = (uint16_t)registers.A + (uint16_t)operand1;
-            ArithFlagsA(res);
-            registers.A = (uint8_t)res;
+            AddToA(operand1, false);
             pc += 2;
             num_cycles += 7;
         }
@@ -2165,15 +2261,15 @@ void Emulator::EmulateOpcode(uint8_t opcode, uint8_t operand1, uint8_t operand2)
     case 0xca:
         // JZ
         {
+            num_cycles += 10;
             if (flags.z == 1)
             {
-                pc = (operand2 << 8) | operand1;
+                Jump(operand2, operand1);
             }
             else
             {
                 pc += 3;
             }
-            num_cycles += 10;
         }
         break;
 
@@ -2210,10 +2306,7 @@ void Emulator::EmulateOpcode(uint8_t opcode, uint8_t operand1, uint8_t operand2)
     case 0xce:
         // ACI D8
         {
-            uint16_t res = (uint16_t)registers.A +
-                           (uint16_t)operand1 + flags.cy;
-            ArithFlagsA(res);
-            registers.A = (uint8_t)res;
+            AddToA(operand1, flags.cy);
             pc += 2;
             num_cycles += 7;
         }
@@ -2261,17 +2354,15 @@ void Emulator::EmulateOpcode(uint8_t opcode, uint8_t operand1, uint8_t operand2)
         // JNC
         // Jump if no carry
         {
+            num_cycles += 10;
             if (!flags.cy)
             {
-                uint8_t addr_high = operand2;
-                uint8_t addr_low = operand1;
-                pc = (addr_high << 8) | addr_low;
+                Jump(operand2, operand1);
             }
             else
             {
                 pc += 3;
             }
-            num_cycles += 10;
         }
         break;
     case 0xd3:
@@ -2286,6 +2377,13 @@ void Emulator::EmulateOpcode(uint8_t opcode, uint8_t operand1, uint8_t operand2)
             case 0x05:
                 ports.port5 = registers.A;
                 break;
+            default:
+                if (output_handler != nullptr)
+                {
+                    output_handler(output_context, this, operand1, registers.A);
+                    idle_clean = false;
+                }
+                break;
             }
             pc += 2;
             num_cycles += 10;
@@ -2364,17 +2462,15 @@ void Emulator::EmulateOpcode(uint8_t opcode, uint8_t operand1, uint8_t operand2)
         // JC
         // Jump if carry
         {
+            num_cycles += 10;
             if (flags.cy)
             {
-                uint16_t addr_high = operand2;
-                uint16_t addr_low = operand1;
-                pc = (addr_high << 8) | addr_low;
+                Jump(operand2, operand1);
             }
             else
             {
                 pc += 3;
             }
-            num_cycles += 10;
         }
         break;
     case 0xdb:
@@ -2422,7 +2518,7 @@ void Emulator::EmulateOpcode(uint8_t opcode, uint8_t operand1, uint8_t operand2)
         // SBI
         // Subtract immediate from accumulator with borrow
         {
-            SubtractFromA(operand1 + flags.cy);
+            SubtractFromA(operand1, flags.cy);
             pc += 2;
             num_cycles += 7;
         }
@@ -2457,8 +2553,8 @@ void Emulator::EmulateOpcode(uint8_t opcode, uint8_t operand1, uint8_t operand2)
     case 0xe1:
         // POP H
         {
-            registers.L = memory[sp];
-            registers.H = memory[sp + 1];
+            registers.L = ReadFromMem(sp);
+            registers.H = ReadFromMem(sp + 1);
             sp += 2;
             pc++;
             num_cycles += 10;
@@ -2468,15 +2564,15 @@ void Emulator::EmulateOpcode(uint8_t opcode, uint8_t operand1, uint8_t operand2)
         // JPO $
         {
             // Parity flag = 1 indicates even
+            num_cycles += 10;
             if (flags.p == 1)
             {
                 pc += 3;
             }
             else
             {
-                pc = (operand2 << 8) | operand1;
+                Jump(operand2, operand1);
             }
-            num_cycles += 10;
         }
         break;
     case 0xe3:
@@ -2484,10 +2580,10 @@ void Emulator::EmulateOpcode(uint8_t opcode, uint8_t operand1, uint8_t operand2)
         {
             uint8_t tempL = registers.L;
             uint8_t tempH = registers.H;
-            registers.L = memory[sp];
-            registers.H = memory[sp + 1];
-            memory[sp] = tempL;
-            memory[sp + 1] = tempH;
+            registers.L = ReadFromMem(sp);
+            registers.H = ReadFromMem(sp + 1);
+            WriteToMem(sp, tempL);
+            WriteToMem(sp + 1, tempH);
             pc++;
             num_cycles += 18;
         }
@@ -2510,8 +2606,8 @@ void Emulator::EmulateOpcode(uint8_t opcode, uint8_t operand1, uint8_t operand2)
         // PUSH H
         {
             sp -= 2;
-            memory[sp + 1] = registers.H;
-            memory[sp] = registers.L;
+            WriteToMem(sp + 1, registers.H);
+            WriteToMem(sp, registers.L);
             pc++;
             num_cycles += 11;
         }
@@ -2519,8 +2615,7 @@ void Emulator::EmulateOpcode(uint8_t opcode, uint8_t operand1, uint8_t operand2)
     case 0xe6:
         // ANI #$
         {
-            registers.A &= operand1;
-            LogicFlagsA();
+            AndWithA(operand1);
             pc += 2;
             num_cycles += 7;
         }
@@ -2560,15 +2655,15 @@ void Emulator::EmulateOpcode(uint8_t opcode, uint8_t operand1, uint8_t operand2)
         // JPE $
         {
             // Parity flag = 0 indicates odd
+            num_cycles += 10;
             if (flags.p == 0)
             {
                 pc += 3;
             }
             else
             {
-                pc = (operand2 << 8) | operand1;
+                Jump(operand2, operand1);
             }
-            num_cycles += 10;
         }
         break;
     case 0xeb:
@@ -2643,8 +2738,8 @@ void Emulator::EmulateOpcode(uint8_t opcode, uint8_t operand1, uint8_t operand2)
     case 0xf1:
         // POP PSW
         {
-            registers.A = memory[sp + 1];
-            uint8_t psw = memory[sp];
+            registers.A = ReadFromMem(sp + 1);
+            uint8_t psw = ReadFromMem(sp);
             flags.z = (0x01 == (psw & 0x01));
             flags.s = (0x02 == (psw & 0x02));
             flags.p = (0x04 == (psw & 0x04));
@@ -2656,15 +2751,15 @@ void Emulator::EmulateOpcode(uint8_t opcode, uint8_t operand1, uint8_t operand2)
         }
         break;
     case 0xf2:
+        num_cycles += 10;
         if (flags.s == 0)
         {
-            pc = (operand2 << 8) | operand1;
+            Jump(operand2, operand1);
         }
         else
         {
             pc += 3;
         }
-        num_cycles += 10;
         break;
     case 0xf3:
         // DI
@@ -2689,9 +2784,9 @@ void Emulator::EmulateOpcode(uint8_t opcode, uint8_t operand1, uint8_t operand2)
     case 0xf5:
         // PUSH PSW
         {
-            memory[sp - 1] = registers.A;
+            WriteToMem(sp - 1, registers.A);
             uint8_t psw = (flags.z | flags.s << 1 | flags.p << 2 | flags.cy << 3 | flags.ac << 4);
-            memory[sp - 2] = psw;
+            WriteToMem(sp - 2, psw);
             // printf("PSW %d\n", (int)psw);
             sp -= 2;
             pc++;
@@ -2741,15 +2836,15 @@ void Emulator::EmulateOpcode(uint8_t opcode, uint8_t operand1, uint8_t operand2)
         break;
     case 0xfa:
         // JM
+        num_cycles += 10;
         if (flags.s != 0)
         {
-            pc = (operand2 << 8) | operand1;
+            Jump(operand2, operand1);
         }
         else
         {
             pc += 3;
         }
-        num_cycles += 10;
         break;
     case 0xfb:
         // EI
@@ -2781,8 +2876,7 @@ void Emulator::EmulateOpcode(uint8_t opcode, uint8_t operand1, uint8_t operand2)
     case 0xfe:
         // CPI byte
         {
-            uint16_t res = (uint16_t)registers.A - operand1;
-            ArithFlagsA(res);
+            CompareWithA(operand1);
             pc += 2;
             num_cycles += 7;
         }
@@ -2836,20 +2930,8 @@ void Emulator::PrintFlags()
     cout << "Aux Carry Flag: " << flags.ac << endl;
 }
 
-// Return state of all registers
-Registers Emulator::GetRegisters()
-{
-    return registers;
-}
-
-// Return state of all flags
-Flags Emulator::GetFlags()
-{
-    return flags;
-}
-
 // Return state of all ports
-Ports Emulator::GetPorts()
+Ports Emulator::GetPorts() const
 {
     return ports;
 }
@@ -2880,16 +2962,22 @@ void Emulator::SetPort(int port_num, uint8_t bit, bool value)
         *port = *port & (value << bit);
 }
 
-// Return value of program counter
-int Emulator::GetPC()
+// Set all registers at once, e.g. to set up a test case
+void Emulator::SetRegisters(const Registers &new_registers)
+{
+    registers = new_registers;
+}
+
+// Set all flags at once
+void Emulator::SetFlags(const Flags &new_flags)
 {
-    return pc;
+    flags = new_flags;
 }
 
-// Return value of stack pointer
-int Emulator::GetSP()
+// Set program counter
+void Emulator::SetPC(uint16_t new_pc)
 {
-    return sp;
+    pc = new_pc;
 }
 
 // Set stack pointer
@@ -2898,11 +2986,392 @@ void Emulator::SetSP(uint16_t new_sp)
     sp = new_sp;
 }
 
+// Write value to address whether or not it is RAM, e.g. from a debugger
+void Emulator::SetMemory(uint16_t address, uint8_t value)
+{
+    if (address < mem_size)
+    {
+        int page = address / kDirtyPageSize;
+        dirty_pages[page / 64] |= uint64_t(1) << (page % 64);
+        memory[address] = value;
+        idle_clean = false;
+        if (address < HleTable::kRomSize)
+        {
+            rom_hash_valid = false;
+            hle_entries_valid = false;
+        }
+    }
+}
+
+// Set the addresses WriteToMem accepts, start inclusive and end exclusive
+// Space Invaders has RAM from 0x2000 to 0x3fff; other machines may make
+// all of memory writable
+void Emulator::SetRamRange(int start, int end)
+{
+    ram_start = start;
+    ram_end = end;
+    idle_clean = false;
+
+    // the ROM may have been written while it was writable
+    rom_hash_valid = false;
+    hle_entries_valid = false;
+}
+
+// Have OUT to any port other than the shift register and sound ports call
+// handler, with pc still at the OUT instruction; nullptr ignores them again
+void Emulator::SetOutputHandler(OutputHandler handler, void *context)
+{
+    output_handler = handler;
+    output_context = context;
+    idle_clean = false;
+}
+
+// Call handler for every data access of the given kinds (kWatchRead,
+// kWatchWrite or both) to [address, address + length), before it happens
+// Instruction fetches are not reported. Returns an id for RemoveWatch
+int Emulator::AddWatch(uint16_t address, int length, int kinds, WatchHandler handler, void *context)
+{
+    MemoryWatch watch;
+    watch.id = next_watch_id++;
+    watch.start = address;
+    watch.end = min(address + length, 0x10000);
+    watch.kinds = kinds;
+    watch.handler = handler;
+    watch.context = context;
+    watches.push_back(watch);
+    UpdateWatchedPages();
+    idle_clean = false;
+    return watch.id;
+}
+
+// Stop the watch AddWatch returned id for
+void Emulator::RemoveWatch(int id)
+{
+    for (size_t i = 0; i < watches.size(); i++)
+    {
+        if (watches[i].id == id)
+        {
+            watches.erase(watches.begin() + i);
+            break;
+        }
+    }
+    UpdateWatchedPages();
+}
+
+// Slow path for an access to a watched page: find the watches that cover
+// address exactly and report the access to them
+void Emulator::CheckWatches(uint16_t address, uint8_t value, int kind)
+{
+    for (size_t i = 0; i < watches.size(); i++)
+    {
+        const MemoryWatch &watch = watches[i];
+        if ((watch.kinds & kind) && address >= watch.start && address < watch.end)
+        {
+            // pc only moves on once the instruction's accesses are done
+            WatchEvent event;
+            event.pc = pc;
+            event.address = address;
+            event.value = value;
+            event.write = kind == kWatchWrite;
+            event.cycle = GetCycles();
+            watch.handler(watch.context, event);
+        }
+    }
+}
+
+// Mark the pages any watch touches
+void Emulator::UpdateWatchedPages()
+{
+    fill(watched_pages, watched_pages + 256, 0);
+    for (size_t i = 0; i < watches.size(); i++)
+    {
+        for (int page = watches[i].start >> 8; page <= (watches[i].end - 1) >> 8; page++)
+        {
+            watched_pages[page] |= watches[i].kinds;
+        }
+    }
+}
+
+// Set all I/O port values at once, e.g. from a recorded input movie
+void Emulator::SetPorts(const Ports &new_ports)
+{
+    ports = new_ports;
+}
+
+// Copy the complete machine state into snapshot
+void Emulator::SaveState(Snapshot *snapshot) const
+{
+    SaveCpu(snapshot);
+    snapshot->memory.assign(memory, memory + mem_size);
+}
+
+// Restore a state saved by SaveState
+void Emulator::LoadState(const Snapshot &snapshot)
+{
+    LoadState(snapshot, snapshot.memory.data(), static_cast<int>(snapshot.memory.size()));
+}
+
+// Restore the state in snapshot, but with size bytes of memory from
+// new_memory instead of snapshot.memory, such as a mapped snapshot file
+void Emulator::LoadState(const Snapshot &snapshot, const uint8_t *new_memory, int size)
+{
+    if (size != mem_size)
+    {
+        AllocateMemory(size);
+    }
+    copy(new_memory, new_memory + size, memory);
+    MarkAllPagesDirty();
+    LoadCpu(snapshot);
+}
+
+// Save the CPU and only the memory pages written since the last call (or
+// since ClearDirtyPages), and start tracking writes afresh
+// A full snapshot followed by every incremental one taken since gives the
+// current state, see LoadIncremental.
+void Emulator::SaveIncremental(IncrementalSnapshot *snapshot)
+{
+    SaveCpu(&snapshot->state);
+    snapshot->state.memory.clear();
+    snapshot->pages.clear();
+    int pages = (mem_size + kDirtyPageSize - 1) / kDirtyPageSize;
+    for (int word = 0; word * 64 < pages; word++)
+    {
+        // most of memory is untouched from one frame to the next
+        if (dirty_pages[word] == 0)
+        {
+            continue;
+        }
+        for (int page = word * 64; page < word * 64 + 64 && page < pages; page++)
+        {
+            if (PageDirty(page))
+            {
+                snapshot->pages.push_back(static_cast<uint16_t>(page));
+            }
+        }
+    }
+    snapshot->memory.resize(snapshot->pages.size() * kDirtyPageSize);
+    for (size_t i = 0; i < snapshot->pages.size(); i++)
+    {
+        int start = snapshot->pages[i] * kDirtyPageSize;
+        int end = min(start + kDirtyPageSize, mem_size);
+        copy(memory + start, memory + end, snapshot->memory.begin() + i * kDirtyPageSize);
+    }
+    ClearDirtyPages();
+}
+
+// Apply an incremental snapshot to the state it was taken after
+void Emulator::LoadIncremental(const IncrementalSnapshot &snapshot)
+{
+    for (size_t i = 0; i < snapshot.pages.size(); i++)
+    {
+        int start = snapshot.pages[i] * kDirtyPageSize;
+        int end = min(start + kDirtyPageSize, mem_size);
+        const uint8_t *page = snapshot.memory.data() + i * kDirtyPageSize;
+        copy(page, page + (end - start), memory + start);
+        dirty_pages[snapshot.pages[i] / 64] |= uint64_t(1) << (snapshot.pages[i] % 64);
+        if (start < HleTable::kRomSize)
+        {
+            rom_hash_valid = false;
+            hle_entries_valid = false;
+        }
+    }
+    LoadCpu(snapshot.state);
+}
+
+// Whether the kDirtyPageSize bytes from page * kDirtyPageSize have been
+// written since the last incremental snapshot
+bool Emulator::PageDirty(int page) const
+{
+    return (dirty_pages[page / 64] >> (page % 64) & 1) != 0;
+}
+
+// Pages the next incremental snapshot would save
+int Emulator::DirtyPageCount() const
+{
+    int count = 0;
+    int pages = (mem_size + kDirtyPageSize - 1) / kDirtyPageSize;
+    for (int page = 0; page < pages; page++)
+    {
+        count += PageDirty(page);
+    }
+    return count;
+}
+
+// Forget the writes so far, e.g. after taking a full snapshot to base
+// incremental ones on
+void Emulator::ClearDirtyPages()
+{
+    fill(dirty_pages, dirty_pages + sizeof(dirty_pages) / sizeof(dirty_pages[0]), 0);
+}
+
+void Emulator::SaveCpu(Snapshot *snapshot) const
+{
+    snapshot->registers = registers;
+    snapshot->flags = flags;
+    snapshot->sp = sp;
+    snapshot->pc = pc;
+    snapshot->interrupt_enable = interrupt_enable;
+    snapshot->halted = halted;
+    snapshot->ports = ports;
+    snapshot->cycles = GetCycles();
+}
+
+void Emulator::LoadCpu(const Snapshot &snapshot)
+{
+    registers = snapshot.registers;
+    flags = snapshot.flags;
+    sp = snapshot.sp;
+    pc = snapshot.pc;
+    interrupt_enable = snapshot.interrupt_enable;
+    halted = snapshot.halted;
+    ports = snapshot.ports;
+    total_cycles = snapshot.cycles;
+    num_cycles = 0;
+    idle_clean = false;
+    PublishState();
+}
+
+// Memory has been replaced wholesale, ROM included
+void Emulator::MarkAllPagesDirty()
+{
+    fill(dirty_pages, dirty_pages + sizeof(dirty_pages) / sizeof(dirty_pages[0]), ~uint64_t(0));
+    rom_hash_valid = false;
+    hle_entries_valid = false;
+}
+
+// Whether HLT has stopped the CPU until the next interrupt
+bool Emulator::Halted() const
+{
+    return halted;
+}
+
+// Let Emulate fast-forward through idle loops, as it does by default, or
+// have it execute every instruction, e.g. to time them
+void Emulator::SetIdleSkipping(bool enabled)
+{
+    idle_skipping = enabled;
+}
+
+// Cycles passed over in idle loops instead of being emulated
+uint64_t Emulator::IdleCyclesSkipped() const
+{
+    return idle_skipped;
+}
+
+// Run the ROM routines in hooks natively, when a CALL or a jump back
+// reaches their entry points in a ROM they were written for; nullptr
+// executes every instruction again
+// Hooks only run with no profiler, watch or output handler attached, since
+// nothing may look at the machine between the instructions they replace,
+// and not while the ROM is writable.
+void Emulator::SetHleHooks(const HleTable *hooks)
+{
+    if (hooks != hle_table)
+    {
+        hle_table = hooks;
+        hle_entries_valid = false;
+    }
+}
+
+// ROM routines run natively so far
+uint64_t Emulator::HleCalls() const
+{
+    return hle_calls;
+}
+
+// Entries of the hook table for the ROM in memory, if hooks may run now
+const HleFunction *Emulator::HleEntries()
+{
+    if (!watches.empty() || output_handler != nullptr || ram_start < HleTable::kRomSize)
+    {
+        return nullptr;
+    }
+    if (!hle_entries_valid)
+    {
+        if (!rom_hash_valid)
+        {
+            rom_hash = HleTable::RomHash(memory, min(mem_size, static_cast<int>(HleTable::kRomSize)));
+            rom_hash_valid = true;
+        }
+        hle_entries = hle_table->Entries(rom_hash);
+        hle_entries_valid = true;
+    }
+    return hle_entries;
+}
+
+// Hand the CPU to the hook for the routine at pc, if there is one
+// Returns whether the hook ran the routine, or part of it
+bool Emulator::RunHleHook()
+{
+    if (pc >= HleTable::kRomSize || hle_active[pc] == nullptr)
+    {
+        return false;
+    }
+    int cycles = hle_active[pc](this, cycle_budget - num_cycles);
+    if (cycles == 0)
+    {
+        return false;
+    }
+    num_cycles += cycles;
+    hle_calls++;
+    return true;
+}
+
+// Log of invalid instructions and writes, see DiagnosticLog
+DiagnosticLog &Emulator::Diagnostics()
+{
+    return diagnostics;
+}
+
+// Make the CPU state visible to other threads
+// Called by Emulate when it returns; call it after changing the state by
+// other means if readers should see the change before the next Emulate
+void Emulator::PublishState()
+{
+    PublishedState state;
+    state.registers = registers;
+    state.flags = flags;
+    state.pc = pc;
+    state.sp = sp;
+    state.interrupt_enable = interrupt_enable;
+    state.ports = ports;
+    state.cycles = GetCycles();
+    published.Write(state);
+}
+
+// CPU state as last published, consistent even while another thread is
+// emulating; safe to call from any thread
+PublishedState Emulator::ReadPublishedState() const
+{
+    return published.Read();
+}
+
+// As ReadPublishedState, but fail instead of retrying if a publication is
+// under way, for readers that must not spin
+bool Emulator::TryReadPublishedState(PublishedState *state) const
+{
+    return published.TryRead(state);
+}
+
+// Number of publications so far, safe to call from any thread
+uint64_t Emulator::PublishCount() const
+{
+    return published.Writes();
+}
+
+// Return size of emulated memory in bytes
+int Emulator::GetMemorySize() const
+{
+    return mem_size;
+}
+
 // Set interrupt for screen display
 void Emulator::Interrupt(int interrupt_num)
 {
     if (interrupt_enable)
     {
+        halted = false;
+
         // perform "PUSH PC"
         Push((pc & 0xff00) >> 8, (pc & 0x00ff));
 
@@ -3,6 +3,9 @@
 
 #include <string>
 #include <cstdint>
+#include <vector>
+#include "emulator/diagnostics.hpp"
+#include "emulator/seqlock.hpp"
 
 typedef struct Registers
 {
@@ -32,6 +35,102 @@ typedef struct Ports
     uint8_t port5 = 0;
 } Ports;
 
+// Complete machine state, see Emulator::SaveState
+typedef struct Snapshot
+{
+    Registers registers;
+    Flags flags;
+    uint16_t sp = 0;
+    uint16_t pc = 0;
+    bool interrupt_enable = false;
+    bool halted = false;
+    Ports ports;
+    uint64_t cycles = 0;
+    std::vector<uint8_t> memory;
+} Snapshot;
+
+// Size of the pages WriteToMem marks as written, see Emulator::SaveIncremental
+const int kDirtyPageSize = 64;
+
+// Machine state with only the memory pages written since the last
+// incremental snapshot, see Emulator::SaveIncremental
+struct IncrementalSnapshot
+{
+    Snapshot state;              // memory left empty
+    std::vector<uint16_t> pages; // page numbers, in increasing order
+    std::vector<uint8_t> memory; // kDirtyPageSize bytes for each page in pages
+};
+
+// CPU state as last published for other threads, see Emulator::ReadPublishedState
+struct PublishedState
+{
+    Registers registers;
+    Flags flags;
+    uint16_t pc = 0;
+    uint16_t sp = 0;
+    bool interrupt_enable = false;
+    Ports ports;
+    uint64_t cycles = 0;
+};
+
+// Keeps rarely taken slow paths out of the instruction loop
+#if defined(_MSC_VER)
+#define EM_NOINLINE __declspec(noinline)
+#else
+#define EM_NOINLINE __attribute__((noinline))
+#endif
+
+class Emulator;
+class HleTable;
+struct NullProfiler;
+
+// Whether EmulateProfiled may fast-forward through idle loops, or run ROM
+// routines natively, with this profiler attached: only if it looks at
+// nothing, since the instructions skipped are never executed
+template <class Profiler>
+inline bool SkipsIdleLoops(const Profiler &)
+{
+    return false;
+}
+
+inline bool SkipsIdleLoops(const NullProfiler &)
+{
+    return true;
+}
+
+// Device on an output port, see Emulator::SetOutputHandler
+typedef void (*OutputHandler)(void *context, Emulator *e, uint8_t port, uint8_t value);
+
+// Native implementation of a ROM routine, see emulator/hle.hpp
+typedef int (*HleFunction)(Emulator *e, int cycles_left);
+
+// Kinds of memory access a watch reports, see Emulator::AddWatch
+const int kWatchRead = 1;
+const int kWatchWrite = 2;
+
+// A data access to watched memory
+struct WatchEvent
+{
+    uint16_t pc = 0;      // instruction making the access
+    uint16_t address = 0;
+    uint8_t value = 0;    // value read, or value being written
+    bool write = false;
+    uint64_t cycle = 0;   // cycles executed before that instruction
+};
+
+typedef void (*WatchHandler)(void *context, const WatchEvent &event);
+
+// A range of memory and who to tell about accesses to it
+struct MemoryWatch
+{
+    int id;
+    int start;
+    int end; // exclusive
+    int kinds;
+    WatchHandler handler;
+    void *context;
+};
+
 class Emulator
 {
 public:
@@ -47,7 +146,12 @@ public:
     void ArithFlagsA(uint16_t res);
     void ZSPFlags(uint8_t value);
 
-    void SubtractFromA(uint8_t);
+    void AddToA(uint8_t operand, bool carry);
+    void SubtractFromA(uint8_t operand, bool borrow = false);
+    void CompareWithA(uint8_t operand);
+    void AndWithA(uint8_t operand);
+    uint8_t Increment(uint8_t value);
+    uint8_t Decrement(uint8_t value);
 
     uint8_t ReadFromMem(uint16_t address);
     void WriteToMem(uint16_t address, uint8_t value);
@@ -55,6 +159,7 @@ public:
     void WriteToHL(uint8_t value);
 
     void Call(uint8_t, uint8_t);
+    void Jump(uint8_t addr_high, uint8_t addr_low);
     void Return();
 
     void Push(uint8_t high, uint8_t low);
@@ -63,22 +168,67 @@ public:
     void InvalidInstruction(uint8_t, uint16_t);
 
     void Emulate(int cycles);
+    template <class Profiler>
+    void EmulateProfiled(int cycles, Profiler &profiler);
     void EmulateOpcode(uint8_t, uint8_t operand1 = 0x00, uint8_t operand2 = 0x00);
 
     void PrintRegisters();
     void PrintFlags();
 
     void Interrupt(int interrupt);
+    template <class Profiler>
+    void InterruptProfiled(int interrupt, Profiler &profiler);
 
-    Registers GetRegisters();
-    Flags GetFlags();
-    Ports GetPorts();
+    Registers GetRegisters() const;
+    Flags GetFlags() const;
+    Ports GetPorts() const;
     void SetPort(int, uint8_t, bool);
-    int GetPC();
-    int GetSP();
+    void SetPorts(const Ports &);
+    void SetRegisters(const Registers &);
+    void SetFlags(const Flags &);
+    int GetPC() const;
+    void SetPC(uint16_t);
+    int GetSP() const;
     void SetSP(uint16_t);
+    const uint8_t *GetMemory() const;
+    int GetMemorySize() const;
+    void SetMemory(uint16_t address, uint8_t value);
+    void SetRamRange(int start, int end);
+    void SetOutputHandler(OutputHandler handler, void *context);
+    int AddWatch(uint16_t address, int length, int kinds, WatchHandler handler, void *context);
+    void RemoveWatch(int id);
+    uint64_t GetCycles() const;
+    bool Halted() const;
+    void SetIdleSkipping(bool enabled);
+    uint64_t IdleCyclesSkipped() const;
+    void SetHleHooks(const HleTable *hooks);
+    uint64_t HleCalls() const;
+    DiagnosticLog &Diagnostics();
+
+    void SaveState(Snapshot *snapshot) const;
+    void LoadState(const Snapshot &snapshot);
+    void LoadState(const Snapshot &snapshot, const uint8_t *memory, int size);
+    void SaveIncremental(IncrementalSnapshot *snapshot);
+    void LoadIncremental(const IncrementalSnapshot &snapshot);
+    bool PageDirty(int page) const;
+    int DirtyPageCount() const;
+    void ClearDirtyPages();
+
+    void PublishState();
+    PublishedState ReadPublishedState() const;
+    bool TryReadPublishedState(PublishedState *state) const;
+    uint64_t PublishCount() const;
 
 private:
+    EM_NOINLINE void CheckWatches(uint16_t address, uint8_t value, int kind);
+    EM_NOINLINE void CheckIdleLoop(uint16_t branch_pc);
+    EM_NOINLINE bool RunHleHook();
+    const HleFunction *HleEntries();
+    void UpdateWatchedPages();
+    void SaveCpu(Snapshot *snapshot) const;
+    void LoadCpu(const Snapshot &snapshot);
+    void MarkAllPagesDirty();
+
     Registers registers;
 
     Flags flags;
@@ -93,9 +243,155 @@ private:
     uint8_t *memory;
     int mem_size;
 
+    // writable addresses, see SetRamRange
+    int ram_start;
+    int ram_end;
+
+    // device for the output ports Space Invaders does not use
+    OutputHandler output_handler;
+    void *output_context;
+
+    // kinds of access watched anywhere in each 256 byte page, so that
+    // accesses to other pages cost a single test, see AddWatch
+    uint8_t watched_pages[256];
+    std::vector<MemoryWatch> watches;
+    int next_watch_id;
+
+    // one bit per kDirtyPageSize bytes of the 64K address space, set by
+    // WriteToMem and cleared by SaveIncremental
+    uint64_t dirty_pages[0x10000 / kDirtyPageSize / 64];
+
+    // invalid instructions and writes, silent unless someone reads them
+    DiagnosticLog diagnostics;
+
     uint16_t num_cycles;
 
+    // cycles executed before the current call to Emulate
+    uint64_t total_cycles;
+
+    // cycles the current call to Emulate runs for; HLT jumps to the end
+    int cycle_budget;
+
+    // whether Emulate may skip idle loops at all, and whether the current
+    // call may
+    bool idle_skipping;
+    bool skip_idle;
+
+    // stopped by HLT until the next interrupt
+    bool halted;
+
+    // CPU state when the backward jump at idle_branch was last taken, and
+    // whether the machine has done nothing since that a repeat of the same
+    // state would not do again, see CheckIdleLoop
+    Snapshot idle;
+    uint16_t idle_branch;
+    bool idle_clean;
+    int idle_backoff;
+    uint64_t idle_skipped;
+
+    // native ROM routines, see SetHleHooks: the table, the hash of the ROM
+    // in memory, the table's entries for that ROM (nullptr if it has none)
+    // and the entries in use for the current call to Emulate, nullptr if
+    // every instruction has to be executed
+    const HleTable *hle_table;
+    uint64_t rom_hash;
+    bool rom_hash_valid;
+    const HleFunction *hle_entries;
+    bool hle_entries_valid;
+    const HleFunction *hle_active;
+    uint64_t hle_calls;
+
     Ports ports;
+
+    // CPU state for other threads, published at the end of every call to
+    // Emulate; the accessors above are for the emulation thread only
+    Seqlock<PublishedState> published;
 };
 
+// Emulate opcodes for designated number of cycles, reporting each executed
+// instruction to profiler (see emulator/profiler.hpp)
+template <class Profiler>
+void Emulator::EmulateProfiled(int cycles, Profiler &profiler)
+{
+    total_cycles += num_cycles;
+    num_cycles = 0;
+    cycle_budget = cycles;
+    skip_idle = idle_skipping && SkipsIdleLoops(profiler);
+    hle_active = nullptr;
+    if (hle_table != nullptr && SkipsIdleLoops(profiler))
+    {
+        hle_active = HleEntries();
+    }
+    if (halted && num_cycles < cycles)
+    {
+        num_cycles = static_cast<uint16_t>(cycles);
+    }
+    while (num_cycles < cycles)
+    {
+        uint16_t instruction_pc = pc;
+        uint16_t cycles_before = num_cycles;
+        uint8_t opcode = memory[pc];
+
+        // uncomment to print each instruction as it is executed
+        // Disassembler::Disassemble(reinterpret_cast<char *>(memory), pc, 0x10000);
+        EmulateOpcode(opcode, memory[pc + 1], memory[pc + 2]);
+        profiler.Instruction(*this, instruction_pc, opcode, static_cast<uint16_t>(num_cycles - cycles_before));
+    }
+    cycle_budget = 0;
+    skip_idle = false;
+    hle_active = nullptr;
+    PublishState();
+}
+
+// Set interrupt, reporting it to profiler if it is taken
+template <class Profiler>
+void Emulator::InterruptProfiled(int interrupt_num, Profiler &profiler)
+{
+    bool taken = interrupt_enable;
+    Interrupt(interrupt_num);
+    if (taken)
+    {
+        profiler.Interrupt(*this, interrupt_num);
+    }
+}
+
+// State accessors are defined here so that profiling policies reading the
+// machine after every instruction compile down to plain loads
+
+// Return state of all registers
+inline Registers Emulator::GetRegisters() const
+{
+    return registers;
+}
+
+// Return state of all flags
+inline Flags Emulator::GetFlags() const
+{
+    return flags;
+}
+
+// Return value of program counter
+inline int Emulator::GetPC() const
+{
+    return pc;
+}
+
+// Return value of stack pointer
+inline int Emulator::GetSP() const
+{
+    return sp;
+}
+
+// Return pointer to emulated memory, for analysis and display
+inline const uint8_t *Emulator::GetMemory() const
+{
+    return memory;
+}
+
+// Return number of cycles executed since the emulator was created
+inline uint64_t Emulator::GetCycles() const
+{
+    return total_cycles + num_cycles;
+}
+
 #endif // EMULATOR_EMULATOR_HPP_
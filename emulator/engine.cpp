@@ -0,0 +1,102 @@
+#include "emulator/engine.hpp"
+#include "emulator/emulator.hpp"
+#include "emulator/hle.hpp"
+#include "emulator/profiler.hpp"
+
+using namespace std;
+
+const int EngineRegistry::kHalfFrameCycles;
+
+namespace
+{
+// The plain interpreter loop
+void RunInterpreter(Emulator *e, int cycles)
+{
+    e->Emulate(cycles);
+}
+
+// The interpreter with the execution profiler attached, to check that
+// instrumenting the loop does not change what it computes
+void RunProfiled(Emulator *e, int cycles)
+{
+    static thread_local ExecutionProfiler profiler;
+    e->EmulateProfiled(cycles, profiler);
+}
+
+// The interpreter with the Space Invaders ROM routines run natively, see
+// emulator/hle.hpp; the hooks are only in place for the call
+void RunHle(Emulator *e, int cycles)
+{
+    e->SetHleHooks(&HleTable::SpaceInvaders());
+    e->Emulate(cycles);
+    e->SetHleHooks(nullptr);
+}
+} // namespace
+
+// Engines registered so far, starting with the built in ones
+// A deque keeps pointers returned by Find valid as engines are added
+deque<Engine> &EngineRegistry::Engines()
+{
+    static deque<Engine> engines;
+    if (engines.empty())
+    {
+        Engine interpreter = {"interpreter", RunInterpreter};
+        Engine profiled = {"profiled", RunProfiled};
+        Engine hle = {"hle", RunHle};
+        engines.push_back(interpreter);
+        engines.push_back(profiled);
+        engines.push_back(hle);
+    }
+    return engines;
+}
+
+// Add an engine, replacing any engine of the same name
+void EngineRegistry::Register(const string &name, EngineFunction run)
+{
+    deque<Engine> &engines = Engines();
+    for (size_t i = 0; i < engines.size(); i++)
+    {
+        if (engines[i].name == name)
+        {
+            engines[i].run = run;
+            return;
+        }
+    }
+    Engine engine = {name, run};
+    engines.push_back(engine);
+}
+
+// Engine called name, or nullptr if there is none
+const Engine *EngineRegistry::Find(const string &name)
+{
+    deque<Engine> &engines = Engines();
+    for (size_t i = 0; i < engines.size(); i++)
+    {
+        if (engines[i].name == name)
+        {
+            return &engines[i];
+        }
+    }
+    return nullptr;
+}
+
+// Names of all registered engines
+vector<string> EngineRegistry::Names()
+{
+    vector<string> names;
+    deque<Engine> &engines = Engines();
+    for (size_t i = 0; i < engines.size(); i++)
+    {
+        names.push_back(engines[i].name);
+    }
+    return names;
+}
+
+// Emulate one video frame the same way SDL::RunGame does
+void EngineRegistry::RunFrame(Emulator *e, EngineFunction run)
+{
+    run(e, kHalfFrameCycles);
+    e->Interrupt(1);
+    run(e, kHalfFrameCycles);
+    e->Interrupt(2);
+}
@@ -0,0 +1,41 @@
+#ifndef EMULATOR_ENGINE_HPP_
+#define EMULATOR_ENGINE_HPP_
+
+#include <deque>
+#include <string>
+#include <vector>
+
+class Emulator;
+
+// Runs the emulator until at least cycles cycles have been spent, with the
+// same semantics as Emulator::Emulate
+typedef void (*EngineFunction)(Emulator *e, int cycles);
+
+// A named way of executing 8080 code
+//
+// Tools that compare implementations (see emulator/divergence.hpp) look
+// engines up by name, so an alternative execution path only has to register
+// itself here to become testable against the interpreter.
+struct Engine
+{
+    std::string name;
+    EngineFunction run;
+};
+
+class EngineRegistry
+{
+public:
+    // cycles between the two screen interrupts of a 60 Hz frame
+    static const int kHalfFrameCycles = 16666;
+
+    static void Register(const std::string &name, EngineFunction run);
+    static const Engine *Find(const std::string &name);
+    static std::vector<std::string> Names();
+
+    static void RunFrame(Emulator *e, EngineFunction run);
+
+private:
+    static std::deque<Engine> &Engines();
+};
+
+#endif // EMULATOR_ENGINE_HPP_
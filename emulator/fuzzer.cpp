@@ -0,0 +1,617 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+#include <thread>
+#include "emulator/divergence.hpp"
+#include "emulator/fuzzer.hpp"
+#include "emulator/opcode_bench.hpp"
+#include "disassembler/control_flow.hpp"
+#include "disassembler/disassembler.hpp"
+
+using namespace std;
+
+const uint16_t DifferentialFuzzer::kCodeAddress;
+const uint16_t DifferentialFuzzer::kStackAddress;
+
+namespace
+{
+// bytes of return addresses around the initial stack pointer
+const int kStackSpread = 0x100;
+
+// SplitMix64: small, fast, and the same on every platform, unlike the
+// standard distributions
+class Random
+{
+public:
+    explicit Random(uint64_t seed) : state(seed)
+    {
+    }
+
+    uint64_t Next()
+    {
+        uint64_t z = (state += 0x9e3779b97f4a7c15ull);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        return z ^ (z >> 31);
+    }
+
+    // Uniform value below n
+    uint32_t Below(uint32_t n)
+    {
+        return static_cast<uint32_t>(Next() % n);
+    }
+
+    uint8_t Byte()
+    {
+        return static_cast<uint8_t>(Next());
+    }
+
+private:
+    uint64_t state;
+};
+
+// Opcodes the emulator implements, which are the ones programs are made of
+vector<uint8_t> FindValidOpcodes()
+{
+    vector<uint8_t> opcodes;
+    for (int op = 0; op < 0x100; op++)
+    {
+        if (OpcodeBench::IsImplemented(static_cast<uint8_t>(op)))
+        {
+            opcodes.push_back(static_cast<uint8_t>(op));
+        }
+    }
+    return opcodes;
+}
+
+const vector<uint8_t> &ValidOpcodes()
+{
+    static const vector<uint8_t> opcodes = FindValidOpcodes();
+    return opcodes;
+}
+
+// True for JMP, CALL and their conditional forms, whose operand is an address
+// in the program
+bool HasProgramTarget(uint8_t opcode)
+{
+    return opcode == 0xc3 || opcode == 0xcd || (opcode & 0xc7) == 0xc2 || (opcode & 0xc7) == 0xc4;
+}
+
+// True if instruction has been replaced by NOPs
+bool IsNop(const vector<uint8_t> &instruction)
+{
+    for (size_t i = 0; i < instruction.size(); i++)
+    {
+        if (instruction[i] != 0x00)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+} // namespace
+
+// Address of the jump to itself that ends the program
+uint16_t FuzzCase::EndAddress() const
+{
+    size_t size = 0;
+    for (size_t i = 0; i < instructions.size(); i++)
+    {
+        size += instructions[i].size();
+    }
+    return static_cast<uint16_t>(DifferentialFuzzer::kCodeAddress + size);
+}
+
+// Program bytes, including the final jump to itself
+vector<uint8_t> FuzzCase::Code() const
+{
+    vector<uint8_t> code;
+    for (size_t i = 0; i < instructions.size(); i++)
+    {
+        code.insert(code.end(), instructions[i].begin(), instructions[i].end());
+    }
+    uint16_t end = EndAddress();
+    code.push_back(0xc3);
+    code.push_back(end & 0xff);
+    code.push_back(end >> 8);
+    return code;
+}
+
+// Constructor, engines[0] is the reference
+DifferentialFuzzer::DifferentialFuzzer(const vector<Engine> &engines)
+    : engines(engines), cycles(2000), instructions(64), threads(static_cast<int>(thread::hardware_concurrency())),
+      max_failures(1)
+{
+    if (threads < 1)
+    {
+        threads = 1;
+    }
+}
+
+// Run each case for this many cycles
+void DifferentialFuzzer::SetCycles(int new_cycles)
+{
+    cycles = max(1, new_cycles);
+}
+
+// Generate programs of this many instructions
+void DifferentialFuzzer::SetInstructions(int new_instructions)
+{
+    instructions = max(1, new_instructions);
+}
+
+// Number of threads running cases
+void DifferentialFuzzer::SetThreads(int new_threads)
+{
+    threads = max(1, new_threads);
+}
+
+// Stop after this many failing cases
+void DifferentialFuzzer::SetMaxFailures(int failures)
+{
+    max_failures = max(1, failures);
+}
+
+// Run the cases of the given seeds
+FuzzStats DifferentialFuzzer::RunSeeds(const vector<uint64_t> &seeds) const
+{
+    return Run(&seeds, 0, 0);
+}
+
+// Run cases of seeds first_seed, first_seed + 1, ... for seconds seconds
+FuzzStats DifferentialFuzzer::RunFor(double seconds, uint64_t first_seed) const
+{
+    return Run(nullptr, seconds, first_seed);
+}
+
+// Run cases on all threads until the seeds or the time run out, or enough
+// cases have failed
+FuzzStats DifferentialFuzzer::Run(const vector<uint64_t> *seeds, double seconds, uint64_t first_seed) const
+{
+    FuzzStats stats;
+    stats.threads = threads;
+    atomic<uint64_t> next(0);
+    atomic<bool> stop(false);
+    mutex merge;
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    vector<thread> pool;
+    for (int t = 0; t < threads; t++)
+    {
+        pool.push_back(thread([&]() {
+            Emulator reference_emulator;
+            Emulator candidate_emulator;
+            uint64_t cases = 0;
+            uint64_t cycles_run = 0;
+            while (!stop)
+            {
+                uint64_t index = next++;
+                if (seeds != nullptr && index >= seeds->size())
+                {
+                    break;
+                }
+                if (seeds == nullptr &&
+                    chrono::duration<double>(chrono::steady_clock::now() - start).count() >= seconds)
+                {
+                    break;
+                }
+
+                FuzzCase fuzz_case = Generate(seeds != nullptr ? (*seeds)[index] : first_seed + index);
+                FuzzFailure failure;
+                bool failed = Check(fuzz_case, &failure, &reference_emulator, &candidate_emulator);
+                cases++;
+                cycles_run += cycles;
+                if (failed)
+                {
+                    lock_guard<mutex> lock(merge);
+                    stats.failures.push_back(failure);
+                    if (static_cast<int>(stats.failures.size()) >= max_failures)
+                    {
+                        stop = true;
+                    }
+                }
+            }
+
+            lock_guard<mutex> lock(merge);
+            stats.cases += cases;
+            stats.cycles += cycles_run;
+        }));
+    }
+    for (size_t t = 0; t < pool.size(); t++)
+    {
+        pool[t].join();
+    }
+    stats.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    sort(stats.failures.begin(), stats.failures.end(),
+         [](const FuzzFailure &a, const FuzzFailure &b) { return a.original.seed < b.original.seed; });
+    if (static_cast<int>(stats.failures.size()) > max_failures)
+    {
+        stats.failures.resize(max_failures);
+    }
+    return stats;
+}
+
+// The case of seed: a random program and a random machine to run it in
+FuzzCase DifferentialFuzzer::Generate(uint64_t seed) const
+{
+    Random random(seed);
+    const vector<uint8_t> &opcodes = ValidOpcodes();
+    FuzzCase fuzz_case;
+    fuzz_case.seed = seed;
+
+    // pick the instructions first, so that jumps can target any of them
+    vector<uint16_t> starts;
+    uint16_t address = kCodeAddress;
+    for (int i = 0; i < instructions; i++)
+    {
+        uint8_t opcode = opcodes[random.Below(static_cast<uint32_t>(opcodes.size()))];
+        vector<uint8_t> instruction(ControlFlowGraph::InstructionLength(opcode));
+        instruction[0] = opcode;
+        fuzz_case.instructions.push_back(instruction);
+        starts.push_back(address);
+        address = static_cast<uint16_t>(address + instruction.size());
+    }
+    starts.push_back(address); // the final jump
+
+    // jumps, calls and return addresses only use instructions whose address
+    // bytes are opcodes too, and all other bytes are random opcodes, so that
+    // code entered at any byte, e.g. through PCHL, still only runs valid
+    // instructions
+    vector<uint16_t> targets;
+    for (size_t i = 0; i < starts.size(); i++)
+    {
+        if (OpcodeBench::IsImplemented(starts[i] & 0xff))
+        {
+            targets.push_back(starts[i]);
+        }
+    }
+    if (targets.empty())
+    {
+        targets.push_back(starts.back());
+    }
+    vector<uint16_t> stack_pointers;
+    for (int offset = -kStackSpread / 2; offset < kStackSpread / 2; offset += 2)
+    {
+        uint16_t sp = static_cast<uint16_t>(kStackAddress + offset);
+        if (OpcodeBench::IsImplemented(sp & 0xff))
+        {
+            stack_pointers.push_back(sp);
+        }
+    }
+
+    for (size_t i = 0; i < fuzz_case.instructions.size(); i++)
+    {
+        vector<uint8_t> &instruction = fuzz_case.instructions[i];
+        uint16_t operand = static_cast<uint16_t>(opcodes[random.Below(static_cast<uint32_t>(opcodes.size()))] |
+                                                 opcodes[random.Below(static_cast<uint32_t>(opcodes.size()))] << 8);
+        if (HasProgramTarget(instruction[0]))
+        {
+            operand = targets[random.Below(static_cast<uint32_t>(targets.size()))];
+        }
+        else if (instruction[0] == 0x31)
+        {
+            // LXI SP stays among the return addresses
+            operand = stack_pointers[random.Below(static_cast<uint32_t>(stack_pointers.size()))];
+        }
+        for (size_t b = 1; b < instruction.size(); b++)
+        {
+            instruction[b] = static_cast<uint8_t>(operand >> (8 * (b - 1)));
+        }
+    }
+
+    Snapshot &start = fuzz_case.start;
+    start.memory.resize(0x10000);
+    for (size_t i = 0; i < start.memory.size(); i++)
+    {
+        start.memory[i] = opcodes[random.Below(static_cast<uint32_t>(opcodes.size()))];
+    }
+    for (int offset = -kStackSpread; offset < kStackSpread; offset += 2)
+    {
+        uint16_t target = targets[random.Below(static_cast<uint32_t>(targets.size()))];
+        start.memory[kStackAddress + offset] = target & 0xff;
+        start.memory[kStackAddress + offset + 1] = target >> 8;
+    }
+
+    start.registers.A = random.Byte();
+    start.registers.B = random.Byte();
+    start.registers.C = random.Byte();
+    start.registers.D = random.Byte();
+    start.registers.E = random.Byte();
+    start.registers.H = random.Byte();
+    start.registers.L = random.Byte();
+    uint8_t flags = random.Byte();
+    start.flags.z = flags & 0x01;
+    start.flags.s = flags & 0x02;
+    start.flags.p = flags & 0x04;
+    start.flags.cy = flags & 0x08;
+    start.flags.ac = flags & 0x10;
+    start.interrupt_enable = flags & 0x20;
+    start.ports.port1 = random.Byte();
+    start.ports.port2 = random.Byte();
+    start.ports.port3 = random.Byte();
+    start.ports.port5 = random.Byte();
+    start.sp = kStackAddress;
+    start.pc = kCodeAddress;
+    start.cycles = 0;
+    return fuzz_case;
+}
+
+// Put the machine and program of fuzz_case into e, with all memory writable
+void DifferentialFuzzer::LoadCase(Emulator *e, const FuzzCase &fuzz_case)
+{
+    e->LoadState(fuzz_case.start);
+    e->SetRamRange(0, 0x10000);
+    vector<uint8_t> code = fuzz_case.Code();
+    for (size_t i = 0; i < code.size(); i++)
+    {
+        e->WriteToMem(static_cast<uint16_t>(kCodeAddress + i), code[i]);
+    }
+}
+
+// Run fuzz_case on every engine; if one disagrees with the reference, shrink
+// the case and describe it in failure
+bool DifferentialFuzzer::Check(const FuzzCase &fuzz_case, FuzzFailure *failure) const
+{
+    Emulator reference_emulator;
+    Emulator candidate_emulator;
+    return Check(fuzz_case, failure, &reference_emulator, &candidate_emulator);
+}
+
+// Check, on the given machines
+bool DifferentialFuzzer::Check(const FuzzCase &fuzz_case, FuzzFailure *failure, Emulator *reference_emulator,
+                               Emulator *candidate_emulator) const
+{
+    for (size_t i = 1; i < engines.size(); i++)
+    {
+        if (!Diverges(fuzz_case, engines[i], cycles, reference_emulator, candidate_emulator))
+        {
+            continue;
+        }
+        failure->reference = engines[0].name;
+        failure->candidate = engines[i].name;
+        failure->cycles = cycles;
+        failure->original = fuzz_case;
+        failure->shrunk = fuzz_case;
+        Shrink(failure, engines[i], reference_emulator, candidate_emulator);
+        FirstDifference(failure, engines[i], reference_emulator, candidate_emulator);
+        return true;
+    }
+    return false;
+}
+
+// True if candidate ends in a different state than the reference after
+// running fuzz_case for budget cycles
+bool DifferentialFuzzer::Diverges(const FuzzCase &fuzz_case, const Engine &candidate, int budget,
+                                  Emulator *reference_emulator, Emulator *candidate_emulator) const
+{
+    LoadCase(reference_emulator, fuzz_case);
+    LoadCase(candidate_emulator, fuzz_case);
+    engines[0].run(reference_emulator, budget);
+    candidate.run(candidate_emulator, budget);
+    return !DivergenceFinder::SameState(*reference_emulator, *candidate_emulator);
+}
+
+// Smallest cycle budget, found by bisection, at which fuzz_case still
+// diverges; budget must diverge
+int DifferentialFuzzer::SmallestBudget(const FuzzCase &fuzz_case, const Engine &candidate, int budget,
+                                       Emulator *reference_emulator, Emulator *candidate_emulator) const
+{
+    int lo = 0;
+    int hi = budget;
+    while (hi - lo > 1)
+    {
+        int mid = lo + (hi - lo) / 2;
+        if (Diverges(fuzz_case, candidate, mid, reference_emulator, candidate_emulator))
+        {
+            hi = mid;
+        }
+        else
+        {
+            lo = mid;
+        }
+    }
+    return hi;
+}
+
+// Make failure->shrunk as small as possible while it still diverges
+void DifferentialFuzzer::Shrink(FuzzFailure *failure, const Engine &candidate, Emulator *reference_emulator,
+                                Emulator *candidate_emulator) const
+{
+    FuzzCase &best = failure->shrunk;
+    int budget = SmallestBudget(best, candidate, failure->cycles, reference_emulator, candidate_emulator);
+
+    // replace ever smaller runs of instructions with NOPs, which keeps the
+    // addresses jumps go to
+    size_t count = best.instructions.size();
+    for (size_t chunk = max<size_t>(count / 2, 1);; chunk /= 2)
+    {
+        for (size_t first = 0; first < count; first += chunk)
+        {
+            FuzzCase trial = best;
+            bool changed = false;
+            for (size_t i = first; i < min(first + chunk, count); i++)
+            {
+                if (!IsNop(trial.instructions[i]))
+                {
+                    fill(trial.instructions[i].begin(), trial.instructions[i].end(), 0x00);
+                    changed = true;
+                }
+            }
+            if (changed && Diverges(trial, candidate, budget, reference_emulator, candidate_emulator))
+            {
+                best = trial;
+            }
+        }
+        if (chunk == 1)
+        {
+            break;
+        }
+    }
+
+    // clear memory page by page, then the registers and flags
+    for (size_t page = 0; page < best.start.memory.size(); page += 0x100)
+    {
+        FuzzCase trial = best;
+        fill(trial.start.memory.begin() + page, trial.start.memory.begin() + page + 0x100, 0x00);
+        if (trial.start.memory != best.start.memory &&
+            Diverges(trial, candidate, budget, reference_emulator, candidate_emulator))
+        {
+            best = trial;
+        }
+    }
+    uint8_t *registers[] = {&best.start.registers.A, &best.start.registers.B, &best.start.registers.C,
+                            &best.start.registers.D, &best.start.registers.E, &best.start.registers.H,
+                            &best.start.registers.L, &best.start.ports.port1, &best.start.ports.port2,
+                            &best.start.ports.port3, &best.start.ports.port5};
+    for (size_t r = 0; r < sizeof(registers) / sizeof(registers[0]); r++)
+    {
+        uint8_t value = *registers[r];
+        *registers[r] = 0;
+        if (value != 0 && !Diverges(best, candidate, budget, reference_emulator, candidate_emulator))
+        {
+            *registers[r] = value;
+        }
+    }
+    bool *flags[] = {&best.start.flags.z, &best.start.flags.s, &best.start.flags.p, &best.start.flags.cy,
+                     &best.start.flags.ac, &best.start.interrupt_enable};
+    for (size_t f = 0; f < sizeof(flags) / sizeof(flags[0]); f++)
+    {
+        bool value = *flags[f];
+        *flags[f] = false;
+        if (value && !Diverges(best, candidate, budget, reference_emulator, candidate_emulator))
+        {
+            *flags[f] = value;
+        }
+    }
+
+    failure->shrunk_cycles = SmallestBudget(best, candidate, budget, reference_emulator, candidate_emulator);
+}
+
+// Step both engines through the shrunk case to the first instruction after
+// which they differ
+void DifferentialFuzzer::FirstDifference(FuzzFailure *failure, const Engine &candidate,
+                                         Emulator *reference_emulator, Emulator *candidate_emulator) const
+{
+    LoadCase(reference_emulator, failure->shrunk);
+    LoadCase(candidate_emulator, failure->shrunk);
+    while (reference_emulator->GetCycles() < static_cast<uint64_t>(failure->shrunk_cycles))
+    {
+        reference_emulator->SaveState(&failure->before);
+        engines[0].run(reference_emulator, 1);
+        candidate.run(candidate_emulator, 1);
+        if (!DivergenceFinder::SameState(*reference_emulator, *candidate_emulator))
+        {
+            reference_emulator->SaveState(&failure->reference_state);
+            candidate_emulator->SaveState(&failure->candidate_state);
+            return;
+        }
+    }
+
+    // the engines only differ when run in one go: report the end states
+    LoadCase(reference_emulator, failure->shrunk);
+    LoadCase(candidate_emulator, failure->shrunk);
+    reference_emulator->SaveState(&failure->before);
+    engines[0].run(reference_emulator, failure->shrunk_cycles);
+    candidate.run(candidate_emulator, failure->shrunk_cycles);
+    reference_emulator->SaveState(&failure->reference_state);
+    candidate_emulator->SaveState(&failure->candidate_state);
+}
+
+// Describe a failure: the seed, the shrunk program and starting state, and
+// the first instruction after which the engines differ
+void DifferentialFuzzer::Report(ostream &out, const FuzzFailure &failure)
+{
+    ios_base::fmtflags saved = out.flags();
+    char fill_char = out.fill();
+
+    const FuzzCase &shrunk = failure.shrunk;
+    int kept = 0;
+    for (size_t i = 0; i < shrunk.instructions.size(); i++)
+    {
+        kept += !IsNop(shrunk.instructions[i]);
+    }
+    out << "seed 0x" << hex << setfill('0') << setw(16) << failure.original.seed << dec << setfill(' ') << ": "
+        << failure.candidate << " differs from " << failure.reference << " within " << failure.shrunk_cycles
+        << " cycles (shrunk from " << failure.original.instructions.size() << " instructions and "
+        << failure.cycles << " cycles to " << kept << " instructions)" << endl;
+
+    // the program, with runs of NOPs collapsed
+    vector<uint8_t> code = shrunk.Code();
+    uint16_t address = kCodeAddress;
+    size_t nops = 0;
+    for (size_t i = 0; i <= shrunk.instructions.size(); i++)
+    {
+        bool end = i == shrunk.instructions.size();
+        if (!end && IsNop(shrunk.instructions[i]))
+        {
+            nops += shrunk.instructions[i].size();
+            address = static_cast<uint16_t>(address + shrunk.instructions[i].size());
+            continue;
+        }
+        if (nops > 0)
+        {
+            out << "  " << nops << " x NOP" << endl;
+            nops = 0;
+        }
+        size_t size = end ? 3 : shrunk.instructions[i].size();
+        out << "  ";
+        Disassembler::Disassemble(out, &code[address - kCodeAddress], static_cast<int>(size), address);
+        address = static_cast<uint16_t>(address + size);
+    }
+
+    const Snapshot &s = shrunk.start;
+    int memory_bytes = 0;
+    for (size_t i = 0; i < s.memory.size(); i++)
+    {
+        memory_bytes += s.memory[i] != 0;
+    }
+    out << hex << setfill('0') << "start: A=" << setw(2) << unsigned(s.registers.A) << " B=" << setw(2)
+        << unsigned(s.registers.B) << " C=" << setw(2) << unsigned(s.registers.C) << " D=" << setw(2)
+        << unsigned(s.registers.D) << " E=" << setw(2) << unsigned(s.registers.E) << " H=" << setw(2)
+        << unsigned(s.registers.H) << " L=" << setw(2) << unsigned(s.registers.L) << " SP=" << setw(4) << s.sp
+        << dec << " z=" << s.flags.z << " s=" << s.flags.s << " p=" << s.flags.p << " cy=" << s.flags.cy
+        << " ac=" << s.flags.ac << " INTE=" << s.interrupt_enable << ", " << memory_bytes
+        << " non-zero memory bytes outside the program" << endl;
+
+    out << "first difference after the instruction at " << hex << setfill('0') << setw(4) << failure.before.pc
+        << dec << setfill(' ') << " (cycle " << failure.before.cycles << ")" << endl;
+    DivergenceFinder::PrintStates(out, failure.reference_state, failure.candidate_state);
+
+    out.flags(saved);
+    out.fill(fill_char);
+}
+
+// Read seeds, one per line in decimal or 0x hex; # starts a comment
+bool DifferentialFuzzer::LoadSeeds(const string &path, vector<uint64_t> *seeds)
+{
+    ifstream in(path.c_str());
+    if (!in)
+    {
+        return false;
+    }
+    string line;
+    while (getline(in, line))
+    {
+        line = line.substr(0, line.find('#'));
+        size_t first = line.find_first_not_of(" \t\r");
+        if (first == string::npos)
+        {
+            continue;
+        }
+        seeds->push_back(strtoull(line.c_str() + first, nullptr, 0));
+    }
+    return true;
+}
+
+// Add seed to the end of a seed file
+bool DifferentialFuzzer::AppendSeed(const string &path, uint64_t seed)
+{
+    ofstream out(path.c_str(), ios::app);
+    out << "0x" << hex << setfill('0') << setw(16) << seed << endl;
+    return static_cast<bool>(out);
+}
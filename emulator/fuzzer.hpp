@@ -0,0 +1,104 @@
+#ifndef EMULATOR_FUZZER_HPP_
+#define EMULATOR_FUZZER_HPP_
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "emulator/emulator.hpp"
+#include "emulator/engine.hpp"
+
+// A generated program and the machine it starts in
+//
+// Everything is derived from seed and the program length, so a seed is
+// enough to reproduce a case. The program is loaded at
+// DifferentialFuzzer::kCodeAddress, followed by a jump to itself.
+struct FuzzCase
+{
+    uint64_t seed = 0;
+    std::vector<std::vector<uint8_t> > instructions;
+    Snapshot start; // registers, flags and memory, without the program
+
+    uint16_t EndAddress() const;
+    std::vector<uint8_t> Code() const;
+};
+
+// Two engines that disagree on a case
+struct FuzzFailure
+{
+    std::string reference;
+    std::string candidate;
+    int cycles = 0;
+    FuzzCase original;
+    FuzzCase shrunk;          // smallest case found that still diverges
+    int shrunk_cycles = 0;    // smallest budget at which shrunk diverges
+    Snapshot before;          // last state of shrunk both engines agree on
+    Snapshot reference_state; // states right after the first difference
+    Snapshot candidate_state;
+};
+
+// Outcome of a fuzzing run
+struct FuzzStats
+{
+    uint64_t cases = 0;
+    uint64_t cycles = 0; // emulated by the reference engine
+    int threads = 0;
+    double seconds = 0;
+    std::vector<FuzzFailure> failures;
+};
+
+// Runs random 8080 programs on several engines and compares the complete
+// machine state they end in
+//
+// Programs are random instruction streams whose jumps and calls land on
+// their own instructions; the rest of memory is filled with random opcode
+// bytes and the stack with addresses of the program's instructions, so
+// that computed jumps and returns also run valid code. The first engine
+// is the reference. A divergence is shrunk by replacing instructions with
+// NOPs, clearing memory and registers and lowering the cycle budget for as
+// long as the engines still disagree.
+class DifferentialFuzzer
+{
+public:
+    static const uint16_t kCodeAddress = 0x4000;
+    static const uint16_t kStackAddress = 0xe000;
+
+    explicit DifferentialFuzzer(const std::vector<Engine> &engines);
+
+    void SetCycles(int cycles);
+    void SetInstructions(int instructions);
+    void SetThreads(int threads);
+    void SetMaxFailures(int failures);
+
+    FuzzStats RunSeeds(const std::vector<uint64_t> &seeds) const;
+    FuzzStats RunFor(double seconds, uint64_t first_seed) const;
+
+    FuzzCase Generate(uint64_t seed) const;
+    bool Check(const FuzzCase &fuzz_case, FuzzFailure *failure) const;
+
+    static void LoadCase(Emulator *e, const FuzzCase &fuzz_case);
+    static void Report(std::ostream &out, const FuzzFailure &failure);
+    static bool LoadSeeds(const std::string &path, std::vector<uint64_t> *seeds);
+    static bool AppendSeed(const std::string &path, uint64_t seed);
+
+private:
+    FuzzStats Run(const std::vector<uint64_t> *seeds, double seconds, uint64_t first_seed) const;
+    bool Check(const FuzzCase &fuzz_case, FuzzFailure *failure, Emulator *reference_emulator,
+               Emulator *candidate_emulator) const;
+    bool Diverges(const FuzzCase &fuzz_case, const Engine &candidate, int budget, Emulator *reference_emulator,
+                  Emulator *candidate_emulator) const;
+    int SmallestBudget(const FuzzCase &fuzz_case, const Engine &candidate, int budget, Emulator *reference_emulator,
+                       Emulator *candidate_emulator) const;
+    void Shrink(FuzzFailure *failure, const Engine &candidate, Emulator *reference_emulator,
+                Emulator *candidate_emulator) const;
+    void FirstDifference(FuzzFailure *failure, const Engine &candidate, Emulator *reference_emulator,
+                         Emulator *candidate_emulator) const;
+
+    std::vector<Engine> engines;
+    int cycles;
+    int instructions;
+    int threads;
+    int max_failures;
+};
+
+#endif // EMULATOR_FUZZER_HPP_
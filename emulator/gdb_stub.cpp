@@ -0,0 +1,933 @@
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include "emulator/gdb_stub.hpp"
+#include "emulator/engine.hpp"
+
+#ifndef _WIN32
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace
+{
+// registers in GDB's z80 layout, af through ir
+const int kRegisterCount = 13;
+
+// instructions run between checks for a Ctrl-C from the debugger
+const int kInterruptCheckInterval = 4096;
+
+const char kHexDigits[] = "0123456789abcdef";
+
+#ifdef MSG_NOSIGNAL
+// a debugger that goes away must not kill the emulator with SIGPIPE
+const int kSendFlags = MSG_NOSIGNAL;
+#else
+const int kSendFlags = 0;
+#endif
+
+int HexValue(char c)
+{
+    if (c >= '0' && c <= '9')
+    {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f')
+    {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F')
+    {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+// Read a hex number starting at *pos, leaving *pos after it
+// Returns false if there are no hex digits at *pos
+bool ParseHex(const string &text, size_t *pos, uint32_t *value)
+{
+    size_t start = *pos;
+    *value = 0;
+    while (*pos < text.size() && HexValue(text[*pos]) >= 0)
+    {
+        *value = *value << 4 | HexValue(text[*pos]);
+        (*pos)++;
+    }
+    return *pos > start;
+}
+
+// Expect separator at *pos and step over it
+bool Skip(const string &text, size_t *pos, char separator)
+{
+    if (*pos < text.size() && text[*pos] == separator)
+    {
+        (*pos)++;
+        return true;
+    }
+    return false;
+}
+
+void AppendByte(string *out, uint8_t value)
+{
+    out->push_back(kHexDigits[value >> 4]);
+    out->push_back(kHexDigits[value & 0xf]);
+}
+
+// A register as GDB sends it: two bytes of hex, least significant first
+bool ParseRegister(const string &text, size_t pos, uint16_t *value)
+{
+    if (pos + 4 > text.size())
+    {
+        return false;
+    }
+    int digits[4];
+    for (int i = 0; i < 4; i++)
+    {
+        digits[i] = HexValue(text[pos + i]);
+        if (digits[i] < 0)
+        {
+            return false;
+        }
+    }
+    *value = static_cast<uint16_t>(digits[0] << 4 | digits[1] | digits[2] << 12 | digits[3] << 8);
+    return true;
+}
+
+// F as the 8080 pushes it with PUSH PSW: S Z 0 AC 0 P 1 CY
+uint8_t PackFlags(const Flags &f)
+{
+    return static_cast<uint8_t>(f.s << 7 | f.z << 6 | f.ac << 4 | f.p << 2 | 0x02 | f.cy);
+}
+
+Flags UnpackFlags(uint8_t value)
+{
+    Flags f;
+    f.s = (value & 0x80) != 0;
+    f.z = (value & 0x40) != 0;
+    f.ac = (value & 0x10) != 0;
+    f.p = (value & 0x04) != 0;
+    f.cy = (value & 0x01) != 0;
+    return f;
+}
+
+uint16_t RegisterValue(const Emulator &e, int number)
+{
+    Registers r = e.GetRegisters();
+    switch (number)
+    {
+    case 0:
+        return static_cast<uint16_t>(r.A << 8 | PackFlags(e.GetFlags()));
+    case 1:
+        return static_cast<uint16_t>(r.B << 8 | r.C);
+    case 2:
+        return static_cast<uint16_t>(r.D << 8 | r.E);
+    case 3:
+        return static_cast<uint16_t>(r.H << 8 | r.L);
+    case 4:
+        return static_cast<uint16_t>(e.GetSP());
+    case 5:
+        return static_cast<uint16_t>(e.GetPC());
+    default:
+        return 0;
+    }
+}
+} // namespace
+
+GdbStub::GdbStub(Emulator *e)
+    : e(e), breakpoints(0x10000, false), watch_hit(0), watch_address(0), frame_cycles(0), next_interrupt(1),
+      step(0), frame(0), listen_fd(-1), fd(-1), port(0), no_ack(false)
+{
+}
+
+GdbStub::~GdbStub()
+{
+    Close();
+    for (size_t i = 0; i < watchpoints.size(); i++)
+    {
+        e->RemoveWatch(watchpoints[i].id);
+    }
+}
+
+// Accept debuggers on 127.0.0.1:port, or on a free port if port is 0
+bool GdbStub::Listen(int new_port)
+{
+    Close();
+#ifndef _WIN32
+    listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (listen_fd < 0)
+    {
+        error = strerror(errno);
+        return false;
+    }
+    int yes = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+
+    sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(static_cast<uint16_t>(new_port));
+    socklen_t length = sizeof(address);
+    if (bind(listen_fd, reinterpret_cast<sockaddr *>(&address), length) != 0 || listen(listen_fd, 1) != 0 ||
+        getsockname(listen_fd, reinterpret_cast<sockaddr *>(&address), &length) != 0)
+    {
+        error = strerror(errno);
+        Close();
+        return false;
+    }
+    port = ntohs(address.sin_port);
+    return true;
+#else
+    error = "not supported on this platform";
+    return false;
+#endif
+}
+
+// Accept debuggers on a UNIX socket at path, replacing any file there
+bool GdbStub::ListenUnix(const string &path)
+{
+    Close();
+#ifndef _WIN32
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    if (path.size() >= sizeof(address.sun_path))
+    {
+        error = "socket path too long";
+        return false;
+    }
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+
+    listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd < 0)
+    {
+        error = strerror(errno);
+        return false;
+    }
+    unlink(path.c_str());
+    if (bind(listen_fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 || listen(listen_fd, 1) != 0)
+    {
+        error = strerror(errno);
+        Close();
+        return false;
+    }
+    unix_path = path;
+    return true;
+#else
+    error = "not supported on this platform";
+    return false;
+#endif
+}
+
+// TCP port being listened on
+int GdbStub::Port() const
+{
+    return port;
+}
+
+// Wait for a debugger to connect
+bool GdbStub::Accept()
+{
+#ifndef _WIN32
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+    fd = accept(listen_fd, nullptr, nullptr);
+    if (fd < 0)
+    {
+        error = strerror(errno);
+        return false;
+    }
+    int yes = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+    no_ack = false;
+    return true;
+#else
+    return false;
+#endif
+}
+
+// Answer the connected debugger until it detaches, kills the program or
+// goes away; returns false in the last case
+bool GdbStub::Serve()
+{
+    string packet;
+    while (ReadPacket(&packet))
+    {
+        if (packet == "k")
+        {
+            return true;
+        }
+        if (!SendPacket(HandlePacket(packet)))
+        {
+            return false;
+        }
+        if (!packet.empty() && packet[0] == 'D')
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Drop the debugger and stop listening
+void GdbStub::Close()
+{
+#ifndef _WIN32
+    if (fd >= 0)
+    {
+        close(fd);
+        fd = -1;
+    }
+    if (listen_fd >= 0)
+    {
+        close(listen_fd);
+        listen_fd = -1;
+    }
+    if (!unix_path.empty())
+    {
+        unlink(unix_path.c_str());
+        unix_path.clear();
+    }
+#endif
+    port = 0;
+}
+
+// Why the last socket call failed
+const string &GdbStub::Error() const
+{
+    return error;
+}
+
+// Carry out one command, given without its framing, and return the reply
+// An empty reply tells GDB the command is not supported
+string GdbStub::HandlePacket(const string &packet)
+{
+    if (packet.empty())
+    {
+        return "";
+    }
+    string reply;
+    size_t pos = 1;
+    uint32_t address;
+    uint32_t length;
+    switch (packet[0])
+    {
+    case '?':
+        return "S05";
+    case 'g':
+        return ReadRegisters(*e);
+    case 'G':
+        for (int number = 0; number < kRegisterCount; number++)
+        {
+            HistoryInput input;
+            input.target = static_cast<uint16_t>(number);
+            if (!ParseRegister(packet, 1 + number * 4, &input.value))
+            {
+                return number >= 6 ? "OK" : "E01";
+            }
+            Change(input);
+        }
+        return "OK";
+    case 'p':
+        if (!ParseHex(packet, &pos, &address) || address >= static_cast<uint32_t>(kRegisterCount))
+        {
+            return "E01";
+        }
+        AppendByte(&reply, RegisterValue(*e, address) & 0xff);
+        AppendByte(&reply, RegisterValue(*e, address) >> 8);
+        return reply;
+    case 'P':
+    {
+        HistoryInput input;
+        if (!ParseHex(packet, &pos, &address) || !Skip(packet, &pos, '=') ||
+            !ParseRegister(packet, pos, &input.value) || address >= static_cast<uint32_t>(kRegisterCount))
+        {
+            return "E01";
+        }
+        input.target = static_cast<uint16_t>(address);
+        Change(input);
+        return "OK";
+    }
+    case 'm':
+        if (!ParseHex(packet, &pos, &address) || !Skip(packet, &pos, ',') || !ParseHex(packet, &pos, &length) ||
+            address + length > static_cast<uint32_t>(e->GetMemorySize()))
+        {
+            return "E01";
+        }
+        for (uint32_t i = 0; i < length; i++)
+        {
+            AppendByte(&reply, e->GetMemory()[address + i]);
+        }
+        return reply;
+    case 'M':
+        if (!ParseHex(packet, &pos, &address) || !Skip(packet, &pos, ',') || !ParseHex(packet, &pos, &length) ||
+            !Skip(packet, &pos, ':') || packet.size() - pos < length * 2 ||
+            address + length > static_cast<uint32_t>(e->GetMemorySize()))
+        {
+            return "E01";
+        }
+        for (uint32_t i = 0; i < length; i++)
+        {
+            int high = HexValue(packet[pos + i * 2]);
+            int low = HexValue(packet[pos + i * 2 + 1]);
+            if (high < 0 || low < 0)
+            {
+                return "E01";
+            }
+            HistoryInput input;
+            input.memory = true;
+            input.target = static_cast<uint16_t>(address + i);
+            input.value = static_cast<uint16_t>(high << 4 | low);
+            Change(input);
+        }
+        return "OK";
+    case 'c':
+    case 's':
+        if (ParseHex(packet, &pos, &address))
+        {
+            HistoryInput input;
+            input.target = 5;
+            input.value = static_cast<uint16_t>(address);
+            Change(input);
+        }
+        return Resume(packet[0] == 's');
+    case 'b':
+        if (packet == "bs")
+        {
+            return ReverseStep();
+        }
+        if (packet == "bc")
+        {
+            return ReverseContinue();
+        }
+        return "";
+    case 'Z':
+    case 'z':
+    {
+        uint32_t type;
+        if (!ParseHex(packet, &pos, &type) || !Skip(packet, &pos, ',') || !ParseHex(packet, &pos, &address) ||
+            !Skip(packet, &pos, ',') || !ParseHex(packet, &pos, &length) || address > 0xffff)
+        {
+            return "E01";
+        }
+        bool insert = packet[0] == 'Z';
+        if (type == 0 || type == 1)
+        {
+            if (insert)
+            {
+                SetBreakpoint(static_cast<uint16_t>(address));
+            }
+            else
+            {
+                ClearBreakpoint(static_cast<uint16_t>(address));
+            }
+            return "OK";
+        }
+        // write, read and access watchpoints
+        const int kinds[] = {kWatchWrite, kWatchRead, kWatchRead | kWatchWrite};
+        if (type >= 2 && type <= 4)
+        {
+            if (insert)
+            {
+                SetWatchpoint(static_cast<uint16_t>(address), length, kinds[type - 2]);
+            }
+            else
+            {
+                ClearWatchpoint(static_cast<uint16_t>(address), length, kinds[type - 2]);
+            }
+            return "OK";
+        }
+        return "";
+    }
+    case 'H':
+    case 'T':
+    case 'D':
+        return "OK";
+    case 'q':
+        if (packet.compare(0, 10, "qSupported") == 0)
+        {
+            return "PacketSize=4000;QStartNoAckMode+;ReverseStep+;ReverseContinue+";
+        }
+        if (packet == "qAttached")
+        {
+            return "1";
+        }
+        if (packet == "qC")
+        {
+            return "QC1";
+        }
+        if (packet == "qfThreadInfo")
+        {
+            return "m1";
+        }
+        if (packet == "qsThreadInfo")
+        {
+            return "l";
+        }
+        return "";
+    case 'Q':
+        if (packet == "QStartNoAckMode")
+        {
+            no_ack = true;
+            return "OK";
+        }
+        return "";
+    default:
+        return "";
+    }
+}
+
+// Stop before executing the instruction at address
+void GdbStub::SetBreakpoint(uint16_t address)
+{
+    breakpoints[address] = true;
+}
+
+void GdbStub::ClearBreakpoint(uint16_t address)
+{
+    breakpoints[address] = false;
+}
+
+// Stop after any instruction that accesses [address, address + length) in
+// one of the ways in kinds
+void GdbStub::SetWatchpoint(uint16_t address, int length, int kinds)
+{
+    GdbWatchpoint watch;
+    watch.address = address;
+    watch.length = length;
+    watch.kinds = kinds;
+    watch.id = e->AddWatch(address, length, kinds, OnWatch, this);
+    watchpoints.push_back(watch);
+}
+
+void GdbStub::ClearWatchpoint(uint16_t address, int length, int kinds)
+{
+    for (size_t i = 0; i < watchpoints.size(); i++)
+    {
+        if (watchpoints[i].address == address && watchpoints[i].length == length && watchpoints[i].kinds == kinds)
+        {
+            e->RemoveWatch(watchpoints[i].id);
+            watchpoints.erase(watchpoints.begin() + i);
+            return;
+        }
+    }
+}
+
+// Run until the next instruction if single_step, otherwise until a
+// breakpoint, a watchpoint or a Ctrl-C from the debugger
+// Returns the stop reply for GDB
+string GdbStub::Resume(bool single_step)
+{
+    // the speed of the run sets how often the history takes snapshots
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    uint64_t start_frame = frame;
+    string reply = Run(single_step);
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+    history.NoteSpeed(frame - start_frame, elapsed.count());
+    return reply;
+}
+
+// The loop behind Resume
+string GdbStub::Run(bool single_step)
+{
+    // the first instruction runs even if it has a breakpoint, which is
+    // where the last stop came from
+    for (int count = 1; ; count++)
+    {
+        StepInstruction();
+        if (watch_hit != 0)
+        {
+            return WatchReply();
+        }
+        if (single_step || breakpoints[e->GetPC()])
+        {
+            return "S05";
+        }
+        if (count % kInterruptCheckInterval == 0 && Interrupted())
+        {
+            return "S02";
+        }
+    }
+}
+
+// Stop reply for the watchpoint accesses of the last instruction, naming
+// the kind of watchpoint they hit
+string GdbStub::WatchReply() const
+{
+    string reply = "T05watch:";
+    for (size_t i = 0; i < watchpoints.size(); i++)
+    {
+        const GdbWatchpoint &watch = watchpoints[i];
+        if ((watch.kinds & watch_hit) && watch_address >= watch.address &&
+            watch_address < watch.address + watch.length)
+        {
+            if (watch.kinds == kWatchRead)
+            {
+                reply = "T05rwatch:";
+            }
+            else if (watch.kinds != kWatchWrite)
+            {
+                reply = "T05awatch:";
+            }
+            break;
+        }
+    }
+    AppendByte(&reply, watch_address >> 8);
+    AppendByte(&reply, watch_address & 0xff);
+    return reply + ";";
+}
+
+// Go back to the state before the last instruction
+string GdbStub::ReverseStep()
+{
+    if (history.Empty() || step == history.Begin())
+    {
+        return "T05replaylog:begin;";
+    }
+    Restore(step - 1);
+    return "S05";
+}
+
+// Go back to the last breakpoint or watchpoint hit before now, or to the
+// start of the recording if there is none
+string GdbStub::ReverseContinue()
+{
+    if (history.Empty() || step == history.Begin())
+    {
+        return "T05replaylog:begin;";
+    }
+    // search back one snapshot interval at a time, replaying each to find
+    // its last hit; a watchpoint hit on arriving where the search started
+    // was the instruction GDB is going back from, so it does not count
+    uint64_t end = step;
+    bool hit_at_end = false;
+    for (;;)
+    {
+        uint64_t start = history.Nearest(end - 1).step;
+        Restore(start);
+        bool found = breakpoints[e->GetPC()];
+        uint64_t found_step = start;
+        string reply = "S05";
+        while (step < end)
+        {
+            StepInstruction();
+            if (watch_hit != 0 && (step < end || hit_at_end))
+            {
+                found = true;
+                found_step = step;
+                reply = WatchReply();
+            }
+            else if (step < end && breakpoints[e->GetPC()])
+            {
+                found = true;
+                found_step = step;
+                reply = "S05";
+            }
+        }
+        if (found)
+        {
+            Restore(found_step);
+            return reply;
+        }
+        if (start == history.Begin())
+        {
+            Restore(start);
+            return "T05replaylog:begin;";
+        }
+        if (Interrupted())
+        {
+            Restore(start);
+            return "S02";
+        }
+        end = start;
+        hit_at_end = true;
+    }
+}
+
+// Start a new recording from the machine as it is now
+void GdbStub::ResetHistory()
+{
+    history.Clear();
+    step = 0;
+    frame = 0;
+}
+
+History &GdbStub::GetHistory()
+{
+    return history;
+}
+
+// Instructions executed since the recording began
+uint64_t GdbStub::GetStep() const
+{
+    return step;
+}
+
+// Frame packet as it goes over the wire: $packet#checksum
+string GdbStub::Frame(const string &packet)
+{
+    uint8_t checksum = 0;
+    for (size_t i = 0; i < packet.size(); i++)
+    {
+        checksum = static_cast<uint8_t>(checksum + packet[i]);
+    }
+    string framed = "$" + packet + "#";
+    AppendByte(&framed, checksum);
+    return framed;
+}
+
+// Reply to a 'g' packet: every register, two bytes each, low byte first
+string GdbStub::ReadRegisters(const Emulator &e)
+{
+    string reply;
+    for (int number = 0; number < kRegisterCount; number++)
+    {
+        uint16_t value = RegisterValue(e, number);
+        AppendByte(&reply, value & 0xff);
+        AppendByte(&reply, value >> 8);
+    }
+    return reply;
+}
+
+// Set register number, in GDB's z80 numbering, to value
+// Writes to registers the 8080 does not have are ignored
+bool GdbStub::WriteRegister(Emulator *e, int number, uint16_t value)
+{
+    Registers r = e->GetRegisters();
+    uint8_t high = static_cast<uint8_t>(value >> 8);
+    uint8_t low = static_cast<uint8_t>(value);
+    switch (number)
+    {
+    case 0:
+        r.A = high;
+        e->SetFlags(UnpackFlags(low));
+        break;
+    case 1:
+        r.B = high;
+        r.C = low;
+        break;
+    case 2:
+        r.D = high;
+        r.E = low;
+        break;
+    case 3:
+        r.H = high;
+        r.L = low;
+        break;
+    case 4:
+        e->SetSP(value);
+        return true;
+    case 5:
+        e->SetPC(value);
+        return true;
+    default:
+        return number < kRegisterCount;
+    }
+    e->SetRegisters(r);
+    return true;
+}
+
+// Execute one instruction, then the video interrupt if it is due
+void GdbStub::StepInstruction()
+{
+    if (history.Empty())
+    {
+        TakeSnapshot();
+    }
+    watch_hit = 0;
+    uint64_t before = e->GetCycles();
+    e->Emulate(1);
+    step++;
+    history.Advance(step);
+    frame_cycles += static_cast<int>(e->GetCycles() - before);
+    if (frame_cycles >= EngineRegistry::kHalfFrameCycles)
+    {
+        frame_cycles -= EngineRegistry::kHalfFrameCycles;
+        e->Interrupt(next_interrupt);
+        next_interrupt = 3 - next_interrupt;
+        if (next_interrupt == 1)
+        {
+            frame++;
+            if (history.SnapshotDue(step, frame))
+            {
+                TakeSnapshot();
+            }
+        }
+    }
+    if (history.HasInputs(step))
+    {
+        ApplyInputs();
+    }
+}
+
+// Make a change for the debugger, and record it to be made again when
+// the run is replayed
+void GdbStub::Change(const HistoryInput &input)
+{
+    // before the first instruction the first snapshot will include it
+    if (!history.Empty())
+    {
+        if (step < history.End())
+        {
+            history.Truncate(step); // a different future from here on
+        }
+        HistoryInput logged = input;
+        logged.step = step;
+        history.AddInput(logged);
+    }
+    Apply(input);
+}
+
+void GdbStub::Apply(const HistoryInput &input)
+{
+    if (input.memory)
+    {
+        e->SetMemory(input.target, static_cast<uint8_t>(input.value));
+    }
+    else
+    {
+        WriteRegister(e, input.target, input.value);
+    }
+}
+
+// Make the changes recorded at this step again
+void GdbStub::ApplyInputs()
+{
+    vector<HistoryInput> inputs = history.InputsAt(step);
+    for (size_t i = 0; i < inputs.size(); i++)
+    {
+        Apply(inputs[i]);
+    }
+}
+
+void GdbStub::TakeSnapshot()
+{
+    HistorySnapshot snapshot;
+    snapshot.step = step;
+    snapshot.frame = frame;
+    snapshot.frame_cycles = frame_cycles;
+    snapshot.next_interrupt = next_interrupt;
+    e->SaveState(&snapshot.state);
+    history.AddSnapshot(snapshot);
+}
+
+// Put the machine back as it was at target, which must be in the recording
+void GdbStub::Restore(uint64_t target)
+{
+    const HistorySnapshot &snapshot = history.Nearest(target);
+    e->LoadState(snapshot.state);
+    step = snapshot.step;
+    frame = snapshot.frame;
+    frame_cycles = snapshot.frame_cycles;
+    next_interrupt = snapshot.next_interrupt;
+    if (history.HasInputs(step))
+    {
+        ApplyInputs();
+    }
+    while (step < target)
+    {
+        StepInstruction();
+    }
+}
+
+// Note an access to a watchpoint, Resume stops once the instruction is done
+void GdbStub::OnWatch(void *context, const WatchEvent &event)
+{
+    GdbStub *stub = static_cast<GdbStub *>(context);
+    if (stub->watch_hit == 0)
+    {
+        stub->watch_address = event.address;
+    }
+    stub->watch_hit |= event.write ? kWatchWrite : kWatchRead;
+}
+
+// True if the debugger sent a Ctrl-C or went away while the machine ran
+bool GdbStub::Interrupted()
+{
+#ifndef _WIN32
+    if (fd < 0)
+    {
+        return false;
+    }
+    pollfd request = {fd, POLLIN, 0};
+    if (poll(&request, 1, 0) <= 0)
+    {
+        return false;
+    }
+    char c;
+    return recv(fd, &c, 1, 0) <= 0 || c == 0x03;
+#else
+    return false;
+#endif
+}
+
+// Read the next command, acknowledging it unless acks are turned off
+bool GdbStub::ReadPacket(string *packet)
+{
+#ifndef _WIN32
+    char c;
+    while (recv(fd, &c, 1, 0) == 1)
+    {
+        if (c != '$')
+        {
+            continue; // acks, and Ctrl-C while already stopped
+        }
+        packet->clear();
+        uint8_t checksum = 0;
+        while (recv(fd, &c, 1, 0) == 1 && c != '#')
+        {
+            packet->push_back(c);
+            checksum = static_cast<uint8_t>(checksum + c);
+        }
+        char digits[2];
+        if (c != '#' || recv(fd, &digits[0], 1, 0) != 1 || recv(fd, &digits[1], 1, 0) != 1)
+        {
+            return false;
+        }
+        if (no_ack)
+        {
+            return true;
+        }
+        if (HexValue(digits[0]) << 4 == (checksum & 0xf0) && HexValue(digits[1]) == (checksum & 0x0f))
+        {
+            return SendAll("+");
+        }
+        SendAll("-");
+    }
+#endif
+    return false;
+}
+
+bool GdbStub::SendPacket(const string &packet)
+{
+    return SendAll(Frame(packet));
+}
+
+bool GdbStub::SendAll(const string &data)
+{
+#ifndef _WIN32
+    size_t sent = 0;
+    while (sent < data.size())
+    {
+        ssize_t n = send(fd, data.data() + sent, data.size() - sent, kSendFlags);
+        if (n <= 0)
+        {
+            return false;
+        }
+        sent += static_cast<size_t>(n);
+    }
+    return true;
+#else
+    return false;
+#endif
+}
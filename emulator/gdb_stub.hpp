@@ -0,0 +1,105 @@
+#ifndef EMULATOR_GDB_STUB_HPP_
+#define EMULATOR_GDB_STUB_HPP_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "emulator/emulator.hpp"
+#include "emulator/history.hpp"
+
+// A range of memory watched for accesses, see Emulator::AddWatch
+struct GdbWatchpoint
+{
+    uint16_t address = 0;
+    int length = 0;
+    int kinds = 0;
+    int id = 0;
+};
+
+// GDB remote serial protocol server for an emulator
+//
+// The stub listens on a loopback TCP port or a UNIX socket and serves one
+// debugger at a time. Registers are presented in the layout of GDB's z80
+// target (AF, BC, DE, HL, SP, PC and seven registers the 8080 lacks, all
+// 16 bits), so gdb-multiarch with "set architecture z80" can attach.
+//
+// The machine runs in the stub's own loop, one instruction at a time with
+// the video interrupts of EngineRegistry::RunFrame, checking a bitmap of
+// breakpoints before every instruction. Emulate itself is never
+// instrumented, so the game runs at full speed whenever no debugger is
+// attached. Watchpoints are memory watches on the emulator, which stop the
+// machine after the instruction that made the access.
+//
+// Everything the machine does under the stub is recorded in a History, so
+// GDB's reverse-stepi and reverse-continue work: the stub restores the
+// last snapshot before the point it goes back to and runs forward from
+// there, making again the changes the debugger made on the way. Changing
+// the machine while in the past discards the recording after that point.
+// Changes made to the emulator other than through the stub are not
+// recorded; call ResetHistory after making them.
+class GdbStub
+{
+public:
+    explicit GdbStub(Emulator *e);
+    ~GdbStub();
+
+    bool Listen(int port);
+    bool ListenUnix(const std::string &path);
+    int Port() const;
+    bool Accept();
+    bool Serve();
+    void Close();
+    const std::string &Error() const;
+
+    std::string HandlePacket(const std::string &packet);
+
+    void SetBreakpoint(uint16_t address);
+    void ClearBreakpoint(uint16_t address);
+    void SetWatchpoint(uint16_t address, int length, int kinds);
+    void ClearWatchpoint(uint16_t address, int length, int kinds);
+    std::string Resume(bool single_step);
+    std::string ReverseStep();
+    std::string ReverseContinue();
+    void ResetHistory();
+    History &GetHistory();
+    uint64_t GetStep() const;
+
+    static std::string Frame(const std::string &packet);
+    static std::string ReadRegisters(const Emulator &e);
+    static bool WriteRegister(Emulator *e, int number, uint16_t value);
+
+private:
+    static void OnWatch(void *context, const WatchEvent &event);
+    std::string Run(bool single_step);
+    std::string WatchReply() const;
+    void StepInstruction();
+    void Change(const HistoryInput &input);
+    void Apply(const HistoryInput &input);
+    void ApplyInputs();
+    void TakeSnapshot();
+    void Restore(uint64_t target);
+    bool Interrupted();
+    bool ReadPacket(std::string *packet);
+    bool SendPacket(const std::string &packet);
+    bool SendAll(const std::string &data);
+
+    Emulator *e;
+    std::vector<bool> breakpoints;
+    std::vector<GdbWatchpoint> watchpoints;
+    int watch_hit;          // kinds of access since the last instruction
+    uint16_t watch_address; // address of the first of them
+    int frame_cycles;       // cycles since the last video interrupt
+    int next_interrupt;
+    History history;
+    uint64_t step;  // instructions executed since the recording began
+    uint64_t frame; // frames completed since then
+
+    int listen_fd;
+    int fd;
+    int port;
+    std::string unix_path;
+    bool no_ack;
+    std::string error;
+};
+
+#endif // EMULATOR_GDB_STUB_HPP_
@@ -0,0 +1,174 @@
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include "emulator/golden.hpp"
+#include "emulator/movie.hpp"
+#include "emulator/video.hpp"
+
+using namespace std;
+
+namespace
+{
+// start of the work RAM hashed by ram_hash
+const uint16_t kRamStart = 0x2000;
+
+// 64 bit FNV-1a hash of size bytes
+uint64_t Fnv1a(const uint8_t *data, int size)
+{
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (int i = 0; i < size; i++)
+    {
+        hash = (hash ^ data[i]) * 0x100000001b3ull;
+    }
+    return hash;
+}
+
+// Run e from frame first_frame up to frame end, applying movie input
+void RunFrames(Emulator *e, EngineFunction run, const InputMovie *movie, uint64_t first_frame, uint64_t end)
+{
+    for (uint64_t frame = first_frame; frame < end; frame++)
+    {
+        if (movie != nullptr)
+        {
+            movie->Apply(e, frame);
+        }
+        EngineRegistry::RunFrame(e, run);
+    }
+}
+} // namespace
+
+// Read a golden file, returns false if it is missing or malformed
+bool GoldenFrames::Load(const string &path)
+{
+    ifstream file(path);
+    if (!file.is_open())
+    {
+        return false;
+    }
+
+    frames.clear();
+    string line;
+    while (getline(file, line))
+    {
+        line = line.substr(0, line.find('#'));
+        istringstream fields(line);
+        GoldenFrame golden;
+        if (!(fields >> dec >> golden.frame))
+        {
+            continue;
+        }
+        if (!(fields >> hex >> golden.vram_hash >> golden.ram_hash) ||
+            (!frames.empty() && golden.frame <= frames.back().frame))
+        {
+            return false;
+        }
+        frames.push_back(golden);
+    }
+    return true;
+}
+
+// Write the hashes in the format read by Load
+bool GoldenFrames::Save(const string &path) const
+{
+    ofstream file(path);
+    if (!file.is_open())
+    {
+        return false;
+    }
+    file << "# frame vram_hash ram_hash" << '\n' << setfill('0');
+    for (size_t i = 0; i < frames.size(); i++)
+    {
+        file << dec << frames[i].frame << ' ' << hex << setw(16) << frames[i].vram_hash << ' '
+             << setw(16) << frames[i].ram_hash << '\n';
+    }
+    return file.good();
+}
+
+// Replace the hashes with those of running frames frames from start, taken
+// every interval frames and after the last one
+void GoldenFrames::Record(const Snapshot &start, EngineFunction run, const InputMovie *movie, uint64_t count,
+                          uint64_t interval)
+{
+    frames.clear();
+    Emulator e;
+    e.LoadState(start);
+    uint64_t frame = 0;
+    while (frame < count)
+    {
+        uint64_t next = min(frame + max<uint64_t>(interval, 1), count);
+        RunFrames(&e, run, movie, frame, next);
+        frame = next;
+        frames.push_back(Capture(e, frame));
+    }
+}
+
+// Replay the movie from start and compare every golden frame
+// Returns false and fills in mismatch at the first frame that differs
+bool GoldenFrames::Check(const Snapshot &start, EngineFunction run, const InputMovie *movie,
+                         GoldenMismatch *mismatch) const
+{
+    Emulator e;
+    e.LoadState(start);
+    uint64_t frame = 0;
+    for (size_t i = 0; i < frames.size(); i++)
+    {
+        RunFrames(&e, run, movie, frame, frames[i].frame);
+        frame = frames[i].frame;
+
+        GoldenFrame actual = Capture(e, frame);
+        if (actual.vram_hash != frames[i].vram_hash || actual.ram_hash != frames[i].ram_hash)
+        {
+            if (mismatch != nullptr)
+            {
+                mismatch->expected = frames[i];
+                mismatch->actual = actual;
+                const uint8_t *vram = e.GetMemory() + Video::kVramStart;
+                mismatch->vram.assign(vram, vram + Video::kVramSize);
+            }
+            return false;
+        }
+    }
+    return true;
+}
+
+const vector<GoldenFrame> &GoldenFrames::Frames() const
+{
+    return frames;
+}
+
+// Hash the video RAM and work RAM of e
+GoldenFrame GoldenFrames::Capture(const Emulator &e, uint64_t frame)
+{
+    GoldenFrame golden;
+    golden.frame = frame;
+    golden.vram_hash = Fnv1a(e.GetMemory() + Video::kVramStart, Video::kVramSize);
+    golden.ram_hash = Fnv1a(e.GetMemory() + kRamStart, Video::kVramStart - kRamStart);
+    return golden;
+}
+
+// Save the screen held in vram as a binary greyscale PGM image, upright and
+// with the color overlay as shades of grey
+bool GoldenFrames::WritePgm(const string &path, const uint8_t *vram)
+{
+    vector<uint32_t> pixels(Video::kWidth * Video::kHeight);
+    Video::ConvertVram(vram, pixels.data());
+
+    vector<uint8_t> grey(pixels.size());
+    for (size_t i = 0; i < pixels.size(); i++)
+    {
+        uint32_t r = pixels[i] >> 16 & 0xff;
+        uint32_t g = pixels[i] >> 8 & 0xff;
+        uint32_t b = pixels[i] & 0xff;
+        grey[i] = static_cast<uint8_t>((r * 77 + g * 150 + b * 29) >> 8);
+    }
+
+    ofstream file(path, ios::binary);
+    if (!file.is_open())
+    {
+        return false;
+    }
+    file << "P5\n" << Video::kWidth << ' ' << Video::kHeight << "\n255\n";
+    file.write(reinterpret_cast<const char *>(grey.data()), grey.size());
+    return file.good();
+}
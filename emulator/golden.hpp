@@ -0,0 +1,56 @@
+#ifndef EMULATOR_GOLDEN_HPP_
+#define EMULATOR_GOLDEN_HPP_
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "emulator/emulator.hpp"
+#include "emulator/engine.hpp"
+
+class InputMovie;
+
+// Hashes of the machine after a number of frames
+struct GoldenFrame
+{
+    uint64_t frame = 0;      // frames emulated before the hashes were taken
+    uint64_t vram_hash = 0;
+    uint64_t ram_hash = 0;   // work RAM below video RAM
+};
+
+// The first frame where a run departs from the golden hashes
+struct GoldenMismatch
+{
+    GoldenFrame expected;
+    GoldenFrame actual;
+    std::vector<uint8_t> vram;  // video RAM of the differing frame
+};
+
+// Whole-game regression check against recorded hashes
+//
+// Record plays an input movie from power on and keeps hashes of video RAM
+// and work RAM every few frames; Check replays the same movie on any
+// engine and stops at the first frame whose hashes differ. The hashes are
+// stored in a text file next to the movie, one "frame vram_hash ram_hash"
+// line per checked frame with the hashes in hex, and '#' starts a comment.
+class GoldenFrames
+{
+public:
+    bool Load(const std::string &path);
+    bool Save(const std::string &path) const;
+
+    void Record(const Snapshot &start, EngineFunction run, const InputMovie *movie, uint64_t frames,
+                uint64_t interval);
+    bool Check(const Snapshot &start, EngineFunction run, const InputMovie *movie,
+               GoldenMismatch *mismatch) const;
+
+    const std::vector<GoldenFrame> &Frames() const;
+
+    static GoldenFrame Capture(const Emulator &e, uint64_t frame);
+    static bool WritePgm(const std::string &path, const uint8_t *vram);
+
+private:
+    std::vector<GoldenFrame> frames;
+};
+
+#endif // EMULATOR_GOLDEN_HPP_
@@ -0,0 +1,195 @@
+#include <algorithm>
+#include "emulator/history.hpp"
+
+using namespace std;
+
+const int History::kMaxSnapshots;
+const uint64_t History::kMaxInterval;
+
+namespace
+{
+// frames between snapshots until the speed of the machine is known
+const uint64_t kDefaultInterval = 60;
+
+// shortest run the speed of the machine is worked out from
+const double kMeasureSeconds = 0.01;
+
+bool StepBefore(uint64_t step, const HistorySnapshot &snapshot)
+{
+    return step < snapshot.step;
+}
+
+bool InputBefore(const HistoryInput &input, uint64_t step)
+{
+    return input.step < step;
+}
+} // namespace
+
+History::History(double budget_seconds)
+    : budget(budget_seconds), fixed_interval(false), interval(kDefaultInterval), measured_frames(0),
+      measured_seconds(0), end(0)
+{
+}
+
+// Forget the recording, the next snapshot starts a new one
+void History::Clear()
+{
+    snapshots.clear();
+    inputs.clear();
+    end = 0;
+}
+
+bool History::Empty() const
+{
+    return snapshots.empty();
+}
+
+// Earliest step that can be returned to
+uint64_t History::Begin() const
+{
+    return snapshots.empty() ? 0 : snapshots.front().step;
+}
+
+// Furthest step the recording has reached
+uint64_t History::End() const
+{
+    return end;
+}
+
+// True if the machine should be saved on reaching step, at the end of frame
+bool History::SnapshotDue(uint64_t step, uint64_t frame) const
+{
+    return snapshots.empty() ||
+           (step > snapshots.back().step && frame >= snapshots.back().frame + interval);
+}
+
+void History::AddSnapshot(const HistorySnapshot &snapshot)
+{
+    snapshots.push_back(snapshot);
+    Advance(snapshot.step);
+    if (snapshots.size() > static_cast<size_t>(kMaxSnapshots))
+    {
+        Thin();
+    }
+}
+
+// Last snapshot at or before step, which must not be before Begin()
+const HistorySnapshot &History::Nearest(uint64_t step) const
+{
+    vector<HistorySnapshot>::const_iterator after =
+        upper_bound(snapshots.begin(), snapshots.end(), step, StepBefore);
+    return *(after - 1);
+}
+
+size_t History::Snapshots() const
+{
+    return snapshots.size();
+}
+
+// Bytes of machine state held
+size_t History::MemoryUse() const
+{
+    size_t bytes = 0;
+    for (size_t i = 0; i < snapshots.size(); i++)
+    {
+        bytes += sizeof(HistorySnapshot) + snapshots[i].state.memory.size();
+    }
+    return bytes + inputs.size() * sizeof(HistoryInput);
+}
+
+// Log a change to be made again whenever the run passes input.step
+void History::AddInput(const HistoryInput &input)
+{
+    Advance(input.step);
+    inputs.push_back(input);
+}
+
+bool History::HasInputs(uint64_t step) const
+{
+    return !inputs.empty() && step <= inputs.back().step &&
+           lower_bound(inputs.begin(), inputs.end(), step, InputBefore)->step == step;
+}
+
+// Inputs logged at step, in the order they were made
+vector<HistoryInput> History::InputsAt(uint64_t step) const
+{
+    vector<HistoryInput>::const_iterator first = lower_bound(inputs.begin(), inputs.end(), step, InputBefore);
+    vector<HistoryInput>::const_iterator last = first;
+    while (last != inputs.end() && last->step == step)
+    {
+        ++last;
+    }
+    return vector<HistoryInput>(first, last);
+}
+
+// Note that the run has reached step
+void History::Advance(uint64_t step)
+{
+    end = max(end, step);
+}
+
+// Forget everything after step, whose future is about to change
+void History::Truncate(uint64_t step)
+{
+    while (!snapshots.empty() && snapshots.back().step > step)
+    {
+        snapshots.pop_back();
+    }
+    while (!inputs.empty() && inputs.back().step > step)
+    {
+        inputs.pop_back();
+    }
+    end = min(end, step);
+}
+
+// Fit the interval to the speed of the machine, measured over runs that
+// add up to at least kMeasureSeconds
+void History::NoteSpeed(uint64_t frames, double seconds)
+{
+    if (fixed_interval)
+    {
+        return;
+    }
+    measured_frames += frames;
+    measured_seconds += seconds;
+    if (measured_frames == 0 || measured_seconds < kMeasureSeconds)
+    {
+        return;
+    }
+    double frames_in_budget = budget / 2 / (measured_seconds / measured_frames);
+    interval = static_cast<uint64_t>(max(1.0, min(frames_in_budget, static_cast<double>(kMaxInterval))));
+    measured_frames = 0;
+    measured_seconds = 0;
+}
+
+// Take snapshots every frames frames from now on, whatever the speed
+void History::SetInterval(uint64_t frames)
+{
+    fixed_interval = true;
+    interval = max<uint64_t>(frames, 1);
+}
+
+uint64_t History::Interval() const
+{
+    return interval;
+}
+
+// Drop every other snapshot in the older half of the recording, keeping the
+// first, so a long session has a bounded size and recent history stays dense
+void History::Thin()
+{
+    size_t half = snapshots.size() / 2;
+    size_t kept = 1;
+    for (size_t i = 1; i < snapshots.size(); i++)
+    {
+        if (i >= half || i % 2 == 0)
+        {
+            if (kept != i)
+            {
+                snapshots[kept] = move(snapshots[i]);
+            }
+            kept++;
+        }
+    }
+    snapshots.resize(kept);
+}
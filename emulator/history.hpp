@@ -0,0 +1,82 @@
+#ifndef EMULATOR_HISTORY_HPP_
+#define EMULATOR_HISTORY_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "emulator/emulator.hpp"
+
+// Machine state at one point of a recording, with the position of the video
+// interrupts so that replaying from it raises them at the same instructions
+struct HistorySnapshot
+{
+    uint64_t step = 0;  // instructions executed since the recording began
+    uint64_t frame = 0; // frames completed since then
+    int frame_cycles = 0;
+    int next_interrupt = 1;
+    Snapshot state;
+};
+
+// A change made to the machine from outside while it was stopped, such as
+// a debugger writing memory or a register
+struct HistoryInput
+{
+    uint64_t step = 0; // instruction it was made before
+    bool memory = false;
+    uint16_t target = 0; // address, or register number
+    uint16_t value = 0;
+};
+
+// Recording of a deterministic run, for stepping backwards through it
+//
+// Any earlier point of the run is reached by restoring the last snapshot
+// before it, applying the inputs logged since and executing forward to
+// it, so the cost of going back is bounded by the distance between
+// snapshots. Snapshots are taken every Interval() frames, and the interval
+// follows the speed the machine was last measured at so that getting from
+// a snapshot to any point before the next takes at most half the budget
+// given to the constructor.
+class History
+{
+public:
+    static const int kMaxSnapshots = 2048;
+    static const uint64_t kMaxInterval = 3600; // a minute of frames
+
+    explicit History(double budget_seconds = 0.05);
+
+    void Clear();
+    bool Empty() const;
+    uint64_t Begin() const;
+    uint64_t End() const;
+
+    bool SnapshotDue(uint64_t step, uint64_t frame) const;
+    void AddSnapshot(const HistorySnapshot &snapshot);
+    const HistorySnapshot &Nearest(uint64_t step) const;
+    size_t Snapshots() const;
+    size_t MemoryUse() const;
+
+    void AddInput(const HistoryInput &input);
+    bool HasInputs(uint64_t step) const;
+    std::vector<HistoryInput> InputsAt(uint64_t step) const;
+
+    void Advance(uint64_t step);
+    void Truncate(uint64_t step);
+
+    void NoteSpeed(uint64_t frames, double seconds);
+    void SetInterval(uint64_t frames);
+    uint64_t Interval() const;
+
+private:
+    void Thin();
+
+    double budget;
+    bool fixed_interval;
+    uint64_t interval;
+    uint64_t measured_frames; // run since the interval was last set
+    double measured_seconds;
+    uint64_t end; // furthest step reached
+    std::vector<HistorySnapshot> snapshots;
+    std::vector<HistoryInput> inputs;
+};
+
+#endif // EMULATOR_HISTORY_HPP_
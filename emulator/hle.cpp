@@ -0,0 +1,887 @@
+#include "emulator/hle.hpp"
+
+using namespace std;
+
+const int HleTable::kRomSize;
+
+namespace
+{
+// HleTable::RomHash of the Space Invaders ROM the routines below are from
+const uint64_t kInvadersRomHash = 0xa02b653391170906ull;
+
+// Whether value has an even number of bits set
+bool EvenParity(uint8_t value)
+{
+    int bits = 0;
+    for (; value != 0; value >>= 1)
+    {
+        bits += value & 1;
+    }
+    return (bits & 1) == 0;
+}
+
+// The CPU as a hook runs it
+//
+// Registers, flags and SP are copied out of the machine and put back by
+// Leave; memory goes through ReadFromMem and WriteToMem in the order the
+// instructions access it, so that dirty pages, writes outside RAM and a
+// stack that overlaps what the routine draws all come out as they would
+// from the interpreter. The operations set flags exactly as the
+// interpreter's instructions of the same name do.
+struct Cpu
+{
+    explicit Cpu(Emulator *machine)
+        : e(machine), r(machine->GetRegisters()), f(machine->GetFlags()),
+          sp(static_cast<uint16_t>(machine->GetSP())), cycles(0)
+    {
+    }
+
+    uint16_t BC() const
+    {
+        return static_cast<uint16_t>(r.B << 8 | r.C);
+    }
+
+    uint16_t DE() const
+    {
+        return static_cast<uint16_t>(r.D << 8 | r.E);
+    }
+
+    uint16_t HL() const
+    {
+        return static_cast<uint16_t>(r.H << 8 | r.L);
+    }
+
+    void SetDE(uint16_t value)
+    {
+        r.D = static_cast<uint8_t>(value >> 8);
+        r.E = static_cast<uint8_t>(value);
+    }
+
+    void SetHL(uint16_t value)
+    {
+        r.H = static_cast<uint8_t>(value >> 8);
+        r.L = static_cast<uint8_t>(value);
+    }
+
+    uint8_t Read(uint16_t address)
+    {
+        return e->ReadFromMem(address);
+    }
+
+    void Write(uint16_t address, uint8_t value)
+    {
+        e->WriteToMem(address, value);
+    }
+
+    void Push(uint8_t high, uint8_t low)
+    {
+        Write(static_cast<uint16_t>(sp - 1), high);
+        Write(static_cast<uint16_t>(sp - 2), low);
+        sp -= 2;
+    }
+
+    void Pop(uint8_t *high, uint8_t *low)
+    {
+        *low = Read(sp);
+        *high = Read(static_cast<uint16_t>(sp + 1));
+        sp += 2;
+    }
+
+    // PUSH PSW and POP PSW, with the flags packed the way the interpreter
+    // packs them
+    void PushPsw()
+    {
+        Push(r.A, static_cast<uint8_t>(f.z | f.s << 1 | f.p << 2 | f.cy << 3 | f.ac << 4));
+    }
+
+    void PopPsw()
+    {
+        uint8_t psw;
+        Pop(&r.A, &psw);
+        f.z = (psw & 0x01) != 0;
+        f.s = (psw & 0x02) != 0;
+        f.p = (psw & 0x04) != 0;
+        f.cy = (psw & 0x08) != 0;
+        f.ac = (psw & 0x10) != 0;
+    }
+
+    void ZspFlags(uint8_t value)
+    {
+        f.z = value == 0;
+        f.s = (value & 0x80) != 0;
+        f.p = EvenParity(value);
+    }
+
+    // ORA, XRA and ORI flags
+    void LogicFlags()
+    {
+        f.cy = false;
+        f.ac = false;
+        ZspFlags(r.A);
+    }
+
+    void Ana(uint8_t operand)
+    {
+        bool ac = ((r.A | operand) & 0x08) != 0;
+        r.A &= operand;
+        LogicFlags();
+        f.ac = ac;
+    }
+
+    void Ora(uint8_t operand)
+    {
+        r.A |= operand;
+        LogicFlags();
+    }
+
+    void Cpi(uint8_t operand)
+    {
+        uint16_t complement = static_cast<uint16_t>(~operand & 0xff);
+        uint16_t result = static_cast<uint16_t>(r.A + complement + 1);
+        f.ac = ((r.A & 0x0f) + (complement & 0x0f) + 1) > 0x0f;
+        ZspFlags(static_cast<uint8_t>(result));
+        f.cy = (result & 0x100) == 0;
+    }
+
+    uint8_t Dcr(uint8_t value)
+    {
+        value--;
+        f.ac = (value & 0x0f) != 0x0f;
+        ZspFlags(value);
+        return value;
+    }
+
+    void Rar()
+    {
+        bool carry = (r.A & 0x01) != 0;
+        r.A = static_cast<uint8_t>(r.A >> 1 | f.cy << 7);
+        f.cy = carry;
+    }
+
+    void Dad(uint16_t value)
+    {
+        uint32_t sum = static_cast<uint32_t>(HL()) + value;
+        SetHL(static_cast<uint16_t>(sum));
+        f.cy = (sum & 0x10000) != 0;
+    }
+
+    // CALL CnvtPixNumber (0x1474), returning to return_pc: turn the pixel
+    // position in HL into a screen address, setting the shift amount on
+    // port 2, which goes nowhere while hooks run. Returns where its RET
+    // went, which is return_pc unless the stack is not writable.
+    uint16_t CnvtPixNumber(uint16_t return_pc)
+    {
+        Push(static_cast<uint8_t>(return_pc >> 8), static_cast<uint8_t>(return_pc)); // CALL 1474
+        r.A = r.L;                                                                     // MOV A,L
+        Ana(0x07);                                                                     // ANI 07
+        Push(r.B, r.C);                                                                // OUT 02, JMP 1a47, PUSH B
+        r.B = 3;                                                                       // MVI B,03
+        do
+        {
+            r.A = r.H; // MOV A,H
+            Rar();
+            r.H = r.A; // MOV H,A
+            r.A = r.L; // MOV A,L
+            Rar();
+            r.L = r.A; // MOV L,A
+            r.B = Dcr(r.B);
+        } while (!f.z);
+        r.A = r.H; // MOV A,H
+        Ana(0x3f);
+        Ora(0x20); // ORI 20
+        r.H = r.A; // MOV H,A
+        Pop(&r.B, &r.C);
+        uint8_t high;
+        uint8_t low;
+        Pop(&high, &low); // RET
+        cycles += kCnvtPixNumberCycles;
+        return static_cast<uint16_t>(high << 8 | low);
+    }
+
+    // Whether the instructions from here, taking cycles_needed, would all
+    // start within this call to Emulate
+    bool Fits(int cycles_needed, int cycles_left) const
+    {
+        return cycles + cycles_needed <= cycles_left;
+    }
+
+    // Put the CPU back in the machine at pc and return the cycles spent
+    int Leave(uint16_t pc)
+    {
+        e->SetRegisters(r);
+        e->SetFlags(f);
+        e->SetSP(sp);
+        e->SetPC(pc);
+        return cycles;
+    }
+
+    // RET at ret_pc, if it fits
+    int Return(uint16_t ret_pc, int cycles_left)
+    {
+        if (!Fits(10, cycles_left))
+        {
+            return Leave(ret_pc);
+        }
+        uint8_t high;
+        uint8_t low;
+        Pop(&high, &low);
+        cycles += 10;
+        return Leave(static_cast<uint16_t>(high << 8 | low));
+    }
+
+    // CALL 17, MOV A,L 5, ANI 7, OUT 10, JMP 10, PUSH B 11, MVI B 7,
+    // three turns of MOV A,H 5, RAR 4, MOV H,A 5, MOV A,L 5, RAR 4,
+    // MOV L,A 5, DCR B 5, JNZ 10, then MOV A,H 5, ANI 7, ORI 7, MOV H,A 5,
+    // POP B 10, RET 10
+    static const int kCnvtPixNumberCycles =
+        17 + 5 + 7 + 10 + 10 + 11 + 7 + 3 * (5 + 4 + 5 + 5 + 4 + 5 + 5 + 10) + 5 + 7 + 7 + 5 + 10 + 10;
+
+    Emulator *e;
+    Registers r;
+    Flags f;
+    uint16_t sp;
+    int cycles;
+};
+
+const int Cpu::kCnvtPixNumberCycles;
+
+// LXI B,0020 / DAD B, moving HL down a row of the screen
+void NextRow(Cpu *cpu)
+{
+    cpu->r.B = 0x00;
+    cpu->r.C = 0x20;
+    cpu->Dad(cpu->BC());
+}
+
+// DrawShiftedSprite rows, from 0x1405
+//   PUSH B / PUSH H / LDAX D / OUT 04 / IN 03 / ORA M / MOV M,A / INX H /
+//   INX D / XRA A / OUT 04 / IN 03 / ORA M / MOV M,A / POP H / LXI B,0020 /
+//   DAD B / POP B / DCR B / JNZ 1405 / RET
+// There is no shift register in this machine, so IN 03 leaves A as it is.
+int DrawShiftedRows(Cpu *cpu, int cycles_left)
+{
+    const int kRowCycles = 11 + 11 + 7 + 10 + 10 + 7 + 7 + 5 + 5 + 4 + 10 + 10 + 7 + 7 + 10 + 10 + 10 + 10 + 5 + 10;
+    do
+    {
+        if (!cpu->Fits(kRowCycles, cycles_left))
+        {
+            return cpu->Leave(0x1405);
+        }
+        cpu->Push(cpu->r.B, cpu->r.C);
+        cpu->Push(cpu->r.H, cpu->r.L);
+        cpu->r.A = cpu->Read(cpu->DE());
+        cpu->Ora(cpu->Read(cpu->HL()));
+        cpu->Write(cpu->HL(), cpu->r.A);
+        cpu->SetHL(cpu->HL() + 1);
+        cpu->SetDE(cpu->DE() + 1);
+        cpu->r.A = 0;
+        cpu->LogicFlags();
+        cpu->Ora(cpu->Read(cpu->HL()));
+        cpu->Write(cpu->HL(), cpu->r.A);
+        cpu->Pop(&cpu->r.H, &cpu->r.L);
+        NextRow(cpu);
+        cpu->Pop(&cpu->r.B, &cpu->r.C);
+        cpu->r.B = cpu->Dcr(cpu->r.B);
+        cpu->cycles += kRowCycles;
+    } while (!cpu->f.z);
+    return cpu->Return(0x1421, cycles_left);
+}
+
+// DrawShiftedSprite, 0x1400: OR B rows of two bytes from DE into the
+// screen at the pixel position in HL
+//   NOP / CALL 1474 / NOP
+int DrawShiftedSprite(Emulator *e, int cycles_left)
+{
+    Cpu cpu(e);
+    if (!cpu.Fits(4 + Cpu::kCnvtPixNumberCycles + 4, cycles_left))
+    {
+        return 0;
+    }
+    cpu.cycles += 4;
+    uint16_t ret = cpu.CnvtPixNumber(0x1404);
+    if (ret != 0x1404)
+    {
+        return cpu.Leave(ret);
+    }
+    cpu.cycles += 4;
+    return DrawShiftedRows(&cpu, cycles_left);
+}
+
+int DrawShiftedSpriteLoop(Emulator *e, int cycles_left)
+{
+    Cpu cpu(e);
+    return DrawShiftedRows(&cpu, cycles_left);
+}
+
+// EraseSimpleSprite rows, from 0x1427
+//   PUSH B / PUSH H / XRA A / MOV M,A / INX H / MOV M,A / INX H / POP H /
+//   LXI B,0020 / DAD B / POP B / DCR B / JNZ 1427 / RET
+int EraseSimpleRows(Cpu *cpu, int cycles_left)
+{
+    const int kRowCycles = 11 + 11 + 4 + 7 + 5 + 7 + 5 + 10 + 10 + 10 + 10 + 5 + 10;
+    do
+    {
+        if (!cpu->Fits(kRowCycles, cycles_left))
+        {
+            return cpu->Leave(0x1427);
+        }
+        cpu->Push(cpu->r.B, cpu->r.C);
+        cpu->Push(cpu->r.H, cpu->r.L);
+        cpu->r.A = 0;
+        cpu->LogicFlags();
+        cpu->Write(cpu->HL(), cpu->r.A);
+        cpu->SetHL(cpu->HL() + 1);
+        cpu->Write(cpu->HL(), cpu->r.A);
+        cpu->SetHL(cpu->HL() + 1);
+        cpu->Pop(&cpu->r.H, &cpu->r.L);
+        NextRow(cpu);
+        cpu->Pop(&cpu->r.B, &cpu->r.C);
+        cpu->r.B = cpu->Dcr(cpu->r.B);
+        cpu->cycles += kRowCycles;
+    } while (!cpu->f.z);
+    return cpu->Return(0x1438, cycles_left);
+}
+
+// EraseSimpleSprite, 0x1424: clear B rows of two bytes on the screen at
+// the pixel position in HL
+//   CALL 1474
+int EraseSimpleSprite(Emulator *e, int cycles_left)
+{
+    Cpu cpu(e);
+    if (!cpu.Fits(Cpu::kCnvtPixNumberCycles, cycles_left))
+    {
+        return 0;
+    }
+    uint16_t ret = cpu.CnvtPixNumber(0x1427);
+    if (ret != 0x1427)
+    {
+        return cpu.Leave(ret);
+    }
+    return EraseSimpleRows(&cpu, cycles_left);
+}
+
+int EraseSimpleSpriteLoop(Emulator *e, int cycles_left)
+{
+    Cpu cpu(e);
+    return EraseSimpleRows(&cpu, cycles_left);
+}
+
+// DrawSimpSprite, 0x1439: copy B bytes from DE to the screen at HL, one
+// per row; the loop starts at the entry point
+//   PUSH B / LDAX D / MOV M,A / INX D / LXI B,0020 / DAD B / POP B /
+//   DCR B / JNZ 1439 / RET
+int DrawSimpSprite(Emulator *e, int cycles_left)
+{
+    const int kRowCycles = 11 + 7 + 7 + 5 + 10 + 10 + 10 + 5 + 10;
+    Cpu cpu(e);
+    do
+    {
+        if (!cpu.Fits(kRowCycles, cycles_left))
+        {
+            return cpu.Leave(0x1439);
+        }
+        cpu.Push(cpu.r.B, cpu.r.C);
+        cpu.r.A = cpu.Read(cpu.DE());
+        cpu.Write(cpu.HL(), cpu.r.A);
+        cpu.SetDE(cpu.DE() + 1);
+        NextRow(&cpu);
+        cpu.Pop(&cpu.r.B, &cpu.r.C);
+        cpu.r.B = cpu.Dcr(cpu.r.B);
+        cpu.cycles += kRowCycles;
+    } while (!cpu.f.z);
+    return cpu.Return(0x1446, cycles_left);
+}
+
+// EraseShifted rows, from 0x1455
+//   PUSH B / PUSH H / LDAX D / OUT 04 / IN 03 / CMA / ANA M / MOV M,A /
+//   INX H / INX D / XRA A / OUT 04 / IN 03 / CMA / ANA M / MOV M,A /
+//   POP H / LXI B,0020 / DAD B / POP B / DCR B / JNZ 1455 / RET
+int EraseShiftedRows(Cpu *cpu, int cycles_left)
+{
+    const int kRowCycles =
+        11 + 11 + 7 + 10 + 10 + 4 + 7 + 7 + 5 + 5 + 4 + 10 + 10 + 4 + 7 + 7 + 10 + 10 + 10 + 10 + 5 + 10;
+    do
+    {
+        if (!cpu->Fits(kRowCycles, cycles_left))
+        {
+            return cpu->Leave(0x1455);
+        }
+        cpu->Push(cpu->r.B, cpu->r.C);
+        cpu->Push(cpu->r.H, cpu->r.L);
+        cpu->r.A = static_cast<uint8_t>(~cpu->Read(cpu->DE()));
+        cpu->Ana(cpu->Read(cpu->HL()));
+        cpu->Write(cpu->HL(), cpu->r.A);
+        cpu->SetHL(cpu->HL() + 1);
+        cpu->SetDE(cpu->DE() + 1);
+        cpu->r.A = 0xff; // XRA A / CMA
+        cpu->Ana(cpu->Read(cpu->HL()));
+        cpu->Write(cpu->HL(), cpu->r.A);
+        cpu->Pop(&cpu->r.H, &cpu->r.L);
+        NextRow(cpu);
+        cpu->Pop(&cpu->r.B, &cpu->r.C);
+        cpu->r.B = cpu->Dcr(cpu->r.B);
+        cpu->cycles += kRowCycles;
+    } while (!cpu->f.z);
+    return cpu->Return(0x1473, cycles_left);
+}
+
+// EraseShifted, 0x1452: clear the bits of B rows of two bytes from DE out
+// of the screen at the pixel position in HL
+//   CALL 1474
+int EraseShifted(Emulator *e, int cycles_left)
+{
+    Cpu cpu(e);
+    if (!cpu.Fits(Cpu::kCnvtPixNumberCycles, cycles_left))
+    {
+        return 0;
+    }
+    uint16_t ret = cpu.CnvtPixNumber(0x1455);
+    if (ret != 0x1455)
+    {
+        return cpu.Leave(ret);
+    }
+    return EraseShiftedRows(&cpu, cycles_left);
+}
+
+int EraseShiftedLoop(Emulator *e, int cycles_left)
+{
+    Cpu cpu(e);
+    return EraseShiftedRows(&cpu, cycles_left);
+}
+
+// One byte of DrawSprCollision: OR A into the screen at HL, and note in
+// 0x2061 if it hits anything already drawn
+//   PUSH PSW / ANA M / JZ + / MVI A,01 / STA 2061 / + POP PSW / ORA M / MOV M,A
+void DrawCollidingByte(Cpu *cpu)
+{
+    cpu->PushPsw();
+    cpu->Ana(cpu->Read(cpu->HL()));
+    if (!cpu->f.z)
+    {
+        cpu->r.A = 0x01;
+        cpu->Write(0x2061, cpu->r.A);
+        cpu->cycles += 7 + 13;
+    }
+    cpu->PopPsw();
+    cpu->Ora(cpu->Read(cpu->HL()));
+    cpu->Write(cpu->HL(), cpu->r.A);
+}
+
+// DrawSprCollision rows, from 0x1498
+//   PUSH B / PUSH H / LDAX D / OUT 04 / IN 03 / (colliding byte) / INX H /
+//   INX D / XRA A / OUT 04 / IN 03 / (colliding byte) / POP H /
+//   LXI B,0020 / DAD B / POP B / DCR B / JNZ 1498 / RET
+int DrawSprCollisionRows(Cpu *cpu, int cycles_left)
+{
+    const int kByteCycles = 11 + 7 + 10 + 10 + 7 + 7; // a byte that hits nothing
+    const int kRowCycles = 11 + 11 + 7 + 10 + 10 + kByteCycles + 5 + 5 + 4 + 10 + 10 + kByteCycles + 10 + 10 + 10 +
+                           10 + 5 + 10;
+    do
+    {
+        // a row that collides twice takes longest
+        if (!cpu->Fits(kRowCycles + 2 * (7 + 13), cycles_left))
+        {
+            return cpu->Leave(0x1498);
+        }
+        cpu->Push(cpu->r.B, cpu->r.C);
+        cpu->Push(cpu->r.H, cpu->r.L);
+        cpu->r.A = cpu->Read(cpu->DE());
+        DrawCollidingByte(cpu);
+        cpu->SetHL(cpu->HL() + 1);
+        cpu->SetDE(cpu->DE() + 1);
+        cpu->r.A = 0;
+        cpu->LogicFlags();
+        DrawCollidingByte(cpu);
+        cpu->Pop(&cpu->r.H, &cpu->r.L);
+        NextRow(cpu);
+        cpu->Pop(&cpu->r.B, &cpu->r.C);
+        cpu->r.B = cpu->Dcr(cpu->r.B);
+        cpu->cycles += kRowCycles;
+    } while (!cpu->f.z);
+    return cpu->Return(0x14ca, cycles_left);
+}
+
+// DrawSprCollision, 0x1491: DrawShiftedSprite, setting 0x2061 if the
+// sprite overlaps anything on the screen
+//   CALL 1474 / XRA A / STA 2061
+int DrawSprCollision(Emulator *e, int cycles_left)
+{
+    Cpu cpu(e);
+    if (!cpu.Fits(Cpu::kCnvtPixNumberCycles + 4 + 13, cycles_left))
+    {
+        return 0;
+    }
+    uint16_t ret = cpu.CnvtPixNumber(0x1494);
+    if (ret != 0x1494)
+    {
+        return cpu.Leave(ret);
+    }
+    cpu.r.A = 0;
+    cpu.LogicFlags();
+    cpu.Write(0x2061, cpu.r.A);
+    cpu.cycles += 4 + 13;
+    return DrawSprCollisionRows(&cpu, cycles_left);
+}
+
+int DrawSprCollisionLoop(Emulator *e, int cycles_left)
+{
+    Cpu cpu(e);
+    return DrawSprCollisionRows(&cpu, cycles_left);
+}
+
+// ClearSmallSprite rows, from 0x14cc
+//   PUSH B / MOV M,A / LXI B,0020 / DAD B / POP B / DCR B / JNZ 14cc / RET
+int ClearSmallRows(Cpu *cpu, int cycles_left)
+{
+    const int kRowCycles = 11 + 7 + 10 + 10 + 10 + 5 + 10;
+    do
+    {
+        if (!cpu->Fits(kRowCycles, cycles_left))
+        {
+            return cpu->Leave(0x14cc);
+        }
+        cpu->Push(cpu->r.B, cpu->r.C);
+        cpu->Write(cpu->HL(), cpu->r.A);
+        NextRow(cpu);
+        cpu->Pop(&cpu->r.B, &cpu->r.C);
+        cpu->r.B = cpu->Dcr(cpu->r.B);
+        cpu->cycles += kRowCycles;
+    } while (!cpu->f.z);
+    return cpu->Return(0x14d7, cycles_left);
+}
+
+// ClearSmallSprite, 0x14cb: clear B bytes on the screen from HL, one per
+// row
+//   XRA A
+int ClearSmallSprite(Emulator *e, int cycles_left)
+{
+    Cpu cpu(e);
+    if (!cpu.Fits(4, cycles_left))
+    {
+        return 0;
+    }
+    cpu.r.A = 0;
+    cpu.LogicFlags();
+    cpu.cycles += 4;
+    return ClearSmallRows(&cpu, cycles_left);
+}
+
+int ClearSmallSpriteLoop(Emulator *e, int cycles_left)
+{
+    Cpu cpu(e);
+    return ClearSmallRows(&cpu, cycles_left);
+}
+
+// DrawSprite, 0x15d3: like DrawShiftedSprite but overwriting the screen,
+// keeping HL
+//   CALL 1474 / PUSH H / rows from 15d7: PUSH B / PUSH H / LDAX D / OUT 04 /
+//   IN 03 / MOV M,A / INX H / INX D / XRA A / OUT 04 / IN 03 / MOV M,A /
+//   POP H / LXI B,0020 / DAD B / POP B / DCR B / JNZ 15d7 / POP H / RET
+int DrawSpriteRows(Cpu *cpu, int cycles_left)
+{
+    const int kRowCycles = 11 + 11 + 7 + 10 + 10 + 7 + 5 + 5 + 4 + 10 + 10 + 7 + 10 + 10 + 10 + 10 + 5 + 10;
+    do
+    {
+        if (!cpu->Fits(kRowCycles, cycles_left))
+        {
+            return cpu->Leave(0x15d7);
+        }
+        cpu->Push(cpu->r.B, cpu->r.C);
+        cpu->Push(cpu->r.H, cpu->r.L);
+        cpu->r.A = cpu->Read(cpu->DE());
+        cpu->Write(cpu->HL(), cpu->r.A);
+        cpu->SetHL(cpu->HL() + 1);
+        cpu->SetDE(cpu->DE() + 1);
+        cpu->r.A = 0;
+        cpu->LogicFlags();
+        cpu->Write(cpu->HL(), cpu->r.A);
+        cpu->Pop(&cpu->r.H, &cpu->r.L);
+        NextRow(cpu);
+        cpu->Pop(&cpu->r.B, &cpu->r.C);
+        cpu->r.B = cpu->Dcr(cpu->r.B);
+        cpu->cycles += kRowCycles;
+    } while (!cpu->f.z);
+    if (!cpu->Fits(10, cycles_left))
+    {
+        return cpu->Leave(0x15f1);
+    }
+    cpu->Pop(&cpu->r.H, &cpu->r.L);
+    cpu->cycles += 10;
+    return cpu->Return(0x15f2, cycles_left);
+}
+
+int DrawSprite(Emulator *e, int cycles_left)
+{
+    Cpu cpu(e);
+    if (!cpu.Fits(Cpu::kCnvtPixNumberCycles + 11, cycles_left))
+    {
+        return 0;
+    }
+    uint16_t ret = cpu.CnvtPixNumber(0x15d6);
+    if (ret != 0x15d6)
+    {
+        return cpu.Leave(ret);
+    }
+    cpu.Push(cpu.r.H, cpu.r.L);
+    cpu.cycles += 11;
+    return DrawSpriteRows(&cpu, cycles_left);
+}
+
+int DrawSpriteLoop(Emulator *e, int cycles_left)
+{
+    Cpu cpu(e);
+    return DrawSpriteRows(&cpu, cycles_left);
+}
+
+// Column scan loop, from 0x15c7: look for a set byte in the B bytes from
+// HL, jumping to 0x166b at the first one
+//   MOV A,M / ANA A / JNZ 166b / INX H / DCR B / JNZ 15c7 / RET
+int ScanColumnBytes(Cpu *cpu, int cycles_left)
+{
+    const int kTestCycles = 7 + 4 + 10;
+    const int kNextCycles = 5 + 5 + 10;
+    do
+    {
+        if (!cpu->Fits(kTestCycles + kNextCycles, cycles_left))
+        {
+            return cpu->Leave(0x15c7);
+        }
+        cpu->r.A = cpu->Read(cpu->HL());
+        cpu->Ana(cpu->r.A);
+        cpu->cycles += kTestCycles;
+        if (!cpu->f.z)
+        {
+            return cpu->Leave(0x166b);
+        }
+        cpu->SetHL(cpu->HL() + 1);
+        cpu->r.B = cpu->Dcr(cpu->r.B);
+        cpu->cycles += kNextCycles;
+    } while (!cpu->f.z);
+    return cpu->Return(0x15d1, cycles_left);
+}
+
+// Column scan, 0x15c5: look for a set byte in the 23 bytes of the screen
+// column from HL, which the fleet's edge checks call
+//   MVI B,17
+int ScanColumn(Emulator *e, int cycles_left)
+{
+    Cpu cpu(e);
+    if (!cpu.Fits(7, cycles_left))
+    {
+        return 0;
+    }
+    cpu.r.B = 0x17;
+    cpu.cycles += 7;
+    return ScanColumnBytes(&cpu, cycles_left);
+}
+
+int ScanColumnLoop(Emulator *e, int cycles_left)
+{
+    Cpu cpu(e);
+    return ScanColumnBytes(&cpu, cycles_left);
+}
+
+// BlockCopy, 0x1a32: copy B bytes from DE to HL; the loop starts at the
+// entry point
+//   LDAX D / MOV M,A / INX H / INX D / DCR B / JNZ 1a32 / RET
+int BlockCopy(Emulator *e, int cycles_left)
+{
+    const int kByteCycles = 7 + 7 + 5 + 5 + 5 + 10;
+    Cpu cpu(e);
+    do
+    {
+        if (!cpu.Fits(kByteCycles, cycles_left))
+        {
+            return cpu.Leave(0x1a32);
+        }
+        cpu.r.A = cpu.Read(cpu.DE());
+        cpu.Write(cpu.HL(), cpu.r.A);
+        cpu.SetHL(cpu.HL() + 1);
+        cpu.SetDE(cpu.DE() + 1);
+        cpu.r.B = cpu.Dcr(cpu.r.B);
+        cpu.cycles += kByteCycles;
+    } while (!cpu.f.z);
+    return cpu.Return(0x1a3a, cycles_left);
+}
+
+// ClearScreen loop, from 0x1a5f: clear memory from HL up to 0x4000
+//   MVI M,00 / INX H / MOV A,H / CPI 40 / JNZ 1a5f / RET
+// The whole screen takes several frames' worth of cycles, so this usually
+// stops at the top of the loop and goes on after the next interrupt.
+int ClearScreenRows(Cpu *cpu, int cycles_left)
+{
+    const int kByteCycles = 10 + 5 + 5 + 7 + 10;
+    do
+    {
+        if (!cpu->Fits(kByteCycles, cycles_left))
+        {
+            return cpu->Leave(0x1a5f);
+        }
+        cpu->Write(cpu->HL(), 0x00);
+        cpu->SetHL(cpu->HL() + 1);
+        cpu->r.A = cpu->r.H;
+        cpu->Cpi(0x40);
+        cpu->cycles += kByteCycles;
+    } while (!cpu->f.z);
+    return cpu->Return(0x1a68, cycles_left);
+}
+
+// ClearScreen, 0x1a5c: clear the screen
+//   LXI H,2400
+int ClearScreen(Emulator *e, int cycles_left)
+{
+    Cpu cpu(e);
+    if (!cpu.Fits(10, cycles_left))
+    {
+        return 0;
+    }
+    cpu.SetHL(0x2400);
+    cpu.cycles += 10;
+    return ClearScreenRows(&cpu, cycles_left);
+}
+
+int ClearScreenLoop(Emulator *e, int cycles_left)
+{
+    Cpu cpu(e);
+    return ClearScreenRows(&cpu, cycles_left);
+}
+
+// ClearPlayField loop, from 0x09d9: clear the screen from HL up to 0x4000,
+// leaving the last four bytes of every line
+//   MVI M,00 / INX H / MOV A,L / ANI 1f / CPI 1c / JC 09e8 /
+//   LXI D,0006 / DAD D / 09e8 MOV A,H / CPI 40 / JC 09d9 / RET
+int ClearPlayFieldRows(Cpu *cpu, int cycles_left)
+{
+    const int kByteCycles = 10 + 5 + 5 + 7 + 7 + 10 + 5 + 7 + 10;
+    const int kLineEndCycles = 10 + 10;
+    do
+    {
+        if (!cpu->Fits(kByteCycles + kLineEndCycles, cycles_left))
+        {
+            return cpu->Leave(0x09d9);
+        }
+        cpu->Write(cpu->HL(), 0x00);
+        cpu->SetHL(cpu->HL() + 1);
+        cpu->r.A = cpu->r.L;
+        cpu->Ana(0x1f);
+        cpu->Cpi(0x1c);
+        cpu->cycles += kByteCycles;
+        if (!cpu->f.cy)
+        {
+            cpu->SetDE(0x0006);
+            cpu->Dad(cpu->DE());
+            cpu->cycles += kLineEndCycles;
+        }
+        cpu->r.A = cpu->r.H;
+        cpu->Cpi(0x40);
+    } while (cpu->f.cy);
+    return cpu->Return(0x09ee, cycles_left);
+}
+
+// ClearPlayField, 0x09d6: clear the screen below the score line
+//   LXI H,2402
+int ClearPlayField(Emulator *e, int cycles_left)
+{
+    Cpu cpu(e);
+    if (!cpu.Fits(10, cycles_left))
+    {
+        return 0;
+    }
+    cpu.SetHL(0x2402);
+    cpu.cycles += 10;
+    return ClearPlayFieldRows(&cpu, cycles_left);
+}
+
+int ClearPlayFieldLoop(Emulator *e, int cycles_left)
+{
+    Cpu cpu(e);
+    return ClearPlayFieldRows(&cpu, cycles_left);
+}
+
+// The sprite, copy and clearing routines, each entry point followed by
+// its loop's
+HleTable InvadersHooks()
+{
+    const HleHook hooks[] = {
+        {"ClearPlayField", kInvadersRomHash, 0x09d6, ClearPlayField},
+        {"ClearPlayField loop", kInvadersRomHash, 0x09d9, ClearPlayFieldLoop},
+        {"DrawShiftedSprite", kInvadersRomHash, 0x1400, DrawShiftedSprite},
+        {"DrawShiftedSprite loop", kInvadersRomHash, 0x1405, DrawShiftedSpriteLoop},
+        {"EraseSimpleSprite", kInvadersRomHash, 0x1424, EraseSimpleSprite},
+        {"EraseSimpleSprite loop", kInvadersRomHash, 0x1427, EraseSimpleSpriteLoop},
+        {"DrawSimpSprite", kInvadersRomHash, 0x1439, DrawSimpSprite},
+        {"EraseShifted", kInvadersRomHash, 0x1452, EraseShifted},
+        {"EraseShifted loop", kInvadersRomHash, 0x1455, EraseShiftedLoop},
+        {"DrawSprCollision", kInvadersRomHash, 0x1491, DrawSprCollision},
+        {"DrawSprCollision loop", kInvadersRomHash, 0x1498, DrawSprCollisionLoop},
+        {"ClearSmallSprite", kInvadersRomHash, 0x14cb, ClearSmallSprite},
+        {"ClearSmallSprite loop", kInvadersRomHash, 0x14cc, ClearSmallSpriteLoop},
+        {"column scan", kInvadersRomHash, 0x15c5, ScanColumn},
+        {"column scan loop", kInvadersRomHash, 0x15c7, ScanColumnLoop},
+        {"DrawSprite", kInvadersRomHash, 0x15d3, DrawSprite},
+        {"DrawSprite loop", kInvadersRomHash, 0x15d7, DrawSpriteLoop},
+        {"BlockCopy", kInvadersRomHash, 0x1a32, BlockCopy},
+        {"ClearScreen", kInvadersRomHash, 0x1a5c, ClearScreen},
+        {"ClearScreen loop", kInvadersRomHash, 0x1a5f, ClearScreenLoop},
+    };
+    HleTable table;
+    for (size_t i = 0; i < sizeof(hooks) / sizeof(hooks[0]); i++)
+    {
+        table.Add(hooks[i]);
+    }
+    return table;
+}
+} // namespace
+
+// Add a hook, replacing any hook at the same entry point of the same ROM
+void HleTable::Add(const HleHook &hook)
+{
+    if (hook.address >= kRomSize)
+    {
+        return;
+    }
+    vector<HleFunction> &rom = entries[hook.rom_hash];
+    rom.resize(kRomSize, nullptr);
+    rom[hook.address] = hook.run;
+    for (size_t i = 0; i < hooks.size(); i++)
+    {
+        if (hooks[i].rom_hash == hook.rom_hash && hooks[i].address == hook.address)
+        {
+            hooks[i] = hook;
+            return;
+        }
+    }
+    hooks.push_back(hook);
+}
+
+// All hooks in the table, for every ROM
+const vector<HleHook> &HleTable::Hooks() const
+{
+    return hooks;
+}
+
+// The hook for each address below kRomSize in the ROM with hash rom_hash,
+// nullptr where there is none, or nullptr if there are no hooks for it
+const HleFunction *HleTable::Entries(uint64_t rom_hash) const
+{
+    map<uint64_t, vector<HleFunction>>::const_iterator rom = entries.find(rom_hash);
+    return rom == entries.end() ? nullptr : rom->second.data();
+}
+
+// FNV-1a of the size bytes of ROM at memory
+uint64_t HleTable::RomHash(const uint8_t *memory, int size)
+{
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (int i = 0; i < size; i++)
+    {
+        hash = (hash ^ memory[i]) * 0x100000001b3ull;
+    }
+    return hash;
+}
+
+// Hooks for the Space Invaders ROM
+const HleTable &HleTable::SpaceInvaders()
+{
+    static const HleTable table = InvadersHooks();
+    return table;
+}
@@ -0,0 +1,54 @@
+#ifndef EMULATOR_HLE_HPP_
+#define EMULATOR_HLE_HPP_
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+#include "emulator/emulator.hpp"
+
+// A ROM routine with a native implementation, see HleTable
+struct HleHook
+{
+    std::string name;
+    uint64_t rom_hash; // HleTable::RomHash of the ROM the routine is in
+    uint16_t address;  // entry point
+    HleFunction run;
+};
+
+// Native implementations of ROM routines (high-level emulation), keyed by
+// ROM hash and entry point
+//
+// Once a table is given to Emulator::SetHleHooks, a CALL or a jump back to
+// an entry point hands the CPU to the hook, with the cycles left in the
+// current call to Emulate. The hook does what the routine's instructions
+// would have done to registers, flags, memory and the stack, sets PC to
+// where they would have got to and returns the cycles they take. It may
+// stop at any instruction the interpreter would reach, typically the top of
+// a loop, but never runs an instruction the interpreter would leave for the
+// next call, so interrupts still come between the same instructions; a
+// loop's head is therefore usually an entry point of its own. A hook that
+// returns 0 has changed nothing and the instructions are executed instead.
+// Hooks for a ROM other than the one in memory are never called.
+class HleTable
+{
+public:
+    // the bytes hashed to pick the hooks that apply; entry points are below
+    static const int kRomSize = 0x2000;
+
+    void Add(const HleHook &hook);
+    const std::vector<HleHook> &Hooks() const;
+    const HleFunction *Entries(uint64_t rom_hash) const;
+
+    static uint64_t RomHash(const uint8_t *memory, int size);
+    static const HleTable &SpaceInvaders();
+
+private:
+    std::vector<HleHook> hooks;
+
+    // kRomSize functions for each ROM with hooks, nullptr where there is
+    // no entry point
+    std::map<uint64_t, std::vector<HleFunction>> entries;
+};
+
+#endif // EMULATOR_HLE_HPP_
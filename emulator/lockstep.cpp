@@ -0,0 +1,318 @@
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include "emulator/lockstep.hpp"
+#include "emulator/divergence.hpp"
+#include "emulator/snapshot_file.hpp"
+
+using namespace std;
+
+const int LockstepFrame::kMaxEvents;
+
+namespace
+{
+// 64 bit FNV-1a style hash of all of memory, eight bytes at a time
+uint64_t MemoryHash(const uint8_t *memory, int size)
+{
+    const uint64_t kPrime = 0x100000001b3ull;
+    uint64_t hash = 0xcbf29ce484222325ull;
+    int i = 0;
+    for (; i + 8 <= size; i += 8)
+    {
+        uint64_t word;
+        memcpy(&word, memory + i, sizeof(word));
+        hash = (hash ^ word) * kPrime;
+    }
+    for (; i < size; i++)
+    {
+        hash = (hash ^ memory[i]) * kPrime;
+    }
+    return hash;
+}
+
+// Perform the calls recorded for frame on e, with run as the engine
+void Replay(Emulator *e, EngineFunction run, const LockstepFrame &frame)
+{
+    for (int i = 0; i < frame.events; i++)
+    {
+        const LockstepEvent &event = frame.event[i];
+        Ports ports = e->GetPorts();
+        ports.port1 = event.port1;
+        ports.port2 = event.port2;
+        e->SetPorts(ports);
+        if (event.interrupt)
+        {
+            e->Interrupt(event.value);
+        }
+        else
+        {
+            run(e, event.value);
+        }
+    }
+}
+} // namespace
+
+// State of e as compared by the checker
+LockstepState LockstepState::Capture(const Emulator &e)
+{
+    LockstepState state;
+    state.registers = e.GetRegisters();
+    state.flags = e.GetFlags();
+    state.pc = static_cast<uint16_t>(e.GetPC());
+    state.sp = static_cast<uint16_t>(e.GetSP());
+    state.interrupt_enable = e.interrupt_enable;
+    state.ports = e.GetPorts();
+    state.cycles = e.GetCycles();
+    state.ram_hash = MemoryHash(e.GetMemory(), e.GetMemorySize());
+    return state;
+}
+
+// True if other holds the same state
+bool LockstepState::Matches(const LockstepState &other) const
+{
+    const Registers &a = registers;
+    const Registers &b = other.registers;
+    const Flags &fa = flags;
+    const Flags &fb = other.flags;
+    return a.A == b.A && a.B == b.B && a.C == b.C && a.D == b.D && a.E == b.E && a.H == b.H && a.L == b.L &&
+           fa.z == fb.z && fa.s == fb.s && fa.p == fb.p && fa.cy == fb.cy && fa.ac == fb.ac &&
+           pc == other.pc && sp == other.sp && interrupt_enable == other.interrupt_enable &&
+           ports.port1 == other.ports.port1 && ports.port2 == other.ports.port2 &&
+           ports.port3 == other.ports.port3 && ports.port5 == other.ports.port5 &&
+           cycles == other.cycles && ram_hash == other.ram_hash;
+}
+
+LockstepChecker::LockstepChecker(const Engine &candidate, const Engine &reference)
+    : candidate(candidate), reference(reference), reference_emulator(nullptr), ring(nullptr),
+      stopping(false), failed(false), frames_checked(0), stalls(0)
+{
+}
+
+LockstepChecker::~LockstepChecker()
+{
+    Stop();
+    delete reference_emulator;
+}
+
+// Begin checking from the current state of e, with the reference on a
+// second thread if threaded, otherwise inside EndFrame
+// ring_capacity is the number of frames the reference may fall behind
+// before the emulation thread waits for it
+void LockstepChecker::Start(const Emulator &e, bool threaded, size_t ring_capacity)
+{
+    Stop();
+    if (reference_emulator == nullptr)
+    {
+        reference_emulator = new Emulator();
+    }
+    Snapshot start;
+    e.SaveState(&start);
+    reference_emulator->LoadState(start);
+
+    current = LockstepFrame();
+    mismatch = LockstepMismatch();
+    stopping.store(false);
+    failed.store(false);
+    frames_checked.store(0);
+    stalls = 0;
+    if (threaded)
+    {
+        ring = new SpscRing<LockstepFrame>(ring_capacity);
+        worker = thread(&LockstepChecker::ReferenceLoop, this);
+    }
+}
+
+// Wait for the reference to check every frame ended so far
+void LockstepChecker::Stop()
+{
+    if (worker.joinable())
+    {
+        stopping.store(true, memory_order_release);
+        worker.join();
+    }
+    delete ring;
+    ring = nullptr;
+}
+
+// Run the candidate engine on e for cycles cycles
+void LockstepChecker::Emulate(Emulator *e, int cycles)
+{
+    Record(*e, false, cycles);
+    candidate.run(e, cycles);
+}
+
+// Send interrupt interrupt_num to e
+void LockstepChecker::Interrupt(Emulator *e, int interrupt_num)
+{
+    Record(*e, true, interrupt_num);
+    e->Interrupt(interrupt_num);
+}
+
+// Checkpoint: hand the frame to the reference, which compares its state
+// at this point with the state of e
+// Returns false once a mismatch has been found
+bool LockstepChecker::EndFrame(const Emulator &e)
+{
+    if (failed.load(memory_order_acquire))
+    {
+        return false;
+    }
+    current.candidate = LockstepState::Capture(e);
+    if (ring == nullptr)
+    {
+        Check(current);
+    }
+    else if (!ring->TryPush(current))
+    {
+        stalls++;
+        while (!ring->TryPush(current))
+        {
+            this_thread::yield();
+        }
+    }
+    current.frame++;
+    current.events = 0;
+    return !failed.load(memory_order_acquire);
+}
+
+// Emulate one video frame the same way EngineRegistry::RunFrame does, and
+// end it
+bool LockstepChecker::RunFrame(Emulator *e)
+{
+    Emulate(e, EngineRegistry::kHalfFrameCycles);
+    Interrupt(e, 1);
+    Emulate(e, EngineRegistry::kHalfFrameCycles);
+    Interrupt(e, 2);
+    return EndFrame(*e);
+}
+
+// True once the engines have disagreed
+bool LockstepChecker::Failed() const
+{
+    return failed.load(memory_order_acquire);
+}
+
+// Frames the reference has checked and found in agreement
+uint64_t LockstepChecker::FramesChecked() const
+{
+    return frames_checked.load(memory_order_acquire);
+}
+
+// Number of times the emulation thread had to wait for the reference
+uint64_t LockstepChecker::Stalls() const
+{
+    return stalls;
+}
+
+// The mismatch found, valid once Failed returns true
+const LockstepMismatch &LockstepChecker::Mismatch() const
+{
+    return mismatch;
+}
+
+// Describe the mismatch: both states side by side and the memory hashes
+void LockstepChecker::Report(ostream &out) const
+{
+    if (!Failed())
+    {
+        out << candidate.name << " agrees with " << reference.name << " after "
+            << FramesChecked() << " frames" << endl;
+        return;
+    }
+
+    ios_base::fmtflags saved = out.flags();
+    char fill_char = out.fill();
+
+    out << candidate.name << " differs from " << reference.name << " at the end of frame "
+        << mismatch.frame << " (cycle " << mismatch.before.cycles << " to " << mismatch.reference.cycles
+        << ")" << endl;
+    DivergenceFinder::PrintStates(out, mismatch.reference_state, mismatch.candidate_state);
+    out << "  " << left << setw(10) << "RAM hash" << right << hex << setfill('0')
+        << "  " << setw(16) << mismatch.reference.ram_hash << "  " << setw(16) << mismatch.candidate.ram_hash
+        << endl;
+    if (!mismatch.reproduced)
+    {
+        out << "  replaying the frame did not reproduce the candidate's state" << endl;
+    }
+
+    out.flags(saved);
+    out.fill(fill_char);
+}
+
+// Write the reference's state at the start of the failing frame as a
+// snapshot file, which Headless -load resumes from to reproduce it
+bool LockstepChecker::WriteSnapshot(const string &path) const
+{
+    return Failed() && SnapshotFile::Write(path, mismatch.before);
+}
+
+// Add a call to the frame being recorded, starting a new frame if it is full
+void LockstepChecker::Record(const Emulator &e, bool interrupt, int value)
+{
+    if (failed.load(memory_order_relaxed))
+    {
+        return;
+    }
+    if (current.events == LockstepFrame::kMaxEvents)
+    {
+        EndFrame(e);
+    }
+    Ports ports = e.GetPorts();
+    LockstepEvent &event = current.event[current.events++];
+    event.interrupt = interrupt;
+    event.port1 = ports.port1;
+    event.port2 = ports.port2;
+    event.value = value;
+}
+
+// Replay frame on the reference and compare the result with the candidate
+void LockstepChecker::Check(const LockstepFrame &frame)
+{
+    reference_emulator->SaveState(&frame_start);
+    Replay(reference_emulator, reference.run, frame);
+    LockstepState state = LockstepState::Capture(*reference_emulator);
+    if (state.Matches(frame.candidate))
+    {
+        frames_checked.fetch_add(1, memory_order_release);
+        return;
+    }
+
+    mismatch.frame = frame.frame;
+    mismatch.reference = state;
+    mismatch.candidate = frame.candidate;
+    mismatch.before = frame_start;
+    reference_emulator->SaveState(&mismatch.reference_state);
+
+    Emulator replay;
+    replay.LoadState(frame_start);
+    Replay(&replay, candidate.run, frame);
+    replay.SaveState(&mismatch.candidate_state);
+    mismatch.reproduced = LockstepState::Capture(replay).Matches(frame.candidate);
+    failed.store(true, memory_order_release);
+}
+
+// Check frames as the emulation thread ends them
+void LockstepChecker::ReferenceLoop()
+{
+    LockstepFrame frame;
+    while (true)
+    {
+        // stopping is checked before popping so no ended frame is skipped
+        bool stop = stopping.load(memory_order_acquire);
+        if (ring->TryPopBulk(&frame, 1) == 1)
+        {
+            if (!failed.load(memory_order_relaxed))
+            {
+                Check(frame);
+            }
+        }
+        else if (stop)
+        {
+            break;
+        }
+        else
+        {
+            this_thread::sleep_for(chrono::microseconds(200));
+        }
+    }
+}
@@ -0,0 +1,119 @@
+#ifndef EMULATOR_LOCKSTEP_HPP_
+#define EMULATOR_LOCKSTEP_HPP_
+
+#include <atomic>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <thread>
+#include "emulator/emulator.hpp"
+#include "emulator/engine.hpp"
+#include "emulator/spsc_ring.hpp"
+
+// What the lockstep checker compares at every checkpoint
+//
+// Memory is reduced to a 64 bit hash so that a checkpoint costs the
+// emulation thread one pass over memory and nothing else.
+struct LockstepState
+{
+    Registers registers;
+    Flags flags;
+    uint16_t pc = 0;
+    uint16_t sp = 0;
+    bool interrupt_enable = false;
+    Ports ports;
+    uint64_t cycles = 0;
+    uint64_t ram_hash = 0;
+
+    static LockstepState Capture(const Emulator &e);
+    bool Matches(const LockstepState &other) const;
+};
+
+// A call made on the running machine, with the input it saw
+struct LockstepEvent
+{
+    bool interrupt = false;
+    uint8_t port1 = 0;
+    uint8_t port2 = 0;
+    int value = 0; // cycles to emulate or interrupt number
+};
+
+// Everything the reference core needs to replay one frame and check it
+struct LockstepFrame
+{
+    static const int kMaxEvents = 8;
+
+    uint64_t frame = 0;
+    int events = 0;
+    LockstepEvent event[kMaxEvents];
+    LockstepState candidate; // state the candidate ended the frame in
+};
+
+// The first frame at whose end the two engines disagree
+struct LockstepMismatch
+{
+    uint64_t frame = 0;
+    LockstepState reference;
+    LockstepState candidate;
+    Snapshot before;          // reference state at the start of the frame
+    Snapshot reference_state; // both states at the end of the frame, the
+    Snapshot candidate_state; // candidate's replayed from before
+    bool reproduced = true;   // the replay ended in the state checked
+};
+
+// Runs a candidate engine and the reference interpreter side by side on
+// the same input and checks that they agree at every frame boundary
+//
+// The caller drives the candidate through Emulate and Interrupt, which
+// record each call together with input ports 1 and 2, and marks frame
+// boundaries with EndFrame. The reference replays the recorded calls on
+// its own copy of the machine, on a second thread that trails the
+// candidate by a frame or so, and compares registers, flags, PC, SP,
+// output ports, cycles and a hash of memory. The first mismatch stops the
+// checking; the frame is then replayed from the reference's state at its
+// start to recover both complete machine states for the report.
+//
+// Only input ports 1 and 2 are replayed, so the machine must not feed
+// anything back to the CPU from an output handler.
+class LockstepChecker
+{
+public:
+    LockstepChecker(const Engine &candidate, const Engine &reference);
+    ~LockstepChecker();
+
+    void Start(const Emulator &e, bool threaded = true, size_t ring_capacity = 16);
+    void Stop();
+
+    void Emulate(Emulator *e, int cycles);
+    void Interrupt(Emulator *e, int interrupt_num);
+    bool EndFrame(const Emulator &e);
+    bool RunFrame(Emulator *e);
+
+    bool Failed() const;
+    uint64_t FramesChecked() const;
+    uint64_t Stalls() const;
+    const LockstepMismatch &Mismatch() const;
+    void Report(std::ostream &out) const;
+    bool WriteSnapshot(const std::string &path) const;
+
+private:
+    void Record(const Emulator &e, bool interrupt, int value);
+    void Check(const LockstepFrame &frame);
+    void ReferenceLoop();
+
+    Engine candidate;
+    Engine reference;
+    Emulator *reference_emulator;
+
+    LockstepFrame current;
+    SpscRing<LockstepFrame> *ring;
+    std::thread worker;
+    std::atomic<bool> stopping;
+    std::atomic<bool> failed;
+    std::atomic<uint64_t> frames_checked;
+    uint64_t stalls;
+    Snapshot frame_start; // reference state before the frame being checked
+    LockstepMismatch mismatch;
+};
+
+#endif // EMULATOR_LOCKSTEP_HPP_
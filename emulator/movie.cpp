@@ -0,0 +1,97 @@
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include "emulator/movie.hpp"
+#include "emulator/emulator.hpp"
+
+using namespace std;
+
+// Read a movie file, returns false if it is missing or malformed
+bool InputMovie::Load(const string &path)
+{
+    ifstream file(path);
+    if (!file.is_open())
+    {
+        return false;
+    }
+
+    changes.clear();
+    string line;
+    while (getline(file, line))
+    {
+        line = line.substr(0, line.find('#'));
+        istringstream fields(line);
+        uint64_t frame;
+        unsigned port1, port2;
+        if (!(fields >> dec >> frame))
+        {
+            continue;
+        }
+        if (!(fields >> hex >> port1 >> port2) || port1 > 0xff || port2 > 0xff)
+        {
+            return false;
+        }
+        Record(frame, static_cast<uint8_t>(port1), static_cast<uint8_t>(port2));
+    }
+    return true;
+}
+
+// Write the movie in the format read by Load
+bool InputMovie::Save(const string &path) const
+{
+    ofstream file(path);
+    if (!file.is_open())
+    {
+        return false;
+    }
+    file << "# frame port1 port2" << '\n' << setfill('0');
+    map<uint64_t, pair<uint8_t, uint8_t> >::const_iterator it;
+    for (it = changes.begin(); it != changes.end(); ++it)
+    {
+        file << dec << it->first << ' ' << hex << setw(2) << static_cast<unsigned>(it->second.first)
+             << ' ' << setw(2) << static_cast<unsigned>(it->second.second) << '\n';
+    }
+    return file.good();
+}
+
+// Note the port values in effect from frame on
+// Frames must be recorded in increasing order
+void InputMovie::Record(uint64_t frame, uint8_t port1, uint8_t port2)
+{
+    if (!changes.empty())
+    {
+        const pair<uint8_t, uint8_t> &last = changes.rbegin()->second;
+        if (last.first == port1 && last.second == port2)
+        {
+            return;
+        }
+    }
+    changes[frame] = make_pair(port1, port2);
+}
+
+// Set the input ports of e to their values during frame
+void InputMovie::Apply(Emulator *e, uint64_t frame) const
+{
+    map<uint64_t, pair<uint8_t, uint8_t> >::const_iterator it = changes.upper_bound(frame);
+    if (it == changes.begin())
+    {
+        return;
+    }
+    --it;
+    Ports ports = e->GetPorts();
+    ports.port1 = it->second.first;
+    ports.port2 = it->second.second;
+    e->SetPorts(ports);
+}
+
+// True if nothing was recorded
+bool InputMovie::Empty() const
+{
+    return changes.empty();
+}
+
+// Frame of the last recorded change
+uint64_t InputMovie::LastChange() const
+{
+    return changes.empty() ? 0 : changes.rbegin()->first;
+}
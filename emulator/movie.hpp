@@ -0,0 +1,32 @@
+#ifndef EMULATOR_MOVIE_HPP_
+#define EMULATOR_MOVIE_HPP_
+
+#include <cstdint>
+#include <map>
+#include <string>
+
+class Emulator;
+
+// Input port values per frame, so that a session can be replayed exactly
+//
+// Only changes are stored. The text format has one change per line,
+// "frame port1 port2" with the frame in decimal and the ports in hex, and
+// '#' starts a comment. Ports keep their values until the next change.
+class InputMovie
+{
+public:
+    bool Load(const std::string &path);
+    bool Save(const std::string &path) const;
+
+    void Record(uint64_t frame, uint8_t port1, uint8_t port2);
+    void Apply(Emulator *e, uint64_t frame) const;
+
+    bool Empty() const;
+    uint64_t LastChange() const;
+
+private:
+    // frame -> (port1, port2)
+    std::map<uint64_t, std::pair<uint8_t, uint8_t> > changes;
+};
+
+#endif // EMULATOR_MOVIE_HPP_
@@ -0,0 +1,444 @@
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <sstream>
+#include "emulator/opcode_bench.hpp"
+#include "emulator/emulator.hpp"
+#include "disassembler/control_flow.hpp"
+#include "disassembler/disassembler.hpp"
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define EMULATOR_HAVE_TSC 1
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define EMULATOR_HAVE_TSC 1
+#endif
+
+using namespace std;
+
+const uint16_t OpcodeBench::kCodeAddress;
+const uint16_t OpcodeBench::kDataAddress;
+const uint16_t OpcodeBench::kStackAddress;
+const int OpcodeBench::kRepeats;
+
+namespace
+{
+// emulated cycles per call into the engine while timing
+const int kChunkCycles = 16666;
+
+// bytes of LXI SP and JMP at the end of a kernel
+const int kTailSize = 6;
+
+// Host time stamp counter, or 0 where there is none
+uint64_t ReadTicks()
+{
+#ifdef EMULATOR_HAVE_TSC
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+void AppendWord(vector<uint8_t> *code, uint16_t word)
+{
+    code->push_back(static_cast<uint8_t>(word & 0xff));
+    code->push_back(static_cast<uint8_t>(word >> 8));
+}
+
+// Append LXI SP and a JMP back to the start of the kernel
+void AppendTail(vector<uint8_t> *code)
+{
+    code->push_back(0x31);
+    AppendWord(code, OpcodeBench::kStackAddress);
+    code->push_back(0xc3);
+    AppendWord(code, OpcodeBench::kCodeAddress);
+}
+} // namespace
+
+OpcodeBench::OpcodeBench(const Engine &engine) : engine(engine), cycles(2000000), tail_ns(-1)
+{
+}
+
+// Emulated cycles to run per opcode and engine
+void OpcodeBench::SetCycles(int new_cycles)
+{
+    cycles = max(new_cycles, kChunkCycles);
+}
+
+// Name of the engine being timed
+const string &OpcodeBench::EngineName() const
+{
+    return engine.name;
+}
+
+// False for the twelve opcodes the emulator treats as invalid
+bool OpcodeBench::IsImplemented(uint8_t opcode)
+{
+    switch (opcode)
+    {
+    case 0x08:
+    case 0x10:
+    case 0x18:
+    case 0x20:
+    case 0x28:
+    case 0x30:
+    case 0x38:
+    case 0xcb:
+    case 0xd9:
+    case 0xdd:
+    case 0xed:
+    case 0xfd:
+        return false;
+    default:
+        return true;
+    }
+}
+
+// Implemented opcodes other than HLT, which waits for an interrupt that the
+// bench machine never raises
+bool OpcodeBench::CanTime(uint8_t opcode)
+{
+    return IsImplemented(opcode) && opcode != 0x76;
+}
+
+// Build the loop that times opcode
+OpcodeKernel OpcodeBench::BuildKernel(uint8_t opcode)
+{
+    OpcodeKernel kernel;
+    kernel.opcode = opcode;
+    kernel.implemented = CanTime(opcode);
+    if (!kernel.implemented)
+    {
+        return kernel;
+    }
+
+    FlowType flow = ControlFlowGraph::GetFlowType(opcode);
+    int length = ControlFlowGraph::InstructionLength(opcode);
+    if (flow == kFlowIndirect)
+    {
+        // PCHL with HL pointing at itself
+        kernel.code.push_back(opcode);
+        kernel.has_tail = false;
+        return kernel;
+    }
+    if (flow == kFlowRestart)
+    {
+        kernel.companion = 0xc9;
+    }
+
+    for (int i = 0; i < kRepeats; i++)
+    {
+        uint16_t next = static_cast<uint16_t>(kCodeAddress + kernel.code.size() + length);
+        kernel.code.push_back(opcode);
+        if (flow == kFlowJump || flow == kFlowBranch || flow == kFlowCall || flow == kFlowCondCall)
+        {
+            AppendWord(&kernel.code, next);
+        }
+        else if (length == 2)
+        {
+            // immediate data or port 0, which the machine ignores
+            kernel.code.push_back(0x00);
+        }
+        else if (length == 3)
+        {
+            AppendWord(&kernel.code, kDataAddress);
+        }
+    }
+    AppendTail(&kernel.code);
+    return kernel;
+}
+
+// Loop with only the tail, to time the loop overhead
+OpcodeKernel OpcodeBench::BuildTailKernel()
+{
+    OpcodeKernel kernel;
+    kernel.opcode = 0x31;
+    kernel.implemented = true;
+    AppendTail(&kernel.code);
+    return kernel;
+}
+
+// Set up a flat 64K RAM machine running kernel
+void OpcodeBench::LoadKernel(Emulator *e, const OpcodeKernel &kernel)
+{
+    Snapshot snapshot;
+    snapshot.memory.assign(0x10000, 0);
+    copy(kernel.code.begin(), kernel.code.end(), snapshot.memory.begin() + kCodeAddress);
+
+    // return addresses for RET and Rcc: each copy returns to the next one
+    if (kernel.implemented)
+    {
+        FlowType flow = ControlFlowGraph::GetFlowType(kernel.opcode);
+        if (flow == kFlowReturn || flow == kFlowCondReturn)
+        {
+            for (int i = 0; i < kRepeats; i++)
+            {
+                uint16_t next = static_cast<uint16_t>(kCodeAddress + i + 1);
+                snapshot.memory[kStackAddress + 2 * i] = static_cast<uint8_t>(next & 0xff);
+                snapshot.memory[kStackAddress + 2 * i + 1] = static_cast<uint8_t>(next >> 8);
+            }
+        }
+        if (flow == kFlowRestart)
+        {
+            snapshot.memory[kernel.opcode & 0x38] = 0xc9;
+        }
+    }
+
+    uint16_t hl = kernel.has_tail ? kDataAddress : kCodeAddress;
+    snapshot.registers.B = snapshot.registers.D = kDataAddress >> 8;
+    snapshot.registers.H = static_cast<uint8_t>(hl >> 8);
+    snapshot.registers.C = snapshot.registers.E = kDataAddress & 0xff;
+    snapshot.registers.L = static_cast<uint8_t>(hl & 0xff);
+    snapshot.sp = kStackAddress;
+    snapshot.pc = kCodeAddress;
+
+    e->LoadState(snapshot);
+    e->SetRamRange(0, 0x10000);
+
+    // most kernels come back to the same state every time round, which
+    // the interpreter would otherwise skip as an idle loop
+    e->SetIdleSkipping(false);
+}
+
+// Single step e through one pass of kernel, which must start at its first
+// instruction. Returns false if the loop does not come back.
+bool OpcodeBench::StepIteration(Emulator *e, EngineFunction run, const OpcodeKernel &kernel,
+                                KernelIteration *iteration)
+{
+    *iteration = KernelIteration();
+    const uint8_t *memory = e->GetMemory();
+    // the tail's LXI SP and JMP do not count for those opcodes
+    int tail = kernel.has_tail ? static_cast<int>(kernel.code.size()) - kTailSize : 0x10000;
+    do
+    {
+        int offset = e->GetPC() - kCodeAddress;
+        uint8_t opcode = memory[e->GetPC()];
+        uint64_t before = e->GetCycles();
+        run(e, 1);
+        int spent = static_cast<int>(e->GetCycles() - before);
+
+        iteration->instructions++;
+        iteration->cycles += spent;
+        if (opcode == kernel.opcode && offset < tail)
+        {
+            iteration->target_instructions++;
+            iteration->target_cycles += spent;
+        }
+        else if (opcode == kernel.companion)
+        {
+            iteration->companion_instructions++;
+        }
+        if (iteration->instructions > 4 * kRepeats + 4)
+        {
+            return false;
+        }
+    } while (e->GetPC() != kCodeAddress);
+    return iteration->cycles > 0;
+}
+
+// Time kernel on the engine, best of three runs
+bool OpcodeBench::TimeKernel(const OpcodeKernel &kernel, KernelIteration *iteration,
+                             double *ns_per_iteration, double *ticks_per_ns)
+{
+    Emulator e;
+    LoadKernel(&e, kernel);
+    if (!StepIteration(&e, engine.run, kernel, iteration))
+    {
+        return false;
+    }
+
+    *ns_per_iteration = -1;
+    for (int run = 0; run < 3; run++)
+    {
+        uint64_t start_cycles = e.GetCycles();
+        uint64_t start_ticks = ReadTicks();
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        while (e.GetCycles() - start_cycles < static_cast<uint64_t>(cycles))
+        {
+            engine.run(&e, kChunkCycles);
+        }
+        chrono::duration<double, nano> elapsed = chrono::steady_clock::now() - start;
+        uint64_t ticks = ReadTicks() - start_ticks;
+
+        double iterations = static_cast<double>(e.GetCycles() - start_cycles) / iteration->cycles;
+        double ns = elapsed.count() / iterations;
+        if (*ns_per_iteration < 0 || ns < *ns_per_iteration)
+        {
+            *ns_per_iteration = ns;
+            *ticks_per_ns = ticks / elapsed.count();
+        }
+    }
+    return true;
+}
+
+// Time opcode, reusing earlier results
+const OpcodeTiming &OpcodeBench::Measure(uint8_t opcode)
+{
+    OpcodeTiming &timing = timings[opcode];
+    if (timing.measured || !CanTime(opcode))
+    {
+        return timing;
+    }
+
+    KernelIteration iteration;
+    double ns_per_iteration;
+    double ticks_per_ns;
+    if (tail_ns < 0)
+    {
+        TimeKernel(BuildTailKernel(), &iteration, &tail_ns, &ticks_per_ns);
+    }
+
+    OpcodeKernel kernel = BuildKernel(opcode);
+    double companion_ns = 0;
+    if (kernel.companion >= 0)
+    {
+        companion_ns = Measure(static_cast<uint8_t>(kernel.companion)).ns_per_instruction;
+    }
+    if (!TimeKernel(kernel, &iteration, &ns_per_iteration, &ticks_per_ns) ||
+        iteration.target_instructions == 0)
+    {
+        return timing;
+    }
+
+    double loop_ns = kernel.has_tail ? tail_ns : 0;
+    double ns = ns_per_iteration - loop_ns - iteration.companion_instructions * companion_ns;
+    timing.measured = true;
+    timing.ns_per_instruction = max(ns, 0.0) / iteration.target_instructions;
+    timing.cycles_per_instruction = static_cast<double>(iteration.target_cycles) / iteration.target_instructions;
+    if (ticks_per_ns > 0)
+    {
+        timing.host_cycles_per_cycle = timing.ns_per_instruction * ticks_per_ns / timing.cycles_per_instruction;
+    }
+    return timing;
+}
+
+// Time every opcode that can be timed
+void OpcodeBench::Run()
+{
+    for (int opcode = 0; opcode < 0x100; opcode++)
+    {
+        Measure(static_cast<uint8_t>(opcode));
+    }
+}
+
+// Result for opcode, if it has been measured
+const OpcodeTiming &OpcodeBench::Timing(uint8_t opcode) const
+{
+    return timings[opcode];
+}
+
+// Mnemonic of opcode with the operands the kernels use
+string OpcodeBench::Mnemonic(uint8_t opcode)
+{
+    const uint8_t bytes[3] = {opcode, kDataAddress & 0xff, kDataAddress >> 8};
+    ostringstream text;
+    Disassembler::Disassemble(text, bytes, 3, 0);
+    string line = text.str();
+    return line.substr(5, line.size() - 6);
+}
+
+// Print a 16x16 table, high nibble down and low nibble across, of the ns per
+// instruction or the host cycles per emulated cycle; color shades cells by
+// how they compare with the median
+void OpcodeBench::PrintHeatTable(ostream &out, bool host_cycles, bool color) const
+{
+    vector<double> values(0x100, -1);
+    vector<double> sorted;
+    for (int opcode = 0; opcode < 0x100; opcode++)
+    {
+        const OpcodeTiming &timing = timings[opcode];
+        if (timing.measured && (!host_cycles || timing.host_cycles_per_cycle >= 0))
+        {
+            values[opcode] = host_cycles ? timing.host_cycles_per_cycle : timing.ns_per_instruction;
+            sorted.push_back(values[opcode]);
+        }
+    }
+    sort(sorted.begin(), sorted.end());
+    double median = sorted.empty() ? 0 : sorted[sorted.size() / 2];
+
+    ios_base::fmtflags saved = out.flags();
+    char fill_char = out.fill();
+    out << engine.name << ": " << (host_cycles ? "host cycles per emulated cycle" : "ns per instruction")
+        << " (median " << fixed << setprecision(2) << median << ")" << endl
+        << "    ";
+    for (int low = 0; low < 0x10; low++)
+    {
+        out << "     x" << hex << uppercase << low;
+    }
+    out << endl;
+
+    for (int high = 0; high < 0x10; high++)
+    {
+        out << hex << uppercase << high << "x  " << dec;
+        for (int low = 0; low < 0x10; low++)
+        {
+            double value = values[high << 4 | low];
+            if (value < 0)
+            {
+                out << setw(7) << "--";
+                continue;
+            }
+
+            const char *shade = nullptr;
+            if (color && median > 0)
+            {
+                double ratio = value / median;
+                shade = ratio < 0.8 ? "\x1b[42m" : ratio < 1.25 ? nullptr : ratio < 2 ? "\x1b[43m"
+                                                                          : ratio < 4 ? "\x1b[41m" : "\x1b[45m";
+            }
+            out << ' ' << (shade ? shade : "") << setw(6) << setprecision(value < 100 ? 2 : 0) << value
+                << (shade ? "\x1b[0m" : "");
+        }
+        out << endl;
+    }
+    out.flags(saved);
+    out.fill(fill_char);
+}
+
+// List the opcodes that take longest per instruction
+void OpcodeBench::PrintSlowest(ostream &out, int top) const
+{
+    vector<pair<double, int> > order;
+    for (int opcode = 0; opcode < 0x100; opcode++)
+    {
+        if (timings[opcode].measured)
+        {
+            order.push_back(make_pair(timings[opcode].ns_per_instruction, opcode));
+        }
+    }
+    sort(order.rbegin(), order.rend());
+
+    ios_base::fmtflags saved = out.flags();
+    char fill_char = out.fill();
+    out << engine.name << ": slowest opcodes" << endl;
+    for (size_t i = 0; i < order.size() && static_cast<int>(i) < top; i++)
+    {
+        int opcode = order[i].second;
+        out << "  " << hex << setfill('0') << setw(2) << opcode << dec << setfill(' ') << "  "
+            << left << setw(16) << Mnemonic(static_cast<uint8_t>(opcode)) << right << fixed
+            << setprecision(2) << setw(8) << order[i].first << " ns" << endl;
+    }
+    out.flags(saved);
+    out.fill(fill_char);
+}
+
+// One line per measured opcode: engine, opcode, mnemonic, ns per
+// instruction, emulated cycles and host cycles per emulated cycle
+void OpcodeBench::WriteCsv(ostream &out, bool header) const
+{
+    if (header)
+    {
+        out << "engine,opcode,mnemonic,ns_per_instruction,cycles,host_cycles_per_cycle\n";
+    }
+    for (int opcode = 0; opcode < 0x100; opcode++)
+    {
+        const OpcodeTiming &timing = timings[opcode];
+        if (timing.measured)
+        {
+            out << engine.name << ",0x" << hex << setfill('0') << setw(2) << opcode << dec << setfill(' ')
+                << ",\"" << Mnemonic(static_cast<uint8_t>(opcode)) << "\"," << timing.ns_per_instruction
+                << ',' << timing.cycles_per_instruction << ',' << timing.host_cycles_per_cycle << '\n';
+        }
+    }
+}
@@ -0,0 +1,87 @@
+#ifndef EMULATOR_OPCODE_BENCH_HPP_
+#define EMULATOR_OPCODE_BENCH_HPP_
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "emulator/engine.hpp"
+
+class Emulator;
+
+// A loop that runs one opcode over and over
+//
+// The body holds kRepeats copies of the instruction, followed by a tail
+// that resets SP and jumps back. Jumps and calls target the next copy,
+// returns pop a table of addresses that does the same, and RST n returns
+// through a RET placed at its vector (the RET is the companion, whose
+// time is subtracted). PCHL is a single instruction jumping to itself.
+struct OpcodeKernel
+{
+    uint8_t opcode = 0;
+    bool implemented = false;
+    std::vector<uint8_t> code;  // loaded at OpcodeBench::kCodeAddress
+    bool has_tail = true;
+    int companion = -1;         // opcode run once per repeat, or -1
+};
+
+// What one pass through a kernel loop executes
+struct KernelIteration
+{
+    int instructions = 0;
+    int cycles = 0;
+    int target_instructions = 0;
+    int target_cycles = 0;
+    int companion_instructions = 0;
+};
+
+// Cost of one opcode on one engine
+struct OpcodeTiming
+{
+    bool measured = false;
+    double ns_per_instruction = 0;
+    double cycles_per_instruction = 0;  // emulated 8080 cycles
+    double host_cycles_per_cycle = -1;  // host cycles per emulated cycle, < 0 if unknown
+};
+
+// Times every implemented opcode but HLT in a RAM-only machine on one engine
+class OpcodeBench
+{
+public:
+    static const uint16_t kCodeAddress = 0x1000;
+    static const uint16_t kDataAddress = 0x3000;
+    static const uint16_t kStackAddress = 0x3f00;
+    static const int kRepeats = 32;
+
+    explicit OpcodeBench(const Engine &engine);
+
+    void SetCycles(int cycles);
+    void Run();
+    const OpcodeTiming &Measure(uint8_t opcode);
+    const OpcodeTiming &Timing(uint8_t opcode) const;
+    const std::string &EngineName() const;
+
+    void PrintHeatTable(std::ostream &out, bool host_cycles, bool color) const;
+    void PrintSlowest(std::ostream &out, int top) const;
+    void WriteCsv(std::ostream &out, bool header) const;
+
+    static bool IsImplemented(uint8_t opcode);
+    static bool CanTime(uint8_t opcode);
+    static OpcodeKernel BuildKernel(uint8_t opcode);
+    static OpcodeKernel BuildTailKernel();
+    static void LoadKernel(Emulator *e, const OpcodeKernel &kernel);
+    static bool StepIteration(Emulator *e, EngineFunction run, const OpcodeKernel &kernel,
+                              KernelIteration *iteration);
+    static std::string Mnemonic(uint8_t opcode);
+
+private:
+    bool TimeKernel(const OpcodeKernel &kernel, KernelIteration *iteration, double *ns_per_iteration,
+                    double *ticks_per_ns);
+
+    Engine engine;
+    int cycles;
+    double tail_ns;
+    OpcodeTiming timings[0x100];
+};
+
+#endif // EMULATOR_OPCODE_BENCH_HPP_
@@ -0,0 +1,236 @@
+#include <cerrno>
+#include <cstring>
+#include <iomanip>
+#include "emulator/perf_counters.hpp"
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace
+{
+#ifdef __linux__
+// perf_event_attr type and config of every PerfEvent
+void EventConfig(PerfEvent event, uint32_t *type, uint64_t *config)
+{
+    const uint64_t read_miss = PERF_COUNT_HW_CACHE_OP_READ << 8 | PERF_COUNT_HW_CACHE_RESULT_MISS << 16;
+    switch (event)
+    {
+    case kPerfInstructions:
+        *type = PERF_TYPE_HARDWARE;
+        *config = PERF_COUNT_HW_INSTRUCTIONS;
+        break;
+    case kPerfCycles:
+        *type = PERF_TYPE_HARDWARE;
+        *config = PERF_COUNT_HW_CPU_CYCLES;
+        break;
+    case kPerfBranchMisses:
+        *type = PERF_TYPE_HARDWARE;
+        *config = PERF_COUNT_HW_BRANCH_MISSES;
+        break;
+    case kPerfL1iMisses:
+        *type = PERF_TYPE_HW_CACHE;
+        *config = PERF_COUNT_HW_CACHE_L1I | read_miss;
+        break;
+    default:
+        *type = PERF_TYPE_HW_CACHE;
+        *config = PERF_COUNT_HW_CACHE_L1D | read_miss;
+        break;
+    }
+}
+
+int OpenEvent(PerfEvent event)
+{
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    uint32_t type;
+    uint64_t config;
+    EventConfig(event, &type, &config);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+}
+#endif
+
+// Print value / count, or a dash when there is nothing to divide by
+void PrintRatio(ostream &out, double value, uint64_t count)
+{
+    if (count == 0)
+    {
+        out << setw(16) << "-";
+    }
+    else
+    {
+        out << setw(16) << value / count;
+    }
+}
+} // namespace
+
+PerfCounters::PerfCounters()
+{
+    for (int i = 0; i < kPerfEventCount; i++)
+    {
+        fds[i] = -1;
+    }
+}
+
+PerfCounters::~PerfCounters()
+{
+    Close();
+}
+
+// Open every counter the system provides, returns false if there are none
+// Error describes why the first unavailable counter could not be opened
+bool PerfCounters::Open()
+{
+    Close();
+    error.clear();
+    bool any = false;
+#ifdef __linux__
+    for (int i = 0; i < kPerfEventCount; i++)
+    {
+        fds[i] = OpenEvent(static_cast<PerfEvent>(i));
+        if (fds[i] >= 0)
+        {
+            any = true;
+        }
+        else if (error.empty())
+        {
+            error = string(EventName(static_cast<PerfEvent>(i))) + ": " + strerror(errno);
+            if (errno == EACCES || errno == EPERM)
+            {
+                error += " (see /proc/sys/kernel/perf_event_paranoid)";
+            }
+            else if (errno == ENOENT || errno == EOPNOTSUPP)
+            {
+                error += " (no hardware PMU, e.g. in a virtual machine)";
+            }
+        }
+    }
+#else
+    error = "hardware counters are only supported on Linux";
+#endif
+    return any;
+}
+
+void PerfCounters::Close()
+{
+    for (int i = 0; i < kPerfEventCount; i++)
+    {
+#ifdef __linux__
+        if (fds[i] >= 0)
+        {
+            close(fds[i]);
+        }
+#endif
+        fds[i] = -1;
+    }
+}
+
+bool PerfCounters::Available(PerfEvent event) const
+{
+    return fds[event] >= 0;
+}
+
+const string &PerfCounters::Error() const
+{
+    return error;
+}
+
+// Zero the open counters and start counting
+void PerfCounters::Start()
+{
+#ifdef __linux__
+    for (int i = 0; i < kPerfEventCount; i++)
+    {
+        if (fds[i] >= 0)
+        {
+            ioctl(fds[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(fds[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+#endif
+}
+
+// Stop counting and read the counters
+// When the kernel had to share the hardware between more events than it
+// has counters, values are scaled up to the whole region
+PerfSample PerfCounters::Stop()
+{
+    PerfSample sample;
+#ifdef __linux__
+    for (int i = 0; i < kPerfEventCount; i++)
+    {
+        if (fds[i] >= 0)
+        {
+            ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+        }
+    }
+    for (int i = 0; i < kPerfEventCount; i++)
+    {
+        // value, time enabled, time running
+        uint64_t data[3];
+        if (fds[i] < 0 || read(fds[i], data, sizeof(data)) != sizeof(data) || data[2] == 0)
+        {
+            continue;
+        }
+        sample.valid[i] = true;
+        sample.value[i] = data[0];
+        if (data[2] < data[1])
+        {
+            sample.value[i] = static_cast<uint64_t>(static_cast<double>(data[0]) * data[1] / data[2]);
+        }
+    }
+#endif
+    return sample;
+}
+
+const char *PerfCounters::EventName(PerfEvent event)
+{
+    static const char *const kNames[kPerfEventCount] = {
+        "instructions", "cycles", "branch-misses", "L1i-misses", "L1d-misses"};
+    return kNames[event];
+}
+
+// Print every counter in total, per emulated 8080 instruction and per frame
+void PerfCounters::Report(ostream &out, const PerfSample &sample, uint64_t instructions, uint64_t frames)
+{
+    ios_base::fmtflags saved = out.flags();
+    out << left << setw(16) << "host counter" << right << setw(16) << "total" << setw(16)
+        << "per 8080 instr" << setw(16) << "per frame" << endl
+        << fixed << setprecision(3);
+    for (int i = 0; i < kPerfEventCount; i++)
+    {
+        out << left << setw(16) << EventName(static_cast<PerfEvent>(i)) << right;
+        if (!sample.valid[i])
+        {
+            out << setw(16) << "n/a" << endl;
+            continue;
+        }
+        out << setw(16) << sample.value[i];
+        PrintRatio(out, static_cast<double>(sample.value[i]), instructions);
+        PrintRatio(out, static_cast<double>(sample.value[i]), frames);
+        out << endl;
+    }
+    if (sample.valid[kPerfInstructions] && sample.valid[kPerfCycles] && sample.value[kPerfCycles] > 0)
+    {
+        out << "host IPC " << static_cast<double>(sample.value[kPerfInstructions]) / sample.value[kPerfCycles];
+        if (sample.valid[kPerfBranchMisses] && sample.value[kPerfInstructions] > 0)
+        {
+            out << ", " << 1000.0 * sample.value[kPerfBranchMisses] / sample.value[kPerfInstructions]
+                << " branch misses per 1000 host instructions";
+        }
+        out << endl;
+    }
+    out.flags(saved);
+}
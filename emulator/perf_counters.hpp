@@ -0,0 +1,56 @@
+#ifndef EMULATOR_PERF_COUNTERS_HPP_
+#define EMULATOR_PERF_COUNTERS_HPP_
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+// Host hardware events counted by PerfCounters
+enum PerfEvent
+{
+    kPerfInstructions,
+    kPerfCycles,
+    kPerfBranchMisses,
+    kPerfL1iMisses,
+    kPerfL1dMisses,
+    kPerfEventCount
+};
+
+// Counter values for one measured region
+struct PerfSample
+{
+    bool valid[kPerfEventCount] = {};
+    uint64_t value[kPerfEventCount] = {};
+};
+
+// Host hardware counters around a measured region
+//
+// Uses perf_event_open on Linux, counting this thread in user mode only.
+// Counters the CPU, kernel or container does not provide are left closed
+// and reported as unavailable, so callers never need to check for
+// support themselves; on other systems nothing is ever available.
+class PerfCounters
+{
+public:
+    PerfCounters();
+    ~PerfCounters();
+    PerfCounters(const PerfCounters &) = delete;
+    PerfCounters &operator=(const PerfCounters &) = delete;
+
+    bool Open();
+    void Close();
+    bool Available(PerfEvent event) const;
+    const std::string &Error() const;
+
+    void Start();
+    PerfSample Stop();
+
+    static const char *EventName(PerfEvent event);
+    static void Report(std::ostream &out, const PerfSample &sample, uint64_t instructions, uint64_t frames);
+
+private:
+    int fds[kPerfEventCount];
+    std::string error;
+};
+
+#endif // EMULATOR_PERF_COUNTERS_HPP_
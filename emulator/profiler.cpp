@@ -0,0 +1,221 @@
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include "emulator/profiler.hpp"
+#include "disassembler/disassembler.hpp"
+#include "disassembler/control_flow.hpp"
+
+using namespace std;
+
+namespace
+{
+// Sort helper - highest cycle count first
+struct ByCycles
+{
+    const vector<uint64_t> *cycles;
+    bool operator()(int a, int b) const
+    {
+        return (*cycles)[a] > (*cycles)[b] || ((*cycles)[a] == (*cycles)[b] && a < b);
+    }
+};
+
+// Mnemonic of the instruction at address, without the address label
+string Mnemonic(const uint8_t *memory, int mem_size, int address)
+{
+    ostringstream line;
+    int available = min(mem_size - address, 3);
+    if (available <= 0)
+    {
+        return "??";
+    }
+    Disassembler::Disassemble(line, memory + address, available, address);
+    string text = line.str();
+    size_t start = text.find(' ');
+    return text.substr(start + 1, text.size() - start - 2);
+}
+
+double Percent(uint64_t part, uint64_t whole)
+{
+    return whole == 0 ? 0.0 : 100.0 * part / whole;
+}
+} // namespace
+
+ExecutionProfiler::ExecutionProfiler()
+    : pc_counts(0x10000), pc_cycles(0x10000), opcode_counts(0x100), opcode_cycles(0x100)
+{
+}
+
+// Clear all counters
+void ExecutionProfiler::Reset()
+{
+    fill(pc_counts.begin(), pc_counts.end(), 0);
+    fill(pc_cycles.begin(), pc_cycles.end(), 0);
+    fill(opcode_counts.begin(), opcode_counts.end(), 0);
+    fill(opcode_cycles.begin(), opcode_cycles.end(), 0);
+}
+
+// Number of times the instruction at pc was executed
+uint64_t ExecutionProfiler::GetPCCount(uint16_t pc) const
+{
+    return pc_counts[pc];
+}
+
+// Cycles spent on the instruction at pc
+uint64_t ExecutionProfiler::GetPCCycles(uint16_t pc) const
+{
+    return pc_cycles[pc];
+}
+
+// Number of times opcode was executed
+uint64_t ExecutionProfiler::GetOpcodeCount(uint8_t opcode) const
+{
+    return opcode_counts[opcode];
+}
+
+// Cycles spent on opcode
+uint64_t ExecutionProfiler::GetOpcodeCycles(uint8_t opcode) const
+{
+    return opcode_cycles[opcode];
+}
+
+// Number of instructions executed since the last reset
+uint64_t ExecutionProfiler::TotalInstructions() const
+{
+    uint64_t total = 0;
+    for (int i = 0; i < 0x100; i++)
+    {
+        total += opcode_counts[i];
+    }
+    return total;
+}
+
+// Number of cycles executed since the last reset
+uint64_t ExecutionProfiler::TotalCycles() const
+{
+    uint64_t total = 0;
+    for (int i = 0; i < 0x100; i++)
+    {
+        total += opcode_cycles[i];
+    }
+    return total;
+}
+
+// Print hot spots by instruction, basic block and opcode, joined with the
+// disassembly of the code in memory
+void ExecutionProfiler::Report(ostream &out, const uint8_t *memory, int mem_size, int top) const
+{
+    ios_base::fmtflags saved = out.flags();
+    char fill_char = out.fill();
+    uint64_t total_cycles = TotalCycles();
+
+    out << "Instructions: " << dec << TotalInstructions() << endl;
+    out << "Cycles:       " << total_cycles << endl;
+
+    // hottest instructions
+    vector<int> pcs;
+    for (int pc = 0; pc < 0x10000; pc++)
+    {
+        if (pc_counts[pc] != 0)
+        {
+            pcs.push_back(pc);
+        }
+    }
+    ByCycles by_pc = {&pc_cycles};
+    sort(pcs.begin(), pcs.end(), by_pc);
+
+    out << endl
+        << "Hot instructions" << endl
+        << "addr        count       cycles      %  instruction" << endl;
+    for (size_t i = 0; i < pcs.size() && static_cast<int>(i) < top; i++)
+    {
+        int pc = pcs[i];
+        out << hex << setfill('0') << setw(4) << pc << dec << setfill(' ')
+            << setw(13) << pc_counts[pc] << setw(13) << pc_cycles[pc]
+            << setw(7) << fixed << setprecision(2) << Percent(pc_cycles[pc], total_cycles)
+            << "  " << Mnemonic(memory, mem_size, pc) << endl;
+    }
+
+    // hottest basic blocks - instructions only reached through RET or PCHL
+    // become extra entry points so that every executed address has a block
+    if (memory != nullptr && mem_size > 0)
+    {
+        int image_size = min(mem_size, 0x10000);
+        ControlFlowGraph cfg;
+        cfg.Analyze(memory, image_size);
+        vector<uint16_t> entries = ControlFlowGraph::DefaultEntryPoints();
+        for (size_t i = 0; i < pcs.size(); i++)
+        {
+            if (pcs[i] < image_size && !cfg.IsCode(pcs[i]))
+            {
+                entries.push_back(pcs[i]);
+            }
+        }
+        cfg.Analyze(memory, image_size, 0x0000, entries);
+
+        vector<uint64_t> block_cycles(0x10000);
+        vector<uint64_t> block_entries(0x10000);
+        vector<int> blocks;
+        for (size_t i = 0; i < pcs.size(); i++)
+        {
+            const BasicBlock *block = cfg.BlockContaining(pcs[i]);
+            if (block == nullptr)
+            {
+                continue;
+            }
+            if (block_cycles[block->start] == 0)
+            {
+                blocks.push_back(block->start);
+            }
+            block_cycles[block->start] += pc_cycles[pcs[i]];
+            if (pcs[i] == block->start)
+            {
+                block_entries[block->start] = pc_counts[pcs[i]];
+            }
+        }
+        ByCycles by_block = {&block_cycles};
+        sort(blocks.begin(), blocks.end(), by_block);
+
+        out << endl
+            << "Hot blocks" << endl
+            << "block           entries       cycles      %" << endl;
+        for (size_t i = 0; i < blocks.size() && static_cast<int>(i) < top; i++)
+        {
+            const BasicBlock *block = cfg.BlockAt(blocks[i]);
+            out << hex << setfill('0') << setw(4) << block->start << '-' << setw(4) << (block->end - 1)
+                << dec << setfill(' ') << setw(13) << block_entries[block->start]
+                << setw(13) << block_cycles[block->start]
+                << setw(7) << fixed << setprecision(2) << Percent(block_cycles[block->start], total_cycles)
+                << endl;
+        }
+    }
+
+    // hottest opcodes
+    vector<int> opcodes;
+    for (int op = 0; op < 0x100; op++)
+    {
+        if (opcode_counts[op] != 0)
+        {
+            opcodes.push_back(op);
+        }
+    }
+    ByCycles by_opcode = {&opcode_cycles};
+    sort(opcodes.begin(), opcodes.end(), by_opcode);
+
+    out << endl
+        << "Hot opcodes" << endl
+        << "op          count       cycles      %  instruction" << endl;
+    for (size_t i = 0; i < opcodes.size() && static_cast<int>(i) < top; i++)
+    {
+        int op = opcodes[i];
+        uint8_t bytes[3] = {static_cast<uint8_t>(op), 0, 0};
+        out << hex << setfill('0') << setw(2) << op << dec << setfill(' ')
+            << setw(15) << opcode_counts[op] << setw(13) << opcode_cycles[op]
+            << setw(7) << fixed << setprecision(2) << Percent(opcode_cycles[op], total_cycles)
+            << "  " << Mnemonic(bytes, 3, 0) << endl;
+    }
+
+    out.flags(saved);
+    out.fill(fill_char);
+}
@@ -0,0 +1,68 @@
+#ifndef EMULATOR_PROFILER_HPP_
+#define EMULATOR_PROFILER_HPP_
+
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+class Emulator;
+
+// Profiling policies for Emulator::EmulateProfiled
+//
+// A policy is any class with the members
+//     void Instruction(const Emulator &e, uint16_t pc, uint8_t opcode, int cycles);
+//     void Interrupt(const Emulator &e, int interrupt_num);
+// The run loop calls Instruction after executing the instruction at pc, and
+// Emulator::InterruptProfiled calls Interrupt when an interrupt is taken.
+// The emulator passed in already holds the state after the event.
+
+// Policy that records nothing - the empty inline hooks compile away
+struct NullProfiler
+{
+    void Instruction(const Emulator &, uint16_t, uint8_t, int) {}
+    void Interrupt(const Emulator &, int) {}
+};
+
+// Counts executed instructions and nothing else
+struct InstructionCounter
+{
+    uint64_t instructions = 0;
+    void Instruction(const Emulator &, uint16_t, uint8_t, int) { instructions++; }
+    void Interrupt(const Emulator &, int) {}
+};
+
+// Counts executions and cycles per program counter and per opcode
+class ExecutionProfiler
+{
+public:
+    ExecutionProfiler();
+
+    void Instruction(const Emulator &, uint16_t pc, uint8_t opcode, int cycles)
+    {
+        pc_counts[pc]++;
+        pc_cycles[pc] += cycles;
+        opcode_counts[opcode]++;
+        opcode_cycles[opcode] += cycles;
+    }
+    void Interrupt(const Emulator &, int) {}
+
+    void Reset();
+
+    uint64_t GetPCCount(uint16_t pc) const;
+    uint64_t GetPCCycles(uint16_t pc) const;
+    uint64_t GetOpcodeCount(uint8_t opcode) const;
+    uint64_t GetOpcodeCycles(uint8_t opcode) const;
+    uint64_t TotalInstructions() const;
+    uint64_t TotalCycles() const;
+
+    void Report(std::ostream &out, const uint8_t *memory, int mem_size, int top = 25) const;
+
+private:
+    // flat tables indexed by address and by opcode
+    std::vector<uint64_t> pc_counts;
+    std::vector<uint64_t> pc_cycles;
+    std::vector<uint64_t> opcode_counts;
+    std::vector<uint64_t> opcode_cycles;
+};
+
+#endif // EMULATOR_PROFILER_HPP_
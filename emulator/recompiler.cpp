@@ -0,0 +1,483 @@
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+#include "disassembler/disassembler.hpp"
+#include "emulator/hle.hpp"
+#include "emulator/opcode_bench.hpp"
+#include "emulator/recompiler.hpp"
+
+using namespace std;
+
+namespace
+{
+// Cycles each instruction takes in the interpreter; conditional calls and
+// returns when they are not taken
+const int kCycles[256] = {
+    4, 10, 7, 5, 5, 5, 7, 4, 4, 10, 7, 5, 5, 5, 7, 4,       // 0x00
+    4, 10, 7, 5, 5, 5, 7, 4, 4, 10, 7, 5, 5, 5, 7, 4,       // 0x10
+    4, 10, 16, 5, 5, 5, 7, 4, 4, 10, 16, 5, 5, 5, 7, 4,     // 0x20
+    4, 10, 13, 5, 10, 10, 10, 4, 4, 10, 13, 5, 5, 5, 7, 4,  // 0x30
+    5, 5, 5, 5, 5, 5, 7, 5, 5, 5, 5, 5, 5, 5, 7, 5,         // 0x40
+    5, 5, 5, 5, 5, 5, 7, 5, 5, 5, 5, 5, 5, 5, 7, 5,         // 0x50
+    5, 5, 5, 5, 5, 5, 7, 5, 5, 5, 5, 5, 5, 5, 7, 5,         // 0x60
+    7, 7, 7, 7, 7, 7, 7, 7, 5, 5, 5, 5, 5, 5, 7, 5,         // 0x70
+    4, 4, 4, 4, 4, 4, 7, 4, 4, 4, 4, 4, 4, 4, 7, 4,         // 0x80
+    4, 4, 4, 4, 4, 4, 7, 4, 4, 4, 4, 4, 4, 4, 7, 4,         // 0x90
+    4, 4, 4, 4, 4, 4, 7, 4, 4, 4, 4, 4, 4, 4, 7, 4,         // 0xa0
+    4, 4, 4, 4, 4, 4, 7, 4, 4, 4, 4, 4, 4, 4, 7, 4,         // 0xb0
+    5, 10, 10, 10, 11, 11, 7, 11, 5, 10, 10, 4, 11, 17, 7, 11, // 0xc0
+    5, 10, 10, 10, 11, 11, 7, 11, 5, 4, 10, 10, 11, 4, 7, 11,  // 0xd0
+    5, 10, 10, 18, 11, 11, 7, 11, 5, 5, 10, 4, 11, 4, 7, 11,   // 0xe0
+    5, 10, 10, 4, 11, 11, 7, 11, 5, 5, 10, 4, 11, 4, 7, 11,    // 0xf0
+};
+
+// Cycles of a conditional call or return that is taken
+const int kCallTakenCycles = 17;
+const int kReturnTakenCycles = 11;
+
+// registers by their number in an opcode; 6 is M, the byte at HL
+const char *const kRegisters[8] = {"c.r.B", "c.r.C", "c.r.D", "c.r.E", "c.r.H", "c.r.L", "", "c.r.A"};
+
+// conditions by their number in a Jcc, Ccc or Rcc opcode
+const char *const kConditions[8] = {"!c.f.z", "c.f.z", "!c.f.cy", "c.f.cy", "!c.f.p", "c.f.p", "!c.f.s", "c.f.s"};
+
+string Hex(uint64_t value, int digits)
+{
+    ostringstream text;
+    text << "0x" << hex << setfill('0') << setw(digits) << value;
+    return text.str();
+}
+
+// Register or memory operand number reg, as an expression
+string Source(int reg)
+{
+    return reg == 6 ? "c.Read(c.HL())" : kRegisters[reg];
+}
+
+// Statement putting value in register or memory operand number reg
+string Store(int reg, const string &value)
+{
+    if (reg == 6)
+    {
+        return "c.Write(c.HL(), " + value + ");";
+    }
+    return string(kRegisters[reg]) + " = " + value + ";";
+}
+
+// Register pair number rp of LXI, INX, DCX and DAD, as an expression
+string Pair(int rp)
+{
+    const char *const pairs[4] = {"c.BC()", "c.DE()", "c.HL()", "c.sp"};
+    return pairs[rp];
+}
+
+// Statement setting register pair number rp to value
+string SetPair(int rp, const string &value)
+{
+    const char *const setters[3] = {"c.SetBC(", "c.SetDE(", "c.SetHL("};
+    if (rp == 3)
+    {
+        return "c.sp = " + value + ";";
+    }
+    return string(setters[rp]) + value + ");";
+}
+
+// Statement for the ALU operation number op of 0x80-0xbf and the
+// immediate forms, on operand
+string Alu(int op, const string &operand)
+{
+    switch (op)
+    {
+    case 0:
+        return "c.Add(" + operand + ", false);";
+    case 1:
+        return "c.Add(" + operand + ", c.f.cy);";
+    case 2:
+        return "c.Sub(" + operand + ", false);";
+    case 3:
+        return "c.Sub(" + operand + ", c.f.cy);";
+    case 4:
+        return "c.Ana(" + operand + ");";
+    case 5:
+        return "c.Xra(" + operand + ");";
+    case 6:
+        return "c.Ora(" + operand + ");";
+    default:
+        return "c.Cmp(" + operand + ");";
+    }
+}
+} // namespace
+
+// Find the code in the first HleTable::kRomSize bytes of rom, starting
+// from the reset and interrupt vectors
+void Recompiler::Analyze(const uint8_t *code, int size)
+{
+    Analyze(code, size, ControlFlowGraph::DefaultEntryPoints());
+}
+
+void Recompiler::Analyze(const uint8_t *code, int size, const vector<uint16_t> &entry_points)
+{
+    // only the bytes RomHash covers are known not to change under the code
+    size = min(size, static_cast<int>(HleTable::kRomSize));
+    rom.assign(code, code + size);
+    graph.Analyze(rom.data(), size, 0x0000, entry_points);
+
+    // operands are read from a padded copy, so that decoding the last
+    // instruction never reads past the end
+    rom.push_back(0);
+    rom.push_back(0);
+
+    blocks.clear();
+    const map<uint16_t, BasicBlock> &found = graph.GetBlocks();
+    for (map<uint16_t, BasicBlock>::const_iterator it = found.begin(); it != found.end(); ++it)
+    {
+        RecompiledBlock block;
+        block.start = it->second.start;
+        block.end = block.start;
+        int cycles = 0;
+        for (int i = 0; i < it->second.num_instructions && Translates(rom[block.end]); i++)
+        {
+            block.cycles_before = cycles;
+            block.last = block.end;
+            cycles += Cycles(rom[block.end]);
+            block.end = static_cast<uint16_t>(block.end + ControlFlowGraph::InstructionLength(rom[block.end]));
+        }
+        if (block.end != block.start)
+        {
+            blocks.push_back(block);
+        }
+    }
+}
+
+// Write the C++ source for the blocks found by Analyze
+void Recompiler::Write(ostream &out, const string &class_name, const string &header) const
+{
+    ios_base::fmtflags saved = out.flags();
+    out << "// Generated by the Recompile tool from a ROM with hash " << Hex(RomHash(), 16)
+        << ", see emulator/recompiler.hpp" << endl
+        << "// " << blocks.size() << " blocks, " << CodeBytes() << " bytes of code; do not edit" << endl
+        << endl
+        << "#include \"" << header << "\"" << endl
+        << endl
+        << "namespace" << endl
+        << "{" << endl;
+    for (size_t i = 0; i < blocks.size(); i++)
+    {
+        WriteBlock(out, blocks[i]);
+    }
+    out << "} // namespace" << endl
+        << endl
+        << "const uint64_t " << class_name << "::kRomHash = " << Hex(RomHash(), 16) << "ull;" << endl
+        << "const int " << class_name << "::kBlockCount = " << dec << blocks.size() << ";" << endl
+        << "const uint16_t " << class_name << "::kBlockStarts[] = {";
+    for (size_t i = 0; i < blocks.size(); i++)
+    {
+        out << (i % 8 == 0 ? "\n    " : " ") << Hex(blocks[i].start, 4) << ",";
+    }
+    out << endl
+        << "};" << endl
+        << endl
+        << "// Run block after block from c.pc until the next one does not fit in" << endl
+        << "// the cycles left or there is no block at c.pc" << endl
+        << "void " << class_name << "::Dispatch(StaticCpu &c)" << endl
+        << "{" << endl
+        << "    for (;;)" << endl
+        << "    {" << endl
+        << "        switch (c.pc)" << endl
+        << "        {" << endl;
+    for (size_t i = 0; i < blocks.size(); i++)
+    {
+        string start = Hex(blocks[i].start, 4);
+        out << "        case " << start << ":" << endl
+            << "            if (!c.Fits(" << dec << blocks[i].cycles_before << "))" << endl
+            << "            {" << endl
+            << "                return;" << endl
+            << "            }" << endl
+            << "            Block" << start.substr(2) << "(c);" << endl
+            << "            break;" << endl;
+    }
+    out << "        default:" << endl
+        << "            return;" << endl
+        << "        }" << endl
+        << "    }" << endl
+        << "}" << endl;
+    out.flags(saved);
+}
+
+// Blocks found by the last Analyze, in address order
+const vector<RecompiledBlock> &Recompiler::Blocks() const
+{
+    return blocks;
+}
+
+// Number of ROM bytes in translated instructions
+int Recompiler::CodeBytes() const
+{
+    vector<bool> covered(rom.size(), false);
+    for (size_t i = 0; i < blocks.size(); i++)
+    {
+        fill(covered.begin() + blocks[i].start, covered.begin() + blocks[i].end, true);
+    }
+    return static_cast<int>(count(covered.begin(), covered.end(), true));
+}
+
+// HleTable::RomHash of the ROM analyzed, which the generated code is only
+// valid for
+uint64_t Recompiler::RomHash() const
+{
+    return HleTable::RomHash(rom.data(), static_cast<int>(rom.size()) - 2);
+}
+
+// Whether instructions starting with opcode are translated; HLT has to stop
+// the machine and the undocumented opcodes report themselves as invalid,
+// both of which only the interpreter can do
+bool Recompiler::Translates(uint8_t opcode)
+{
+    return opcode != 0x76 && OpcodeBench::IsImplemented(opcode);
+}
+
+// Cycles the interpreter counts for the instruction starting with opcode;
+// a conditional call or return that is taken costs more, see WriteInstruction
+int Recompiler::Cycles(uint8_t opcode)
+{
+    return kCycles[opcode];
+}
+
+void Recompiler::WriteBlock(ostream &out, const RecompiledBlock &block) const
+{
+    string start = Hex(block.start, 4);
+    out << "// " << start.substr(2) << "-" << Hex(block.end - 1, 4).substr(2) << endl
+        << "inline void Block" << start.substr(2) << "(StaticCpu &c)" << endl
+        << "{" << endl;
+    for (uint16_t address = block.start; address != block.end;
+         address = static_cast<uint16_t>(address + ControlFlowGraph::InstructionLength(rom[address])))
+    {
+        WriteInstruction(out, address);
+    }
+
+    // the taken and not taken costs of a conditional call or return are
+    // added by the instruction itself
+    uint8_t last = rom[block.last];
+    FlowType exit = ControlFlowGraph::GetFlowType(last);
+    if (exit == kFlowNext)
+    {
+        out << "    c.pc = " << Hex(block.end, 4) << ";" << endl;
+    }
+    int cycles = block.cycles_before;
+    if (exit != kFlowCondCall && exit != kFlowCondReturn)
+    {
+        cycles += Cycles(last);
+    }
+    out << "    c.cycles += " << dec << cycles << ";" << endl
+        << "}" << endl
+        << endl;
+}
+
+// Write the statements for the instruction at address, after a comment
+// with its disassembly
+void Recompiler::WriteInstruction(ostream &out, uint16_t address) const
+{
+    const uint8_t *code = &rom[address];
+    uint8_t opcode = code[0];
+    uint16_t next = static_cast<uint16_t>(address + ControlFlowGraph::InstructionLength(opcode));
+    string byte = Hex(code[1], 2);
+    string word = Hex(code[2] << 8 | code[1], 4);
+    string word_next = Hex(((code[2] << 8 | code[1]) + 1) & 0xffff, 4);
+    int dst = (opcode >> 3) & 7;
+    int src = opcode & 7;
+    int rp = (opcode >> 4) & 3;
+
+    ostringstream disassembly;
+    Disassembler::Disassemble(disassembly, code, 3, address);
+    string comment = disassembly.str();
+    comment.erase(comment.find_last_not_of('\n') + 1);
+    out << "    // " << comment << endl;
+
+    vector<string> lines;
+    if (opcode >= 0x40 && opcode < 0x80)
+    {
+        // MOV; HLT is never translated
+        if (dst != src)
+        {
+            lines.push_back(Store(dst, Source(src)));
+        }
+    }
+    else if (opcode >= 0x80 && opcode < 0xc0)
+    {
+        lines.push_back(Alu(dst, Source(src)));
+    }
+    else if (opcode < 0x40 && (opcode & 0x07) == 0x04)
+    {
+        lines.push_back(Store(dst, "c.Inr(" + Source(dst) + ")"));
+    }
+    else if (opcode < 0x40 && (opcode & 0x07) == 0x05)
+    {
+        lines.push_back(Store(dst, "c.Dcr(" + Source(dst) + ")"));
+    }
+    else if (opcode < 0x40 && (opcode & 0x07) == 0x06)
+    {
+        lines.push_back(Store(dst, byte));
+    }
+    else if (opcode < 0x40 && (opcode & 0x0f) == 0x01)
+    {
+        lines.push_back(SetPair(rp, word));
+    }
+    else if (opcode < 0x40 && (opcode & 0x0f) == 0x03)
+    {
+        lines.push_back(SetPair(rp, "static_cast<uint16_t>(" + Pair(rp) + " + 1)"));
+    }
+    else if (opcode < 0x40 && (opcode & 0x0f) == 0x0b)
+    {
+        lines.push_back(SetPair(rp, "static_cast<uint16_t>(" + Pair(rp) + " - 1)"));
+    }
+    else if (opcode < 0x40 && (opcode & 0x0f) == 0x09)
+    {
+        lines.push_back("c.Dad(" + Pair(rp) + ");");
+    }
+    else if ((opcode & 0xc7) == 0xc6)
+    {
+        lines.push_back(Alu(dst, byte));
+    }
+    else if ((opcode & 0xc7) == 0xc2)
+    {
+        // Jcc
+        lines.push_back("c.pc = " + string(kConditions[dst]) + " ? " + word + " : " + Hex(next, 4) + ";");
+    }
+    else if ((opcode & 0xc7) == 0xc4)
+    {
+        // Ccc
+        lines.push_back("if (" + string(kConditions[dst]) + ")");
+        lines.push_back("{");
+        lines.push_back("    c.Call(" + word + ", " + Hex(next, 4) + ");");
+        lines.push_back("    c.cycles += " + to_string(kCallTakenCycles) + ";");
+        lines.push_back("}");
+        lines.push_back("else");
+        lines.push_back("{");
+        lines.push_back("    c.pc = " + Hex(next, 4) + ";");
+        lines.push_back("    c.cycles += " + to_string(Cycles(opcode)) + ";");
+        lines.push_back("}");
+    }
+    else if ((opcode & 0xc7) == 0xc0)
+    {
+        // Rcc
+        lines.push_back("if (" + string(kConditions[dst]) + ")");
+        lines.push_back("{");
+        lines.push_back("    c.Return();");
+        lines.push_back("    c.cycles += " + to_string(kReturnTakenCycles) + ";");
+        lines.push_back("}");
+        lines.push_back("else");
+        lines.push_back("{");
+        lines.push_back("    c.pc = " + Hex(next, 4) + ";");
+        lines.push_back("    c.cycles += " + to_string(Cycles(opcode)) + ";");
+        lines.push_back("}");
+    }
+    else if ((opcode & 0xc7) == 0xc7)
+    {
+        // RST
+        lines.push_back("c.Call(" + Hex(opcode & 0x38, 4) + ", " + Hex(next, 4) + ");");
+    }
+    else if ((opcode & 0xcf) == 0xc1)
+    {
+        const char *const pops[4] = {"c.Pop(&c.r.B, &c.r.C);", "c.Pop(&c.r.D, &c.r.E);", "c.Pop(&c.r.H, &c.r.L);",
+                                     "c.PopPsw();"};
+        lines.push_back(pops[rp]);
+    }
+    else if ((opcode & 0xcf) == 0xc5)
+    {
+        const char *const pushes[4] = {"c.Push(c.r.B, c.r.C);", "c.Push(c.r.D, c.r.E);", "c.Push(c.r.H, c.r.L);",
+                                       "c.PushPsw();"};
+        lines.push_back(pushes[rp]);
+    }
+    else
+    {
+        switch (opcode)
+        {
+        case 0x02:
+        case 0x12:
+            lines.push_back("c.Write(" + Pair(rp) + ", c.r.A);");
+            break;
+        case 0x0a:
+        case 0x1a:
+            lines.push_back("c.r.A = c.Read(" + Pair(rp) + ");");
+            break;
+        case 0x07:
+            lines.push_back("c.Rlc();");
+            break;
+        case 0x0f:
+            lines.push_back("c.Rrc();");
+            break;
+        case 0x17:
+            lines.push_back("c.Ral();");
+            break;
+        case 0x1f:
+            lines.push_back("c.Rar();");
+            break;
+        case 0x22:
+            lines.push_back("c.Write(" + word + ", c.r.L);");
+            lines.push_back("c.Write(" + word_next + ", c.r.H);");
+            break;
+        case 0x2a:
+            lines.push_back("c.r.L = c.Read(" + word + ");");
+            lines.push_back("c.r.H = c.Read(" + word_next + ");");
+            break;
+        case 0x27:
+            lines.push_back("c.Daa();");
+            break;
+        case 0x2f:
+            lines.push_back("c.r.A = static_cast<uint8_t>(~c.r.A);");
+            break;
+        case 0x32:
+            lines.push_back("c.Write(" + word + ", c.r.A);");
+            break;
+        case 0x3a:
+            lines.push_back("c.r.A = c.Read(" + word + ");");
+            break;
+        case 0x37:
+            lines.push_back("c.f.cy = true;");
+            break;
+        case 0x3f:
+            lines.push_back("c.f.cy = !c.f.cy;");
+            break;
+        case 0xc3:
+            lines.push_back("c.pc = " + word + ";");
+            break;
+        case 0xc9:
+            lines.push_back("c.Return();");
+            break;
+        case 0xcd:
+            lines.push_back("c.Call(" + word + ", " + Hex(next, 4) + ");");
+            break;
+        case 0xd3:
+            lines.push_back("c.Out(" + byte + ");");
+            break;
+        case 0xdb:
+            lines.push_back("c.In(" + byte + ");");
+            break;
+        case 0xe3:
+            lines.push_back("c.Xthl();");
+            break;
+        case 0xe9:
+            lines.push_back("c.pc = c.HL();");
+            break;
+        case 0xeb:
+            lines.push_back("c.Xchg();");
+            break;
+        case 0xf3:
+            lines.push_back("c.interrupt_enable = false;");
+            break;
+        case 0xf9:
+            lines.push_back("c.sp = c.HL();");
+            break;
+        case 0xfb:
+            lines.push_back("c.interrupt_enable = true;");
+            break;
+        default:
+            // NOP
+            break;
+        }
+    }
+    for (size_t i = 0; i < lines.size(); i++)
+    {
+        out << "    " << lines[i] << endl;
+    }
+}
@@ -0,0 +1,57 @@
+#ifndef EMULATOR_RECOMPILER_HPP_
+#define EMULATOR_RECOMPILER_HPP_
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "disassembler/control_flow.hpp"
+
+// A basic block as the recompiler translates it: the instructions from
+// start up to end, which may stop short of the block in the control flow
+// graph at an instruction that is left to the interpreter
+struct RecompiledBlock
+{
+    uint16_t start = 0;
+    uint16_t end = 0;          // address after the last instruction translated
+    uint16_t last = 0;         // address of the last instruction translated
+    int cycles_before = 0;     // cycles of the instructions before last
+};
+
+// Ahead-of-time translation of an 8080 ROM to C++, see tools/recompile.cpp
+//
+// The ROM is split into basic blocks by ControlFlowGraph, starting from the
+// reset and interrupt vectors and any entry points given. Write emits a
+// function per block operating on a StaticCpu (emulator/static_cpu.hpp),
+// which does what the interpreter does for the block's instructions and
+// counts the same cycles, and a dispatcher that switches on PC to run
+// block after block. It returns once the next block would not start all
+// of its instructions within the cycles left, or PC reaches an address
+// where no block was found, such as a PCHL target or code in RAM; HLT and
+// the undocumented opcodes end a block and are left to the interpreter
+// too. The dispatcher and the table of block starts are written as
+// members of class_name, declared in header.
+class Recompiler
+{
+public:
+    void Analyze(const uint8_t *rom, int size);
+    void Analyze(const uint8_t *rom, int size, const std::vector<uint16_t> &entry_points);
+    void Write(std::ostream &out, const std::string &class_name, const std::string &header) const;
+
+    const std::vector<RecompiledBlock> &Blocks() const;
+    int CodeBytes() const;
+    uint64_t RomHash() const;
+
+    static bool Translates(uint8_t opcode);
+    static int Cycles(uint8_t opcode);
+
+private:
+    void WriteBlock(std::ostream &out, const RecompiledBlock &block) const;
+    void WriteInstruction(std::ostream &out, uint16_t address) const;
+
+    std::vector<uint8_t> rom;
+    ControlFlowGraph graph;
+    std::vector<RecompiledBlock> blocks;
+};
+
+#endif // EMULATOR_RECOMPILER_HPP_
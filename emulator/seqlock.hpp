@@ -0,0 +1,95 @@
+#ifndef EMULATOR_SEQLOCK_HPP_
+#define EMULATOR_SEQLOCK_HPP_
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <type_traits>
+
+// Value written by one thread and read by any number of others
+//
+// The writer never waits: it bumps the sequence number to odd, stores the
+// value and bumps it back to even. A reader copies the value out between two
+// loads of the sequence number and keeps the copy only if both were the same
+// even number, so it never sees half of one write and half of another. The
+// value is held in atomic words so that a copy racing a write is not a data
+// race, merely one that gets thrown away.
+template <class T>
+class Seqlock
+{
+    static_assert(std::is_trivially_copyable<T>::value, "Seqlock values are copied bytewise");
+
+public:
+    Seqlock()
+    {
+        sequence.store(0, std::memory_order_relaxed);
+        for (size_t i = 0; i < kWords; i++)
+        {
+            words[i].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    // Writer: publish value
+    void Write(const T &value)
+    {
+        uint64_t buffer[kWords] = {};
+        std::memcpy(buffer, &value, sizeof(T));
+        uint64_t s = sequence.load(std::memory_order_relaxed);
+        sequence.store(s + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        for (size_t i = 0; i < kWords; i++)
+        {
+            words[i].store(buffer[i], std::memory_order_relaxed);
+        }
+        sequence.store(s + 2, std::memory_order_release);
+    }
+
+    // Reader: copy the last value written into *value, or return false if a
+    // write was under way
+    bool TryRead(T *value) const
+    {
+        uint64_t before = sequence.load(std::memory_order_acquire);
+        if (before & 1)
+        {
+            return false;
+        }
+        uint64_t buffer[kWords];
+        for (size_t i = 0; i < kWords; i++)
+        {
+            buffer[i] = words[i].load(std::memory_order_relaxed);
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (sequence.load(std::memory_order_relaxed) != before)
+        {
+            return false;
+        }
+        std::memcpy(value, buffer, sizeof(T));
+        return true;
+    }
+
+    // Reader: the last value written, retrying until a copy is consistent
+    T Read() const
+    {
+        T value;
+        while (!TryRead(&value))
+        {
+            std::this_thread::yield();
+        }
+        return value;
+    }
+
+    // Number of writes so far, for readers waiting for a new value
+    uint64_t Writes() const
+    {
+        return sequence.load(std::memory_order_acquire) / 2;
+    }
+
+private:
+    static const size_t kWords = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+    std::atomic<uint64_t> sequence;
+    std::atomic<uint64_t> words[kWords];
+};
+
+#endif // EMULATOR_SEQLOCK_HPP_
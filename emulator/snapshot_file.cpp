@@ -0,0 +1,361 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include "emulator/snapshot_file.hpp"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+const uint32_t SnapshotFile::kVersion;
+const uint32_t SnapshotFile::kMemoryAlignment;
+
+static_assert(sizeof(SnapshotFileHeader) == 64, "snapshot file header layout changed");
+
+namespace
+{
+const char kMagic[8] = {'8', '0', '8', '0', 'S', 'N', 'A', 'P'};
+
+uint64_t Fnv1a(const uint8_t *data, size_t size)
+{
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < size; i++)
+    {
+        hash = (hash ^ data[i]) * 0x100000001b3ull;
+    }
+    return hash;
+}
+
+uint32_t MemoryOffset()
+{
+    return (sizeof(SnapshotFileHeader) + SnapshotFile::kMemoryAlignment - 1) / SnapshotFile::kMemoryAlignment *
+           SnapshotFile::kMemoryAlignment;
+}
+} // namespace
+
+SnapshotFile::SnapshotFile() : data(nullptr), size(0), mapping(nullptr)
+{
+}
+
+SnapshotFile::~SnapshotFile()
+{
+    Close();
+}
+
+// Map the snapshot file at path and check that it is one this build can read
+bool SnapshotFile::Open(const string &path)
+{
+    Close();
+#ifndef _WIN32
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        error = "unable to open " + path + ": " + strerror(errno);
+        return false;
+    }
+    struct stat status;
+    if (fstat(fd, &status) != 0 || status.st_size < static_cast<off_t>(sizeof(SnapshotFileHeader)))
+    {
+        close(fd);
+        error = path + " is not a snapshot file";
+        return false;
+    }
+    size_t file_size = static_cast<size_t>(status.st_size);
+    void *mapped = mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED)
+    {
+        error = "unable to map " + path + ": " + strerror(errno);
+        return false;
+    }
+    mapping = mapped;
+    data = static_cast<const uint8_t *>(mapped);
+    size = file_size;
+#else
+    ifstream file(path, ios::binary);
+    buffer.assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+    if (!file && !file.eof())
+    {
+        error = "unable to open " + path;
+        return false;
+    }
+    data = buffer.data();
+    size = buffer.size();
+#endif
+    if (!Check(size))
+    {
+        error = path + ": " + error;
+        Close();
+        return false;
+    }
+    return true;
+}
+
+void SnapshotFile::Close()
+{
+#ifndef _WIN32
+    if (mapping != nullptr)
+    {
+        munmap(mapping, size);
+        mapping = nullptr;
+    }
+#endif
+    buffer.clear();
+    data = nullptr;
+    size = 0;
+}
+
+// Put e in the state saved in the open file
+bool SnapshotFile::Restore(Emulator *e) const
+{
+    if (data == nullptr)
+    {
+        return false;
+    }
+    const SnapshotFileHeader &header = Header();
+    Snapshot state;
+    state.registers.A = header.registers[0];
+    state.registers.B = header.registers[1];
+    state.registers.C = header.registers[2];
+    state.registers.D = header.registers[3];
+    state.registers.E = header.registers[4];
+    state.registers.H = header.registers[5];
+    state.registers.L = header.registers[6];
+    state.flags.s = (header.flags & 0x80) != 0;
+    state.flags.z = (header.flags & 0x40) != 0;
+    state.flags.ac = (header.flags & 0x10) != 0;
+    state.flags.p = (header.flags & 0x04) != 0;
+    state.flags.cy = (header.flags & 0x01) != 0;
+    state.sp = header.sp;
+    state.pc = header.pc;
+    state.interrupt_enable = header.interrupt_enable != 0;
+    state.halted = header.halted != 0;
+    state.ports.port1 = header.ports[0];
+    state.ports.port2 = header.ports[1];
+    state.ports.port3 = header.ports[2];
+    state.ports.port5 = header.ports[3];
+    state.cycles = header.cycles;
+    e->LoadState(state, Memory(), static_cast<int>(header.memory_size));
+    return true;
+}
+
+const SnapshotFileHeader &SnapshotFile::Header() const
+{
+    return *reinterpret_cast<const SnapshotFileHeader *>(data);
+}
+
+const uint8_t *SnapshotFile::Memory() const
+{
+    return data + Header().memory_offset;
+}
+
+// Why the last Open failed
+const string &SnapshotFile::Error() const
+{
+    return error;
+}
+
+// Save snapshot to path, replacing any file there only once the new one is
+// complete; on failure the reason is put in *error if it is given
+bool SnapshotFile::Write(const string &path, const Snapshot &snapshot, string *error)
+{
+    SnapshotFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.version = kVersion;
+    header.header_size = sizeof(SnapshotFileHeader);
+    header.cycles = snapshot.cycles;
+    header.memory_offset = MemoryOffset();
+    header.memory_size = static_cast<uint32_t>(snapshot.memory.size());
+    header.memory_hash = Fnv1a(snapshot.memory.data(), snapshot.memory.size());
+    header.sp = snapshot.sp;
+    header.pc = snapshot.pc;
+    const Registers &r = snapshot.registers;
+    const uint8_t registers[7] = {r.A, r.B, r.C, r.D, r.E, r.H, r.L};
+    memcpy(header.registers, registers, sizeof(registers));
+    const Flags &f = snapshot.flags;
+    header.flags = static_cast<uint8_t>(f.s << 7 | f.z << 6 | f.ac << 4 | f.p << 2 | 0x02 | f.cy);
+    header.interrupt_enable = snapshot.interrupt_enable;
+    header.halted = snapshot.halted;
+    header.ports[0] = snapshot.ports.port1;
+    header.ports[1] = snapshot.ports.port2;
+    header.ports[2] = snapshot.ports.port3;
+    header.ports[3] = snapshot.ports.port5;
+
+    string temporary = path + ".tmp";
+    FILE *file = fopen(temporary.c_str(), "wb");
+    if (file == nullptr)
+    {
+        if (error != nullptr)
+        {
+            *error = "unable to create " + temporary + ": " + strerror(errno);
+        }
+        return false;
+    }
+    vector<uint8_t> padding(header.memory_offset - sizeof(header), 0);
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+              fwrite(padding.data(), 1, padding.size(), file) == padding.size() &&
+              fwrite(snapshot.memory.data(), 1, snapshot.memory.size(), file) == snapshot.memory.size() &&
+              fflush(file) == 0;
+#ifndef _WIN32
+    ok = ok && fsync(fileno(file)) == 0;
+#endif
+    ok = fclose(file) == 0 && ok;
+#ifdef _WIN32
+    remove(path.c_str());
+#endif
+    if (!ok || rename(temporary.c_str(), path.c_str()) != 0)
+    {
+        if (error != nullptr)
+        {
+            *error = "unable to write " + path + ": " + strerror(errno);
+        }
+        remove(temporary.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool SnapshotFile::Write(const string &path, const Emulator &e, string *error)
+{
+    Snapshot snapshot;
+    e.SaveState(&snapshot);
+    return Write(path, snapshot, error);
+}
+
+// Check the header and memory of a file of size bytes at data
+bool SnapshotFile::Check(size_t file_size)
+{
+    const SnapshotFileHeader &header = Header();
+    if (file_size < sizeof(SnapshotFileHeader) || memcmp(header.magic, kMagic, sizeof(kMagic)) != 0)
+    {
+        error = "not a snapshot file";
+        return false;
+    }
+    if (header.version != kVersion || header.header_size != sizeof(SnapshotFileHeader))
+    {
+        error = "snapshot version " + to_string(header.version) + ", expected " + to_string(kVersion);
+        return false;
+    }
+    if (header.memory_offset % kMemoryAlignment != 0 || header.memory_offset < sizeof(SnapshotFileHeader) ||
+        header.memory_size == 0 || header.memory_size > 0x10000 ||
+        static_cast<uint64_t>(header.memory_offset) + header.memory_size > file_size)
+    {
+        error = "snapshot file truncated or damaged";
+        return false;
+    }
+    if (Fnv1a(data + header.memory_offset, header.memory_size) != header.memory_hash)
+    {
+        error = "snapshot memory does not match its hash";
+        return false;
+    }
+    return true;
+}
+
+CheckpointWriter::CheckpointWriter() : ring(1), stopping(false), written(0), skipped(0), failures(0)
+{
+}
+
+CheckpointWriter::~CheckpointWriter()
+{
+    Stop();
+}
+
+// Write checkpoints to path from now on
+void CheckpointWriter::Start(const string &checkpoint_path)
+{
+    Stop();
+    path = checkpoint_path;
+    stopping = false;
+    writer = thread(&CheckpointWriter::WriterLoop, this);
+}
+
+// Finish writing the last checkpoint submitted and stop the writer thread
+void CheckpointWriter::Stop()
+{
+    if (writer.joinable())
+    {
+        {
+            lock_guard<mutex> lock(wake_mutex);
+            stopping = true;
+        }
+        wake.notify_one();
+        writer.join();
+    }
+}
+
+// Emulation thread: checkpoint e as it is now, or return false without
+// waiting if the writer is still busy with the last checkpoint
+bool CheckpointWriter::Submit(const Emulator &e)
+{
+    if (ring.Size() != 0)
+    {
+        skipped.fetch_add(1, memory_order_relaxed);
+        return false;
+    }
+    e.SaveState(&scratch);
+    ring.TryPush(scratch);
+
+    // the writer only holds the lock between looking at the ring and going
+    // to sleep, so taking it here is brief and no wakeup is lost
+    {
+        lock_guard<mutex> lock(wake_mutex);
+    }
+    wake.notify_one();
+    return true;
+}
+
+// Checkpoints written to the file
+uint64_t CheckpointWriter::Written() const
+{
+    return written.load(memory_order_relaxed);
+}
+
+// Checkpoints left out because the writer was busy
+uint64_t CheckpointWriter::Skipped() const
+{
+    return skipped.load(memory_order_relaxed);
+}
+
+// Checkpoints that could not be written
+uint64_t CheckpointWriter::Failures() const
+{
+    return failures.load(memory_order_relaxed);
+}
+
+void CheckpointWriter::WriterLoop()
+{
+    Snapshot state;
+    for (;;)
+    {
+        if (ring.TryPopBulk(&state, 1) == 1)
+        {
+            if (SnapshotFile::Write(path, state))
+            {
+                written.fetch_add(1, memory_order_relaxed);
+            }
+            else
+            {
+                failures.fetch_add(1, memory_order_relaxed);
+            }
+            continue;
+        }
+
+        // sleep until Submit or Stop; checkpoints come seconds apart
+        unique_lock<mutex> lock(wake_mutex);
+        while (ring.Size() == 0 && !stopping)
+        {
+            wake.wait(lock);
+        }
+        if (ring.Size() == 0)
+        {
+            return;
+        }
+    }
+}
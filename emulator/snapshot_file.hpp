@@ -0,0 +1,114 @@
+#ifndef EMULATOR_SNAPSHOT_FILE_HPP_
+#define EMULATOR_SNAPSHOT_FILE_HPP_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "emulator/emulator.hpp"
+#include "emulator/spsc_ring.hpp"
+
+// Header of a snapshot file, 64 bytes in host (little endian) byte order
+//
+// Memory follows at memory_offset, a multiple of 64, so that a mapped file
+// can be copied into the emulator's memory in one go. Readers check magic,
+// version and header_size; fields may only be added in reserved space, and
+// any other change to the layout needs a new version. flags are stored as a
+// real 8080 pushes PSW, which is not the bit order this emulator's PUSH PSW
+// uses; the file format is fixed, so keep the encoder as it is.
+struct SnapshotFileHeader
+{
+    char magic[8];          // "8080SNAP"
+    uint32_t version;
+    uint32_t header_size;
+    uint64_t cycles;
+    uint32_t memory_offset;
+    uint32_t memory_size;
+    uint64_t memory_hash;   // FNV-1a of the memory
+    uint16_t sp;
+    uint16_t pc;
+    uint8_t registers[7];   // A B C D E H L
+    uint8_t flags;          // S Z 0 AC 0 P 1 CY, see above
+    uint8_t interrupt_enable;
+    uint8_t ports[4];       // port1 port2 port3 port5
+    uint8_t halted;
+    uint8_t reserved[6];
+};
+
+// A snapshot file, mapped into memory for reading
+//
+// Open maps the file and checks it; Restore then sets the registers from
+// the header and copies memory straight from the mapping, so resuming a
+// saved machine costs little more than the page faults of one copy.
+// Write goes through a temporary file and a rename, so a crash while
+// writing leaves the previous file intact.
+class SnapshotFile
+{
+public:
+    static const uint32_t kVersion = 1;
+    static const uint32_t kMemoryAlignment = 64;
+
+    SnapshotFile();
+    ~SnapshotFile();
+    SnapshotFile(const SnapshotFile &) = delete;
+    SnapshotFile &operator=(const SnapshotFile &) = delete;
+
+    bool Open(const std::string &path);
+    void Close();
+    bool Restore(Emulator *e) const;
+    const SnapshotFileHeader &Header() const;
+    const uint8_t *Memory() const;
+    const std::string &Error() const;
+
+    static bool Write(const std::string &path, const Snapshot &snapshot, std::string *error = nullptr);
+    static bool Write(const std::string &path, const Emulator &e, std::string *error = nullptr);
+
+private:
+    bool Check(size_t size);
+
+    const uint8_t *data;
+    size_t size;
+    void *mapping;
+    std::vector<uint8_t> buffer; // the file's contents where it cannot be mapped
+    std::string error;
+};
+
+// Writes checkpoints of a running machine to a snapshot file on a
+// background thread
+//
+// Submit copies the machine state and hands it to the writer thread. It
+// never waits: a checkpoint offered while the last one is still waiting
+// for the writer is skipped.
+class CheckpointWriter
+{
+public:
+    CheckpointWriter();
+    ~CheckpointWriter();
+
+    void Start(const std::string &path);
+    void Stop();
+    bool Submit(const Emulator &e);
+
+    uint64_t Written() const;
+    uint64_t Skipped() const;
+    uint64_t Failures() const;
+
+private:
+    void WriterLoop();
+
+    SpscRing<Snapshot> ring;
+    Snapshot scratch;
+    std::string path;
+    std::thread writer;
+    std::mutex wake_mutex;
+    std::condition_variable wake;
+    bool stopping;
+    std::atomic<uint64_t> written;
+    std::atomic<uint64_t> skipped;
+    std::atomic<uint64_t> failures;
+};
+
+#endif // EMULATOR_SNAPSHOT_FILE_HPP_
@@ -0,0 +1,86 @@
+#ifndef EMULATOR_SPSC_RING_HPP_
+#define EMULATOR_SPSC_RING_HPP_
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+// Bounded lock-free queue for one producer thread and one consumer thread
+//
+// The producer only writes tail and the consumer only writes head, so
+// neither side ever waits on a lock. Capacity is rounded up to a power of two.
+template <class T>
+class SpscRing
+{
+public:
+    explicit SpscRing(size_t capacity)
+    {
+        size_t size = 1;
+        while (size < capacity)
+        {
+            size <<= 1;
+        }
+        slots.resize(size);
+        mask = size - 1;
+        head.store(0, std::memory_order_relaxed);
+        tail.store(0, std::memory_order_relaxed);
+        cached_head = 0;
+    }
+
+    // Producer: append item, or return false if the ring is full
+    bool TryPush(const T &item)
+    {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t - cached_head > mask)
+        {
+            cached_head = head.load(std::memory_order_acquire);
+            if (t - cached_head > mask)
+            {
+                return false;
+            }
+        }
+        slots[t & mask] = item;
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer: move up to max_items into out, returns the number moved
+    size_t TryPopBulk(T *out, size_t max_items)
+    {
+        size_t h = head.load(std::memory_order_relaxed);
+        size_t available = tail.load(std::memory_order_acquire) - h;
+        size_t count = available < max_items ? available : max_items;
+        for (size_t i = 0; i < count; i++)
+        {
+            out[i] = slots[(h + i) & mask];
+        }
+        head.store(h + count, std::memory_order_release);
+        return count;
+    }
+
+    // Approximate number of queued items, exact when called from either end
+    size_t Size() const
+    {
+        return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+    }
+
+    size_t Capacity() const
+    {
+        return mask + 1;
+    }
+
+private:
+    std::vector<T> slots;
+    size_t mask;
+
+    // keep the two indices on separate cache lines; padded rather than
+    // aligned, as C++11 new does not honour alignment beyond max_align_t
+    std::atomic<size_t> head;
+    char pad[64 - sizeof(std::atomic<size_t>)];
+    std::atomic<size_t> tail;
+
+    // producer's last view of head
+    size_t cached_head;
+};
+
+#endif // EMULATOR_SPSC_RING_HPP_
@@ -0,0 +1,330 @@
+#ifndef EMULATOR_STATIC_CPU_HPP_
+#define EMULATOR_STATIC_CPU_HPP_
+
+#include <cstdint>
+#include "emulator/emulator.hpp"
+
+// The CPU as code from the recompiler runs it, see emulator/recompiler.hpp
+//
+// Registers, flags, SP, the ports and the interrupt flag are copied out of
+// the machine and put back by Leave. Reads come straight from memory, since
+// recompiled code only runs with no watch attached (see
+// Emulator::SetHleHooks); writes go through WriteToMem so that dirty pages
+// and writes outside RAM come out as they do from the interpreter. Each
+// operation sets flags exactly as the interpreter's instruction of the same
+// name does.
+struct StaticCpu
+{
+    StaticCpu(Emulator *machine, int cycles_left)
+        : e(machine), memory(machine->GetMemory()), r(machine->GetRegisters()), f(machine->GetFlags()),
+          ports(machine->GetPorts()), sp(static_cast<uint16_t>(machine->GetSP())),
+          pc(static_cast<uint16_t>(machine->GetPC())), interrupt_enable(machine->interrupt_enable), cycles(0),
+          limit(cycles_left)
+    {
+    }
+
+    // Whether a block whose instructions but the last take cycles_before
+    // would start all of them within this call to Emulate
+    bool Fits(int cycles_before) const
+    {
+        return cycles + cycles_before < limit;
+    }
+
+    // Put the CPU back in the machine and return the cycles spent
+    int Leave()
+    {
+        e->SetRegisters(r);
+        e->SetFlags(f);
+        e->SetPorts(ports);
+        e->SetSP(sp);
+        e->SetPC(pc);
+        e->interrupt_enable = interrupt_enable;
+        return cycles;
+    }
+
+    uint16_t BC() const
+    {
+        return static_cast<uint16_t>(r.B << 8 | r.C);
+    }
+
+    uint16_t DE() const
+    {
+        return static_cast<uint16_t>(r.D << 8 | r.E);
+    }
+
+    uint16_t HL() const
+    {
+        return static_cast<uint16_t>(r.H << 8 | r.L);
+    }
+
+    void SetBC(uint16_t value)
+    {
+        r.B = static_cast<uint8_t>(value >> 8);
+        r.C = static_cast<uint8_t>(value);
+    }
+
+    void SetDE(uint16_t value)
+    {
+        r.D = static_cast<uint8_t>(value >> 8);
+        r.E = static_cast<uint8_t>(value);
+    }
+
+    void SetHL(uint16_t value)
+    {
+        r.H = static_cast<uint8_t>(value >> 8);
+        r.L = static_cast<uint8_t>(value);
+    }
+
+    uint8_t Read(uint16_t address) const
+    {
+        return memory[address];
+    }
+
+    void Write(uint16_t address, uint8_t value)
+    {
+        e->WriteToMem(address, value);
+    }
+
+    void Push(uint8_t high, uint8_t low)
+    {
+        Write(static_cast<uint16_t>(sp - 1), high);
+        Write(static_cast<uint16_t>(sp - 2), low);
+        sp -= 2;
+    }
+
+    void Pop(uint8_t *high, uint8_t *low)
+    {
+        *low = Read(sp);
+        *high = Read(static_cast<uint16_t>(sp + 1));
+        sp += 2;
+    }
+
+    // PUSH PSW and POP PSW, with the flags packed the way the interpreter
+    // packs them
+    void PushPsw()
+    {
+        Push(r.A, static_cast<uint8_t>(f.z | f.s << 1 | f.p << 2 | f.cy << 3 | f.ac << 4));
+    }
+
+    void PopPsw()
+    {
+        r.A = Read(static_cast<uint16_t>(sp + 1));
+        uint8_t psw = Read(sp);
+        f.z = (psw & 0x01) != 0;
+        f.s = (psw & 0x02) != 0;
+        f.p = (psw & 0x04) != 0;
+        f.cy = (psw & 0x08) != 0;
+        f.ac = (psw & 0x10) != 0;
+        sp += 2;
+    }
+
+    // CALL and RST: push return and go to target
+    void Call(uint16_t target, uint16_t ret)
+    {
+        Push(static_cast<uint8_t>(ret >> 8), static_cast<uint8_t>(ret));
+        pc = target;
+    }
+
+    void Return()
+    {
+        uint8_t high;
+        uint8_t low;
+        Pop(&high, &low);
+        pc = static_cast<uint16_t>(high << 8 | low);
+    }
+
+    void Xthl()
+    {
+        uint8_t l = r.L;
+        uint8_t h = r.H;
+        r.L = Read(sp);
+        r.H = Read(static_cast<uint16_t>(sp + 1));
+        Write(sp, l);
+        Write(static_cast<uint16_t>(sp + 1), h);
+    }
+
+    void Xchg()
+    {
+        uint16_t hl = HL();
+        SetHL(DE());
+        SetDE(hl);
+    }
+
+    // IN and OUT for the ports the interpreter knows; OUT to any other
+    // port goes to the output handler, which is never set while recompiled
+    // code runs
+    void In(uint8_t port)
+    {
+        if (port == 0x01)
+        {
+            r.A = ports.port1;
+        }
+        else if (port == 0x02)
+        {
+            r.A = ports.port2;
+        }
+    }
+
+    void Out(uint8_t port)
+    {
+        if (port == 0x03)
+        {
+            ports.port3 = r.A;
+        }
+        else if (port == 0x05)
+        {
+            ports.port5 = r.A;
+        }
+    }
+
+    static bool EvenParity(uint8_t value)
+    {
+        value ^= value >> 4;
+        return ((0x9669 >> (value & 0x0f)) & 1) != 0;
+    }
+
+    void ZspFlags(uint8_t value)
+    {
+        f.z = value == 0;
+        f.s = (value & 0x80) != 0;
+        f.p = EvenParity(value);
+    }
+
+    void Add(uint8_t operand, bool carry)
+    {
+        uint16_t result = static_cast<uint16_t>(r.A + operand + carry);
+        f.ac = ((r.A & 0x0f) + (operand & 0x0f) + carry) > 0x0f;
+        f.cy = result > 0xff;
+        r.A = static_cast<uint8_t>(result);
+        ZspFlags(r.A);
+    }
+
+    void Sub(uint8_t operand, bool borrow)
+    {
+        uint16_t complement = static_cast<uint16_t>(~operand & 0xff);
+        uint16_t result = static_cast<uint16_t>(r.A + complement + !borrow);
+        f.ac = ((r.A & 0x0f) + (complement & 0x0f) + !borrow) > 0x0f;
+        f.cy = (result & 0x100) == 0;
+        r.A = static_cast<uint8_t>(result);
+        ZspFlags(r.A);
+    }
+
+    void Cmp(uint8_t operand)
+    {
+        uint8_t a = r.A;
+        Sub(operand, false);
+        r.A = a;
+    }
+
+    // ORA, XRA and ORI flags
+    void LogicFlags()
+    {
+        f.cy = false;
+        f.ac = false;
+        ZspFlags(r.A);
+    }
+
+    void Ana(uint8_t operand)
+    {
+        bool ac = ((r.A | operand) & 0x08) != 0;
+        r.A &= operand;
+        LogicFlags();
+        f.ac = ac;
+    }
+
+    void Xra(uint8_t operand)
+    {
+        r.A ^= operand;
+        LogicFlags();
+    }
+
+    void Ora(uint8_t operand)
+    {
+        r.A |= operand;
+        LogicFlags();
+    }
+
+    uint8_t Inr(uint8_t value)
+    {
+        value++;
+        f.ac = (value & 0x0f) == 0x00;
+        ZspFlags(value);
+        return value;
+    }
+
+    uint8_t Dcr(uint8_t value)
+    {
+        value--;
+        f.ac = (value & 0x0f) != 0x0f;
+        ZspFlags(value);
+        return value;
+    }
+
+    void Dad(uint16_t value)
+    {
+        uint32_t sum = static_cast<uint32_t>(HL()) + value;
+        SetHL(static_cast<uint16_t>(sum));
+        f.cy = (sum & 0x10000) != 0;
+    }
+
+    void Rlc()
+    {
+        f.cy = (r.A & 0x80) != 0;
+        r.A = static_cast<uint8_t>(r.A << 1 | f.cy);
+    }
+
+    void Rrc()
+    {
+        f.cy = (r.A & 0x01) != 0;
+        r.A = static_cast<uint8_t>(r.A >> 1 | f.cy << 7);
+    }
+
+    void Ral()
+    {
+        bool carry = (r.A & 0x80) != 0;
+        r.A = static_cast<uint8_t>(r.A << 1 | f.cy);
+        f.cy = carry;
+    }
+
+    void Rar()
+    {
+        bool carry = (r.A & 0x01) != 0;
+        r.A = static_cast<uint8_t>(r.A >> 1 | f.cy << 7);
+        f.cy = carry;
+    }
+
+    void Daa()
+    {
+        uint8_t low = r.A & 0x0f;
+        uint8_t high = r.A >> 4;
+        uint8_t correction = 0;
+        if (low > 9 || f.ac)
+        {
+            correction = 0x06;
+        }
+        if (high > 9 || f.cy || (high == 9 && low > 9))
+        {
+            correction |= 0x60;
+            f.cy = true;
+        }
+        f.ac = (low + (correction & 0x0f)) > 0x0f;
+        r.A = static_cast<uint8_t>(r.A + correction);
+        ZspFlags(r.A);
+    }
+
+    Emulator *e;
+    const uint8_t *memory;
+    Registers r;
+    Flags f;
+    Ports ports;
+    uint16_t sp;
+    uint16_t pc;
+    bool interrupt_enable;
+
+    // cycles spent so far, and the cycles left in the call to Emulate when
+    // the recompiled code was entered
+    int cycles;
+    int limit;
+};
+
+#endif // EMULATOR_STATIC_CPU_HPP_
@@ -0,0 +1,426 @@
+#include <chrono>
+#include <cstring>
+#include "emulator/trace.hpp"
+#include "disassembler/control_flow.hpp"
+
+using namespace std;
+
+/*
+
+Trace file layout
+
+    header   "8080TRC1"
+    block    uint32 record count, uint32 payload size, payload
+    ...
+
+The payload stores each field as a column: the opcode bytes, then cycle
+deltas, pc deltas and sp deltas as LEB128 varints, then the operand1,
+operand2, a and flags bytes. The pc is stored relative to the address
+following the previous instruction and, like sp, zigzag encoded, so only
+jumps, calls and returns take more than a byte. The operand columns only
+hold entries for instructions long enough to have them. All integers are
+little endian.
+
+*/
+
+namespace
+{
+const char kTraceMagic[8] = {'8', '0', '8', '0', 'T', 'R', 'C', '1'};
+
+// Write value as a varint at out, returns the byte after it
+uint8_t *PutVarint(uint64_t value, uint8_t *out)
+{
+    while (value >= 0x80)
+    {
+        *out++ = static_cast<uint8_t>(value | 0x80);
+        value >>= 7;
+    }
+    *out++ = static_cast<uint8_t>(value);
+    return out;
+}
+
+bool GetVarint(const uint8_t **data, const uint8_t *end, uint64_t *value)
+{
+    *value = 0;
+    for (int shift = 0; shift < 64 && *data < end; shift += 7)
+    {
+        uint8_t byte = *(*data)++;
+        *value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Map a 16 bit difference to a small unsigned number
+uint16_t ZigZag(uint16_t current, uint16_t previous)
+{
+    uint16_t delta = static_cast<uint16_t>(current - previous);
+    return static_cast<uint16_t>((delta << 1) ^ (0u - (delta >> 15)));
+}
+
+uint16_t UnZigZag(uint64_t value, uint16_t previous)
+{
+    uint16_t zigzag = static_cast<uint16_t>(value);
+    uint16_t delta = static_cast<uint16_t>((zigzag >> 1) ^ (0u - (zigzag & 1)));
+    return static_cast<uint16_t>(previous + delta);
+}
+
+void PutUint32(uint32_t value, uint8_t *out)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        out[i] = static_cast<uint8_t>(value >> (8 * i));
+    }
+}
+
+uint32_t GetUint32(const uint8_t *in)
+{
+    return in[0] | in[1] << 8 | in[2] << 16 | static_cast<uint32_t>(in[3]) << 24;
+}
+
+// Move the bytes from begin to end down to data, returns the byte after them
+uint8_t *MoveDown(uint8_t *data, const uint8_t *begin, const uint8_t *end)
+{
+    memmove(data, begin, end - begin);
+    return data + (end - begin);
+}
+
+// Length of every opcode, as executed by the emulator
+struct LengthTable
+{
+    uint8_t length[0x100];
+};
+
+LengthTable BuildLengthTable()
+{
+    LengthTable table;
+    for (int op = 0; op < 0x100; op++)
+    {
+        table.length[op] = static_cast<uint8_t>(ControlFlowGraph::InstructionLength(op));
+    }
+    return table;
+}
+
+// The table is built on first use by whichever thread gets there first;
+// C++11 makes the initialisation of a local static thread safe
+const uint8_t *InstructionLengths()
+{
+    static const LengthTable table = BuildLengthTable();
+    return table.length;
+}
+} // namespace
+
+const size_t TraceRecorder::kBlockRecords;
+
+TraceRecorder::TraceRecorder()
+    : ring(nullptr), stopping(false), file(nullptr), records_written(0), stalls(0)
+{
+}
+
+TraceRecorder::~TraceRecorder()
+{
+    Close();
+}
+
+// Create the trace file at path and start the writer thread
+bool TraceRecorder::Open(const string &path, size_t ring_capacity)
+{
+    Close();
+    file = fopen(path.c_str(), "wb");
+    if (file == nullptr)
+    {
+        return false;
+    }
+    fwrite(kTraceMagic, 1, sizeof(kTraceMagic), file);
+
+    ring = new SpscRing<TraceRecord>(ring_capacity);
+    stopping.store(false);
+    records_written.store(0);
+    stalls = 0;
+    writer = thread(&TraceRecorder::WriterLoop, this);
+    return true;
+}
+
+// Write out everything still queued and close the file
+void TraceRecorder::Close()
+{
+    if (writer.joinable())
+    {
+        stopping.store(true, memory_order_release);
+        writer.join();
+    }
+    if (file != nullptr)
+    {
+        fclose(file);
+        file = nullptr;
+    }
+    delete ring;
+    ring = nullptr;
+}
+
+// Record an interrupt as the RST instruction the hardware feeds the CPU
+void TraceRecorder::Interrupt(const Emulator &e, int interrupt_num)
+{
+    Flags f = e.GetFlags();
+    TraceRecord record;
+    record.cycle = e.GetCycles();
+    record.pc = static_cast<uint16_t>(e.GetPC());
+    record.sp = static_cast<uint16_t>(e.GetSP());
+    record.opcode = static_cast<uint8_t>(0xc7 | (interrupt_num << 3));
+    record.operand1 = 0;
+    record.operand2 = 0;
+    record.a = e.GetRegisters().A;
+    record.flags = f.z | f.s << 1 | f.p << 2 | f.cy << 3 | f.ac << 4 | kTraceInterrupt;
+    if (!ring->TryPush(record))
+    {
+        PushSlow(record);
+    }
+}
+
+// Wait for the writer thread to make room - records are never dropped
+void TraceRecorder::PushSlow(const TraceRecord &record)
+{
+    stalls++;
+    while (!ring->TryPush(record))
+    {
+        this_thread::yield();
+    }
+}
+
+// Number of records written to the file so far
+uint64_t TraceRecorder::RecordsWritten() const
+{
+    return records_written.load(memory_order_acquire);
+}
+
+// Number of times the emulation thread found the ring full
+uint64_t TraceRecorder::Stalls() const
+{
+    return stalls;
+}
+
+// Drain the ring into the file, one block at a time
+void TraceRecorder::WriterLoop()
+{
+    vector<TraceRecord> records(kBlockRecords);
+    vector<uint8_t> encoded;
+    size_t count = 0;
+
+    while (true)
+    {
+        bool stop = stopping.load(memory_order_acquire);
+        count += ring->TryPopBulk(&records[count], kBlockRecords - count);
+
+        // stopping is checked before draining so nothing pushed earlier is lost
+        if (count == kBlockRecords || (stop && count > 0))
+        {
+            EncodeBlock(records.data(), count, &encoded);
+            fwrite(encoded.data(), 1, encoded.size(), file);
+            records_written.fetch_add(count, memory_order_release);
+            count = 0;
+        }
+        else if (stop)
+        {
+            break;
+        }
+        else if (ring->Size() == 0)
+        {
+            this_thread::sleep_for(chrono::microseconds(200));
+        }
+    }
+    fflush(file);
+}
+
+// Encode records as one block, header included
+void TraceRecorder::EncodeBlock(const TraceRecord *records, size_t count, vector<uint8_t> *out)
+{
+    // fill every column in a single pass, each in a region sized for its
+    // worst case, then close the gaps between the regions
+    out->resize(8 + count * 21);
+    uint8_t *opcodes = out->data() + 8;
+    uint8_t *cycles_begin = opcodes + count;
+    uint8_t *pcs_begin = cycles_begin + count * 10;
+    uint8_t *sps_begin = pcs_begin + count * 3;
+    uint8_t *operand1_begin = sps_begin + count * 3;
+    uint8_t *operand2_begin = operand1_begin + count;
+    uint8_t *a = operand2_begin + count;
+    uint8_t *flags = a + count;
+
+    const uint8_t *lengths = InstructionLengths();
+    uint8_t *cycles = cycles_begin;
+    uint8_t *pcs = pcs_begin;
+    uint8_t *sps = sps_begin;
+    uint8_t *operand1 = operand1_begin;
+    uint8_t *operand2 = operand2_begin;
+    uint64_t cycle = 0;
+    uint16_t next_pc = 0;
+    uint16_t sp = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        const TraceRecord &record = records[i];
+        int length = lengths[record.opcode];
+        opcodes[i] = record.opcode;
+        cycles = PutVarint(record.cycle - cycle, cycles);
+        cycle = record.cycle;
+        pcs = PutVarint(ZigZag(record.pc, next_pc), pcs);
+        next_pc = static_cast<uint16_t>(record.pc + length);
+        sps = PutVarint(ZigZag(record.sp, sp), sps);
+        sp = record.sp;
+
+        // operands are only stored for the instructions that have them
+        *operand1 = record.operand1;
+        operand1 += length > 1;
+        *operand2 = record.operand2;
+        operand2 += length > 2;
+        a[i] = record.a;
+        flags[i] = record.flags;
+    }
+
+    uint8_t *data = cycles;
+    data = MoveDown(data, pcs_begin, pcs);
+    data = MoveDown(data, sps_begin, sps);
+    data = MoveDown(data, operand1_begin, operand1);
+    data = MoveDown(data, operand2_begin, operand2);
+    data = MoveDown(data, a, flags + count);
+
+    out->resize(data - out->data());
+    PutUint32(static_cast<uint32_t>(count), &(*out)[0]);
+    PutUint32(static_cast<uint32_t>(out->size() - 8), &(*out)[4]);
+}
+
+// Decode the payload of a block holding count records
+// Operands past the end of an instruction read back as zero
+bool TraceRecorder::DecodeBlock(const uint8_t *data, size_t size, size_t count, vector<TraceRecord> *out)
+{
+    const uint8_t *end = data + size;
+    out->resize(count);
+
+    if (static_cast<size_t>(end - data) < count)
+    {
+        return false;
+    }
+    const uint8_t *lengths = InstructionLengths();
+    size_t operand1_count = 0;
+    size_t operand2_count = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        (*out)[i].opcode = data[i];
+        operand1_count += lengths[data[i]] > 1;
+        operand2_count += lengths[data[i]] > 2;
+    }
+    data += count;
+
+    uint64_t value;
+    uint64_t cycle = 0;
+    uint16_t next_pc = 0;
+    uint16_t sp = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        if (!GetVarint(&data, end, &value))
+        {
+            return false;
+        }
+        cycle += value;
+        (*out)[i].cycle = cycle;
+    }
+    for (size_t i = 0; i < count; i++)
+    {
+        if (!GetVarint(&data, end, &value))
+        {
+            return false;
+        }
+        uint16_t pc = UnZigZag(value, next_pc);
+        (*out)[i].pc = pc;
+        next_pc = static_cast<uint16_t>(pc + lengths[(*out)[i].opcode]);
+    }
+    for (size_t i = 0; i < count; i++)
+    {
+        if (!GetVarint(&data, end, &value))
+        {
+            return false;
+        }
+        sp = UnZigZag(value, sp);
+        (*out)[i].sp = sp;
+    }
+    if (static_cast<size_t>(end - data) != 2 * count + operand1_count + operand2_count)
+    {
+        return false;
+    }
+
+    const uint8_t *operand1 = data;
+    const uint8_t *operand2 = operand1 + operand1_count;
+    const uint8_t *a = operand2 + operand2_count;
+    const uint8_t *flags = a + count;
+    for (size_t i = 0; i < count; i++)
+    {
+        int length = lengths[(*out)[i].opcode];
+        (*out)[i].operand1 = length > 1 ? *operand1++ : 0;
+        (*out)[i].operand2 = length > 2 ? *operand2++ : 0;
+        (*out)[i].a = a[i];
+        (*out)[i].flags = flags[i];
+    }
+    return true;
+}
+
+TraceReader::TraceReader() : file(nullptr), next(0)
+{
+}
+
+TraceReader::~TraceReader()
+{
+    if (file != nullptr)
+    {
+        fclose(file);
+    }
+}
+
+// Open a trace file, returns false if it is missing or not a trace
+bool TraceReader::Open(const string &path)
+{
+    file = fopen(path.c_str(), "rb");
+    char magic[sizeof(kTraceMagic)];
+    if (file == nullptr || fread(magic, 1, sizeof(magic), file) != sizeof(magic) ||
+        memcmp(magic, kTraceMagic, sizeof(magic)) != 0)
+    {
+        return false;
+    }
+    block.clear();
+    next = 0;
+    return true;
+}
+
+// Read the next record, returns false at the end of the trace
+bool TraceReader::Next(TraceRecord *record)
+{
+    while (next == block.size())
+    {
+        if (!ReadBlock())
+        {
+            return false;
+        }
+    }
+    *record = block[next++];
+    return true;
+}
+
+// Load and decode the next block
+bool TraceReader::ReadBlock()
+{
+    uint8_t header[8];
+    if (file == nullptr || fread(header, 1, sizeof(header), file) != sizeof(header))
+    {
+        return false;
+    }
+    uint32_t count = GetUint32(header);
+    uint32_t size = GetUint32(header + 4);
+    vector<uint8_t> payload(size);
+    if (fread(payload.data(), 1, size, file) != size)
+    {
+        return false;
+    }
+    next = 0;
+    return TraceRecorder::DecodeBlock(payload.data(), size, count, &block);
+}
@@ -0,0 +1,103 @@
+#ifndef EMULATOR_TRACE_HPP_
+#define EMULATOR_TRACE_HPP_
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+#include "emulator/emulator.hpp"
+#include "emulator/spsc_ring.hpp"
+
+// One executed instruction, with the machine state after it
+struct TraceRecord
+{
+    uint64_t cycle;     // cycle count when the instruction started
+    uint16_t pc;
+    uint16_t sp;
+    uint8_t opcode;
+    uint8_t operand1;
+    uint8_t operand2;
+    uint8_t a;
+    uint8_t flags;      // PUSH PSW layout, plus kTraceInterrupt
+};
+
+// Set in TraceRecord::flags for an interrupt; opcode is the RST it performs
+const uint8_t kTraceInterrupt = 0x80;
+
+// Profiling policy that records every instruction to a binary trace file
+//
+// The emulation thread appends fixed size records to a lock-free ring. A
+// background thread drains the ring and writes blocks of records, each
+// stored column by column with delta encoded cycle, pc and sp columns so
+// that the file stays small and every block can be decoded on its own.
+class TraceRecorder
+{
+public:
+    static const size_t kBlockRecords = 4096;
+
+    TraceRecorder();
+    ~TraceRecorder();
+
+    bool Open(const std::string &path, size_t ring_capacity = 1 << 16);
+    void Close();
+
+    void Instruction(const Emulator &e, uint16_t pc, uint8_t opcode, int cycles)
+    {
+        const uint8_t *memory = e.GetMemory();
+        Flags f = e.GetFlags();
+        TraceRecord record;
+        record.cycle = e.GetCycles() - cycles;
+        record.pc = pc;
+        record.sp = static_cast<uint16_t>(e.GetSP());
+        record.opcode = opcode;
+        record.operand1 = memory[pc + 1];
+        record.operand2 = memory[pc + 2];
+        record.a = e.GetRegisters().A;
+        record.flags = f.z | f.s << 1 | f.p << 2 | f.cy << 3 | f.ac << 4;
+        if (!ring->TryPush(record))
+        {
+            PushSlow(record);
+        }
+    }
+    void Interrupt(const Emulator &e, int interrupt_num);
+
+    uint64_t RecordsWritten() const;
+    uint64_t Stalls() const;
+
+    static void EncodeBlock(const TraceRecord *records, size_t count, std::vector<uint8_t> *out);
+    static bool DecodeBlock(const uint8_t *data, size_t size, size_t count, std::vector<TraceRecord> *out);
+
+private:
+    void PushSlow(const TraceRecord &record);
+    void WriterLoop();
+
+    SpscRing<TraceRecord> *ring;
+    std::thread writer;
+    std::atomic<bool> stopping;
+    FILE *file;
+
+    std::atomic<uint64_t> records_written;
+    uint64_t stalls;
+};
+
+// Reads back a file written by TraceRecorder
+class TraceReader
+{
+public:
+    TraceReader();
+    ~TraceReader();
+
+    bool Open(const std::string &path);
+    bool Next(TraceRecord *record);
+
+private:
+    bool ReadBlock();
+
+    FILE *file;
+    std::vector<TraceRecord> block;
+    size_t next;
+};
+
+#endif // EMULATOR_TRACE_HPP_
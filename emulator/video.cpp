@@ -0,0 +1,69 @@
+#include <vector>
+#include "emulator/video.hpp"
+
+using namespace std;
+
+namespace
+{
+// Overlay color of every pixel of the picture
+vector<uint32_t> BuildOverlay()
+{
+    vector<uint32_t> overlay(Video::kWidth * Video::kHeight);
+    for (int y = 0; y < Video::kHeight; y++)
+    {
+        for (int x = 0; x < Video::kWidth; x++)
+        {
+            overlay[y * Video::kWidth + x] = Video::OverlayColor(x, y);
+        }
+    }
+    return overlay;
+}
+} // namespace
+
+const int Video::kWidth;
+const int Video::kHeight;
+const uint16_t Video::kVramStart;
+const int Video::kVramSize;
+const uint32_t Video::kBlack;
+const uint32_t Video::kWhite;
+const uint32_t Video::kGreen;
+const uint32_t Video::kRed;
+
+// Color of a lit pixel at picture coordinates x, y
+uint32_t Video::OverlayColor(int x, int y)
+{
+    // distance from the bottom of the picture, i.e. the bit within a line
+    int h = kHeight - 1 - y;
+    if (h < 64 && (h >= 16 || (x >= 16 && x < 128)))
+    {
+        // green in player area
+        return kGreen;
+    }
+    else if (h >= 192 && h < 224)
+    {
+        // red for UFO area
+        return kRed;
+    }
+    // white everywhere else
+    return kWhite;
+}
+
+// Fill pixels, kWidth * kHeight ARGB values stored row by row, from the
+// kVramSize bytes of video RAM at vram
+void Video::ConvertVram(const uint8_t *vram, uint32_t *pixels)
+{
+    // the overlay only depends on the position, so look it up once
+    static const vector<uint32_t> overlay = BuildOverlay();
+
+    for (int x = 0; x < kWidth; x++)
+    {
+        const uint8_t *line = vram + x * (kHeight / 8);
+        for (int h = 0; h < kHeight; h++)
+        {
+            // rotate coordinates counter clockwise
+            int index = (kHeight - 1 - h) * kWidth + x;
+            bool lit = (line[h >> 3] >> (h & 7)) & 1;
+            pixels[index] = lit ? overlay[index] : kBlack;
+        }
+    }
+}
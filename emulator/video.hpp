@@ -0,0 +1,29 @@
+#ifndef EMULATOR_VIDEO_HPP_
+#define EMULATOR_VIDEO_HPP_
+
+#include <cstdint>
+
+// Converts Space Invaders video RAM to displayable pixels
+//
+// Video RAM holds 224 lines of 256 one bit pixels, 32 bytes per line with
+// the lowest bit first. The monitor is mounted rotated, so each line is a
+// column of the picture, drawn bottom to top. The cabinet's color overlay
+// tints the player area green and the UFO area red.
+class Video
+{
+public:
+    static const int kWidth = 224;
+    static const int kHeight = 256;
+    static const uint16_t kVramStart = 0x2400;
+    static const int kVramSize = kWidth * kHeight / 8;
+
+    static const uint32_t kBlack = 0xff000000;
+    static const uint32_t kWhite = 0xffffffff;
+    static const uint32_t kGreen = 0xff00ff00;
+    static const uint32_t kRed = 0xffff0000;
+
+    static void ConvertVram(const uint8_t *vram, uint32_t *pixels);
+    static uint32_t OverlayColor(int x, int y);
+};
+
+#endif // EMULATOR_VIDEO_HPP_
@@ -0,0 +1,327 @@
+#include "emulator/workloads.hpp"
+#include "emulator/cpm.hpp"
+
+using namespace std;
+
+namespace
+{
+// Hand assembled, see the listing above each image. Data lives at
+// 3000-5fff, above the program and below the CP/M stack.
+
+// memcpy
+// 0100         LXI H,4000h    ; fill 4000-4fff with 3, 10, 17, ...
+// 0103         MVI C,3
+// 0105 fill:   MOV M,C
+// 0106         MOV A,C
+// 0107         ADI 7
+// 0109         MOV C,A
+// 010a         INX H
+// 010b         MOV A,H
+// 010c         CPI 50h
+// 010e         JNZ fill
+// 0111         MVI A,48       ; copy it to 5000-5fff 48 times
+// 0113         STA 3000h
+// 0116 pass:   LXI H,4000h
+// 0119         LXI D,5000h
+// 011c         LXI B,1000h
+// 011f copy:   MOV A,M
+// 0120         STAX D
+// 0121         INX H
+// 0122         INX D
+// 0123         DCX B
+// 0124         MOV A,B
+// 0125         ORA C
+// 0126         JNZ copy
+// 0129         LDA 3000h
+// 012c         DCR A
+// 012d         STA 3000h
+// 0130         JNZ pass
+// 0133         RET
+const uint8_t kMemcpy[] = {
+    0x21, 0x00, 0x40, 0x0e, 0x03, 0x71, 0x79, 0xc6, 0x07, 0x4f, 0x23, 0x7c, 0xfe, 0x50,
+    0xc2, 0x05, 0x01, 0x3e, 0x30, 0x32, 0x00, 0x30, 0x21, 0x00, 0x40, 0x11, 0x00, 0x50,
+    0x01, 0x00, 0x10, 0x7e, 0x12, 0x23, 0x13, 0x0b, 0x78, 0xb1, 0xc2, 0x1f, 0x01, 0x3a,
+    0x00, 0x30, 0x3d, 0x32, 0x00, 0x30, 0xc2, 0x16, 0x01, 0xc9,
+};
+
+// bubble_sort
+// 0100         MVI A,8        ; sort 8 times
+// 0102         STA 3000h
+// 0105 round:  LXI H,4000h    ; fill 4000-40ff with x = 5x + 17, a permutation of 0-255
+// 0108         MVI A,1
+// 010a fill:   MOV M,A
+// 010b         MOV B,A
+// 010c         ADD A
+// 010d         ADD A
+// 010e         ADD B
+// 010f         ADI 17
+// 0111         INR L
+// 0112         JNZ fill
+// 0115         MVI D,255      ; bubble sort, 255 passes
+// 0117 pass:   LXI H,4000h
+// 011a         MOV E,D        ; compares in this pass
+// 011b cmp:    MOV A,M
+// 011c         INX H
+// 011d         CMP M
+// 011e         JC next        ; in order if A <= M
+// 0121         JZ next
+// 0124         MOV C,M        ; swap
+// 0125         MOV M,A
+// 0126         DCX H
+// 0127         MOV M,C
+// 0128         INX H
+// 0129 next:   DCR E
+// 012a         JNZ cmp
+// 012d         DCR D
+// 012e         JNZ pass
+// 0131         LDA 3000h
+// 0134         DCR A
+// 0135         STA 3000h
+// 0138         JNZ round
+// 013b         RET
+const uint8_t kBubbleSort[] = {
+    0x3e, 0x08, 0x32, 0x00, 0x30, 0x21, 0x00, 0x40, 0x3e, 0x01, 0x77, 0x47, 0x87, 0x87,
+    0x80, 0xc6, 0x11, 0x2c, 0xc2, 0x0a, 0x01, 0x16, 0xff, 0x21, 0x00, 0x40, 0x5a, 0x7e,
+    0x23, 0xbe, 0xda, 0x29, 0x01, 0xca, 0x29, 0x01, 0x4e, 0x77, 0x2b, 0x71, 0x23, 0x1d,
+    0xc2, 0x1b, 0x01, 0x15, 0xc2, 0x17, 0x01, 0x3a, 0x00, 0x30, 0x3d, 0x32, 0x00, 0x30,
+    0xc2, 0x05, 0x01, 0xc9,
+};
+
+// crc16
+// 0100         LXI H,4000h    ; fill 4000-4fff with x = 5x + 17
+// 0103         MVI A,1
+// 0105 fill:   MOV M,A
+// 0106         MOV B,A
+// 0107         ADD A
+// 0108         ADD A
+// 0109         ADD B
+// 010a         ADI 17
+// 010c         INX H
+// 010d         MOV B,A
+// 010e         MOV A,H
+// 010f         CPI 50h
+// 0111         MOV A,B
+// 0112         JNZ fill
+// 0115         MVI C,4        ; CRC-16/CCITT of the buffer, 4 times
+// 0117 pass:   LXI H,0FFFFh
+// 011a         LXI D,4000h
+// 011d byte:   LDAX D         ; crc ^= byte << 8
+// 011e         XRA H
+// 011f         MOV H,A
+// 0120         MVI B,8
+// 0122 bit:    DAD H          ; crc <<= 1
+// 0123         JNC nopoly
+// 0126         MOV A,H        ; crc ^= 1021
+// 0127         XRI 10h
+// 0129         MOV H,A
+// 012a         MOV A,L
+// 012b         XRI 21h
+// 012d         MOV L,A
+// 012e nopoly: DCR B
+// 012f         JNZ bit
+// 0132         INX D
+// 0133         MOV A,D
+// 0134         CPI 50h
+// 0136         JNZ byte
+// 0139         SHLD 3000h
+// 013c         DCR C
+// 013d         JNZ pass
+// 0140         RET
+const uint8_t kCrc16[] = {
+    0x21, 0x00, 0x40, 0x3e, 0x01, 0x77, 0x47, 0x87, 0x87, 0x80, 0xc6, 0x11, 0x23, 0x47,
+    0x7c, 0xfe, 0x50, 0x78, 0xc2, 0x05, 0x01, 0x0e, 0x04, 0x21, 0xff, 0xff, 0x11, 0x00,
+    0x40, 0x1a, 0xac, 0x67, 0x06, 0x08, 0x29, 0xd2, 0x2e, 0x01, 0x7c, 0xee, 0x10, 0x67,
+    0x7d, 0xee, 0x21, 0x6f, 0x05, 0xc2, 0x22, 0x01, 0x13, 0x7a, 0xfe, 0x50, 0xc2, 0x1d,
+    0x01, 0x22, 0x00, 0x30, 0x0d, 0xc2, 0x17, 0x01, 0xc9,
+};
+
+// bcd_counter
+// 0100         LXI H,3000h    ; clear the 8 digit counter at 3000-3003, lowest first
+// 0103         XRA A
+// 0104         MOV M,A
+// 0105         INX H
+// 0106         MOV M,A
+// 0107         INX H
+// 0108         MOV M,A
+// 0109         INX H
+// 010a         MOV M,A
+// 010b         LXI B,50000    ; count to 50000 in BCD
+// 010e count:  LXI H,3000h
+// 0111         MVI D,1        ; carry into the lowest two digits
+// 0113         MVI E,4
+// 0115 digit:  MOV A,M
+// 0116         ORA A          ; AC clear for DAA, additions do not set it here
+// 0117         ADD D
+// 0118         DAA
+// 0119         MOV M,A
+// 011a         MVI D,0
+// 011c         JNC nocarry
+// 011f         INR D
+// 0120 nocarry:INX H
+// 0121         DCR E
+// 0122         JNZ digit
+// 0125         DCX B
+// 0126         MOV A,B
+// 0127         ORA C
+// 0128         JNZ count
+// 012b         RET
+const uint8_t kBcdCounter[] = {
+    0x21, 0x00, 0x30, 0xaf, 0x77, 0x23, 0x77, 0x23, 0x77, 0x23, 0x77, 0x01, 0x50, 0xc3,
+    0x21, 0x00, 0x30, 0x16, 0x01, 0x1e, 0x04, 0x7e, 0xb7, 0x82, 0x27, 0x77, 0x16, 0x00,
+    0xd2, 0x20, 0x01, 0x14, 0x23, 0x1d, 0xc2, 0x15, 0x01, 0x0b, 0x78, 0xb1, 0xc2, 0x0e,
+    0x01, 0xc9,
+};
+
+// multiply
+// 0100         LXI H,0        ; sum of i * 12345 for i = 6000 down to 1, mod 65536
+// 0103         SHLD 3000h
+// 0106         LXI B,6000
+// 0109 outer:  PUSH B
+// 010a         LXI D,12345
+// 010d         CALL mul
+// 0110         XCHG
+// 0111         LHLD 3000h
+// 0114         DAD D
+// 0115         SHLD 3000h
+// 0118         POP B
+// 0119         DCX B
+// 011a         MOV A,B
+// 011b         ORA C
+// 011c         JNZ outer
+// 011f         RET
+// 0120 mul:    LXI H,0        ; HL = BC * DE, shift and add from the top bit
+// 0123         MVI A,16
+// 0125         STA 3002h
+// 0128 mbit:   DAD H
+// 0129         MOV A,C        ; BC <<= 1, top bit into carry
+// 012a         ADD A
+// 012b         MOV C,A
+// 012c         MOV A,B
+// 012d         ADC A
+// 012e         MOV B,A
+// 012f         JNC mnext
+// 0132         DAD D
+// 0133 mnext:  LDA 3002h
+// 0136         DCR A
+// 0137         STA 3002h
+// 013a         JNZ mbit
+// 013d         RET
+const uint8_t kMultiply[] = {
+    0x21, 0x00, 0x00, 0x22, 0x00, 0x30, 0x01, 0x70, 0x17, 0xc5, 0x11, 0x39, 0x30, 0xcd,
+    0x20, 0x01, 0xeb, 0x2a, 0x00, 0x30, 0x19, 0x22, 0x00, 0x30, 0xc1, 0x0b, 0x78, 0xb1,
+    0xc2, 0x09, 0x01, 0xc9, 0x21, 0x00, 0x00, 0x3e, 0x10, 0x32, 0x02, 0x30, 0x29, 0x79,
+    0x87, 0x4f, 0x78, 0x8f, 0x47, 0xd2, 0x33, 0x01, 0x19, 0x3a, 0x02, 0x30, 0x3d, 0x32,
+    0x02, 0x30, 0xc2, 0x28, 0x01, 0xc9,
+};
+
+// fibonacci
+// 0100         LXI H,0        ; HL = fib(24), recursively
+// 0103         MVI C,24
+// 0105         CALL fib
+// 0108         SHLD 3000h
+// 010b         RET
+// 010c fib:    MOV A,C        ; HL += fib(C)
+// 010d         CPI 2
+// 010f         JNC split
+// 0112         ORA A
+// 0113         RZ
+// 0114         INX H
+// 0115         RET
+// 0116 split:  DCR C
+// 0117         PUSH B
+// 0118         CALL fib       ; fib(n - 1)
+// 011b         POP B
+// 011c         DCR C
+// 011d         CALL fib       ; fib(n - 2)
+// 0120         RET
+const uint8_t kFibonacci[] = {
+    0x21, 0x00, 0x00, 0x0e, 0x18, 0xcd, 0x0c, 0x01, 0x22, 0x00, 0x30, 0xc9, 0x79, 0xfe,
+    0x02, 0xd2, 0x16, 0x01, 0xb7, 0xc8, 0x23, 0xc9, 0x0d, 0xc5, 0xcd, 0x0c, 0x01, 0xc1,
+    0x0d, 0xcd, 0x0c, 0x01, 0xc9,
+};
+
+// Build the workload table once
+vector<Workload> MakeWorkloads()
+{
+    struct Entry
+    {
+        const char *name;
+        const char *description;
+        const uint8_t *code;
+        size_t size;
+        uint16_t result_start;
+        uint16_t result_size;
+        uint32_t checksum;
+    };
+    const Entry entries[] = {
+        {"memcpy", "copy 4K with MOV, STAX and a 16 bit counter, 48 times", kMemcpy, sizeof(kMemcpy),
+         0x5000, 0x1000, 0xafc57dc5},
+        {"bubble_sort", "bubble sort 256 bytes, 8 times", kBubbleSort, sizeof(kBubbleSort), 0x4000, 0x100,
+         0x90a458c5},
+        {"crc16", "bitwise CRC-16/CCITT of 4K with DAD, 4 times", kCrc16, sizeof(kCrc16), 0x3000, 2,
+         0xfccaa5cc},
+        {"bcd_counter", "count to 50000 in BCD with DAA", kBcdCounter, sizeof(kBcdCounter), 0x3000, 4,
+         0x8d899108},
+        {"multiply", "6000 shift and add 16 bit multiplies with DAD", kMultiply, sizeof(kMultiply), 0x3000,
+         2, 0x81622d65},
+        {"fibonacci", "recursive fib(24), about 150000 calls", kFibonacci, sizeof(kFibonacci), 0x3000, 2,
+         0x1cc65afe},
+    };
+
+    vector<Workload> workloads;
+    for (size_t i = 0; i < sizeof(entries) / sizeof(entries[0]); i++)
+    {
+        Workload workload;
+        workload.name = entries[i].name;
+        workload.description = entries[i].description;
+        workload.image.assign(entries[i].code, entries[i].code + entries[i].size);
+        workload.result_start = entries[i].result_start;
+        workload.result_size = entries[i].result_size;
+        workload.checksum = entries[i].checksum;
+        workloads.push_back(workload);
+    }
+    return workloads;
+}
+} // namespace
+
+// Every bundled workload
+const vector<Workload> &Workloads::All()
+{
+    static const vector<Workload> workloads = MakeWorkloads();
+    return workloads;
+}
+
+// Workload called name, or nullptr
+const Workload *Workloads::Find(const string &name)
+{
+    const vector<Workload> &workloads = All();
+    for (size_t i = 0; i < workloads.size(); i++)
+    {
+        if (workloads[i].name == name)
+        {
+            return &workloads[i];
+        }
+    }
+    return nullptr;
+}
+
+// 32 bit FNV-1a hash of size bytes
+uint32_t Workloads::Checksum(const uint8_t *data, int size)
+{
+    uint32_t hash = 0x811c9dc5;
+    for (int i = 0; i < size; i++)
+    {
+        hash = (hash ^ data[i]) * 0x01000193;
+    }
+    return hash;
+}
+
+// True if run finished and left the expected result
+bool Workloads::Verify(const Workload &workload, const CpmRun &run)
+{
+    if (!run.finished || run.memory.size() < static_cast<size_t>(workload.result_start + workload.result_size))
+    {
+        return false;
+    }
+    return Checksum(&run.memory[workload.result_start], workload.result_size) == workload.checksum;
+}
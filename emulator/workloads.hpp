@@ -0,0 +1,35 @@
+#ifndef EMULATOR_WORKLOADS_HPP_
+#define EMULATOR_WORKLOADS_HPP_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct CpmRun;
+
+// A self-contained 8080 benchmark program and the result it must leave
+//
+// The programs are CP/M .COM images for CpmMachine that end with RET. Each
+// leaves its result in a block of memory whose FNV-1a checksum is known
+// from a reference implementation of the same algorithm.
+struct Workload
+{
+    std::string name;
+    std::string description;
+    std::vector<uint8_t> image;  // loaded at CpmMachine::kLoadAddress
+    uint16_t result_start;
+    uint16_t result_size;
+    uint32_t checksum;
+};
+
+class Workloads
+{
+public:
+    static const std::vector<Workload> &All();
+    static const Workload *Find(const std::string &name);
+
+    static uint32_t Checksum(const uint8_t *data, int size);
+    static bool Verify(const Workload &workload, const CpmRun &run);
+};
+
+#endif // EMULATOR_WORKLOADS_HPP_
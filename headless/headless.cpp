@@ -0,0 +1,374 @@
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include "headless/headless.hpp"
+#include "emulator/emulator.hpp"
+#include "emulator/engine.hpp"
+#include "emulator/gdb_stub.hpp"
+#include "emulator/lockstep.hpp"
+#include "emulator/snapshot_file.hpp"
+#include "emulator/profiler.hpp"
+#include "emulator/call_profiler.hpp"
+#include "emulator/trace.hpp"
+#include "emulator/perf_counters.hpp"
+#include "static_invaders/static_invaders.hpp"
+
+using namespace std;
+
+// 16666 cycles between the two screen interrupts gives the 60 Hz refresh rate
+static const int kHalfFrameCycles = 16666;
+
+// frames between checkpoints unless -checkpoint-every says otherwise, ten
+// seconds of play
+static const long kCheckpointFrames = 600;
+
+// Emulate one video frame the same way SDL::RunGame does
+template <class Profiler>
+void Headless::RunFrame(Emulator *e, Profiler &profiler)
+{
+    e->EmulateProfiled(kHalfFrameCycles, profiler);
+    e->InterruptProfiled(1, profiler);
+    e->EmulateProfiled(kHalfFrameCycles, profiler);
+    e->InterruptProfiled(2, profiler);
+}
+
+// Command line entry point
+// usage: Headless [-rom file] [-frames n] [-profile [top]]
+//                 [-callgraph folded_file] [-symbols file] [-trace file] [-perf]
+//                 [-engine name] [-lockstep] [-gdb port_or_socket]
+//                 [-load file] [-save file] [-checkpoint file [-checkpoint-every n]]
+//                 [-no-idle-skip]
+int Headless::main(int argc, char **argv)
+{
+    string rom;
+    long frames = 600;
+    bool profile = false;
+    int top = 25;
+    string folded_path;
+    string symbols_path = "./space_invaders_rom/invaders.sym";
+    string trace_path;
+    bool perf = false;
+    string engine_name;
+    bool lockstep = false;
+    string gdb_address;
+    bool diagnostics = false;
+    string load_path;
+    string save_path;
+    string checkpoint_path;
+    long checkpoint_every = kCheckpointFrames;
+    bool idle_skipping = true;
+
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "-rom" && has_value)
+        {
+            rom = argv[++i];
+        }
+        else if (arg == "-frames" && has_value)
+        {
+            frames = strtol(argv[++i], nullptr, 0);
+        }
+        else if (arg == "-profile")
+        {
+            profile = true;
+            if (has_value && argv[i + 1][0] != '-')
+            {
+                top = atoi(argv[++i]);
+            }
+        }
+        else if (arg == "-callgraph" && has_value)
+        {
+            folded_path = argv[++i];
+        }
+        else if (arg == "-symbols" && has_value)
+        {
+            symbols_path = argv[++i];
+        }
+        else if (arg == "-trace" && has_value)
+        {
+            trace_path = argv[++i];
+        }
+        else if (arg == "-perf")
+        {
+            perf = true;
+        }
+        else if (arg == "-engine" && has_value)
+        {
+            engine_name = argv[++i];
+        }
+        else if (arg == "-lockstep")
+        {
+            lockstep = true;
+        }
+        else if (arg == "-gdb" && has_value)
+        {
+            gdb_address = argv[++i];
+        }
+        else if (arg == "-diagnostics")
+        {
+            diagnostics = true;
+        }
+        else if (arg == "-load" && has_value)
+        {
+            load_path = argv[++i];
+        }
+        else if (arg == "-save" && has_value)
+        {
+            save_path = argv[++i];
+        }
+        else if (arg == "-checkpoint" && has_value)
+        {
+            checkpoint_path = argv[++i];
+        }
+        else if (arg == "-checkpoint-every" && has_value && strtol(argv[i + 1], nullptr, 0) > 0)
+        {
+            checkpoint_every = strtol(argv[++i], nullptr, 0);
+        }
+        else if (arg == "-no-idle-skip")
+        {
+            idle_skipping = false;
+        }
+        else
+        {
+            cout << "usage: " << argv[0] << " [-rom file] [-frames n] [-profile [top]]"
+                 << " [-callgraph folded_file] [-symbols file] [-trace file] [-perf]" << endl
+                 << "       [-engine name] [-lockstep] [-gdb port_or_socket] [-diagnostics]" << endl
+                 << "       [-load file] [-save file] [-checkpoint file [-checkpoint-every n]]"
+                 << " [-no-idle-skip]" << endl;
+            return 1;
+        }
+    }
+
+    if (perf)
+    {
+        // the instruction count comes from a replay that executes every
+        // instruction on the interpreter, so the measured run must too
+        if (!engine_name.empty() && engine_name != "interpreter")
+        {
+            cout << "-perf measures the interpreter, ignoring -engine " << engine_name << endl;
+        }
+        engine_name.clear();
+        idle_skipping = false;
+    }
+
+    StaticInvaders::Register();
+    const Engine *engine = EngineRegistry::Find(engine_name.empty() ? "interpreter" : engine_name);
+    if (engine == nullptr)
+    {
+        cout << "Unknown engine " << engine_name << endl;
+        return 1;
+    }
+
+    Emulator e;
+    if (!rom.empty() && e.LoadRom(rom) == 0)
+    {
+        return 1;
+    }
+    if (!load_path.empty())
+    {
+        // resume from a snapshot; the ROM comes with it
+        chrono::steady_clock::time_point load_start = chrono::steady_clock::now();
+        SnapshotFile snapshot;
+        if (!snapshot.Open(load_path) || !snapshot.Restore(&e))
+        {
+            cout << "Unable to load " << snapshot.Error() << endl;
+            return 1;
+        }
+        chrono::duration<double, micro> load_time = chrono::steady_clock::now() - load_start;
+        cout << "Resumed " << load_path << " at cycle " << snapshot.Header().cycles << " in "
+             << load_time.count() << " us" << endl;
+    }
+    e.SetIdleSkipping(idle_skipping);
+    // invalid instructions and writes are only counted unless asked for
+    if (diagnostics)
+    {
+        e.Diagnostics().StartPrinting(cout);
+    }
+
+    if (!gdb_address.empty())
+    {
+        // a number is a TCP port on 127.0.0.1, anything else a UNIX socket
+        GdbStub stub(&e);
+        bool numeric = gdb_address.find_first_not_of("0123456789") == string::npos;
+        if (!(numeric ? stub.Listen(atoi(gdb_address.c_str())) : stub.ListenUnix(gdb_address)))
+        {
+            cout << "Unable to listen on " << gdb_address << ": " << stub.Error() << endl;
+            return 1;
+        }
+        cout << "Waiting for GDB on " << (numeric ? "localhost:" + to_string(stub.Port()) : gdb_address)
+             << endl;
+        while (stub.Accept())
+        {
+            if (stub.Serve())
+            {
+                break;
+            }
+        }
+        return 0;
+    }
+
+    // hardware counters cover the same region as the wall clock time
+    PerfCounters counters;
+    Snapshot start_state;
+    if (perf)
+    {
+        if (!counters.Open())
+        {
+            cout << "Hardware counters unavailable: " << counters.Error() << endl;
+        }
+        e.SaveState(&start_state);
+    }
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    counters.Start();
+    if (profile)
+    {
+        // profiler tables are large, keep them off the stack
+        ExecutionProfiler *profiler = new ExecutionProfiler();
+        for (long frame = 0; frame < frames; frame++)
+        {
+            RunFrame(&e, *profiler);
+        }
+        profiler->Report(cout, e.GetMemory(), e.GetMemorySize(), top);
+        delete profiler;
+    }
+    else if (!folded_path.empty())
+    {
+        CallGraphProfiler profiler;
+        profiler.LoadSymbols(symbols_path);
+        for (long frame = 0; frame < frames; frame++)
+        {
+            RunFrame(&e, profiler);
+        }
+        profiler.Report(cout, top);
+
+        // render with e.g. flamegraph.pl folded_file > flame.svg
+        ofstream folded(folded_path);
+        profiler.WriteFolded(folded);
+    }
+    else if (!trace_path.empty())
+    {
+        // expand with TraceDump trace_file
+        TraceRecorder recorder;
+        if (!recorder.Open(trace_path))
+        {
+            cout << "Unable to create trace " << trace_path << endl;
+            return 1;
+        }
+        for (long frame = 0; frame < frames; frame++)
+        {
+            RunFrame(&e, recorder);
+        }
+        recorder.Close();
+        cout << recorder.RecordsWritten() << " records traced, "
+             << recorder.Stalls() << " stalls" << endl;
+    }
+    else if (lockstep)
+    {
+        // the interpreter checks the engine one frame behind, on its own thread
+        LockstepChecker checker(*engine, *EngineRegistry::Find("interpreter"));
+        checker.Start(e);
+        for (long frame = 0; frame < frames; frame++)
+        {
+            if (!checker.RunFrame(&e))
+            {
+                break;
+            }
+        }
+        checker.Stop();
+        checker.Report(cout);
+        cout << checker.Stalls() << " stalls" << endl;
+        if (checker.Failed())
+        {
+            string snapshot_path = "lockstep_frame_" + to_string(checker.Mismatch().frame) + ".snap";
+            if (checker.WriteSnapshot(snapshot_path))
+            {
+                cout << "Machine at the start of the frame written to " << snapshot_path << endl;
+            }
+            return 2;
+        }
+    }
+    else
+    {
+        // checkpoints are written on another thread, the frame loop only
+        // copies the machine
+        CheckpointWriter checkpoint;
+        if (!checkpoint_path.empty())
+        {
+            checkpoint.Start(checkpoint_path);
+        }
+        NullProfiler profiler;
+        for (long frame = 0; frame < frames; frame++)
+        {
+            if (!engine_name.empty())
+            {
+                EngineRegistry::RunFrame(&e, engine->run);
+            }
+            else
+            {
+                RunFrame(&e, profiler);
+            }
+            if (!checkpoint_path.empty() && (frame + 1) % checkpoint_every == 0)
+            {
+                checkpoint.Submit(e);
+            }
+        }
+        checkpoint.Stop();
+        if (!checkpoint_path.empty())
+        {
+            cout << checkpoint.Written() << " checkpoints written to " << checkpoint_path << ", "
+                 << checkpoint.Skipped() << " skipped, " << checkpoint.Failures() << " failed" << endl;
+        }
+    }
+    PerfSample sample = counters.Stop();
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+    if (diagnostics)
+    {
+        e.Diagnostics().StopPrinting();
+        e.Diagnostics().Summary(cout);
+    }
+
+    if (!save_path.empty())
+    {
+        string error;
+        if (!SnapshotFile::Write(save_path, e, &error))
+        {
+            cout << error << endl;
+            return 1;
+        }
+        cout << "Snapshot written to " << save_path << endl;
+    }
+
+    cout << endl
+         << frames << " frames in " << elapsed.count() << " s ("
+         << frames / elapsed.count() << " frames/s)" << endl;
+    if (e.IdleCyclesSkipped() != 0)
+    {
+        cout << e.IdleCyclesSkipped() << " cycles of idle loops skipped" << endl;
+    }
+    if (e.HleCalls() != 0)
+    {
+        cout << e.HleCalls() << " calls to native code" << endl;
+    }
+
+    if (perf)
+    {
+        // replay the run to count the 8080 instructions without slowing
+        // down the measured one
+        Emulator replay;
+        replay.LoadState(start_state);
+        InstructionCounter counter;
+        for (long frame = 0; frame < frames; frame++)
+        {
+            RunFrame(&replay, counter);
+        }
+        cout << endl;
+        PerfCounters::Report(cout, sample, counter.instructions, frames);
+    }
+    return 0;
+}
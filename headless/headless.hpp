@@ -0,0 +1,16 @@
+#ifndef HEADLESS_HEADLESS_HPP_
+#define HEADLESS_HEADLESS_HPP_
+
+class Emulator;
+
+// Runs the game without a display, as fast as the host allows
+class Headless
+{
+public:
+    template <class Profiler>
+    static void RunFrame(Emulator *e, Profiler &profiler);
+
+    int main(int argc, char **argv);
+};
+
+#endif // HEADLESS_HEADLESS_HPP_
@@ -0,0 +1,8 @@
+#include "headless/headless.hpp"
+
+int main(int argc, char **argv)
+{
+  // Run the emulator without SDL, see Headless::main for options
+  Headless h;
+  return h.main(argc, argv);
+}
@@ -0,0 +1,51 @@
+#include "static_invaders/static_invaders.hpp"
+#include "emulator/emulator.hpp"
+#include "emulator/engine.hpp"
+
+using namespace std;
+
+// Add the "static" engine to the EngineRegistry; engines from libraries
+// other than Emulator are only registered when a program asks for them
+void StaticInvaders::Register()
+{
+    EngineRegistry::Register("static", Run);
+}
+
+// The interpreter with the recompiled code in place for the call, as the
+// hle engine runs it with its hooks
+void StaticInvaders::Run(Emulator *e, int cycles)
+{
+    e->SetHleHooks(&Hooks());
+    e->Emulate(cycles);
+    e->SetHleHooks(nullptr);
+}
+
+// A hook at the start of every recompiled block
+const HleTable &StaticInvaders::Hooks()
+{
+    static const HleTable table = BuildHooks();
+    return table;
+}
+
+HleTable StaticInvaders::BuildHooks()
+{
+    HleTable table;
+    for (int i = 0; i < kBlockCount; i++)
+    {
+        HleHook hook = {"recompiled block", kRomHash, kBlockStarts[i], Enter};
+        table.Add(hook);
+    }
+    return table;
+}
+
+// Run recompiled code from the block at PC, returning the cycles spent
+int StaticInvaders::Enter(Emulator *e, int cycles_left)
+{
+    StaticCpu c(e, cycles_left);
+    Dispatch(c);
+    if (c.cycles == 0)
+    {
+        return 0;
+    }
+    return c.Leave();
+}
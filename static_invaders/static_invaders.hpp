@@ -0,0 +1,39 @@
+#ifndef STATIC_INVADERS_STATIC_INVADERS_HPP_
+#define STATIC_INVADERS_STATIC_INVADERS_HPP_
+
+#include <cstdint>
+#include "emulator/hle.hpp"
+#include "emulator/static_cpu.hpp"
+
+class Emulator;
+
+// The Space Invaders ROM recompiled to C++ at build time, see
+// emulator/recompiler.hpp
+//
+// The recompiled code is entered the way ROM routines are run natively
+// (see emulator/hle.hpp): a CALL or a jump back to the start of any block
+// hands the CPU to Dispatch, which runs block after block until the cycles
+// left in the call to Emulate run out or PC reaches code the recompiler did
+// not find, such as a PCHL target, where the interpreter carries on until
+// the next CALL or jump back. Like the hooks, the code only runs for the ROM
+// it was compiled from and with no profiler, watch or output handler
+// attached. Register adds it to the EngineRegistry as "static".
+class StaticInvaders
+{
+public:
+    static void Register();
+    static void Run(Emulator *e, int cycles);
+    static const HleTable &Hooks();
+
+    // written by the Recompile tool
+    static const uint64_t kRomHash;
+    static const int kBlockCount;
+    static const uint16_t kBlockStarts[];
+    static void Dispatch(StaticCpu &c);
+
+private:
+    static HleTable BuildHooks();
+    static int Enter(Emulator *e, int cycles_left);
+};
+
+#endif // STATIC_INVADERS_STATIC_INVADERS_HPP_
@@ -0,0 +1,469 @@
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
+#include <catch2/catch_all.hpp>
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+#include "emulator/cpm.hpp"
+#include "emulator/emulator.hpp"
+#include "emulator/engine.hpp"
+#include "emulator/gdb_stub.hpp"
+#include "emulator/hle.hpp"
+#include "emulator/movie.hpp"
+#include "emulator/perf_counters.hpp"
+#include "emulator/profiler.hpp"
+#include "emulator/video.hpp"
+#include "emulator/workloads.hpp"
+#include "static_invaders/static_invaders.hpp"
+
+/*
+
+Emulator core benchmarks
+
+Run em_bench from anywhere; the ROM and movie are found through
+EM_SOURCE_DIR. Besides the usual Catch2 output, the results are written as
+JSON to em_bench.json, or to the file named by the EM_BENCH_JSON
+environment variable, with the instructions per second and nanoseconds per
+frame of every benchmark that emulates frames. Where the host allows
+perf_event_open, the hardware counters of one run of each of those
+benchmarks are added, per emulated instruction and per frame.
+
+Idle loop skipping is turned off wherever instructions are counted, so
+that every instruction counted is also executed and timed. Skipping has a
+benchmark of its own, which reports the cycles it executed and skipped.
+
+The synthetic workloads (see emulator/workloads.hpp) run in a RAM-only
+CP/M machine on the interpreter; they have no frames, so only their
+instructions per second are reported.
+
+*/
+
+#ifndef EM_SOURCE_DIR
+#define EM_SOURCE_DIR "."
+#endif
+
+// Work done by one iteration of a benchmark
+struct BenchmarkWork
+{
+    uint64_t frames;
+    uint64_t instructions;
+    PerfSample counters;
+    uint64_t executed_cycles;
+    uint64_t skipped_cycles;
+};
+
+static std::map<std::string, BenchmarkWork> &Work()
+{
+    static std::map<std::string, BenchmarkWork> work;
+    return work;
+}
+
+// Hardware counters shared by all benchmarks, opened on first use
+static PerfCounters &Counters()
+{
+    static PerfCounters counters;
+    static bool opened = false;
+    if (!opened)
+    {
+        if (!counters.Open())
+        {
+            std::cout << "No hardware counters: " << counters.Error() << std::endl;
+        }
+        opened = true;
+    }
+    return counters;
+}
+
+// Emulate frames first_frame up to first_frame + count, the same way as
+// EngineRegistry::RunFrame
+template <class Profiler>
+static void RunFrames(Emulator *e, const InputMovie *movie, uint64_t first_frame, uint64_t count,
+                      Profiler &profiler)
+{
+    for (uint64_t frame = first_frame; frame < first_frame + count; frame++)
+    {
+        if (movie != nullptr)
+        {
+            movie->Apply(e, frame);
+        }
+        e->EmulateProfiled(EngineRegistry::kHalfFrameCycles, profiler);
+        e->InterruptProfiled(1, profiler);
+        e->EmulateProfiled(EngineRegistry::kHalfFrameCycles, profiler);
+        e->InterruptProfiled(2, profiler);
+    }
+}
+
+// True once the splash screen has drawn something
+static bool ScreenLit(const Emulator &e)
+{
+    const uint8_t *vram = e.GetMemory() + Video::kVramStart;
+    for (int i = 0; i < Video::kVramSize; i++)
+    {
+        if (vram[i] != 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Frames from power on until the attract mode splash screen shows
+template <class Profiler>
+static uint64_t Boot(Emulator *e, Profiler &profiler)
+{
+    uint64_t frames = 0;
+    while (!ScreenLit(*e) && frames < 600)
+    {
+        RunFrames(e, nullptr, frames, 1, profiler);
+        frames++;
+    }
+    return frames;
+}
+
+static void CountWatchHit(void *context, const WatchEvent &)
+{
+    (*static_cast<int *>(context))++;
+}
+
+// Machine state at power on
+static Snapshot PowerOn()
+{
+    Emulator e;
+    REQUIRE(e.LoadRom(EM_SOURCE_DIR "/space_invaders_rom/invaders") == 0x2000);
+    Snapshot snapshot;
+    e.SaveState(&snapshot);
+    return snapshot;
+}
+
+// Frames, instructions and hardware counters of running count frames from start
+static BenchmarkWork MeasureWork(const Snapshot &start, const InputMovie *movie, uint64_t first_frame,
+                                 uint64_t count)
+{
+    Emulator e;
+    e.SetIdleSkipping(false);
+    e.LoadState(start);
+    InstructionCounter counter;
+    RunFrames(&e, movie, first_frame, count, counter);
+    BenchmarkWork work = {count, counter.instructions, PerfSample()};
+
+    NullProfiler none;
+    e.LoadState(start);
+    Counters().Start();
+    RunFrames(&e, movie, first_frame, count, none);
+    work.counters = Counters().Stop();
+    return work;
+}
+
+TEST_CASE("Emulator benchmarks", "[benchmark]")
+{
+    const Snapshot power_on = PowerOn();
+    NullProfiler none;
+    Emulator e;
+    e.SetIdleSkipping(false);
+
+    // boot once to find the attract mode state and the work it takes
+    e.LoadState(power_on);
+    InstructionCounter boot_counter;
+    const uint64_t boot_frames = Boot(&e, boot_counter);
+    REQUIRE(ScreenLit(e));
+    Snapshot attract;
+    e.SaveState(&attract);
+    BenchmarkWork boot_work = {boot_frames, boot_counter.instructions, PerfSample()};
+    e.LoadState(power_on);
+    Counters().Start();
+    Boot(&e, none);
+    boot_work.counters = Counters().Stop();
+    Work()["boot to attract mode"] = boot_work;
+
+    BENCHMARK("boot to attract mode")
+    {
+        e.LoadState(power_on);
+        return Boot(&e, none);
+    };
+
+    Work()["1000 frames attract mode"] = MeasureWork(attract, nullptr, boot_frames, 1000);
+    BENCHMARK("1000 frames attract mode")
+    {
+        e.LoadState(attract);
+        RunFrames(&e, nullptr, boot_frames, 1000, none);
+        return e.GetCycles();
+    };
+
+    // the same frames with idle loops passed over rather than executed
+    Emulator idle;
+    idle.LoadState(attract);
+    RunFrames(&idle, nullptr, boot_frames, 1000, none);
+    BenchmarkWork idle_work = {1000, 0, PerfSample()};
+    idle_work.skipped_cycles = idle.IdleCyclesSkipped();
+    idle_work.executed_cycles = idle.GetCycles() - attract.cycles - idle_work.skipped_cycles;
+    Work()["1000 frames attract mode, idle loops skipped"] = idle_work;
+    std::cout << "Attract mode with idle loops skipped, 1000 frames:\n"
+              << "  " << idle_work.executed_cycles << " cycles executed\n"
+              << "  " << idle_work.skipped_cycles << " cycles skipped" << std::endl;
+    CHECK(idle_work.skipped_cycles > 0);
+    BENCHMARK("1000 frames attract mode, idle loops skipped")
+    {
+        idle.LoadState(attract);
+        RunFrames(&idle, nullptr, boot_frames, 1000, none);
+        return idle.GetCycles();
+    };
+
+    // the movie inserts a coin and starts a game within its first 200 frames
+    InputMovie movie;
+    REQUIRE(movie.Load(EM_SOURCE_DIR "/test/data/gameplay.movie"));
+    const uint64_t game_start = 200;
+    e.LoadState(power_on);
+    RunFrames(&e, &movie, 0, game_start, none);
+    REQUIRE(e.GetMemory()[0x20ef] == 1); // game mode
+    Snapshot playing;
+    e.SaveState(&playing);
+
+    Work()["1000 frames gameplay movie"] = MeasureWork(playing, &movie, game_start, 1000);
+    BENCHMARK("1000 frames gameplay movie")
+    {
+        e.LoadState(playing);
+        RunFrames(&e, &movie, game_start, 1000, none);
+        return e.GetCycles();
+    };
+
+    // a watch on the score only slows down accesses to the page it is in
+    int score_writes = 0;
+    int watch = e.AddWatch(0x20f8, 2, kWatchWrite, CountWatchHit, &score_writes);
+    BenchmarkWork watched_work = Work()["1000 frames gameplay movie"];
+    watched_work.counters = PerfSample();
+    Work()["1000 frames gameplay movie, score watched"] = watched_work;
+    BENCHMARK("1000 frames gameplay movie, score watched")
+    {
+        e.LoadState(playing);
+        RunFrames(&e, &movie, game_start, 1000, none);
+        return e.GetCycles();
+    };
+    e.RemoveWatch(watch);
+    CHECK(score_writes > 0);
+
+    // the same instructions, with the sprite and clearing routines run
+    // natively
+    BenchmarkWork native_work = Work()["1000 frames gameplay movie"];
+    native_work.counters = PerfSample();
+    Work()["1000 frames gameplay movie, ROM routines native"] = native_work;
+    e.SetHleHooks(&HleTable::SpaceInvaders());
+    BENCHMARK("1000 frames gameplay movie, ROM routines native")
+    {
+        e.LoadState(playing);
+        RunFrames(&e, &movie, game_start, 1000, none);
+        return e.GetCycles();
+    };
+    CHECK(e.HleCalls() > 0);
+    e.SetHleHooks(nullptr);
+
+    // and with the whole ROM recompiled to C++
+    BenchmarkWork recompiled_work = Work()["1000 frames gameplay movie"];
+    recompiled_work.counters = PerfSample();
+    Work()["1000 frames gameplay movie, ROM recompiled"] = recompiled_work;
+    const uint64_t hle_calls = e.HleCalls();
+    e.SetHleHooks(&StaticInvaders::Hooks());
+    BENCHMARK("1000 frames gameplay movie, ROM recompiled")
+    {
+        e.LoadState(playing);
+        RunFrames(&e, &movie, game_start, 1000, none);
+        return e.GetCycles();
+    };
+    CHECK(e.HleCalls() > hle_calls);
+    e.SetHleHooks(nullptr);
+
+    std::vector<uint32_t> pixels(Video::kWidth * Video::kHeight);
+    BENCHMARK("VRAM conversion")
+    {
+        Video::ConvertVram(playing.memory.data() + Video::kVramStart, pixels.data());
+        return pixels[0];
+    };
+
+    Snapshot saved;
+    BENCHMARK("snapshot save and restore")
+    {
+        e.SaveState(&saved);
+        e.LoadState(saved);
+        return saved.cycles;
+    };
+
+    // rewind and run-ahead keep a snapshot of every frame; incremental ones
+    // hold only the pages written during the frame
+    IncrementalSnapshot delta;
+    uint64_t delta_bytes = 0;
+    size_t largest_delta = 0;
+    e.LoadState(playing);
+    e.ClearDirtyPages();
+    for (uint64_t frame = game_start; frame < game_start + 1000; frame++)
+    {
+        RunFrames(&e, &movie, frame, 1, none);
+        e.SaveIncremental(&delta);
+        delta_bytes += delta.memory.size();
+        largest_delta = std::max(largest_delta, delta.memory.size());
+    }
+    std::cout << "Gameplay incremental snapshots: " << delta_bytes / 1000 << " bytes per frame on average, "
+              << largest_delta << " at most, of " << e.GetMemorySize() << std::endl;
+    CHECK(delta_bytes / 1000 < static_cast<uint64_t>(e.GetMemorySize()) / 4);
+
+    IncrementalSnapshot saved_delta;
+    BENCHMARK("incremental snapshot save and restore, one frame of gameplay")
+    {
+        e.LoadIncremental(delta);
+        e.SaveIncremental(&saved_delta);
+        return saved_delta.memory.size();
+    };
+}
+
+TEST_CASE("Debugger benchmarks", "[benchmark]")
+{
+    // ten minutes of attract mode under the debugger, stopping at the end
+    // of every frame the way a breakpoint in the interrupt handler would
+    Emulator e;
+    REQUIRE(e.LoadRom(EM_SOURCE_DIR "/space_invaders_rom/invaders") == 0x2000);
+    GdbStub stub(&e);
+    stub.SetBreakpoint(0x0010);
+    const uint64_t session_frames = 10 * 60 * 60;
+    while (e.GetCycles() < session_frames * 2 * EngineRegistry::kHalfFrameCycles)
+    {
+        REQUIRE(stub.Resume(false) == "S05");
+    }
+    // from a stop on a snapshot, a step back replays a whole interval
+    const History &history = stub.GetHistory();
+    while (history.Nearest(stub.GetStep()).step != stub.GetStep())
+    {
+        stub.Resume(false);
+    }
+    std::cout << history.Snapshots() << " snapshots every " << history.Interval() << " frames, "
+              << history.MemoryUse() / 1024 << " KiB" << std::endl;
+
+    BENCHMARK("reverse step after 10 minutes under the debugger")
+    {
+        stub.ReverseStep();
+        return stub.Resume(true);
+    };
+}
+
+TEST_CASE("Workload benchmarks", "[benchmark]")
+{
+    const Engine *interpreter = EngineRegistry::Find("interpreter");
+    REQUIRE(interpreter != nullptr);
+    const uint64_t max_cycles = 1000000000;
+
+    const std::vector<Workload> &workloads = Workloads::All();
+    for (size_t i = 0; i < workloads.size(); i++)
+    {
+        CpmMachine machine;
+        machine.LoadProgram(workloads[i].image.data(), static_cast<int>(workloads[i].image.size()));
+        CpmRun counted = machine.Count(max_cycles);
+        REQUIRE(Workloads::Verify(workloads[i], counted));
+
+        const std::string name = "workload " + workloads[i].name;
+        BenchmarkWork work = {0, counted.instructions, PerfSample()};
+        Counters().Start();
+        machine.Run(interpreter->run, max_cycles);
+        work.counters = Counters().Stop();
+        Work()[name] = work;
+
+        BENCHMARK(std::string(name))
+        {
+            return machine.Run(interpreter->run, max_cycles).cycles;
+        };
+    }
+}
+
+// Collects the benchmark results and writes them out as JSON
+class JsonBenchmarkListener : public Catch::EventListenerBase
+{
+public:
+    using Catch::EventListenerBase::EventListenerBase;
+
+    void benchmarkEnded(Catch::BenchmarkStats<> const &stats) override
+    {
+        Result result;
+        result.name = stats.info.name;
+        result.mean = stats.mean.point.count();
+        result.low = stats.mean.lower_bound.count();
+        result.high = stats.mean.upper_bound.count();
+        result.std_dev = stats.standardDeviation.point.count();
+        results.push_back(result);
+    }
+
+    void testRunEnded(Catch::TestRunStats const &) override
+    {
+        if (results.empty())
+        {
+            return;
+        }
+        const char *path = std::getenv("EM_BENCH_JSON");
+        std::ofstream out(path != nullptr ? path : "em_bench.json");
+        out << "{\n  \"benchmarks\": [";
+        for (size_t i = 0; i < results.size(); i++)
+        {
+            const Result &r = results[i];
+            out << (i ? "," : "") << "\n    {\"name\": \"" << r.name << "\", \"mean_ns\": " << r.mean
+                << ", \"low_ns\": " << r.low << ", \"high_ns\": " << r.high
+                << ", \"std_dev_ns\": " << r.std_dev;
+            std::map<std::string, BenchmarkWork>::const_iterator work = Work().find(r.name);
+            if (work != Work().end())
+            {
+                if (work->second.frames > 0)
+                {
+                    out << ", \"frames\": " << work->second.frames
+                        << ", \"ns_per_frame\": " << r.mean / work->second.frames;
+                }
+                if (work->second.instructions > 0)
+                {
+                    out << ", \"instructions\": " << work->second.instructions
+                        << ", \"instructions_per_second\": " << work->second.instructions * 1e9 / r.mean;
+                    WriteCounters(out, work->second);
+                }
+                if (work->second.skipped_cycles > 0)
+                {
+                    out << ", \"executed_cycles\": " << work->second.executed_cycles
+                        << ", \"skipped_cycles\": " << work->second.skipped_cycles;
+                }
+            }
+            out << "}";
+        }
+        out << "\n  ]\n}\n";
+    }
+
+private:
+    // Hardware counters per emulated instruction and per frame
+    static void WriteCounters(std::ostream &out, const BenchmarkWork &work)
+    {
+        const PerfSample &sample = work.counters;
+        const char *sep = "";
+        out << ", \"counters\": {";
+        for (int i = 0; i < kPerfEventCount; i++)
+        {
+            if (sample.valid[i] && work.instructions > 0)
+            {
+                out << sep << "\"" << PerfCounters::EventName(static_cast<PerfEvent>(i))
+                    << "\": {\"total\": " << sample.value[i]
+                    << ", \"per_instruction\": " << static_cast<double>(sample.value[i]) / work.instructions;
+                if (work.frames > 0)
+                {
+                    out << ", \"per_frame\": " << static_cast<double>(sample.value[i]) / work.frames;
+                }
+                out << "}";
+                sep = ", ";
+            }
+        }
+        out << "}";
+    }
+
+    struct Result
+    {
+        std::string name;
+        double mean;
+        double low;
+        double high;
+        double std_dev;
+    };
+    std::vector<Result> results;
+};
+
+CATCH_REGISTER_LISTENER(JsonBenchmarkListener)
@@ -1,7 +1,180 @@
 #include <catch2/catch_all.hpp>
 #include "disassembler/disassembler.hpp"
+#include "disassembler/control_flow.hpp"
+#include "disassembler/chunk_reader.hpp"
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
 
 TEST_CASE("A simple test", "[fast]")
 {
     REQUIRE(1 + 1 == 2);
 }
+
+TEST_CASE("Instruction lengths", "[cfg]")
+{
+    CHECK(ControlFlowGraph::InstructionLength(0x00) == 1);
+    CHECK(ControlFlowGraph::InstructionLength(0x06) == 2);
+    CHECK(ControlFlowGraph::InstructionLength(0xd3) == 2);
+    CHECK(ControlFlowGraph::InstructionLength(0x21) == 3);
+    CHECK(ControlFlowGraph::InstructionLength(0xcd) == 3);
+    // undocumented opcodes are single byte no-ops in the Emulator
+    CHECK(ControlFlowGraph::InstructionLength(0xcb) == 1);
+    CHECK(ControlFlowGraph::InstructionLength(0xfd) == 1);
+}
+
+TEST_CASE("Control flow graph", "[cfg]")
+{
+    // 0000 JMP 0006
+    // 0003 DB  11 22 33
+    // 0006 MVI B,03
+    // 0008 DCR B
+    // 0009 JNZ 0008
+    // 000c CALL 0011
+    // 000f JMP 000f
+    // 0011 RET
+    uint8_t code[] = {0xc3, 0x06, 0x00, 0x11, 0x22, 0x33, 0x06, 0x03, 0x05, 0xc2, 0x08, 0x00,
+                      0xcd, 0x11, 0x00, 0xc3, 0x0f, 0x00, 0xc9};
+    ControlFlowGraph cfg;
+    std::vector<uint16_t> entries(1, 0x0000);
+    cfg.Analyze(code, sizeof(code), 0x0000, entries);
+
+    SECTION("Code and data")
+    {
+        CHECK(cfg.GetByteType(0x0000) == kByteOpcode);
+        CHECK(cfg.GetByteType(0x0001) == kByteOperand);
+        CHECK_FALSE(cfg.IsCode(0x0003));
+        CHECK_FALSE(cfg.IsCode(0x0005));
+        CHECK(cfg.IsCode(0x0006));
+        CHECK(cfg.CodeBytes() == sizeof(code) - 3);
+    }
+    SECTION("Blocks")
+    {
+        CHECK(cfg.GetBlocks().size() == 6);
+        CHECK(cfg.IsBlockStart(0x0006));
+        CHECK(cfg.IsBlockStart(0x0008));
+        CHECK(cfg.BlockContaining(0x0009)->start == 0x0008);
+        CHECK(cfg.BlockContaining(0x0004) == nullptr);
+
+        const BasicBlock *loop = cfg.BlockAt(0x0008);
+        REQUIRE(loop != nullptr);
+        CHECK(loop->exit == kFlowBranch);
+        CHECK(loop->num_instructions == 2);
+        CHECK(loop->successors == std::vector<uint16_t>({0x0008, 0x000c}));
+        CHECK(loop->predecessors == std::vector<uint16_t>({0x0006, 0x0008}));
+
+        const BasicBlock *call = cfg.BlockAt(0x000c);
+        REQUIRE(call != nullptr);
+        CHECK(call->successors == std::vector<uint16_t>({0x000f, 0x0011}));
+        CHECK(cfg.BlockAt(0x0011)->successors.empty());
+    }
+    SECTION("Subroutines")
+    {
+        CHECK(cfg.GetSubroutines().count(0x0000) == 1);
+        CHECK(cfg.GetSubroutines().count(0x0011) == 1);
+        CHECK(cfg.GetSubroutines().count(0x0006) == 0);
+    }
+}
+
+TEST_CASE("Restart targets", "[cfg]")
+{
+    uint8_t rst[] = {0xd7};
+    uint16_t target = 0;
+    CHECK(ControlFlowGraph::BranchTarget(rst, &target));
+    CHECK(target == 0x0010);
+
+    uint8_t pchl[] = {0xe9};
+    CHECK_FALSE(ControlFlowGraph::BranchTarget(pchl, &target));
+}
+
+TEST_CASE("Bounded disassembly", "[disassemble]")
+{
+    uint8_t code[] = {0xc3, 0x34, 0x12};
+    std::ostringstream out;
+
+    SECTION("Whole instruction")
+    {
+        CHECK(Disassembler::Disassemble(out, code, 3, 0x1a32) == 3);
+        CHECK(out.str() == "1a32 JMP $1234\n");
+    }
+    SECTION("Instruction cut off by the end of the input")
+    {
+        CHECK(Disassembler::Disassemble(out, code, 2, 0x1ffe) == 2);
+        CHECK(out.str() == "1ffe DB #$c3\n1fff DB #$34\n");
+    }
+    SECTION("Stream flags are left alone")
+    {
+        Disassembler::Disassemble(out, code, 3, 0x0000);
+        out << 10;
+        CHECK(out.str() == "0000 JMP $1234\n10");
+    }
+    SECTION("Buffer entry point")
+    {
+        char buffer[] = {0x00, static_cast<char>(0xc3), 0x34};
+        CHECK(Disassembler::Disassemble(buffer, 0, 3) == 1);
+        CHECK(Disassembler::Disassemble(buffer, 1, 3) == 2);
+    }
+}
+
+TEST_CASE("Streaming disassembly", "[disassemble][stream]")
+{
+    // instructions of every length so that some straddle each chunk size
+    const char *path = "da_stream_test.bin";
+    std::string bytes;
+    for (int i = 0; i < 200; i++)
+    {
+        bytes += std::string("\x00\x06\x11\x21\x34\x12\xd3\x05", 8);
+    }
+    bytes += "\xcd\x00";
+    std::ofstream(path, std::ios::binary).write(bytes.data(), bytes.size());
+
+    std::ostringstream expected;
+    for (size_t pc = 0; pc < bytes.size();)
+    {
+        int available = static_cast<int>(std::min(bytes.size() - pc, static_cast<size_t>(3)));
+        pc += Disassembler::Disassemble(expected, reinterpret_cast<const uint8_t *>(&bytes[pc]), available, pc);
+    }
+
+    bool use_mmap = GENERATE(false, true);
+    size_t chunk_size = GENERATE(16, 17, 18, 4096);
+    ChunkReader reader;
+    REQUIRE(reader.Open(path, 0, UINT64_MAX, use_mmap, chunk_size));
+
+    std::ostringstream out;
+    CHECK(Disassembler::DisassembleStream(out, &reader, 0x0000) == bytes.size());
+    CHECK(out.str() == expected.str());
+    CHECK(reader.AtEnd());
+    CHECK_FALSE(reader.Failed());
+
+    SECTION("Region with a load address")
+    {
+        ChunkReader region;
+        REQUIRE(region.Open(path, 3, 5, use_mmap, chunk_size));
+        std::ostringstream listing;
+        CHECK(Disassembler::DisassembleStream(listing, &region, 0x2000) == 5);
+        CHECK(listing.str() == "2000 LXI H, #$1234\n2003 OUT $05\n");
+    }
+
+    reader.Close();
+    std::remove(path);
+}
+
+TEST_CASE("A failed read is not the end of the input", "[disassemble][stream]")
+{
+    const char *path = "da_truncated_test.bin";
+    std::ofstream(path, std::ios::binary) << std::string(100000, '\0');
+
+    ChunkReader reader;
+    REQUIRE(reader.Open(path, 0, UINT64_MAX, false, 16));
+
+    // the file shrinks after its size was taken, as if it could not be read
+    std::ofstream(path, std::ios::binary | std::ios::trunc) << std::string(10000, '\0');
+    std::ostringstream out;
+    CHECK(Disassembler::DisassembleStream(out, &reader, 0x0000) <= 10000);
+    CHECK(reader.Failed());
+    CHECK_FALSE(reader.AtEnd());
+
+    reader.Close();
+    std::remove(path);
+}
@@ -1468,6 +1468,7 @@ TEST_CASE("Halt instruction", "[opcode][hlt]")
 
     // HLT
     e.EmulateOpcode(0x76);
-    // Should do nothing but halt the instruction and increment PC
+    // Should stop the CPU until an interrupt, with PC at the next instruction
     CHECK(e.GetPC() == pc + 1);
+    CHECK(e.Halted());
 }
@@ -0,0 +1,163 @@
+#include <catch2/catch_all.hpp>
+#include <string>
+#include <vector>
+#include "emulator/alu_sweep.hpp"
+#include "emulator/emulator.hpp"
+#include "emulator/engine.hpp"
+#include "static_invaders/static_invaders.hpp"
+
+// Engine that loses AC after every instruction, like a lazy flag core that
+// forgot to materialize it
+static void RunWithoutAc(Emulator *e, int cycles)
+{
+    e->Emulate(cycles);
+    Flags flags = e->GetFlags();
+    flags.ac = false;
+    e->SetFlags(flags);
+}
+
+static AluResult Reference(uint8_t opcode, uint8_t a, uint8_t operand, bool cy, bool ac)
+{
+    AluCase input;
+    input.opcode = opcode;
+    input.a = a;
+    input.operand = operand;
+    input.cy = cy;
+    input.ac = ac;
+    return AluReference::Execute(input);
+}
+
+TEST_CASE("Reference model matches the 8080 manual", "[alu]")
+{
+    SECTION("ADI carries out of bits 3 and 7")
+    {
+        AluResult r = Reference(0xc6, 0x2e, 0x74, false, false);
+        CHECK(r.value == 0xa2);
+        CHECK(r.flags.ac == 1);
+        CHECK(r.flags.cy == 0);
+        CHECK(r.flags.s == 1);
+        CHECK(r.flags.p == 0);
+
+        r = Reference(0xc6, 0xf0, 0x10, false, true);
+        CHECK(r.value == 0x00);
+        CHECK(r.flags.ac == 0);
+        CHECK(r.flags.cy == 1);
+        CHECK(r.flags.z == 1);
+    }
+
+    SECTION("SBB borrows the carry even when the operand is 0xff")
+    {
+        AluResult r = Reference(0x98, 0x00, 0xff, true, false);
+        CHECK(r.value == 0x00);
+        CHECK(r.flags.cy == 1);
+        CHECK(r.flags.z == 1);
+    }
+
+    SECTION("SUI sets AC when the low digit does not borrow")
+    {
+        AluResult r = Reference(0xd6, 0x3e, 0x3e, false, false);
+        CHECK(r.value == 0x00);
+        CHECK(r.flags.ac == 1);
+        CHECK(r.flags.cy == 0);
+
+        r = Reference(0xd6, 0x30, 0x01, false, true);
+        CHECK(r.value == 0x2f);
+        CHECK(r.flags.ac == 0);
+    }
+
+    SECTION("ANA sets AC from bit 3 of its operands")
+    {
+        CHECK(Reference(0xa0, 0x08, 0x00, false, false).flags.ac == 1);
+        CHECK(Reference(0xa8, 0x08, 0x00, false, true).flags.ac == 0);
+    }
+
+    SECTION("INR and DCR keep CY")
+    {
+        AluResult r = Reference(0x04, 0x00, 0x0f, true, false);
+        CHECK(r.value == 0x10);
+        CHECK(r.flags.ac == 1);
+        CHECK(r.flags.cy == 1);
+
+        r = Reference(0x05, 0x00, 0x00, false, true);
+        CHECK(r.value == 0xff);
+        CHECK(r.flags.ac == 0);
+        CHECK(r.flags.cy == 0);
+    }
+
+    SECTION("DAA after a BCD addition")
+    {
+        // 0x38 + 0x49 = 0x81 with AC, corrected to 87
+        AluResult sum = Reference(0x80, 0x38, 0x49, false, false);
+        REQUIRE(sum.value == 0x81);
+        AluResult r = Reference(0x27, sum.value, 0, sum.flags.cy, sum.flags.ac);
+        CHECK(r.value == 0x87);
+        CHECK(r.flags.cy == 0);
+
+        r = Reference(0x27, 0x9b, 0, false, false);
+        CHECK(r.value == 0x01);
+        CHECK(r.flags.cy == 1);
+    }
+}
+
+TEST_CASE("Every engine passes the ALU sweep", "[alu]")
+{
+    StaticInvaders::Register();
+    std::vector<std::string> names = EngineRegistry::Names();
+    for (size_t i = 0; i < names.size(); i++)
+    {
+        AluSweep sweep(*EngineRegistry::Find(names[i]));
+        AluSweepReport report = sweep.Run();
+        INFO(names[i]);
+        CHECK(report.mismatches == 0);
+
+        uint64_t cases = 0;
+        std::vector<uint8_t> opcodes = AluSweep::Opcodes();
+        for (size_t op = 0; op < opcodes.size(); op++)
+        {
+            cases += AluSweep::CaseCount(opcodes[op]);
+        }
+        CHECK(report.cases == cases);
+    }
+}
+
+TEST_CASE("ALU sweep reports a broken engine the same on any number of threads", "[alu]")
+{
+    Engine broken = {"broken", RunWithoutAc};
+    AluSweep sweep(broken);
+    sweep.SetOpcodes(std::vector<uint8_t>{0x80, 0xa8, 0x3c});
+
+    sweep.SetThreads(1);
+    AluSweepReport one = sweep.Run();
+    sweep.SetThreads(3);
+    AluSweepReport three = sweep.Run();
+
+    CHECK(one.cases == 256 * 256 * 4 * 2 + 256 * 4);
+    CHECK(one.value_mismatches == 0);
+    CHECK(one.flag_mismatches[3] == 0);
+    CHECK(one.flag_mismatches[4] > 0);
+    CHECK(one.opcode_mismatches[0xa8] == 0);
+
+    // examples come in opcode order: INR A first carries out of bit 3 for
+    // 0x0f, ADD B for 0x01 + 0x0f
+    REQUIRE(one.examples.size() == 2);
+    CHECK(one.examples[0].input.opcode == 0x3c);
+    CHECK(one.examples[0].input.a == 0x0f);
+    CHECK(one.examples[1].input.opcode == 0x80);
+    CHECK(one.examples[1].input.a == 0x01);
+    CHECK(one.examples[1].input.operand == 0x0f);
+    CHECK(one.examples[1].expected.flags.ac == 1);
+    CHECK(one.examples[1].actual.flags.ac == 0);
+    CHECK(AluSweep::Describe(one.examples[1].input) == "ADD B a=0x01 operand=0x0f cy=0 ac=0");
+
+    CHECK(three.threads == 3);
+    CHECK(three.mismatches == one.mismatches);
+    REQUIRE(three.examples.size() == one.examples.size());
+    for (size_t i = 0; i < one.examples.size(); i++)
+    {
+        CHECK(three.examples[i].input.opcode == one.examples[i].input.opcode);
+        CHECK(three.examples[i].input.a == one.examples[i].input.a);
+        CHECK(three.examples[i].input.operand == one.examples[i].input.operand);
+        CHECK(three.examples[i].input.cy == one.examples[i].input.cy);
+        CHECK(three.examples[i].input.ac == one.examples[i].input.ac);
+    }
+}
@@ -0,0 +1,91 @@
+#include <catch2/catch_all.hpp>
+#include <string>
+#include <vector>
+#include "emulator/cpm.hpp"
+#include "emulator/emulator.hpp"
+#include "emulator/engine.hpp"
+#include "static_invaders/static_invaders.hpp"
+
+// 0100 LXI D,0116
+// 0103 MVI C,09
+// 0105 CALL 0005
+// 0108 MVI C,02
+// 010a MVI E,'!'
+// 010c CALL 0005
+// 010f MVI B,64
+// 0111 DCR B
+// 0112 JNZ 0111
+// 0115 RET
+// 0116 "HELLO$"
+static const uint8_t kHelloProgram[] = {0x11, 0x16, 0x01, 0x0e, 0x09, 0xcd, 0x05, 0x00, 0x0e, 0x02, 0x1e,
+                                        0x21, 0xcd, 0x05, 0x00, 0x06, 0x64, 0x05, 0xc2, 0x11, 0x01, 0xc9,
+                                        'H', 'E', 'L', 'L', 'O', '$'};
+
+// 0100 MVI C,09 / LXI D,010b / CALL 0005 / JMP 0000
+// 010b "ERROR$"
+static const uint8_t kErrorProgram[] = {0x0e, 0x09, 0x11, 0x0b, 0x01, 0xcd, 0x05, 0x00, 0xc3, 0x00, 0x00,
+                                        'E', 'R', 'R', 'O', 'R', '$'};
+
+// 0100 JMP 0100
+static const uint8_t kEndlessProgram[] = {0xc3, 0x00, 0x01};
+
+TEST_CASE("CP/M console output", "[cpm]")
+{
+    CpmMachine machine;
+    machine.LoadProgram(kHelloProgram, sizeof(kHelloProgram));
+
+    CpmRun counted = machine.Count(1000000);
+    REQUIRE(counted.finished);
+    CHECK(counted.output == "HELLO!");
+    // 9 instructions, 200 in the loop, RET, 2 in each of the two BDOS calls
+    // and the OUT at 0000
+    CHECK(counted.instructions == 9 + 200 + 4 + 1);
+    CHECK(CpmMachine::Passed(counted));
+
+    StaticInvaders::Register();
+    std::vector<std::string> names = EngineRegistry::Names();
+    for (size_t i = 0; i < names.size(); i++)
+    {
+        INFO("engine " << names[i]);
+        CpmRun run = machine.Run(EngineRegistry::Find(names[i])->run, 1000000);
+        CHECK(run.finished);
+        CHECK(run.output == counted.output);
+        CHECK(run.cycles == counted.cycles);
+    }
+}
+
+TEST_CASE("CP/M failures", "[cpm]")
+{
+    CpmMachine machine;
+    machine.LoadProgram(kErrorProgram, sizeof(kErrorProgram));
+    CpmRun run = machine.Run(EngineRegistry::Find("interpreter")->run, 1000000);
+    CHECK(run.finished);
+    CHECK(run.output == "ERROR");
+    CHECK_FALSE(CpmMachine::Passed(run));
+
+    machine.LoadProgram(kEndlessProgram, sizeof(kEndlessProgram));
+    run = machine.Run(EngineRegistry::Find("interpreter")->run, 1000000);
+    CHECK_FALSE(run.finished);
+    CHECK(run.cycles >= 1000000);
+    CHECK_FALSE(CpmMachine::Passed(run));
+}
+
+TEST_CASE("Output handler", "[cpm]")
+{
+    struct Capture
+    {
+        static void Out(void *context, Emulator *, uint8_t port, uint8_t value)
+        {
+            static_cast<std::vector<int> *>(context)->push_back(port << 8 | value);
+        }
+    };
+    std::vector<int> writes;
+    Emulator e;
+    e.SetOutputHandler(Capture::Out, &writes);
+    e.EmulateOpcode(0x3e, 0x42); // MVI A,42
+    e.EmulateOpcode(0xd3, 0x10); // OUT 10
+    e.EmulateOpcode(0xd3, 0x03); // OUT 3, the shift register
+    REQUIRE(writes.size() == 1);
+    CHECK(writes[0] == 0x1042);
+    CHECK(e.GetPorts().port3 == 0x42);
+}
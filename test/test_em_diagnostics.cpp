@@ -0,0 +1,118 @@
+#include <catch2/catch_all.hpp>
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include "emulator/diagnostics.hpp"
+#include "emulator/emulator.hpp"
+
+// Put code at the start of RAM and point pc at it
+static void LoadCode(Emulator *e, const std::vector<uint8_t> &code)
+{
+    for (size_t i = 0; i < code.size(); i++)
+    {
+        e->SetMemory(static_cast<uint16_t>(0x2000 + i), code[i]);
+    }
+    e->SetPC(0x2000);
+}
+
+TEST_CASE("Diagnostics are recorded without printing", "[diagnostics]")
+{
+    Emulator e;
+    // MVI A,42; STA 0100; db 08
+    LoadCode(&e, {0x3e, 0x42, 0x32, 0x00, 0x01, 0x08});
+
+    std::ostringstream captured;
+    std::streambuf *original = std::cout.rdbuf(captured.rdbuf());
+    std::ios_base::fmtflags flags = std::cout.flags();
+    e.Emulate(7 + 13 + 4);
+    bool flags_kept = std::cout.flags() == flags;
+    std::cout.rdbuf(original);
+    CHECK(captured.str().empty());
+    CHECK(flags_kept);
+
+    DiagnosticLog &log = e.Diagnostics();
+    CHECK(log.Count(kDiagnosticInvalidWrite) == 1);
+    CHECK(log.Count(kDiagnosticInvalidInstruction) == 1);
+    std::vector<DiagnosticEvent> events;
+    REQUIRE(log.Drain(&events) == 2);
+    CHECK(events[0].kind == kDiagnosticInvalidWrite);
+    CHECK(events[0].pc == 0x2002);
+    CHECK(events[0].address == 0x0100);
+    CHECK(events[0].value == 0x42);
+    CHECK(events[0].cycle == 7);
+    CHECK(events[1].kind == kDiagnosticInvalidInstruction);
+    CHECK(events[1].address == 0x2005);
+    CHECK(events[1].value == 0x08);
+    CHECK(e.GetPC() == 0x2006);
+
+    std::ostringstream text;
+    DiagnosticLog::Format(text, events[0]);
+    CHECK(text.str() == "Invalid write of 0x42 to 0x0100 at 0x2002, cycle 7");
+    text.str("");
+    DiagnosticLog::Format(text, events[1]);
+    CHECK(text.str() == "Invalid instruction 0x08 at 0x2005, cycle 20");
+    CHECK(log.Drain(&events) == 0);
+}
+
+TEST_CASE("Diagnostics are rate limited per kind", "[diagnostics]")
+{
+    Emulator e;
+    // STA 0100; JMP 2000, nearly three emulated seconds of writes to ROM
+    LoadCode(&e, {0x32, 0x00, 0x01, 0xc3, 0x00, 0x20});
+    DiagnosticLog &log = e.Diagnostics();
+    log.SetRateLimit(kDiagnosticInvalidWrite, 50);
+    for (int i = 0; i < 290; i++)
+    {
+        e.Emulate(20000);
+    }
+
+    std::vector<DiagnosticEvent> events;
+    log.Drain(&events);
+    uint64_t writes = log.Count(kDiagnosticInvalidWrite);
+    CHECK(writes > 290 * 20000 / 23 - 10);
+    CHECK(events.size() == 150);
+    CHECK(log.Suppressed(kDiagnosticInvalidWrite) == writes - 150);
+    CHECK(log.Dropped() == 0);
+    CHECK(events[50].cycle - events[0].cycle >= DiagnosticLog::kCyclesPerSecond);
+
+    std::ostringstream summary;
+    log.Summary(summary);
+    CHECK(summary.str() == "invalid write: " + std::to_string(writes) + " (" + std::to_string(writes - 150) +
+                               " over the rate limit)\n");
+}
+
+TEST_CASE("Diagnostics past the capacity of the ring are dropped", "[diagnostics]")
+{
+    DiagnosticLog log(16);
+    log.SetRateLimit(kDiagnosticInvalidInstruction, 0);
+    for (int i = 0; i < 20; i++)
+    {
+        log.Record(kDiagnosticInvalidInstruction, 0x1000, 0x1000, 0xfd, i);
+    }
+    CHECK(log.Count(kDiagnosticInvalidInstruction) == 20);
+    CHECK(log.Dropped() == 4);
+    std::ostringstream out;
+    CHECK(log.Print(out) == 16);
+    CHECK(out.str().find("Invalid instruction 0xfd at 0x1000, cycle 15\n") != std::string::npos);
+}
+
+TEST_CASE("Diagnostics are printed in the background", "[diagnostics]")
+{
+    DiagnosticLog log;
+    std::ostringstream out;
+    log.StartPrinting(out);
+    for (int i = 0; i < 10; i++)
+    {
+        log.Record(kDiagnosticInvalidWrite, 0x0020, 0x0000, i, i * 10);
+    }
+    log.StopPrinting();
+    std::istringstream lines(out.str());
+    std::string line;
+    int count = 0;
+    while (std::getline(lines, line))
+    {
+        count++;
+    }
+    CHECK(count == 10);
+    CHECK(out.str().find("Invalid write of 0x09 to 0x0000 at 0x0020, cycle 90") != std::string::npos);
+}
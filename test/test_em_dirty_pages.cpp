@@ -0,0 +1,103 @@
+#include <catch2/catch_all.hpp>
+#include <vector>
+#include "emulator/divergence.hpp"
+#include "emulator/emulator.hpp"
+#include "emulator/engine.hpp"
+
+static void RunFrames(Emulator *e, int frames)
+{
+    const Engine *interpreter = EngineRegistry::Find("interpreter");
+    for (int frame = 0; frame < frames; frame++)
+    {
+        EngineRegistry::RunFrame(e, interpreter->run);
+    }
+}
+
+TEST_CASE("Writes to memory mark their page dirty", "[dirty_pages]")
+{
+    Emulator e;
+    CHECK(e.DirtyPageCount() == e.GetMemorySize() / kDirtyPageSize);
+    const uint8_t program[] = {
+        0x77,             // MOV M,A
+        0xf5,             // PUSH PSW
+        0x32, 0x00, 0x01, // STA 0x0100, into ROM
+    };
+    for (uint16_t i = 0; i < sizeof(program); i++)
+    {
+        e.SetMemory(0x2000 + i, program[i]);
+    }
+    Registers registers;
+    registers.H = 0x21;
+    registers.L = 0x47;
+    e.SetRegisters(registers);
+    e.SetSP(0x2400);
+    e.SetPC(0x2000);
+    e.ClearDirtyPages();
+    CHECK(e.DirtyPageCount() == 0);
+
+    e.Emulate(1);
+    CHECK(e.PageDirty(0x2147 / kDirtyPageSize));
+    CHECK(e.DirtyPageCount() == 1);
+    e.Emulate(1);
+    CHECK(e.PageDirty(0x23ff / kDirtyPageSize));
+    CHECK(e.DirtyPageCount() == 2);
+    e.Emulate(1);
+    CHECK(!e.PageDirty(0x0100 / kDirtyPageSize));
+    CHECK(e.DirtyPageCount() == 2);
+
+    // so does changing memory from outside
+    e.SetMemory(0x0100, 0xff);
+    CHECK(e.PageDirty(0x0100 / kDirtyPageSize));
+
+    IncrementalSnapshot snapshot;
+    e.SaveIncremental(&snapshot);
+    REQUIRE(snapshot.pages.size() == 3);
+    CHECK(snapshot.pages[0] == 0x0100 / kDirtyPageSize);
+    CHECK(snapshot.pages[2] == 0x23ff / kDirtyPageSize);
+    CHECK(snapshot.memory.size() == 3 * kDirtyPageSize);
+    CHECK(snapshot.memory[kDirtyPageSize + 0x2147 % kDirtyPageSize] == 0);
+    CHECK(e.DirtyPageCount() == 0);
+
+    Snapshot full;
+    e.SaveState(&full);
+    e.LoadState(full);
+    CHECK(e.DirtyPageCount() == e.GetMemorySize() / kDirtyPageSize);
+}
+
+TEST_CASE("Incremental snapshots rebuild the machine", "[dirty_pages]")
+{
+    Emulator e;
+    RunFrames(&e, 50);
+    Snapshot base;
+    e.SaveState(&base);
+    e.ClearDirtyPages();
+
+    // one incremental snapshot per frame, the way a rewind buffer keeps them
+    std::vector<IncrementalSnapshot> frames(100);
+    size_t bytes = 0;
+    for (size_t i = 0; i < frames.size(); i++)
+    {
+        RunFrames(&e, 1);
+        e.SaveIncremental(&frames[i]);
+        bytes += frames[i].memory.size();
+    }
+    CHECK(bytes < frames.size() * base.memory.size() / 2);
+
+    Emulator rebuilt;
+    rebuilt.LoadState(base);
+    for (size_t i = 0; i < frames.size(); i++)
+    {
+        rebuilt.LoadIncremental(frames[i]);
+        if (i == 49)
+        {
+            CHECK(rebuilt.GetCycles() == frames[49].state.cycles);
+            CHECK(rebuilt.GetPC() == frames[49].state.pc);
+        }
+    }
+    CHECK(DivergenceFinder::SameState(e, rebuilt));
+
+    // and it carries on exactly like the original
+    RunFrames(&e, 10);
+    RunFrames(&rebuilt, 10);
+    CHECK(DivergenceFinder::SameState(e, rebuilt));
+}
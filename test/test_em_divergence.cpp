@@ -0,0 +1,152 @@
+#include <catch2/catch_all.hpp>
+#include <cstdio>
+#include <sstream>
+#include "emulator/emulator.hpp"
+#include "emulator/engine.hpp"
+#include "emulator/movie.hpp"
+#include "emulator/divergence.hpp"
+
+// Load program into RAM at 0x2000 and jump to it
+static void LoadProgram(Emulator *e, const uint8_t *program, int size)
+{
+    e->AllocateMemory(0x3000);
+    for (int i = 0; i < size; i++)
+    {
+        e->WriteToMem(0x2000 + i, program[i]);
+    }
+    e->EmulateOpcode(0xc3, 0x00, 0x20);
+}
+
+// 2000 LXI H,2100
+// 2003 INR M
+// 2004 JMP 2003
+static const uint8_t kCounterProgram[] = {0x21, 0x00, 0x21, 0x34, 0xc3, 0x03, 0x20};
+
+// Engine that flips a RAM bit once the cycle count passes kFaultCycle
+static const uint64_t kFaultCycle = 1234567;
+static void RunFaulty(Emulator *e, int cycles)
+{
+    int spent = 0;
+    while (spent < cycles)
+    {
+        uint64_t before = e->GetCycles();
+        e->Emulate(1);
+        spent += static_cast<int>(e->GetCycles() - before);
+        if (before < kFaultCycle && e->GetCycles() >= kFaultCycle)
+        {
+            e->WriteToMem(0x2200, e->GetMemory()[0x2200] ^ 0x01);
+        }
+    }
+}
+
+TEST_CASE("Snapshots", "[divergence]")
+{
+    Emulator e;
+    LoadProgram(&e, kCounterProgram, sizeof(kCounterProgram));
+    e.Emulate(1000);
+
+    Snapshot snapshot;
+    e.SaveState(&snapshot);
+    CHECK(snapshot.cycles == e.GetCycles());
+    CHECK(snapshot.memory.size() == 0x3000);
+
+    Emulator copy;
+    copy.LoadState(snapshot);
+    CHECK(DivergenceFinder::SameState(e, copy));
+    CHECK(DivergenceFinder::StateHash(e) == DivergenceFinder::StateHash(copy));
+
+    e.Emulate(1000);
+    copy.Emulate(1000);
+    CHECK(DivergenceFinder::SameState(e, copy));
+
+    e.LoadState(snapshot);
+    CHECK(e.GetCycles() == snapshot.cycles);
+    CHECK(e.GetMemory()[0x2100] == snapshot.memory[0x2100]);
+    CHECK_FALSE(DivergenceFinder::SameState(e, copy));
+    CHECK(DivergenceFinder::StateHash(e) != DivergenceFinder::StateHash(copy));
+}
+
+TEST_CASE("Input movie", "[divergence]")
+{
+    InputMovie movie;
+    movie.Record(0, 0x08, 0x00);
+    movie.Record(1, 0x08, 0x00);
+    movie.Record(10, 0x0c, 0x03);
+    movie.Record(20, 0x08, 0x00);
+    CHECK(movie.LastChange() == 20);
+
+    const char *path = "em_movie_test.txt";
+    REQUIRE(movie.Save(path));
+    InputMovie loaded;
+    REQUIRE(loaded.Load(path));
+    std::remove(path);
+
+    Emulator e;
+    loaded.Apply(&e, 9);
+    CHECK(e.GetPorts().port1 == 0x08);
+    loaded.Apply(&e, 10);
+    CHECK(e.GetPorts().port1 == 0x0c);
+    CHECK(e.GetPorts().port2 == 0x03);
+    loaded.Apply(&e, 1000);
+    CHECK(e.GetPorts().port1 == 0x08);
+    CHECK(e.GetPorts().port2 == 0x00);
+}
+
+TEST_CASE("Divergence finder", "[divergence]")
+{
+    Emulator e;
+    LoadProgram(&e, kCounterProgram, sizeof(kCounterProgram));
+    Snapshot start;
+    e.SaveState(&start);
+
+    const Engine *interpreter = EngineRegistry::Find("interpreter");
+    REQUIRE(interpreter != nullptr);
+
+    SECTION("Identical engines agree")
+    {
+        DivergenceFinder finder(*interpreter, *EngineRegistry::Find("profiled"));
+        CHECK_FALSE(finder.Run(start, 0, 100));
+        CHECK(finder.FramesEmulated() == 100);
+    }
+    SECTION("Injected fault is found")
+    {
+        // frame in which the fault cycle falls
+        uint64_t fault_frame = 0;
+        for (Emulator reference; ; fault_frame++)
+        {
+            if (fault_frame == 0)
+            {
+                reference.LoadState(start);
+            }
+            EngineRegistry::RunFrame(&reference, interpreter->run);
+            if (reference.GetCycles() >= kFaultCycle)
+            {
+                break;
+            }
+        }
+
+        EngineRegistry::Register("faulty", RunFaulty);
+        DivergenceFinder finder(*interpreter, *EngineRegistry::Find("faulty"));
+        finder.SetCheckpointInterval(16);
+        finder.SetThreads(1);
+        REQUIRE(finder.Run(start, 0, 100));
+
+        const Divergence &result = finder.Result();
+        CHECK(result.found);
+        CHECK(result.stepped);
+        CHECK(result.frame == fault_frame);
+        CHECK(result.before.cycles < kFaultCycle);
+        CHECK(result.reference.cycles >= kFaultCycle);
+        CHECK(result.reference.memory[0x2200] != result.candidate.memory[0x2200]);
+        CHECK(result.history.back() == result.before.pc);
+
+        // the reference runs at most two intervals ahead of the one worker,
+        // and bisection only reruns part of one checkpoint interval
+        CHECK(finder.FramesEmulated() < fault_frame + 16 + 16 + 16);
+
+        std::ostringstream report;
+        finder.Report(report);
+        CHECK(report.str().find("in frame " + std::to_string(fault_frame)) != std::string::npos);
+        CHECK(report.str().find("[2200]") != std::string::npos);
+    }
+}
@@ -0,0 +1,129 @@
+#include <catch2/catch_all.hpp>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "emulator/emulator.hpp"
+#include "emulator/engine.hpp"
+#include "emulator/fuzzer.hpp"
+#include "static_invaders/static_invaders.hpp"
+
+#ifndef EM_SOURCE_DIR
+#define EM_SOURCE_DIR "."
+#endif
+
+// Engine whose XRA B sets the carry instead of clearing it
+static void RunBrokenXra(Emulator *e, int cycles)
+{
+    uint64_t end = e->GetCycles() + cycles;
+    while (e->GetCycles() < end)
+    {
+        uint8_t opcode = e->GetMemory()[e->GetPC()];
+        e->Emulate(1);
+        if (opcode == 0xa8)
+        {
+            Flags flags = e->GetFlags();
+            flags.cy = true;
+            e->SetFlags(flags);
+        }
+    }
+}
+
+static std::vector<Engine> AllEngines()
+{
+    StaticInvaders::Register();
+    std::vector<Engine> engines;
+    std::vector<std::string> names = EngineRegistry::Names();
+    for (size_t i = 0; i < names.size(); i++)
+    {
+        engines.push_back(*EngineRegistry::Find(names[i]));
+    }
+    return engines;
+}
+
+TEST_CASE("Fuzz cases are reproducible from their seed", "[fuzz]")
+{
+    DifferentialFuzzer fuzzer(AllEngines());
+    FuzzCase a = fuzzer.Generate(42);
+    FuzzCase b = fuzzer.Generate(42);
+    FuzzCase c = fuzzer.Generate(43);
+
+    CHECK(a.instructions.size() == 64);
+    CHECK(a.Code() == b.Code());
+    CHECK(a.start.memory == b.start.memory);
+    CHECK(a.start.registers.A == b.start.registers.A);
+    CHECK(a.Code() != c.Code());
+
+    // the program ends in a jump to itself
+    std::vector<uint8_t> code = a.Code();
+    uint16_t end = a.EndAddress();
+    CHECK(code[end - DifferentialFuzzer::kCodeAddress] == 0xc3);
+    CHECK((code[code.size() - 2] | code[code.size() - 1] << 8) == end);
+
+    Emulator e;
+    DifferentialFuzzer::LoadCase(&e, a);
+    CHECK(e.GetPC() == DifferentialFuzzer::kCodeAddress);
+    CHECK(e.GetMemory()[DifferentialFuzzer::kCodeAddress] == a.instructions[0][0]);
+}
+
+TEST_CASE("Engines agree on the checked-in seeds", "[fuzz]")
+{
+    std::vector<uint64_t> seeds;
+    REQUIRE(DifferentialFuzzer::LoadSeeds(EM_SOURCE_DIR "/test/data/fuzz.seeds", &seeds));
+    REQUIRE(seeds.size() > 0);
+
+    DifferentialFuzzer fuzzer(AllEngines());
+    FuzzStats stats = fuzzer.RunSeeds(seeds);
+    CHECK(stats.cases == seeds.size());
+    for (size_t i = 0; i < stats.failures.size(); i++)
+    {
+        std::ostringstream report;
+        DifferentialFuzzer::Report(report, stats.failures[i]);
+        INFO(report.str());
+        CHECK(false);
+    }
+}
+
+TEST_CASE("Fuzzer finds and shrinks a divergence", "[fuzz]")
+{
+    std::vector<Engine> engines;
+    engines.push_back(*EngineRegistry::Find("interpreter"));
+    engines.push_back(Engine{"broken", RunBrokenXra});
+    DifferentialFuzzer fuzzer(engines);
+    fuzzer.SetThreads(2);
+
+    std::vector<uint64_t> seeds;
+    for (uint64_t seed = 1; seed <= 200; seed++)
+    {
+        seeds.push_back(seed);
+    }
+    FuzzStats stats = fuzzer.RunSeeds(seeds);
+    REQUIRE(stats.failures.size() == 1);
+    const FuzzFailure &failure = stats.failures[0];
+    CHECK(failure.reference == "interpreter");
+    CHECK(failure.candidate == "broken");
+
+    // the shrunk program still diverges, and hardly anything but the XRA B
+    // is left of it
+    int kept = 0;
+    bool has_xra = false;
+    for (size_t i = 0; i < failure.shrunk.instructions.size(); i++)
+    {
+        const std::vector<uint8_t> &instruction = failure.shrunk.instructions[i];
+        kept += instruction[0] != 0x00;
+        has_xra = has_xra || instruction[0] == 0xa8;
+    }
+    CHECK(kept <= 3);
+    CHECK(failure.shrunk_cycles <= failure.cycles);
+    CHECK(failure.reference_state.flags.cy == 0);
+    CHECK(failure.candidate_state.flags.cy == 1);
+    CHECK(failure.before.memory[failure.before.pc] == 0xa8);
+    CHECK((has_xra || kept == 0));
+
+    FuzzFailure again;
+    CHECK(fuzzer.Check(fuzzer.Generate(failure.original.seed), &again));
+
+    std::ostringstream report;
+    DifferentialFuzzer::Report(report, failure);
+    CHECK(report.str().find("broken differs from interpreter") != std::string::npos);
+    CHECK(report.str().find("XRA") != std::string::npos);
+}
@@ -0,0 +1,315 @@
+#include <catch2/catch_all.hpp>
+#include <string>
+#include <thread>
+#include "emulator/emulator.hpp"
+#include "emulator/gdb_stub.hpp"
+#include "emulator/lockstep.hpp"
+
+#ifndef _WIN32
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+// Put program at the start of RAM and point pc at it
+static void LoadProgram(Emulator *e, const std::string &hex)
+{
+    for (size_t i = 0; i * 2 < hex.size(); i++)
+    {
+        e->SetMemory(static_cast<uint16_t>(0x2000 + i),
+                     static_cast<uint8_t>(std::stoi(hex.substr(i * 2, 2), nullptr, 16)));
+    }
+    e->SetPC(0x2000);
+    e->SetSP(0x2400);
+}
+
+TEST_CASE("GDB stub reads and writes registers", "[gdb]")
+{
+    Emulator e;
+    GdbStub stub(&e);
+    Registers r;
+    r.A = 0x12;
+    r.B = 0x34;
+    r.C = 0x56;
+    r.H = 0x20;
+    r.L = 0x01;
+    e.SetRegisters(r);
+    Flags f;
+    f.z = true;
+    f.cy = true;
+    e.SetFlags(f);
+    e.SetSP(0x2400);
+    e.SetPC(0x18d4);
+
+    // AF BC DE HL SP PC, low byte first, then the z80 registers
+    std::string g = stub.HandlePacket("g");
+    CHECK(g.substr(0, 24) == "43125634000001200024d418");
+    CHECK(g.size() == 13 * 4);
+    CHECK(stub.HandlePacket("p5") == "d418");
+
+    CHECK(stub.HandlePacket("P3=3412") == "OK");
+    CHECK(e.GetRegisters().H == 0x12);
+    CHECK(e.GetRegisters().L == 0x34);
+    CHECK(stub.HandlePacket("P0=8177") == "OK");
+    CHECK(e.GetRegisters().A == 0x77);
+    CHECK(e.GetFlags().s);
+    CHECK(!e.GetFlags().z);
+    CHECK(e.GetFlags().cy);
+    CHECK(stub.HandlePacket("P4=0024") == "OK");
+    CHECK(e.GetSP() == 0x2400);
+    CHECK(stub.HandlePacket("p20") == "E01");
+
+    CHECK(stub.HandlePacket("G" + g) == "OK");
+    CHECK(stub.HandlePacket("g") == g);
+}
+
+TEST_CASE("GDB stub reads and writes memory", "[gdb]")
+{
+    Emulator e;
+    GdbStub stub(&e);
+    CHECK(stub.HandlePacket("m0,4") == "000000c3");
+    CHECK(stub.HandlePacket("M10,3:c3d4a8") == "OK");
+    CHECK(stub.HandlePacket("m10,3") == "c3d4a8");
+    CHECK(e.GetMemory()[0x11] == 0xd4);
+    CHECK(stub.HandlePacket("mffff,2") == "E01");
+    CHECK(stub.HandlePacket("M10,2:c3") == "E01");
+}
+
+TEST_CASE("GDB stub steps, and stops at breakpoints and watchpoints", "[gdb]")
+{
+    Emulator e;
+    GdbStub stub(&e);
+    // MVI A,5; INR A; STA 2100; JMP 2002
+    LoadProgram(&e, "3e053c320021c30220");
+
+    CHECK(stub.HandlePacket("?") == "S05");
+    CHECK(stub.HandlePacket("s") == "S05");
+    CHECK(e.GetPC() == 0x2002);
+    CHECK(e.GetRegisters().A == 5);
+
+    SECTION("breakpoint")
+    {
+        CHECK(stub.HandlePacket("Z0,2006,1") == "OK");
+        CHECK(stub.HandlePacket("c") == "S05");
+        CHECK(e.GetPC() == 0x2006);
+        CHECK(e.GetMemory()[0x2100] == 6);
+
+        // continuing from a breakpoint goes round the loop back to it
+        CHECK(stub.HandlePacket("c") == "S05");
+        CHECK(e.GetPC() == 0x2006);
+        CHECK(e.GetRegisters().A == 7);
+        CHECK(stub.HandlePacket("s") == "S05");
+        CHECK(e.GetPC() == 0x2002);
+
+        CHECK(stub.HandlePacket("z0,2006,1") == "OK");
+        CHECK(stub.HandlePacket("Z0,2002,1") == "OK");
+        CHECK(stub.HandlePacket("c") == "S05");
+        CHECK(e.GetPC() == 0x2002);
+        CHECK(e.GetRegisters().A == 8);
+    }
+    SECTION("watchpoint")
+    {
+        CHECK(stub.HandlePacket("Z2,2100,1") == "OK");
+        CHECK(stub.HandlePacket("c") == "T05watch:2100;");
+        CHECK(e.GetPC() == 0x2006);
+        CHECK(stub.HandlePacket("c") == "T05watch:2100;");
+        CHECK(e.GetMemory()[0x2100] == 7);
+        CHECK(stub.HandlePacket("s") == "S05");
+        CHECK(stub.HandlePacket("z2,2100,1") == "OK");
+
+        // LDA 2100 in place of the STA
+        CHECK(stub.HandlePacket("M2003,1:3a") == "OK");
+        CHECK(stub.HandlePacket("Z3,2100,1") == "OK");
+        CHECK(stub.HandlePacket("c") == "T05rwatch:2100;");
+        CHECK(e.GetRegisters().A == 7);
+        CHECK(stub.HandlePacket("z3,2100,1") == "OK");
+        CHECK(stub.HandlePacket("Z4,20ff,4") == "OK");
+        CHECK(stub.HandlePacket("c") == "T05awatch:2100;");
+    }
+}
+
+TEST_CASE("GDB stub runs the video interrupts", "[gdb]")
+{
+    Emulator e;
+    GdbStub stub(&e);
+    // EI; JMP 2001 - the RST 1 handler at 0008 is a breakpoint
+    LoadProgram(&e, "fbc30120");
+    stub.SetBreakpoint(0x0008);
+    CHECK(stub.Resume(false) == "S05");
+    CHECK(e.GetPC() == 0x0008);
+    CHECK(e.GetCycles() >= 16666);
+    CHECK(e.GetCycles() < 16666 + 20);
+}
+
+TEST_CASE("GDB stub goes back through the recorded run", "[gdb]")
+{
+    Emulator e;
+    GdbStub stub(&e);
+    stub.GetHistory().SetInterval(1);
+    CHECK(stub.HandlePacket("bs") == "T05replaylog:begin;");
+    CHECK(stub.HandlePacket("Z2,23fe,2") == "OK");
+
+    // three frames of the ROM booting, one instruction at a time, noting
+    // the state at every step and where the watchpoint stopped
+    std::vector<LockstepState> states(1, LockstepState::Capture(e));
+    std::vector<uint64_t> watch_stops;
+    while (e.GetCycles() < 3 * 33332)
+    {
+        std::string reply = stub.Resume(true);
+        if (reply != "S05")
+        {
+            CHECK(reply == "T05watch:23ff;");
+            watch_stops.push_back(stub.GetStep());
+        }
+        states.push_back(LockstepState::Capture(e));
+    }
+    REQUIRE(stub.GetStep() == states.size() - 1);
+    REQUIRE(watch_stops.size() >= 2);
+    CHECK(stub.GetHistory().Snapshots() >= 3);
+
+    for (int i = 0; i < 20; i++)
+    {
+        REQUIRE(stub.HandlePacket("bs") == "S05");
+        REQUIRE(LockstepState::Capture(e).Matches(states[stub.GetStep()]));
+    }
+    CHECK(stub.GetStep() == states.size() - 21);
+
+    // back to each watchpoint hit in turn, then to the start
+    uint64_t last = states.size() - 1;
+    for (size_t i = watch_stops.size(); i-- > 0;)
+    {
+        if (watch_stops[i] < stub.GetStep())
+        {
+            REQUIRE(stub.HandlePacket("bc") == "T05watch:23ff;");
+            CHECK(stub.GetStep() == watch_stops[i]);
+            CHECK(LockstepState::Capture(e).Matches(states[watch_stops[i]]));
+        }
+    }
+    CHECK(stub.HandlePacket("bc") == "T05replaylog:begin;");
+    CHECK(stub.GetStep() == 0);
+    CHECK(LockstepState::Capture(e).Matches(states[0]));
+
+    // forward again to the end, and back to a breakpoint
+    CHECK(stub.HandlePacket("z2,23fe,2") == "OK");
+    while (stub.GetStep() < last)
+    {
+        stub.Resume(true);
+    }
+    CHECK(LockstepState::Capture(e).Matches(states[last]));
+    uint16_t pc = states[2000].pc;
+    uint64_t expected = last - 1;
+    while (states[expected].pc != pc)
+    {
+        expected--;
+    }
+    stub.SetBreakpoint(pc);
+    CHECK(stub.HandlePacket("bc") == "S05");
+    CHECK(stub.GetStep() == expected);
+    CHECK(LockstepState::Capture(e).Matches(states[expected]));
+}
+
+TEST_CASE("GDB stub replays changes made while stopped", "[gdb]")
+{
+    Emulator e;
+    GdbStub stub(&e);
+    // MVI A,5; INR A; STA 2100; JMP 2002
+    LoadProgram(&e, "3e053c320021c30220");
+    for (int i = 0; i < 10; i++)
+    {
+        stub.HandlePacket("s");
+    }
+    CHECK(e.GetRegisters().A == 8);
+    for (int i = 0; i < 4; i++)
+    {
+        CHECK(stub.HandlePacket("bs") == "S05");
+    }
+    CHECK(stub.GetStep() == 6);
+    CHECK(e.GetRegisters().A == 7);
+    CHECK(e.GetPC() == 0x2006);
+
+    // a change in the past replaces the future
+    CHECK(stub.HandlePacket("P0=0240") == "OK");
+    CHECK(stub.GetHistory().End() == 6);
+    for (int i = 0; i < 3; i++)
+    {
+        stub.HandlePacket("s");
+    }
+    CHECK(e.GetRegisters().A == 0x41);
+    CHECK(e.GetMemory()[0x2100] == 0x41);
+
+    // and is made again whenever the run passes that point
+    for (int i = 0; i < 3; i++)
+    {
+        stub.HandlePacket("bs");
+    }
+    CHECK(e.GetRegisters().A == 0x40);
+    CHECK(stub.HandlePacket("bs") == "S05");
+    CHECK(e.GetRegisters().A == 7);
+    stub.HandlePacket("s");
+    CHECK(e.GetRegisters().A == 0x40);
+    CHECK(stub.HandlePacket("bc") == "T05replaylog:begin;");
+    CHECK(e.GetPC() == 0x2000);
+    CHECK(e.GetRegisters().A == 0);
+}
+
+TEST_CASE("GDB packets are framed with a checksum", "[gdb]")
+{
+    CHECK(GdbStub::Frame("OK") == "$OK#9a");
+    CHECK(GdbStub::Frame("") == "$#00");
+}
+
+#ifndef _WIN32
+// Send one framed packet and return the reply, without its framing
+static std::string Exchange(int fd, const std::string &packet)
+{
+    std::string framed = GdbStub::Frame(packet);
+    send(fd, framed.data(), framed.size(), 0);
+    std::string reply;
+    char c;
+    while (recv(fd, &c, 1, 0) == 1 && c != '$')
+    {
+    }
+    while (recv(fd, &c, 1, 0) == 1 && c != '#')
+    {
+        reply.push_back(c);
+    }
+    char checksum[2];
+    recv(fd, checksum, 2, 0);
+    return reply;
+}
+
+TEST_CASE("GDB stub serves a debugger over TCP", "[gdb]")
+{
+    Emulator e;
+    GdbStub stub(&e);
+    REQUIRE(stub.Listen(0));
+    REQUIRE(stub.Port() > 0);
+
+    bool detached = false;
+    std::thread server([&]() {
+        if (stub.Accept())
+        {
+            detached = stub.Serve();
+        }
+    });
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(static_cast<uint16_t>(stub.Port()));
+    REQUIRE(connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) == 0);
+
+    CHECK(Exchange(fd, "qSupported:multiprocess+") == "PacketSize=4000;QStartNoAckMode+;ReverseStep+;ReverseContinue+");
+    CHECK(Exchange(fd, "QStartNoAckMode") == "OK");
+    CHECK(Exchange(fd, "m0,3") == "000000");
+    CHECK(Exchange(fd, "Z0,0003,1") == "OK");
+    CHECK(Exchange(fd, "c") == "S05");
+    CHECK(Exchange(fd, "p5") == "0300");
+    CHECK(Exchange(fd, "D") == "OK");
+    server.join();
+    close(fd);
+    CHECK(detached);
+}
+#endif
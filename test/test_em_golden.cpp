@@ -0,0 +1,115 @@
+#include <catch2/catch_all.hpp>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "emulator/emulator.hpp"
+#include "emulator/engine.hpp"
+#include "emulator/golden.hpp"
+#include "emulator/movie.hpp"
+#include "emulator/video.hpp"
+#include "static_invaders/static_invaders.hpp"
+
+#ifndef EM_SOURCE_DIR
+#define EM_SOURCE_DIR "."
+#endif
+
+// Engine that corrupts a byte of video RAM from frame 150 on
+static void RunFaulty(Emulator *e, int cycles)
+{
+    e->Emulate(cycles);
+    if (e->GetCycles() > 150 * 2 * 16666ull)
+    {
+        e->WriteToMem(0x3000, 0xff);
+    }
+}
+
+static Snapshot PowerOn()
+{
+    Emulator e;
+    REQUIRE(e.LoadRom(EM_SOURCE_DIR "/space_invaders_rom/invaders") == 0x2000);
+    Snapshot snapshot;
+    e.SaveState(&snapshot);
+    return snapshot;
+}
+
+TEST_CASE("Every engine matches the golden frames", "[golden]")
+{
+    InputMovie movie;
+    REQUIRE(movie.Load(EM_SOURCE_DIR "/test/data/gameplay.movie"));
+    GoldenFrames golden;
+    REQUIRE(golden.Load(EM_SOURCE_DIR "/test/data/gameplay.golden"));
+    REQUIRE(golden.Frames().size() > 0);
+    const Snapshot power_on = PowerOn();
+
+    StaticInvaders::Register();
+    REQUIRE(EngineRegistry::Find("static") != nullptr);
+    std::vector<std::string> names = EngineRegistry::Names();
+    for (size_t i = 0; i < names.size(); i++)
+    {
+        INFO("engine " << names[i]);
+        GoldenMismatch mismatch;
+        bool passed = golden.Check(power_on, EngineRegistry::Find(names[i])->run, &movie, &mismatch);
+        if (!passed)
+        {
+            GoldenFrames::WritePgm("golden_" + names[i] + ".pgm", mismatch.vram.data());
+            INFO("first differing frame " << mismatch.actual.frame << " written to golden_" << names[i] << ".pgm");
+            CHECK(passed);
+        }
+    }
+}
+
+TEST_CASE("Golden frames find the first bad frame", "[golden]")
+{
+    InputMovie movie;
+    REQUIRE(movie.Load(EM_SOURCE_DIR "/test/data/gameplay.movie"));
+    const Snapshot power_on = PowerOn();
+
+    GoldenFrames golden;
+    golden.Record(power_on, EngineRegistry::Find("interpreter")->run, &movie, 250, 60);
+    REQUIRE(golden.Frames().size() == 5);
+    CHECK(golden.Frames().back().frame == 250);
+
+    const char *path = "golden_test.txt";
+    REQUIRE(golden.Save(path));
+    GoldenFrames loaded;
+    REQUIRE(loaded.Load(path));
+    std::remove(path);
+    REQUIRE(loaded.Frames().size() == golden.Frames().size());
+    CHECK(loaded.Frames()[2].vram_hash == golden.Frames()[2].vram_hash);
+    CHECK(loaded.Frames()[2].ram_hash == golden.Frames()[2].ram_hash);
+
+    GoldenMismatch mismatch;
+    CHECK(loaded.Check(power_on, EngineRegistry::Find("interpreter")->run, &movie, &mismatch));
+    REQUIRE_FALSE(loaded.Check(power_on, RunFaulty, &movie, &mismatch));
+    CHECK(mismatch.actual.frame == 180);
+    CHECK(mismatch.actual.vram_hash != mismatch.expected.vram_hash);
+    REQUIRE(mismatch.vram.size() == static_cast<size_t>(Video::kVramSize));
+    CHECK(mismatch.vram[0x3000 - Video::kVramStart] == 0xff);
+}
+
+TEST_CASE("PGM output", "[golden]")
+{
+    std::vector<uint8_t> vram(Video::kVramSize, 0);
+    vram[0] = 0x01; // bottom left pixel, white
+
+    const char *path = "golden_test.pgm";
+    REQUIRE(GoldenFrames::WritePgm(path, vram.data()));
+    std::ifstream file(path, std::ios::binary);
+    std::string magic;
+    int width, height, max_value;
+    file >> magic >> width >> height >> max_value;
+    file.get();
+    std::vector<char> pixels(width * height);
+    file.read(pixels.data(), pixels.size());
+    CHECK(file.good());
+    file.close();
+    std::remove(path);
+
+    CHECK(magic == "P5");
+    CHECK(width == Video::kWidth);
+    CHECK(height == Video::kHeight);
+    CHECK(max_value == 255);
+    CHECK(static_cast<uint8_t>(pixels[(Video::kHeight - 1) * Video::kWidth]) == 255);
+    CHECK(pixels[0] == 0);
+}
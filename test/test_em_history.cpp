@@ -0,0 +1,89 @@
+#include <catch2/catch_all.hpp>
+#include "emulator/history.hpp"
+
+static HistorySnapshot At(uint64_t step, uint64_t frame)
+{
+    HistorySnapshot snapshot;
+    snapshot.step = step;
+    snapshot.frame = frame;
+    return snapshot;
+}
+
+TEST_CASE("History finds the snapshot to replay from", "[history]")
+{
+    History history;
+    history.SetInterval(2);
+    CHECK(history.Empty());
+    CHECK(history.SnapshotDue(0, 0));
+    history.AddSnapshot(At(0, 0));
+    CHECK(!history.SnapshotDue(100, 1));
+    CHECK(history.SnapshotDue(200, 2));
+    history.AddSnapshot(At(200, 2));
+    CHECK(!history.SnapshotDue(200, 4));
+    history.AddSnapshot(At(400, 4));
+    history.Advance(450);
+
+    CHECK(history.Begin() == 0);
+    CHECK(history.End() == 450);
+    CHECK(history.Nearest(0).step == 0);
+    CHECK(history.Nearest(199).step == 0);
+    CHECK(history.Nearest(200).step == 200);
+    CHECK(history.Nearest(450).step == 400);
+
+    HistoryInput input;
+    input.step = 300;
+    input.value = 1;
+    history.AddInput(input);
+    input.value = 2;
+    history.AddInput(input);
+    input.step = 420;
+    history.AddInput(input);
+    CHECK(!history.HasInputs(299));
+    CHECK(history.HasInputs(300));
+    CHECK(history.InputsAt(300).size() == 2);
+    CHECK(history.InputsAt(300)[1].value == 2);
+    CHECK(history.InputsAt(301).empty());
+
+    history.Truncate(300);
+    CHECK(history.End() == 300);
+    CHECK(history.Snapshots() == 2);
+    CHECK(history.HasInputs(300));
+    CHECK(!history.HasInputs(420));
+}
+
+TEST_CASE("History spaces snapshots by the speed of the machine", "[history]")
+{
+    History history(0.05);
+    // 1ms a frame leaves 25 frames to replay in half the budget
+    history.NoteSpeed(100, 0.1);
+    CHECK(history.Interval() == 25);
+    history.NoteSpeed(10, 1.0);
+    CHECK(history.Interval() == 1);
+    history.NoteSpeed(1000000, 0.1);
+    CHECK(history.Interval() == History::kMaxInterval);
+
+    // short runs are added up until they are long enough to time
+    history.NoteSpeed(1, 0.004);
+    CHECK(history.Interval() == History::kMaxInterval);
+    history.NoteSpeed(0, 0.004);
+    history.NoteSpeed(1, 0.002);
+    CHECK(history.Interval() == 5);
+    history.SetInterval(7);
+    history.NoteSpeed(100, 0.1);
+    CHECK(history.Interval() == 7);
+}
+
+TEST_CASE("History thins out old snapshots", "[history]")
+{
+    History history;
+    history.SetInterval(1);
+    for (int i = 0; i <= History::kMaxSnapshots; i++)
+    {
+        history.AddSnapshot(At(i * 10, i));
+    }
+    CHECK(history.Snapshots() <= static_cast<size_t>(History::kMaxSnapshots));
+    CHECK(history.Begin() == 0);
+    CHECK(history.Nearest(History::kMaxSnapshots * 10).step == History::kMaxSnapshots * 10u);
+    CHECK(history.Nearest(History::kMaxSnapshots * 10 - 1).step == History::kMaxSnapshots * 10u - 10);
+    CHECK(history.Nearest(15).step == 0);
+}
@@ -0,0 +1,194 @@
+#include <catch2/catch_all.hpp>
+#include <random>
+#include "emulator/divergence.hpp"
+#include "emulator/emulator.hpp"
+#include "emulator/engine.hpp"
+#include "emulator/hle.hpp"
+#include "emulator/lockstep.hpp"
+#include "emulator/profiler.hpp"
+
+// Put e at a call to address from 0x2000, or a jump back to it if loop is
+// set, with a return to the HLT at 0x2003 on the stack already for a loop
+// and, for DrawSprite's loop, the HL it pushes before
+static void EnterAt(Emulator *e, uint16_t address, bool loop)
+{
+    e->SetMemory(0x2000, loop ? 0xc3 : 0xcd); // JMP or CALL
+    e->SetMemory(0x2001, address & 0xff);
+    e->SetMemory(0x2002, address >> 8);
+    e->SetMemory(0x2003, 0x76); // HLT
+    e->SetPC(0x2000);
+    e->SetSP(0x2400);
+    if (loop)
+    {
+        e->SetMemory(0x23fe, 0x03);
+        e->SetMemory(0x23ff, 0x20);
+        e->SetSP(0x23fe);
+    }
+    if (address == 0x15d7)
+    {
+        e->SetSP(0x23fc);
+    }
+}
+
+// Input for a frame of a game that starts with a coin and keeps moving and
+// firing
+static void Play(Emulator *e, int frame)
+{
+    e->SetPort(1, 0, frame > 100 && frame < 110);
+    e->SetPort(1, 2, frame > 200 && frame < 210);
+    e->SetPort(1, 4, frame % 40 < 5);
+    e->SetPort(1, 5, frame % 300 < 150);
+    e->SetPort(1, 6, frame % 300 >= 150);
+}
+
+TEST_CASE("Each hook does what the routine's instructions do", "[hle]")
+{
+    const HleTable &hooks = HleTable::SpaceInvaders();
+    REQUIRE(!hooks.Hooks().empty());
+    std::mt19937 random(467);
+    for (size_t i = 0; i < hooks.Hooks().size(); i++)
+    {
+        const HleHook &hook = hooks.Hooks()[i];
+        bool loop = hook.name.find("loop") != std::string::npos;
+
+        // these start by turning a pixel position into a screen address
+        bool converts = hook.address == 0x1400 || hook.address == 0x1424 || hook.address == 0x1452 ||
+                        hook.address == 0x1491 || hook.address == 0x15d3;
+        INFO(hook.name);
+        for (int attempt = 0; attempt < 20; attempt++)
+        {
+            // a sprite of up to 8 rows from somewhere in ROM, drawn so
+            // that it stays on the screen
+            Emulator executed;
+            Registers registers;
+            registers.A = random() & 0xff;
+            registers.B = 1 + random() % 8;
+            registers.C = random() & 0xff;
+            registers.D = 0x1b + random() % 4;
+            registers.E = random() & 0xff;
+            registers.H = 0x24 + random() % 0x1a;
+            registers.L = random() & 0xff;
+            if (converts)
+            {
+                registers.H = 0x20 + random() % 0xd0;
+            }
+            if (hook.address == 0x1a5f || hook.address == 0x09d9)
+            {
+                // the clearing loops run to the end of the screen
+                registers.H = 0x3f;
+            }
+            executed.SetRegisters(registers);
+            Flags flags;
+            flags.cy = attempt % 2;
+            executed.SetFlags(flags);
+            for (int address = 0x2400; address < 0x4000; address += 7)
+            {
+                executed.SetMemory(static_cast<uint16_t>(address), random() & 0xff);
+            }
+            EnterAt(&executed, hook.address, loop);
+            Snapshot start;
+            executed.SaveState(&start);
+            Emulator hooked;
+            hooked.LoadState(start);
+            hooked.SetHleHooks(&hooks);
+
+            // calls of all sizes, so that some stop part way through
+            for (int call = 0; call < 1000 && !executed.Halted(); call++)
+            {
+                int cycles = 20 + random() % 3000;
+                executed.Emulate(cycles);
+                hooked.Emulate(cycles);
+                REQUIRE(DivergenceFinder::SameState(executed, hooked));
+            }
+            CHECK(hooked.Halted());
+            CHECK(hooked.HleCalls() > 0);
+            CHECK(executed.HleCalls() == 0);
+        }
+    }
+}
+
+TEST_CASE("The game runs in lockstep with ROM routines run natively", "[hle]")
+{
+    Emulator e;
+    LockstepChecker checker(*EngineRegistry::Find("hle"), *EngineRegistry::Find("interpreter"));
+    checker.Start(e, false);
+    for (int frame = 0; frame < 3000; frame++)
+    {
+        Play(&e, frame);
+        REQUIRE(checker.RunFrame(&e));
+    }
+    checker.Stop();
+    CHECK(!checker.Failed());
+    CHECK(e.HleCalls() > 1000);
+}
+
+TEST_CASE("Hooks are left out where they cannot be trusted", "[hle]")
+{
+    Emulator e;
+    e.SetHleHooks(&HleTable::SpaceInvaders());
+    const Engine *interpreter = EngineRegistry::Find("interpreter");
+    for (int frame = 0; frame < 100; frame++)
+    {
+        EngineRegistry::RunFrame(&e, interpreter->run);
+    }
+    uint64_t calls = e.HleCalls();
+    REQUIRE(calls > 0);
+
+    SECTION("a different ROM")
+    {
+        e.SetMemory(0x1fff, e.GetMemory()[0x1fff] ^ 0xff);
+        for (int frame = 0; frame < 100; frame++)
+        {
+            EngineRegistry::RunFrame(&e, interpreter->run);
+        }
+        CHECK(e.HleCalls() == calls);
+
+        // and back
+        e.SetMemory(0x1fff, e.GetMemory()[0x1fff] ^ 0xff);
+        for (int frame = 0; frame < 100; frame++)
+        {
+            EngineRegistry::RunFrame(&e, interpreter->run);
+        }
+        CHECK(e.HleCalls() > calls);
+    }
+    SECTION("a profiler attached")
+    {
+        InstructionCounter counter;
+        for (int frame = 0; frame < 100; frame++)
+        {
+            e.EmulateProfiled(EngineRegistry::kHalfFrameCycles, counter);
+            e.Interrupt(1);
+            e.EmulateProfiled(EngineRegistry::kHalfFrameCycles, counter);
+            e.Interrupt(2);
+        }
+        CHECK(e.HleCalls() == calls);
+    }
+    SECTION("turned off")
+    {
+        e.SetHleHooks(nullptr);
+        for (int frame = 0; frame < 100; frame++)
+        {
+            EngineRegistry::RunFrame(&e, interpreter->run);
+        }
+        CHECK(e.HleCalls() == calls);
+    }
+}
+
+TEST_CASE("Hooks are found by ROM hash and address", "[hle]")
+{
+    Emulator e;
+    uint64_t hash = HleTable::RomHash(e.GetMemory(), HleTable::kRomSize);
+    const HleFunction *entries = HleTable::SpaceInvaders().Entries(hash);
+    REQUIRE(entries != nullptr);
+    CHECK(entries[0x1439] != nullptr);
+    CHECK(entries[0x143a] == nullptr);
+    CHECK(HleTable::SpaceInvaders().Entries(hash + 1) == nullptr);
+
+    HleTable table;
+    HleHook hook = {"test", hash + 1, 0x0100, nullptr};
+    table.Add(hook);
+    hook.address = HleTable::kRomSize;
+    table.Add(hook);
+    CHECK(table.Hooks().size() == 1);
+    CHECK(table.Entries(hash) == nullptr);
+}
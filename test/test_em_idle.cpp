@@ -0,0 +1,150 @@
+#include <catch2/catch_all.hpp>
+#include "emulator/divergence.hpp"
+#include "emulator/emulator.hpp"
+#include "emulator/engine.hpp"
+#include "emulator/profiler.hpp"
+
+static void Load(Emulator *e, const uint8_t *program, int size)
+{
+    for (int i = 0; i < size; i++)
+    {
+        e->SetMemory(static_cast<uint16_t>(0x2000 + i), program[i]);
+    }
+    e->SetPC(0x2000);
+    e->SetSP(0x2400);
+}
+
+static void CountHit(void *context, const WatchEvent &)
+{
+    (*static_cast<int *>(context))++;
+}
+
+TEST_CASE("HLT stops the CPU until an interrupt", "[idle]")
+{
+    const uint8_t program[] = {
+        0xfb, // EI
+        0x76, // HLT
+        0xf3, // DI
+        0x76, // HLT
+    };
+    Emulator e;
+    Load(&e, program, sizeof(program));
+    uint64_t start = e.GetCycles();
+    e.Emulate(1000);
+    CHECK(e.Halted());
+    CHECK(e.GetPC() == 0x2002);
+    CHECK(e.GetCycles() - start == 1000);
+    e.Emulate(500);
+    CHECK(e.GetPC() == 0x2002);
+    CHECK(e.GetCycles() - start == 1500);
+
+    // a snapshot keeps the CPU halted
+    Snapshot halted;
+    e.SaveState(&halted);
+    Emulator copy;
+    copy.LoadState(halted);
+    CHECK(copy.Halted());
+
+    // the interrupt returns to the instruction after HLT
+    e.Interrupt(1);
+    CHECK(!e.Halted());
+    CHECK(e.GetPC() == 0x08);
+    CHECK(e.GetMemory()[0x23fe] == 0x02);
+    CHECK(e.GetMemory()[0x23ff] == 0x20);
+    e.SetPC(0x2002);
+    e.SetSP(0x2400);
+
+    // with interrupts off nothing wakes it
+    e.Emulate(100);
+    CHECK(e.Halted());
+    CHECK(e.GetPC() == 0x2004);
+    e.Interrupt(2);
+    CHECK(e.Halted());
+    CHECK(e.GetPC() == 0x2004);
+}
+
+TEST_CASE("Idle loops are skipped without changing the result", "[idle]")
+{
+    const uint8_t program[] = {
+        0x3a, 0x00, 0x21, // LDA 0x2100
+        0xa7,             // ANA A
+        0xc2, 0x00, 0x20, // JNZ 0x2000
+        0x76,             // HLT
+    };
+    Emulator skipped;
+    Load(&skipped, program, sizeof(program));
+    skipped.SetMemory(0x2100, 1);
+    Snapshot start;
+    skipped.SaveState(&start);
+    Emulator executed;
+    executed.LoadState(start);
+
+    // the same run with a profiler attached executes every instruction
+    InstructionCounter counter;
+    for (int i = 0; i < 10; i++)
+    {
+        skipped.Emulate(EngineRegistry::kHalfFrameCycles);
+        executed.EmulateProfiled(EngineRegistry::kHalfFrameCycles, counter);
+        CHECK(DivergenceFinder::SameState(skipped, executed));
+    }
+    CHECK(skipped.IdleCyclesSkipped() > 9 * EngineRegistry::kHalfFrameCycles);
+    CHECK(executed.IdleCyclesSkipped() == 0);
+    CHECK(counter.instructions > 10 * EngineRegistry::kHalfFrameCycles / 27);
+
+    // the loop ends as soon as the flag it polls changes
+    skipped.SetMemory(0x2100, 0);
+    executed.SetMemory(0x2100, 0);
+    skipped.Emulate(100);
+    executed.Emulate(100);
+    CHECK(skipped.Halted());
+    CHECK(DivergenceFinder::SameState(skipped, executed));
+}
+
+TEST_CASE("Loops with side effects are executed", "[idle]")
+{
+    Emulator e;
+    uint64_t before = e.IdleCyclesSkipped();
+
+    SECTION("writing memory")
+    {
+        const uint8_t program[] = {
+            0x21, 0x00, 0x21, // LXI H,0x2100
+            0x34,             // INR M
+            0xc3, 0x03, 0x20, // JMP 0x2003
+        };
+        Load(&e, program, sizeof(program));
+        e.Emulate(1000);
+        CHECK(e.IdleCyclesSkipped() == before);
+        CHECK(e.GetMemory()[0x2100] == (1000 - 10) / 20 + 1);
+    }
+    SECTION("reading watched memory")
+    {
+        const uint8_t program[] = {
+            0x3a, 0x00, 0x21, // LDA 0x2100
+            0xc3, 0x00, 0x20, // JMP 0x2000
+        };
+        Load(&e, program, sizeof(program));
+        int reads = 0;
+        e.AddWatch(0x2100, 1, kWatchRead, CountHit, &reads);
+        e.Emulate(2300);
+        CHECK(e.IdleCyclesSkipped() == before);
+        CHECK(reads == 100);
+    }
+}
+
+TEST_CASE("The game runs the same with idle loops skipped", "[idle]")
+{
+    Emulator skipped;
+    Emulator executed;
+    InstructionCounter counter;
+    for (int frame = 0; frame < 300; frame++)
+    {
+        EngineRegistry::RunFrame(&skipped, EngineRegistry::Find("interpreter")->run);
+        executed.EmulateProfiled(EngineRegistry::kHalfFrameCycles, counter);
+        executed.Interrupt(1);
+        executed.EmulateProfiled(EngineRegistry::kHalfFrameCycles, counter);
+        executed.Interrupt(2);
+    }
+    CHECK(DivergenceFinder::SameState(skipped, executed));
+    CHECK(skipped.IdleCyclesSkipped() > 0);
+}
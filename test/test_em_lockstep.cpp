@@ -0,0 +1,140 @@
+#include <catch2/catch_all.hpp>
+#include <sstream>
+#include <string>
+#include "emulator/emulator.hpp"
+#include "emulator/engine.hpp"
+#include "emulator/lockstep.hpp"
+
+// Cycle at which RunCorrupting flips a bit of RAM, about 2000 frames in
+static const uint64_t kCorruptCycle = 2000ull * 33332;
+
+// Engine that flips a bit of RAM in the one call that reaches kCorruptCycle
+static void RunCorrupting(Emulator *e, int cycles)
+{
+    uint64_t start = e->GetCycles();
+    e->Emulate(cycles);
+    if (start < kCorruptCycle && e->GetCycles() >= kCorruptCycle)
+    {
+        Snapshot state;
+        e->SaveState(&state);
+        state.memory[0x2100] ^= 0x40;
+        e->LoadState(state);
+    }
+}
+
+static const Engine &Interpreter()
+{
+    return *EngineRegistry::Find("interpreter");
+}
+
+TEST_CASE("Lockstep state covers registers, ports and memory", "[lockstep]")
+{
+    Emulator e;
+    LockstepState a = LockstepState::Capture(e);
+    CHECK(a.Matches(LockstepState::Capture(e)));
+
+    Registers registers = e.GetRegisters();
+    registers.L ^= 1;
+    e.SetRegisters(registers);
+    CHECK(!a.Matches(LockstepState::Capture(e)));
+    registers.L ^= 1;
+    e.SetRegisters(registers);
+
+    Snapshot state;
+    e.SaveState(&state);
+    state.memory[0x3fff] ^= 1;
+    e.LoadState(state);
+    LockstepState b = LockstepState::Capture(e);
+    CHECK(b.ram_hash != a.ram_hash);
+    CHECK(!a.Matches(b));
+
+    state.memory[0x3fff] ^= 1;
+    state.ports.port5 = 0x10;
+    e.LoadState(state);
+    CHECK(!a.Matches(LockstepState::Capture(e)));
+}
+
+TEST_CASE("Engines run in lockstep with the interpreter", "[lockstep]")
+{
+    Emulator e;
+    LockstepChecker checker(*EngineRegistry::Find("profiled"), Interpreter());
+
+    SECTION("inline")
+    {
+        checker.Start(e, false);
+    }
+    SECTION("on a second thread")
+    {
+        checker.Start(e, true, 2);
+    }
+    for (int frame = 0; frame < 300; frame++)
+    {
+        // input changes mid frame, as it does in the SDL frontend
+        checker.Emulate(&e, EngineRegistry::kHalfFrameCycles);
+        e.SetPort(1, 2, (frame / 20) % 2);
+        checker.Interrupt(&e, 1);
+        checker.Emulate(&e, EngineRegistry::kHalfFrameCycles);
+        e.SetPort(1, 5, (frame / 30) % 2);
+        checker.Interrupt(&e, 2);
+        REQUIRE(checker.EndFrame(e));
+    }
+    checker.Stop();
+    CHECK(!checker.Failed());
+    CHECK(checker.FramesChecked() == 300);
+
+    std::ostringstream report;
+    checker.Report(report);
+    CHECK(report.str() == "profiled agrees with interpreter after 300 frames\n");
+}
+
+TEST_CASE("Lockstep reports the frame an engine goes wrong in", "[lockstep]")
+{
+    Emulator e;
+    LockstepChecker checker(Engine{"corrupting", RunCorrupting}, Interpreter());
+    bool threaded = GENERATE(false, true);
+    checker.Start(e, threaded);
+
+    int frames = 0;
+    while (frames < 2100 && checker.RunFrame(&e))
+    {
+        frames++;
+    }
+    checker.Stop();
+    REQUIRE(checker.Failed());
+    const LockstepMismatch &mismatch = checker.Mismatch();
+    CHECK(mismatch.before.cycles < kCorruptCycle);
+    CHECK(mismatch.reference.cycles >= kCorruptCycle);
+    CHECK(mismatch.frame <= 2000);
+    CHECK(mismatch.reproduced);
+    CHECK(mismatch.reference.ram_hash != mismatch.candidate.ram_hash);
+    CHECK(mismatch.reference_state.memory[0x2100] == (mismatch.candidate_state.memory[0x2100] ^ 0x40));
+
+    // the emulation thread finds out right away inline, and only a few
+    // frames later when the reference trails it
+    CHECK(static_cast<uint64_t>(frames) >= mismatch.frame);
+    CHECK(static_cast<uint64_t>(frames) <= mismatch.frame + (threaded ? 20 : 0));
+
+    std::ostringstream report;
+    checker.Report(report);
+    CHECK(report.str().find("corrupting differs from interpreter at the end of frame " +
+                            std::to_string(mismatch.frame)) != std::string::npos);
+    CHECK(report.str().find("[2100]") != std::string::npos);
+    CHECK(report.str().find("RAM hash") != std::string::npos);
+}
+
+TEST_CASE("Lockstep checks long frames in parts", "[lockstep]")
+{
+    // more calls than a frame holds end the frame early, so a caller that
+    // emulates in small slices is still checked every few slices
+    Emulator e;
+    LockstepChecker checker(*EngineRegistry::Find("profiled"), Interpreter());
+    checker.Start(e, true);
+    for (int slice = 0; slice < 20; slice++)
+    {
+        checker.Emulate(&e, 1000);
+    }
+    REQUIRE(checker.EndFrame(e));
+    checker.Stop();
+    CHECK(!checker.Failed());
+    CHECK(checker.FramesChecked() == 3);
+}
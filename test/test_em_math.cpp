@@ -18,11 +18,12 @@ TEST_CASE("Subtraction", "[math]")
     Emulator e;
 
     // aa - aa = 0
+    // AC is set when the low digit does not borrow, as in all three cases
     e.EmulateOpcode(0x3e, 0xaa);
     REQUIRE(e.GetRegisters().A == 0xaa);
     e.SubtractFromA(0xaa);
     CHECK(e.GetRegisters().A == 0x00);
-    Flags result = {.z = 1, .s = 0, .p = 1, .cy = 0};
+    Flags result = {.z = 1, .s = 0, .p = 1, .cy = 0, .ac = 1};
     CHECK(e.GetFlags() == result);
 
     // 20 - 10 = 10
@@ -30,7 +31,7 @@ TEST_CASE("Subtraction", "[math]")
     REQUIRE(e.GetRegisters().A == 0x20);
     e.SubtractFromA(0x10);
     CHECK(e.GetRegisters().A == 0x10);
-    result = {.z = 0, .s = 0, .p = 0, .cy = 0};
+    result = {.z = 0, .s = 0, .p = 0, .cy = 0, .ac = 1};
     CHECK(e.GetFlags() == result);
 
     // aa - c5 = e5
@@ -38,7 +39,7 @@ TEST_CASE("Subtraction", "[math]")
     REQUIRE(e.GetRegisters().A == 0xaa);
     e.SubtractFromA(0xc5);
     CHECK(e.GetRegisters().A == 0xe5);
-    result = {.z = 0, .s = 1, .p = 0, .cy = 1};
+    result = {.z = 0, .s = 1, .p = 0, .cy = 1, .ac = 1};
     CHECK(e.GetFlags() == result);
 }
 
@@ -2066,4 +2067,21 @@ TEST_CASE("Decimal Adjust Accumulator", "[opcode][daa][math]")
         CHECK(e.GetFlags().cy == 1);
         CHECK(e.GetPC() == test_pc + 1);
     }
+
+    SECTION("DAA - Lower nibble carries into upper nibble")
+    {
+        int test_pc = pc;
+
+        // MVI A
+        e.EmulateOpcode(0x3e, 0x9a);
+        REQUIRE(e.GetRegisters().A == 0x9a);
+        test_pc = e.GetPC();
+
+        // DAA
+        e.EmulateOpcode(0x27);
+        CHECK(e.GetRegisters().A == 0x00);
+        CHECK(e.GetFlags().cy == 1);
+        CHECK(e.GetFlags().z == 1);
+        CHECK(e.GetPC() == test_pc + 1);
+    }
 }
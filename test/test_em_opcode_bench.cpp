@@ -0,0 +1,65 @@
+#include <catch2/catch_all.hpp>
+#include "disassembler/control_flow.hpp"
+#include "emulator/emulator.hpp"
+#include "emulator/engine.hpp"
+#include "emulator/opcode_bench.hpp"
+
+TEST_CASE("SetRamRange", "[opcode_bench]")
+{
+    Emulator e;
+    e.WriteToMem(0x1000, 0x42);
+    REQUIRE(e.GetMemory()[0x1000] == 0x00);
+
+    e.SetRamRange(0, e.GetMemorySize());
+    e.WriteToMem(0x1000, 0x42);
+    REQUIRE(e.GetMemory()[0x1000] == 0x42);
+}
+
+TEST_CASE("Opcode kernels loop back", "[opcode_bench]")
+{
+    const Engine *engine = EngineRegistry::Find("interpreter");
+    REQUIRE(engine != nullptr);
+
+    int implemented = 0;
+    for (int opcode = 0; opcode < 0x100; opcode++)
+    {
+        OpcodeKernel kernel = OpcodeBench::BuildKernel(static_cast<uint8_t>(opcode));
+        if (!kernel.implemented)
+        {
+            continue;
+        }
+        implemented++;
+
+        INFO("opcode " << opcode);
+        Emulator e;
+        OpcodeBench::LoadKernel(&e, kernel);
+        KernelIteration iteration;
+        REQUIRE(OpcodeBench::StepIteration(&e, engine->run, kernel, &iteration));
+        bool single = ControlFlowGraph::GetFlowType(static_cast<uint8_t>(opcode)) == kFlowIndirect;
+        CHECK(iteration.target_instructions == (single ? 1 : OpcodeBench::kRepeats));
+
+        // the second pass must behave the same as the first
+        KernelIteration again;
+        REQUIRE(OpcodeBench::StepIteration(&e, engine->run, kernel, &again));
+        CHECK(again.cycles == iteration.cycles);
+        CHECK(again.target_instructions == iteration.target_instructions);
+    }
+    // all but the invalid opcodes and HLT
+    REQUIRE(implemented == 0x100 - 13);
+}
+
+TEST_CASE("Opcode timing", "[opcode_bench]")
+{
+    OpcodeBench bench(*EngineRegistry::Find("interpreter"));
+    bench.SetCycles(20000);
+    const OpcodeTiming &nop = bench.Measure(0x00);
+    REQUIRE(nop.measured);
+    REQUIRE(nop.cycles_per_instruction == 4);
+    REQUIRE(nop.ns_per_instruction >= 0);
+
+    const OpcodeTiming &rst = bench.Measure(0xc7);
+    REQUIRE(rst.measured);
+    REQUIRE(rst.cycles_per_instruction == 11);
+    REQUIRE(bench.Timing(0xc9).measured);
+    REQUIRE_FALSE(bench.Timing(0x08).measured);
+}
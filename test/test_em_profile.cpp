@@ -0,0 +1,126 @@
+#include <catch2/catch_all.hpp>
+#include <sstream>
+#include "emulator/emulator.hpp"
+#include "emulator/profiler.hpp"
+#include "emulator/call_profiler.hpp"
+
+// Load program into RAM at 0x2000 and jump to it
+static void LoadProgram(Emulator *e, const uint8_t *program, int size)
+{
+    e->AllocateMemory(0x3000);
+    for (int i = 0; i < size; i++)
+    {
+        e->WriteToMem(0x2000 + i, program[i]);
+    }
+    e->EmulateOpcode(0xc3, 0x00, 0x20);
+}
+
+TEST_CASE("Execution profiler", "[profile]")
+{
+    // 2000 MVI B,03
+    // 2002 DCR B
+    // 2003 JNZ 2002
+    // 2006 JMP 2006
+    const uint8_t program[] = {0x06, 0x03, 0x05, 0xc2, 0x02, 0x20, 0xc3, 0x06, 0x20};
+    Emulator e;
+    LoadProgram(&e, program, sizeof(program));
+
+    ExecutionProfiler *profiler = new ExecutionProfiler();
+    e.EmulateProfiled(7 + 3 * (5 + 10), *profiler);
+
+    SECTION("Per PC counts")
+    {
+        CHECK(profiler->GetPCCount(0x2000) == 1);
+        CHECK(profiler->GetPCCount(0x2002) == 3);
+        CHECK(profiler->GetPCCount(0x2003) == 3);
+        CHECK(profiler->GetPCCount(0x2006) == 0);
+        CHECK(profiler->GetPCCycles(0x2002) == 15);
+        CHECK(profiler->GetPCCycles(0x2003) == 30);
+    }
+    SECTION("Per opcode counts")
+    {
+        CHECK(profiler->GetOpcodeCount(0x05) == 3);
+        CHECK(profiler->GetOpcodeCycles(0xc2) == 30);
+        CHECK(profiler->TotalInstructions() == 7);
+        CHECK(profiler->TotalCycles() == 52);
+    }
+    SECTION("Report")
+    {
+        std::ostringstream report;
+        profiler->Report(report, e.GetMemory(), e.GetMemorySize(), 1);
+        CHECK(report.str().find("2003            3           30  57.69  JNZ $2002") != std::string::npos);
+    }
+    SECTION("Reset")
+    {
+        profiler->Reset();
+        CHECK(profiler->TotalInstructions() == 0);
+        CHECK(profiler->GetPCCount(0x2002) == 0);
+    }
+    delete profiler;
+}
+
+TEST_CASE("Profiled and plain run loops agree", "[profile]")
+{
+    const uint8_t program[] = {0x06, 0x03, 0x05, 0xc2, 0x02, 0x20, 0xc3, 0x06, 0x20};
+    Emulator plain;
+    Emulator profiled;
+    LoadProgram(&plain, program, sizeof(program));
+    LoadProgram(&profiled, program, sizeof(program));
+
+    NullProfiler none;
+    plain.Emulate(1000);
+    profiled.EmulateProfiled(1000, none);
+    CHECK(plain.GetPC() == profiled.GetPC());
+    CHECK(plain.GetRegisters().B == profiled.GetRegisters().B);
+}
+
+TEST_CASE("Call graph profiler", "[profile][callgraph]")
+{
+    // 2000 LXI SP,2400
+    // 2003 CALL 2010
+    // 2006 CALL 2010
+    // 2009 JMP 2009
+    // 2010 CALL 2020
+    // 2013 RET
+    // 2020 NOP
+    // 2021 RET
+    uint8_t program[0x22] = {0x31, 0x00, 0x24, 0xcd, 0x10, 0x20, 0xcd, 0x10, 0x20, 0xc3, 0x09, 0x20};
+    program[0x10] = 0xcd;
+    program[0x11] = 0x20;
+    program[0x12] = 0x20;
+    program[0x13] = 0xc9;
+    program[0x21] = 0xc9;
+    Emulator e;
+    LoadProgram(&e, program, sizeof(program));
+
+    CallGraphProfiler profiler;
+    profiler.Reset(0x2000);
+    profiler.SetSymbol(0x2000, "Main");
+    profiler.SetSymbol(0x2010, "Outer");
+    e.EmulateProfiled(126, profiler);
+
+    SECTION("Cycles per routine")
+    {
+        CHECK(profiler.Depth() == 0);
+        CHECK(profiler.TotalCycles() == 126);
+        CHECK(profiler.Calls(0x2010) == 2);
+        CHECK(profiler.Calls(0x2020) == 2);
+        CHECK(profiler.ExclusiveCycles(0x2000) == 10 + 17 + 17);
+        CHECK(profiler.ExclusiveCycles(0x2010) == 2 * (17 + 10));
+        CHECK(profiler.InclusiveCycles(0x2010) == 2 * (17 + 10 + 4 + 10));
+        CHECK(profiler.InclusiveCycles(0x2000) == 126);
+    }
+    SECTION("Folded stacks")
+    {
+        std::ostringstream folded;
+        profiler.WriteFolded(folded);
+        CHECK(folded.str() == "Main 44\nMain;Outer 54\nMain;Outer;sub_2020 28\n");
+    }
+    SECTION("Interrupts push a frame")
+    {
+        e.interrupt_enable = true;
+        e.InterruptProfiled(1, profiler);
+        CHECK(profiler.Depth() == 1);
+        CHECK(profiler.Calls(0x0008) == 1);
+    }
+}
@@ -0,0 +1,123 @@
+#include <catch2/catch_all.hpp>
+#include <atomic>
+#include <thread>
+#include "emulator/emulator.hpp"
+#include "emulator/engine.hpp"
+#include "emulator/seqlock.hpp"
+
+// Value that shows a torn read: all of its words are written together
+struct Stamp
+{
+    uint64_t word[6];
+    uint8_t tail;
+};
+
+static Stamp MakeStamp(uint64_t n)
+{
+    Stamp stamp;
+    for (int i = 0; i < 6; i++)
+    {
+        stamp.word[i] = n;
+    }
+    stamp.tail = static_cast<uint8_t>(n);
+    return stamp;
+}
+
+TEST_CASE("Seqlock hands over the last value written", "[seqlock]")
+{
+    Seqlock<Stamp> lock;
+    Stamp stamp;
+    REQUIRE(lock.TryRead(&stamp));
+    CHECK(stamp.word[5] == 0);
+    CHECK(lock.Writes() == 0);
+
+    lock.Write(MakeStamp(7));
+    lock.Write(MakeStamp(9));
+    CHECK(lock.Writes() == 2);
+    CHECK(lock.Read().word[0] == 9);
+    CHECK(lock.Read().tail == 9);
+}
+
+TEST_CASE("Seqlock readers never see a torn value", "[seqlock]")
+{
+    Seqlock<Stamp> lock;
+    std::atomic<bool> done(false);
+    const uint64_t writes = 200000;
+    std::thread writer([&]() {
+        for (uint64_t n = 1; n <= writes; n++)
+        {
+            lock.Write(MakeStamp(n));
+            if (n % 1000 == 0)
+            {
+                std::this_thread::yield(); // let the reader in on one core
+            }
+        }
+        done = true;
+    });
+
+    uint64_t last = 0;
+    uint64_t reads = 0;
+    bool torn = false;
+    bool backwards = false;
+    do
+    {
+        Stamp stamp = lock.Read();
+        for (int i = 1; i < 6; i++)
+        {
+            torn = torn || stamp.word[i] != stamp.word[0];
+        }
+        torn = torn || stamp.tail != static_cast<uint8_t>(stamp.word[0]);
+        backwards = backwards || stamp.word[0] < last;
+        last = stamp.word[0];
+        reads++;
+    } while (!done);
+    writer.join();
+    CHECK(!torn);
+    CHECK(!backwards);
+    CHECK(reads > 0);
+    CHECK(lock.Read().word[3] == writes);
+}
+
+TEST_CASE("Emulator publishes its state for other threads", "[seqlock]")
+{
+    Emulator e;
+    PublishedState start = e.ReadPublishedState();
+    CHECK(start.pc == 0);
+    CHECK(start.cycles == 0);
+
+    std::atomic<bool> done(false);
+    std::thread emulation([&]() {
+        for (int frame = 0; frame < 600; frame++)
+        {
+            EngineRegistry::RunFrame(&e, EngineRegistry::Find("interpreter")->run);
+        }
+        done = true;
+    });
+
+    // a monitor polling while the game boots sees time only move forward,
+    // one published block after another
+    uint64_t last_cycles = 0;
+    bool backwards = false;
+    while (!done)
+    {
+        PublishedState state = e.ReadPublishedState();
+        backwards = backwards || state.cycles < last_cycles;
+        last_cycles = state.cycles;
+        std::this_thread::yield();
+    }
+    emulation.join();
+    CHECK(!backwards);
+    CHECK(e.PublishCount() >= 1200);
+
+    // the frame's last interrupt came after the last block was published
+    PublishedState end = e.ReadPublishedState();
+    CHECK(end.cycles == e.GetCycles());
+    e.PublishState();
+    end = e.ReadPublishedState();
+    CHECK(end.pc == e.GetPC());
+    CHECK(end.sp == e.GetSP());
+    CHECK(end.registers.A == e.GetRegisters().A);
+    CHECK(end.registers.H == e.GetRegisters().H);
+    CHECK(end.flags.z == e.GetFlags().z);
+    CHECK(end.ports.port2 == e.GetPorts().port2);
+}
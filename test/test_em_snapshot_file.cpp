@@ -0,0 +1,197 @@
+#include <catch2/catch_all.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "emulator/divergence.hpp"
+#include "emulator/emulator.hpp"
+#include "emulator/engine.hpp"
+#include "emulator/snapshot_file.hpp"
+
+static const char kPath[] = "test_em_snapshot_file.snap";
+
+// Boot the game far enough that every part of the state is in use
+static void Boot(Emulator *e, int frames)
+{
+    const Engine *interpreter = EngineRegistry::Find("interpreter");
+    for (int frame = 0; frame < frames; frame++)
+    {
+        EngineRegistry::RunFrame(e, interpreter->run);
+    }
+}
+
+static std::vector<char> ReadFile(const std::string &path)
+{
+    std::ifstream file(path, std::ios::binary);
+    return std::vector<char>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+static void WriteFile(const std::string &path, const std::vector<char> &contents)
+{
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file.write(contents.data(), contents.size());
+}
+
+TEST_CASE("Snapshot files restore the whole machine", "[snapshot_file]")
+{
+    Emulator e;
+    Boot(&e, 200);
+    Registers registers;
+    registers.A = 0x12;
+    registers.B = 0x34;
+    registers.L = 0xfe;
+    e.SetRegisters(registers);
+    Flags flags;
+    flags.s = true;
+    flags.ac = true;
+    flags.cy = true;
+    e.SetFlags(flags);
+    REQUIRE(SnapshotFile::Write(kPath, e));
+
+    Emulator restored;
+    SnapshotFile file;
+    REQUIRE(file.Open(kPath));
+    CHECK(file.Header().version == SnapshotFile::kVersion);
+    CHECK(file.Header().memory_offset % SnapshotFile::kMemoryAlignment == 0);
+    CHECK(file.Header().cycles == e.GetCycles());
+    REQUIRE(file.Restore(&restored));
+    CHECK(DivergenceFinder::SameState(e, restored));
+    CHECK(restored.GetRegisters().L == 0xfe);
+    CHECK(restored.GetFlags().ac);
+    CHECK(!restored.GetFlags().z);
+
+    // both carry on the same way
+    Boot(&e, 100);
+    Boot(&restored, 100);
+    CHECK(DivergenceFinder::SameState(e, restored));
+    file.Close();
+    remove(kPath);
+}
+
+TEST_CASE("Snapshot files that cannot be trusted are refused", "[snapshot_file]")
+{
+    Emulator e;
+    Boot(&e, 10);
+    REQUIRE(SnapshotFile::Write(kPath, e));
+    std::vector<char> good = ReadFile(kPath);
+    SnapshotFile file;
+
+    SECTION("missing")
+    {
+        remove(kPath);
+        CHECK(!file.Open(kPath));
+    }
+    SECTION("wrong magic")
+    {
+        std::vector<char> bad = good;
+        bad[0] = 'Z';
+        WriteFile(kPath, bad);
+        CHECK(!file.Open(kPath));
+        CHECK(file.Error().find("not a snapshot") != std::string::npos);
+    }
+    SECTION("newer version")
+    {
+        std::vector<char> bad = good;
+        bad[8]++;
+        WriteFile(kPath, bad);
+        CHECK(!file.Open(kPath));
+        CHECK(file.Error().find("version") != std::string::npos);
+    }
+    SECTION("truncated")
+    {
+        std::vector<char> bad(good.begin(), good.end() - 1);
+        WriteFile(kPath, bad);
+        CHECK(!file.Open(kPath));
+        bad.resize(20);
+        WriteFile(kPath, bad);
+        CHECK(!file.Open(kPath));
+    }
+    SECTION("memory changed")
+    {
+        std::vector<char> bad = good;
+        bad[bad.size() - 100] ^= 1;
+        WriteFile(kPath, bad);
+        CHECK(!file.Open(kPath));
+        CHECK(file.Error().find("hash") != std::string::npos);
+    }
+    CHECK(!file.Restore(&e));
+    remove(kPath);
+}
+
+TEST_CASE("Snapshot files are replaced whole", "[snapshot_file]")
+{
+    Emulator e;
+    REQUIRE(SnapshotFile::Write(kPath, e));
+    Boot(&e, 50);
+    REQUIRE(SnapshotFile::Write(kPath, e));
+    CHECK(!std::ifstream(std::string(kPath) + ".tmp").good());
+
+    Emulator restored;
+    SnapshotFile file;
+    REQUIRE(file.Open(kPath));
+    REQUIRE(file.Restore(&restored));
+    CHECK(DivergenceFinder::SameState(e, restored));
+
+    std::string error;
+    CHECK(!SnapshotFile::Write("no_such_directory/x.snap", e, &error));
+    CHECK(!error.empty());
+    file.Close();
+    remove(kPath);
+}
+
+TEST_CASE("Snapshot files resume the game in under a millisecond", "[snapshot_file]")
+{
+    Emulator e;
+    Boot(&e, 600);
+    REQUIRE(SnapshotFile::Write(kPath, e));
+
+    // best of a few, the first may wait on the disk
+    double best = 1;
+    for (int attempt = 0; attempt < 5; attempt++)
+    {
+        Emulator restored;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        SnapshotFile file;
+        REQUIRE(file.Open(kPath));
+        REQUIRE(file.Restore(&restored));
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        best = std::min(best, elapsed.count());
+        CHECK(DivergenceFinder::SameState(e, restored));
+    }
+    CHECK(best < 0.001);
+    remove(kPath);
+}
+
+TEST_CASE("Checkpoints are written in the background", "[snapshot_file]")
+{
+    Emulator e;
+    CheckpointWriter checkpoint;
+    checkpoint.Start(kPath);
+    Boot(&e, 20);
+    CHECK(checkpoint.Submit(e));
+
+    // a second checkpoint offered before the writer has taken the first is
+    // skipped rather than waited for
+    bool skipped = !checkpoint.Submit(e);
+    CHECK(checkpoint.Skipped() == (skipped ? 1u : 0u));
+    checkpoint.Stop();
+    CHECK(checkpoint.Written() == (skipped ? 1u : 2u));
+    CHECK(checkpoint.Failures() == 0);
+
+    Emulator restored;
+    SnapshotFile file;
+    REQUIRE(file.Open(kPath));
+    REQUIRE(file.Restore(&restored));
+    CHECK(DivergenceFinder::SameState(e, restored));
+    file.Close();
+
+    CheckpointWriter unwritable;
+    unwritable.Start("no_such_directory/x.snap");
+    CHECK(unwritable.Submit(e));
+    unwritable.Stop();
+    CHECK(unwritable.Written() == 0);
+    CHECK(unwritable.Failures() == 1);
+    remove(kPath);
+}
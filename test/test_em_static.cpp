@@ -0,0 +1,220 @@
+#include <catch2/catch_all.hpp>
+#include <algorithm>
+#include <random>
+#include <sstream>
+#include "disassembler/control_flow.hpp"
+#include "emulator/divergence.hpp"
+#include "emulator/emulator.hpp"
+#include "emulator/engine.hpp"
+#include "emulator/golden.hpp"
+#include "emulator/movie.hpp"
+#include "emulator/recompiler.hpp"
+#include "static_invaders/static_invaders.hpp"
+
+#ifndef EM_SOURCE_DIR
+#define EM_SOURCE_DIR "."
+#endif
+
+// Input for a frame of a game that starts with a coin and keeps moving and
+// firing
+static void Play(Emulator *e, int frame)
+{
+    e->SetPort(1, 0, frame > 100 && frame < 110);
+    e->SetPort(1, 2, frame > 200 && frame < 210);
+    e->SetPort(1, 4, frame % 40 < 5);
+    e->SetPort(1, 5, frame % 300 < 150);
+    e->SetPort(1, 6, frame % 300 >= 150);
+}
+
+TEST_CASE("Blocks end at control transfers and before what is left to the interpreter", "[static]")
+{
+    const uint8_t rom[] = {
+        0x3e, 0x01,       // 0000 MVI A,01
+        0xcd, 0x08, 0x00, // 0002 CALL 0008
+        0x76,             // 0005 HLT
+        0x00,             // 0006 NOP
+        0x00,             // 0007 NOP
+        0x3c,             // 0008 INR A
+        0x08,             // 0009 undocumented
+        0xc9,             // 000a RET
+        0x77,             // 000b MOV M,A, only reached from -entry
+        0xc9,             // 000c RET
+    };
+    Recompiler recompiler;
+    recompiler.Analyze(rom, sizeof(rom));
+    const std::vector<RecompiledBlock> &blocks = recompiler.Blocks();
+    REQUIRE(blocks.size() == 3);
+    CHECK(blocks[0].start == 0x0000);
+    CHECK(blocks[0].end == 0x0005);
+    CHECK(blocks[0].last == 0x0002);
+    CHECK(blocks[0].cycles_before == 7);
+    CHECK(blocks[1].start == 0x0006);
+    CHECK(blocks[1].end == 0x0008);
+    CHECK(blocks[2].start == 0x0008);
+    CHECK(blocks[2].end == 0x0009);
+    CHECK(recompiler.CodeBytes() == 8);
+
+    std::vector<uint16_t> entries = ControlFlowGraph::DefaultEntryPoints();
+    entries.push_back(0x000b);
+    recompiler.Analyze(rom, sizeof(rom), entries);
+    REQUIRE(recompiler.Blocks().size() == 4);
+    CHECK(recompiler.Blocks()[3].start == 0x000b);
+
+    std::ostringstream source;
+    recompiler.Write(source, "Example", "example.hpp");
+    CHECK(source.str().find("#include \"example.hpp\"") != std::string::npos);
+    CHECK(source.str().find("void Example::Dispatch(StaticCpu &c)") != std::string::npos);
+    CHECK(source.str().find("inline void Block000b(StaticCpu &c)") != std::string::npos);
+    CHECK(source.str().find("case 0x0005:") == std::string::npos);
+}
+
+TEST_CASE("The game object handlers are read from the ROM's records", "[static]")
+{
+    Emulator e;
+    REQUIRE(e.LoadRom(EM_SOURCE_DIR "/space_invaders_rom/invaders") == 0x2000);
+    const uint8_t *rom = e.GetMemory();
+    std::vector<uint16_t> entries;
+    REQUIRE(ControlFlowGraph::TableEntryPoints(rom, 0x2000, 0x0000, 0x1b13, 5, 16, &entries));
+    REQUIRE(ControlFlowGraph::TableEntryPoints(rom, 0x2000, 0x0000, 0x1bc3, 1, 16, &entries));
+    CHECK(entries == std::vector<uint16_t>({0x028e, 0x03bb, 0x0476, 0x04b6, 0x0682, 0x050e}));
+    for (uint16_t entry : entries)
+    {
+        CHECK(std::find(StaticInvaders::kBlockStarts, StaticInvaders::kBlockStarts + StaticInvaders::kBlockCount,
+                        entry) != StaticInvaders::kBlockStarts + StaticInvaders::kBlockCount);
+    }
+
+    // a record out of step reads an address outside the ROM
+    CHECK_FALSE(ControlFlowGraph::TableEntryPoints(rom, 0x2000, 0x0000, 0x1b10, 1, 16, &entries));
+    CHECK_FALSE(ControlFlowGraph::TableEntryPoints(rom, 0x2000, 0x0000, 0x1fff, 1, 16, &entries));
+}
+
+TEST_CASE("The recompiler counts the interpreter's cycles", "[static]")
+{
+    for (int opcode = 0; opcode < 0x100; opcode++)
+    {
+        if (!Recompiler::Translates(static_cast<uint8_t>(opcode)))
+        {
+            continue;
+        }
+        INFO("opcode " << opcode);
+        Emulator e;
+        e.SetMemory(0x2000, static_cast<uint8_t>(opcode));
+        e.SetMemory(0x2001, 0x00);
+        e.SetMemory(0x2002, 0x21);
+        e.SetPC(0x2000);
+        e.SetSP(0x2400);
+
+        // conditions with an even number test for a flag being clear, so
+        // set every flag for those and clear them for the others, so that
+        // conditional calls and returns are not taken
+        bool set = (opcode & 0x08) == 0;
+        Flags flags;
+        flags.z = set;
+        flags.s = set;
+        flags.p = set;
+        flags.cy = set;
+        flags.ac = set;
+        e.SetFlags(flags);
+        uint64_t start = e.GetCycles();
+        e.Emulate(1);
+        CHECK(e.GetCycles() - start == static_cast<uint64_t>(Recompiler::Cycles(static_cast<uint8_t>(opcode))));
+    }
+}
+
+TEST_CASE("Recompiled code stops where the interpreter would", "[static]")
+{
+    StaticInvaders::Register();
+    Emulator executed;
+    Emulator recompiled;
+    std::mt19937 random(467);
+    for (int frame = 0; frame < 2000; frame++)
+    {
+        Play(&executed, frame);
+        Play(&recompiled, frame);
+        for (int half = 1; half <= 2; half++)
+        {
+            // calls of all sizes, so that some end part way through a block
+            int left = EngineRegistry::kHalfFrameCycles;
+            while (left > 0)
+            {
+                int cycles = std::min(left, 1 + static_cast<int>(random() % 4000));
+                executed.Emulate(cycles);
+                StaticInvaders::Run(&recompiled, cycles);
+                REQUIRE(DivergenceFinder::SameState(executed, recompiled));
+                left -= cycles;
+            }
+            executed.Interrupt(half);
+            recompiled.Interrupt(half);
+        }
+    }
+    CHECK(recompiled.HleCalls() > 1000);
+    CHECK(executed.HleCalls() == 0);
+}
+
+TEST_CASE("The recompiled game matches the golden hashes", "[static]")
+{
+    InputMovie movie;
+    REQUIRE(movie.Load(EM_SOURCE_DIR "/test/data/gameplay.movie"));
+    GoldenFrames golden;
+    REQUIRE(golden.Load(EM_SOURCE_DIR "/test/data/gameplay.golden"));
+    Emulator e;
+    REQUIRE(e.LoadRom(EM_SOURCE_DIR "/space_invaders_rom/invaders") == 0x2000);
+    Snapshot power_on;
+    e.SaveState(&power_on);
+    GoldenMismatch mismatch;
+    CHECK(golden.Check(power_on, StaticInvaders::Run, &movie, &mismatch));
+}
+
+TEST_CASE("Code the recompiler did not see runs on the interpreter", "[static]")
+{
+    Emulator executed;
+    for (int frame = 0; frame < 100; frame++)
+    {
+        EngineRegistry::RunFrame(&executed, EngineRegistry::Find("interpreter")->run);
+    }
+    Snapshot start;
+    executed.SaveState(&start);
+    Emulator recompiled;
+    recompiled.LoadState(start);
+
+    SECTION("a different ROM")
+    {
+        executed.SetMemory(0x1fff, executed.GetMemory()[0x1fff] ^ 0xff);
+        recompiled.SetMemory(0x1fff, recompiled.GetMemory()[0x1fff] ^ 0xff);
+        for (int frame = 0; frame < 100; frame++)
+        {
+            EngineRegistry::RunFrame(&executed, EngineRegistry::Find("interpreter")->run);
+            EngineRegistry::RunFrame(&recompiled, StaticInvaders::Run);
+        }
+        CHECK(DivergenceFinder::SameState(executed, recompiled));
+        CHECK(recompiled.HleCalls() == 0);
+    }
+    SECTION("code in RAM")
+    {
+        // a loop in RAM that counts the times it calls a ROM routine: the
+        // call goes into recompiled code, the rest is interpreted
+        const uint8_t program[] = {
+            0xcd, 0x5c, 0x1a, // 2300 CALL 1a5c, ClearScreen
+            0x3a, 0x00, 0x22, // 2303 LDA 2200
+            0x3c,             // 2306 INR A
+            0x32, 0x00, 0x22, // 2307 STA 2200
+            0xc3, 0x00, 0x23, // 230a JMP 2300
+        };
+        for (int i = 0; i < static_cast<int>(sizeof(program)); i++)
+        {
+            executed.SetMemory(static_cast<uint16_t>(0x2300 + i), program[i]);
+            recompiled.SetMemory(static_cast<uint16_t>(0x2300 + i), program[i]);
+        }
+        executed.SetPC(0x2300);
+        recompiled.SetPC(0x2300);
+        executed.interrupt_enable = false;
+        recompiled.interrupt_enable = false;
+        for (int call = 0; call < 20; call++)
+        {
+            executed.Emulate(EngineRegistry::kHalfFrameCycles);
+            StaticInvaders::Run(&recompiled, EngineRegistry::kHalfFrameCycles);
+            REQUIRE(DivergenceFinder::SameState(executed, recompiled));
+        }
+        CHECK(recompiled.HleCalls() > 0);
+    }
+}
@@ -0,0 +1,102 @@
+#include <catch2/catch_all.hpp>
+#include <cstdio>
+#include <vector>
+#include "emulator/emulator.hpp"
+#include "emulator/trace.hpp"
+
+// Load program into RAM at 0x2000 and jump to it
+static void LoadProgram(Emulator *e, const uint8_t *program, int size)
+{
+    e->AllocateMemory(0x3000);
+    for (int i = 0; i < size; i++)
+    {
+        e->WriteToMem(0x2000 + i, program[i]);
+    }
+    e->EmulateOpcode(0xc3, 0x00, 0x20);
+}
+
+static TraceRecord MakeRecord(uint64_t cycle, uint16_t pc, uint16_t sp, uint8_t opcode,
+                              uint8_t operand1, uint8_t operand2, uint8_t a, uint8_t flags)
+{
+    TraceRecord record = {cycle, pc, sp, opcode, operand1, operand2, a, flags};
+    return record;
+}
+
+static bool SameRecord(const TraceRecord &x, const TraceRecord &y)
+{
+    return x.cycle == y.cycle && x.pc == y.pc && x.sp == y.sp && x.opcode == y.opcode &&
+           x.operand1 == y.operand1 && x.operand2 == y.operand2 && x.a == y.a && x.flags == y.flags;
+}
+
+TEST_CASE("Trace block encoding", "[trace]")
+{
+    std::vector<TraceRecord> records;
+    records.push_back(MakeRecord(0, 0x0000, 0x0000, 0x00, 0, 0, 0x00, 0x00));
+    records.push_back(MakeRecord(4, 0x0001, 0x0000, 0x3e, 0x80, 0, 0x80, 0x00));
+    records.push_back(MakeRecord(11, 0x0003, 0x23fe, 0xcd, 0x00, 0x1a, 0x80, 0x02));
+    records.push_back(MakeRecord(28, 0x1a00, 0x2400, 0xc9, 0, 0, 0x80, 0x0f));
+    records.push_back(MakeRecord(38, 0x0010, 0x23fe, 0xd7, 0, 0, 0x80, 0x02 | kTraceInterrupt));
+    records.push_back(MakeRecord(0x123456789ull, 0xffff, 0x0001, 0xc3, 0xff, 0xff, 0xff, 0x1f));
+
+    std::vector<uint8_t> encoded;
+    TraceRecorder::EncodeBlock(records.data(), records.size(), &encoded);
+    REQUIRE(encoded.size() > 8);
+
+    std::vector<TraceRecord> decoded;
+    REQUIRE(TraceRecorder::DecodeBlock(&encoded[8], encoded.size() - 8, records.size(), &decoded));
+    REQUIRE(decoded.size() == records.size());
+    for (size_t i = 0; i < records.size(); i++)
+    {
+        CHECK(SameRecord(decoded[i], records[i]));
+    }
+
+    SECTION("Unused operands are not stored")
+    {
+        records[0].operand1 = 0x55;
+        records[0].operand2 = 0x66;
+        std::vector<uint8_t> reencoded;
+        TraceRecorder::EncodeBlock(records.data(), records.size(), &reencoded);
+        CHECK(reencoded == encoded);
+    }
+    SECTION("Truncated block")
+    {
+        CHECK_FALSE(TraceRecorder::DecodeBlock(&encoded[8], encoded.size() - 9, records.size(), &decoded));
+    }
+}
+
+TEST_CASE("Trace recorder", "[trace]")
+{
+    // 2000 MVI B,03
+    // 2002 DCR B
+    // 2003 JNZ 2002
+    // 2006 JMP 2006
+    const uint8_t program[] = {0x06, 0x03, 0x05, 0xc2, 0x02, 0x20, 0xc3, 0x06, 0x20};
+    const char *path = "em_trace_test.trc";
+    Emulator e;
+    LoadProgram(&e, program, sizeof(program));
+    uint64_t start = e.GetCycles();
+
+    TraceRecorder *recorder = new TraceRecorder();
+    REQUIRE(recorder->Open(path, 4));
+    e.EmulateProfiled(7 + 3 * (5 + 10) + 2 * 10, *recorder);
+    recorder->Close();
+    CHECK(recorder->RecordsWritten() == 9);
+    delete recorder;
+
+    TraceReader reader;
+    REQUIRE(reader.Open(path));
+    const uint16_t pcs[] = {0x2000, 0x2002, 0x2003, 0x2002, 0x2003, 0x2002, 0x2003, 0x2006, 0x2006};
+    const uint8_t opcodes[] = {0x06, 0x05, 0xc2, 0x05, 0xc2, 0x05, 0xc2, 0xc3, 0xc3};
+    uint64_t cycle = start;
+    TraceRecord record;
+    for (int i = 0; i < 9; i++)
+    {
+        REQUIRE(reader.Next(&record));
+        CHECK(record.pc == pcs[i]);
+        CHECK(record.opcode == opcodes[i]);
+        CHECK(record.cycle == cycle);
+        cycle += opcodes[i] == 0x06 ? 7 : opcodes[i] == 0x05 ? 5 : 10;
+    }
+    CHECK_FALSE(reader.Next(&record));
+    std::remove(path);
+}
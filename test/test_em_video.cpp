@@ -0,0 +1,61 @@
+#include <catch2/catch_all.hpp>
+#include <vector>
+#include "emulator/video.hpp"
+
+// Pixel at x, y as SDL::DrawGraphic used to draw it point by point
+static uint32_t ReferencePixel(const uint8_t *vram, int x, int y)
+{
+    int v = x;
+    int h = 256 - 1 - y;
+    bool lit = (vram[0x20 * v + (h >> 3)] & (1 << (h % 8))) != 0;
+    if (!lit)
+    {
+        return Video::kBlack;
+    }
+    if (h < 64 && (h >= 16 || (v >= 16 && v < 128)))
+    {
+        return Video::kGreen;
+    }
+    if (h >= 192 && h < 224)
+    {
+        return Video::kRed;
+    }
+    return Video::kWhite;
+}
+
+TEST_CASE("VRAM conversion", "[video]")
+{
+    std::vector<uint8_t> vram(Video::kVramSize);
+    uint32_t seed = 12345;
+    for (size_t i = 0; i < vram.size(); i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        vram[i] = static_cast<uint8_t>(seed >> 16);
+    }
+
+    std::vector<uint32_t> pixels(Video::kWidth * Video::kHeight);
+    Video::ConvertVram(vram.data(), pixels.data());
+
+    int mismatches = 0;
+    for (int y = 0; y < Video::kHeight; y++)
+    {
+        for (int x = 0; x < Video::kWidth; x++)
+        {
+            mismatches += pixels[y * Video::kWidth + x] != ReferencePixel(vram.data(), x, y);
+        }
+    }
+    CHECK(mismatches == 0);
+
+    SECTION("Rotation")
+    {
+        std::vector<uint8_t> blank(Video::kVramSize, 0);
+        // first bit of line 0 is the bottom left corner
+        blank[0] = 0x01;
+        // last bit of the last line is the top right corner
+        blank[Video::kVramSize - 1] = 0x80;
+        Video::ConvertVram(blank.data(), pixels.data());
+        CHECK(pixels[(Video::kHeight - 1) * Video::kWidth] == Video::kWhite);
+        CHECK(pixels[Video::kWidth - 1] == Video::kWhite);
+        CHECK(pixels[0] == Video::kBlack);
+    }
+}
@@ -0,0 +1,93 @@
+#include <catch2/catch_all.hpp>
+#include <vector>
+#include "emulator/emulator.hpp"
+
+static void Record(void *context, const WatchEvent &event)
+{
+    static_cast<std::vector<WatchEvent> *>(context)->push_back(event);
+}
+
+// Put code at the start of RAM and point pc at it
+static void LoadCode(Emulator *e, const std::vector<uint8_t> &code)
+{
+    for (size_t i = 0; i < code.size(); i++)
+    {
+        e->SetMemory(static_cast<uint16_t>(0x2000 + i), code[i]);
+    }
+    e->SetPC(0x2000);
+    e->SetSP(0x2400);
+}
+
+TEST_CASE("Watches report accesses to their range", "[watch]")
+{
+    Emulator e;
+    std::vector<WatchEvent> events;
+    // MVI A,42; STA 2101; STA 2102; LDA 2101; SHLD 2100
+    LoadCode(&e, {0x3e, 0x42, 0x32, 0x01, 0x21, 0x32, 0x02, 0x21, 0x3a, 0x01, 0x21, 0x22, 0x00, 0x21});
+
+    SECTION("writes")
+    {
+        e.AddWatch(0x2101, 1, kWatchWrite, Record, &events);
+        e.Emulate(7 + 13 + 13 + 13 + 16);
+        REQUIRE(events.size() == 2);
+        CHECK(events[0].pc == 0x2002);
+        CHECK(events[0].address == 0x2101);
+        CHECK(events[0].value == 0x42);
+        CHECK(events[0].write);
+        CHECK(events[0].cycle == 7);
+        CHECK(events[1].pc == 0x200b);
+        CHECK(events[1].address == 0x2101);
+        CHECK(events[1].cycle == 7 + 13 + 13 + 13);
+    }
+    SECTION("reads")
+    {
+        e.AddWatch(0x2100, 2, kWatchRead, Record, &events);
+        e.Emulate(7 + 13 + 13 + 13 + 16);
+        REQUIRE(events.size() == 1);
+        CHECK(events[0].pc == 0x2008);
+        CHECK(events[0].value == 0x42);
+        CHECK(!events[0].write);
+    }
+    SECTION("removed")
+    {
+        int id = e.AddWatch(0x2101, 1, kWatchRead | kWatchWrite, Record, &events);
+        std::vector<WatchEvent> other;
+        e.AddWatch(0x2102, 1, kWatchWrite, Record, &other);
+        e.RemoveWatch(id);
+        e.Emulate(7 + 13 + 13 + 13 + 16);
+        CHECK(events.empty());
+        CHECK(other.size() == 1);
+    }
+}
+
+TEST_CASE("Watches see the stack and writes outside RAM", "[watch]")
+{
+    Emulator e;
+    std::vector<WatchEvent> events;
+    // PUSH PSW; CALL 2010; ... RET
+    LoadCode(&e, {0xf5, 0xcd, 0x10, 0x20});
+    e.SetMemory(0x2010, 0xc9);
+    e.AddWatch(0x23fc, 4, kWatchRead | kWatchWrite, Record, &events);
+    e.AddWatch(0x0000, 0x2000, kWatchWrite, Record, &events);
+    e.Emulate(11 + 17 + 10);
+
+    REQUIRE(events.size() == 6);
+    CHECK(events[0].address == 0x23ff);
+    CHECK(events[2].address == 0x23fd);
+    CHECK(events[2].value == 0x20);
+    CHECK(events[3].value == 0x04);
+    CHECK(events[4].pc == 0x2010);
+    CHECK(!events[4].write);
+    CHECK(e.GetPC() == 0x2004);
+
+    // a write to ROM is reported before it is refused
+    events.clear();
+    e.SetMemory(0x2004, 0x32); // STA 0100
+    e.SetMemory(0x2005, 0x00);
+    e.SetMemory(0x2006, 0x01);
+    uint8_t rom = e.GetMemory()[0x0100];
+    e.Emulate(13);
+    REQUIRE(events.size() == 1);
+    CHECK(events[0].address == 0x0100);
+    CHECK(e.GetMemory()[0x0100] == rom);
+}
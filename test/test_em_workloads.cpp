@@ -0,0 +1,113 @@
+#include <catch2/catch_all.hpp>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "emulator/cpm.hpp"
+#include "emulator/engine.hpp"
+#include "emulator/workloads.hpp"
+#include "static_invaders/static_invaders.hpp"
+
+// What each workload leaves behind, computed the obvious way in C++
+static std::vector<uint8_t> ReferenceResult(const std::string &name)
+{
+    std::vector<uint8_t> result;
+    if (name == "memcpy")
+    {
+        for (int i = 0; i < 0x1000; i++)
+        {
+            result.push_back(static_cast<uint8_t>(3 + 7 * i));
+        }
+    }
+    else if (name == "bubble_sort")
+    {
+        uint8_t x = 1;
+        for (int i = 0; i < 0x100; i++)
+        {
+            result.push_back(x);
+            x = static_cast<uint8_t>(5 * x + 17);
+        }
+        std::sort(result.begin(), result.end());
+    }
+    else if (name == "crc16")
+    {
+        uint16_t crc = 0xffff;
+        uint8_t x = 1;
+        for (int i = 0; i < 0x1000; i++)
+        {
+            crc ^= x << 8;
+            for (int bit = 0; bit < 8; bit++)
+            {
+                crc = static_cast<uint16_t>(crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1);
+            }
+            x = static_cast<uint8_t>(5 * x + 17);
+        }
+        result.push_back(crc & 0xff);
+        result.push_back(crc >> 8);
+    }
+    else if (name == "bcd_counter")
+    {
+        // 00050000, lowest two digits first
+        result.push_back(0x00);
+        result.push_back(0x00);
+        result.push_back(0x05);
+        result.push_back(0x00);
+    }
+    else if (name == "multiply")
+    {
+        uint16_t sum = 0;
+        for (uint32_t i = 1; i <= 6000; i++)
+        {
+            sum = static_cast<uint16_t>(sum + i * 12345);
+        }
+        result.push_back(sum & 0xff);
+        result.push_back(sum >> 8);
+    }
+    else if (name == "fibonacci")
+    {
+        uint16_t a = 0;
+        uint16_t b = 1;
+        for (int i = 0; i < 24; i++)
+        {
+            uint16_t next = static_cast<uint16_t>(a + b);
+            a = b;
+            b = next;
+        }
+        result.push_back(a & 0xff);
+        result.push_back(a >> 8);
+    }
+    return result;
+}
+
+TEST_CASE("Workload checksums match the reference", "[workloads]")
+{
+    const std::vector<Workload> &workloads = Workloads::All();
+    REQUIRE(workloads.size() == 6);
+    for (size_t i = 0; i < workloads.size(); i++)
+    {
+        INFO("workload " << workloads[i].name);
+        std::vector<uint8_t> expected = ReferenceResult(workloads[i].name);
+        REQUIRE(expected.size() == workloads[i].result_size);
+        CHECK(Workloads::Checksum(expected.data(), static_cast<int>(expected.size())) == workloads[i].checksum);
+    }
+    CHECK(Workloads::Find("crc16") == &workloads[2]);
+    CHECK(Workloads::Find("missing") == nullptr);
+}
+
+TEST_CASE("Workloads run correctly on every engine", "[workloads]")
+{
+    StaticInvaders::Register();
+    std::vector<std::string> names = EngineRegistry::Names();
+    const std::vector<Workload> &workloads = Workloads::All();
+    for (size_t w = 0; w < workloads.size(); w++)
+    {
+        CpmMachine machine;
+        machine.LoadProgram(workloads[w].image.data(), static_cast<int>(workloads[w].image.size()));
+        for (size_t i = 0; i < names.size(); i++)
+        {
+            INFO("workload " << workloads[w].name << " on " << names[i]);
+            CpmRun run = machine.Run(EngineRegistry::Find(names[i])->run, 100000000);
+            CHECK(run.finished);
+            CHECK(Workloads::Verify(workloads[w], run));
+        }
+    }
+}
@@ -0,0 +1,92 @@
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "emulator/alu_sweep.hpp"
+#include "emulator/engine.hpp"
+#include "static_invaders/static_invaders.hpp"
+
+using namespace std;
+
+// Check every ALU opcode on every engine against the reference model for
+// all values of A, the operand, CY and AC; exits with 2 on any mismatch
+// usage: AluSweep [-engine name] [-threads n] [-opcode 0xnn] [-examples n]
+int main(int argc, char **argv)
+{
+    StaticInvaders::Register();
+
+    vector<string> engine_names;
+    vector<uint8_t> opcodes;
+    int threads = 0;
+    int examples = 20;
+
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "-engine" && has_value)
+        {
+            engine_names.push_back(argv[++i]);
+        }
+        else if (arg == "-threads" && has_value)
+        {
+            threads = atoi(argv[++i]);
+        }
+        else if (arg == "-opcode" && has_value)
+        {
+            long opcode = strtol(argv[++i], nullptr, 0);
+            if (opcode < 0 || opcode > 0xff || !AluReference::IsAluOpcode(static_cast<uint8_t>(opcode)))
+            {
+                cout << argv[i] << " is not an ALU opcode" << endl;
+                return 1;
+            }
+            opcodes.push_back(static_cast<uint8_t>(opcode));
+        }
+        else if (arg == "-examples" && has_value)
+        {
+            examples = atoi(argv[++i]);
+        }
+        else
+        {
+            cout << "usage: " << argv[0] << " [-engine name] [-threads n] [-opcode 0xnn] [-examples n]" << endl
+                 << "engines:";
+            vector<string> names = EngineRegistry::Names();
+            for (size_t n = 0; n < names.size(); n++)
+            {
+                cout << ' ' << names[n];
+            }
+            cout << endl;
+            return 1;
+        }
+    }
+    if (engine_names.empty())
+    {
+        engine_names = EngineRegistry::Names();
+    }
+
+    bool failed = false;
+    for (size_t n = 0; n < engine_names.size(); n++)
+    {
+        const Engine *engine = EngineRegistry::Find(engine_names[n]);
+        if (engine == nullptr)
+        {
+            cout << "Unknown engine " << engine_names[n] << endl;
+            return 1;
+        }
+
+        AluSweep sweep(*engine);
+        if (threads > 0)
+        {
+            sweep.SetThreads(threads);
+        }
+        if (!opcodes.empty())
+        {
+            sweep.SetOpcodes(opcodes);
+        }
+        AluSweepReport report = sweep.Run();
+        cout << engine->name << ": ";
+        AluSweep::Print(cout, report, examples);
+        failed = failed || report.mismatches > 0;
+    }
+    return failed ? 2 : 0;
+}
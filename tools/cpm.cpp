@@ -0,0 +1,121 @@
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "emulator/cpm.hpp"
+#include "emulator/engine.hpp"
+#include "emulator/workloads.hpp"
+#include "static_invaders/static_invaders.hpp"
+
+using namespace std;
+
+// Run CP/M .COM programs such as the 8080 exercisers on every engine,
+// checking their output and reporting the speed of each engine; -workloads
+// adds the bundled benchmark programs, which are checked by their results
+// usage: Cpm [-engine name] [-max-cycles n] [-quiet] [-workloads] program.com...
+int main(int argc, char **argv)
+{
+    StaticInvaders::Register();
+
+    vector<string> engine_names;
+    vector<string> programs;
+    uint64_t max_cycles = 100000000000ull;
+    bool quiet = false;
+    bool workloads = false;
+
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "-engine" && has_value)
+        {
+            engine_names.push_back(argv[++i]);
+        }
+        else if (arg == "-max-cycles" && has_value)
+        {
+            max_cycles = strtoull(argv[++i], nullptr, 0);
+        }
+        else if (arg == "-quiet")
+        {
+            quiet = true;
+        }
+        else if (arg == "-workloads")
+        {
+            workloads = true;
+        }
+        else if (arg[0] != '-')
+        {
+            programs.push_back(arg);
+        }
+        else
+        {
+            programs.clear();
+            break;
+        }
+    }
+    if (workloads)
+    {
+        for (size_t w = 0; w < Workloads::All().size(); w++)
+        {
+            programs.push_back(Workloads::All()[w].name);
+        }
+    }
+    if (programs.empty())
+    {
+        cout << "usage: " << argv[0] << " [-engine name] [-max-cycles n] [-quiet] [-workloads] program.com..."
+             << endl;
+        return 1;
+    }
+    if (engine_names.empty())
+    {
+        engine_names = EngineRegistry::Names();
+    }
+
+    int failures = 0;
+    for (size_t p = 0; p < programs.size(); p++)
+    {
+        CpmMachine machine;
+        const Workload *workload = workloads ? Workloads::Find(programs[p]) : nullptr;
+        if (workload != nullptr)
+        {
+            machine.LoadProgram(workload->image.data(), static_cast<int>(workload->image.size()));
+        }
+        else if (!machine.Load(programs[p]))
+        {
+            cout << "Unable to load " << programs[p] << endl;
+            return 1;
+        }
+
+        // the instruction count, and the output every engine must match
+        CpmRun reference = machine.Count(max_cycles);
+        cout << programs[p] << ": " << reference.instructions << " instructions, " << reference.cycles
+             << " cycles" << (reference.finished ? "" : " (cycle limit reached)") << endl;
+        if (!quiet)
+        {
+            cout << reference.output << endl;
+        }
+        bool passed = workload != nullptr ? Workloads::Verify(*workload, reference) : CpmMachine::Passed(reference);
+
+        for (size_t n = 0; n < engine_names.size(); n++)
+        {
+            const Engine *engine = EngineRegistry::Find(engine_names[n]);
+            if (engine == nullptr)
+            {
+                cout << "Unknown engine " << engine_names[n] << endl;
+                return 1;
+            }
+            CpmRun run = machine.Run(engine->run, max_cycles);
+            bool same = run.output == reference.output && run.cycles == reference.cycles &&
+                        (workload == nullptr || Workloads::Verify(*workload, run));
+            cout << "  " << left << setw(16) << engine->name << right << fixed << setprecision(3)
+                 << setw(10) << run.seconds << " s" << setw(10) << run.cycles / run.seconds / 1e6 << " MHz"
+                 << setw(10) << reference.instructions / run.seconds / 1e6 << " MIPS"
+                 << (same ? "" : "  output differs from the interpreter") << endl;
+            passed = passed && same;
+        }
+        cout << (passed ? "PASSED" : "FAILED") << endl;
+        failures += !passed;
+    }
+    return failures > 0 ? 2 : 0;
+}
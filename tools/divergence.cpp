@@ -0,0 +1,115 @@
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "emulator/divergence.hpp"
+#include "emulator/engine.hpp"
+#include "emulator/movie.hpp"
+#include "static_invaders/static_invaders.hpp"
+
+using namespace std;
+
+// Find the first instruction where two engines disagree
+// usage: Divergence [-reference engine] [-candidate engine] [-frames n]
+//                   [-start n] [-interval n] [-threads n] [-movie file]
+int main(int argc, char **argv)
+{
+    StaticInvaders::Register();
+
+    string reference_name = "interpreter";
+    string candidate_name = "profiled";
+    uint64_t frames = 3600;
+    uint64_t start_frame = 0;
+    int interval = 64;
+    int threads = 0;
+    string movie_path;
+
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "-reference" && has_value)
+        {
+            reference_name = argv[++i];
+        }
+        else if (arg == "-candidate" && has_value)
+        {
+            candidate_name = argv[++i];
+        }
+        else if (arg == "-frames" && has_value)
+        {
+            frames = strtoull(argv[++i], nullptr, 0);
+        }
+        else if (arg == "-start" && has_value)
+        {
+            start_frame = strtoull(argv[++i], nullptr, 0);
+        }
+        else if (arg == "-interval" && has_value)
+        {
+            interval = atoi(argv[++i]);
+        }
+        else if (arg == "-threads" && has_value)
+        {
+            threads = atoi(argv[++i]);
+        }
+        else if (arg == "-movie" && has_value)
+        {
+            movie_path = argv[++i];
+        }
+        else
+        {
+            cout << "usage: " << argv[0] << " [-reference engine] [-candidate engine] [-frames n]"
+                 << " [-start n] [-interval n] [-threads n] [-movie file]" << endl
+                 << "engines:";
+            vector<string> names = EngineRegistry::Names();
+            for (size_t n = 0; n < names.size(); n++)
+            {
+                cout << ' ' << names[n];
+            }
+            cout << endl;
+            return 1;
+        }
+    }
+
+    const Engine *reference = EngineRegistry::Find(reference_name);
+    const Engine *candidate = EngineRegistry::Find(candidate_name);
+    if (reference == nullptr || candidate == nullptr)
+    {
+        cout << "Unknown engine " << (reference == nullptr ? reference_name : candidate_name) << endl;
+        return 1;
+    }
+
+    InputMovie movie;
+    if (!movie_path.empty() && !movie.Load(movie_path))
+    {
+        cout << "Unable to read movie " << movie_path << endl;
+        return 1;
+    }
+
+    // both engines start from the reference's state at start_frame
+    Emulator e;
+    for (uint64_t frame = 0; frame < start_frame; frame++)
+    {
+        movie.Apply(&e, frame);
+        EngineRegistry::RunFrame(&e, reference->run);
+    }
+    Snapshot start;
+    e.SaveState(&start);
+
+    DivergenceFinder finder(*reference, *candidate);
+    finder.SetMovie(&movie);
+    finder.SetCheckpointInterval(interval);
+    if (threads > 0)
+    {
+        finder.SetThreads(threads);
+    }
+
+    chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+    bool diverged = finder.Run(start, start_frame, frames);
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - begin;
+
+    finder.Report(cout);
+    cout << finder.FramesEmulated() << " frames per engine in " << elapsed.count() << " s" << endl;
+    return diverged ? 2 : 0;
+}
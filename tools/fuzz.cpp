@@ -0,0 +1,147 @@
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "emulator/engine.hpp"
+#include "emulator/fuzzer.hpp"
+#include "static_invaders/static_invaders.hpp"
+
+using namespace std;
+
+// Run random programs on every engine and compare the machine states they
+// end in, shrinking any divergence to a small repro; failing seeds can be
+// appended to a seed file with -save and replayed with -seeds
+// usage: Fuzz [-engine name]... [-seconds n] [-threads n] [-cycles n] [-instructions n]
+//             [-seed n] [-seeds file] [-save file] [-failures n]
+int main(int argc, char **argv)
+{
+    StaticInvaders::Register();
+
+    vector<string> engine_names;
+    double seconds = 10;
+    int threads = 0;
+    int cycles = 2000;
+    int instructions = 64;
+    uint64_t first_seed = static_cast<uint64_t>(chrono::system_clock::now().time_since_epoch().count());
+    string seeds_path;
+    string save_path;
+    int failures = 1;
+
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "-engine" && has_value)
+        {
+            engine_names.push_back(argv[++i]);
+        }
+        else if (arg == "-seconds" && has_value)
+        {
+            seconds = atof(argv[++i]);
+        }
+        else if (arg == "-threads" && has_value)
+        {
+            threads = atoi(argv[++i]);
+        }
+        else if (arg == "-cycles" && has_value)
+        {
+            cycles = atoi(argv[++i]);
+        }
+        else if (arg == "-instructions" && has_value)
+        {
+            instructions = atoi(argv[++i]);
+        }
+        else if (arg == "-seed" && has_value)
+        {
+            first_seed = strtoull(argv[++i], nullptr, 0);
+        }
+        else if (arg == "-seeds" && has_value)
+        {
+            seeds_path = argv[++i];
+        }
+        else if (arg == "-save" && has_value)
+        {
+            save_path = argv[++i];
+        }
+        else if (arg == "-failures" && has_value)
+        {
+            failures = atoi(argv[++i]);
+        }
+        else
+        {
+            cout << "usage: " << argv[0] << " [-engine name]... [-seconds n] [-threads n] [-cycles n]"
+                 << " [-instructions n]" << endl
+                 << "       [-seed n] [-seeds file] [-save file] [-failures n]" << endl
+                 << "engines:";
+            vector<string> names = EngineRegistry::Names();
+            for (size_t n = 0; n < names.size(); n++)
+            {
+                cout << ' ' << names[n];
+            }
+            cout << endl;
+            return 1;
+        }
+    }
+    if (engine_names.empty())
+    {
+        engine_names = EngineRegistry::Names();
+    }
+
+    vector<Engine> engines;
+    for (size_t n = 0; n < engine_names.size(); n++)
+    {
+        const Engine *engine = EngineRegistry::Find(engine_names[n]);
+        if (engine == nullptr)
+        {
+            cout << "Unknown engine " << engine_names[n] << endl;
+            return 1;
+        }
+        engines.push_back(*engine);
+    }
+    if (engines.size() < 2)
+    {
+        cout << "Need at least two engines to compare" << endl;
+        return 1;
+    }
+
+    DifferentialFuzzer fuzzer(engines);
+    fuzzer.SetCycles(cycles);
+    fuzzer.SetInstructions(instructions);
+    fuzzer.SetMaxFailures(failures);
+    if (threads > 0)
+    {
+        fuzzer.SetThreads(threads);
+    }
+
+    FuzzStats stats;
+    if (!seeds_path.empty())
+    {
+        vector<uint64_t> seeds;
+        if (!DifferentialFuzzer::LoadSeeds(seeds_path, &seeds))
+        {
+            cout << "Unable to read " << seeds_path << endl;
+            return 1;
+        }
+        stats = fuzzer.RunSeeds(seeds);
+    }
+    else
+    {
+        cout << "seeds from 0x" << hex << setfill('0') << setw(16) << first_seed << dec << setfill(' ') << endl;
+        stats = fuzzer.RunFor(seconds, first_seed);
+    }
+
+    cout << dec << stats.cases << " cases (" << stats.cycles << " cycles) on " << stats.threads << " threads in "
+         << stats.seconds << " s, " << stats.failures.size() << " failing" << endl;
+    for (size_t f = 0; f < stats.failures.size(); f++)
+    {
+        cout << endl;
+        DifferentialFuzzer::Report(cout, stats.failures[f]);
+        if (!save_path.empty() && !DifferentialFuzzer::AppendSeed(save_path, stats.failures[f].original.seed))
+        {
+            cout << "Unable to write " << save_path << endl;
+        }
+    }
+    return stats.failures.empty() ? 0 : 2;
+}
@@ -0,0 +1,154 @@
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "emulator/emulator.hpp"
+#include "emulator/engine.hpp"
+#include "emulator/golden.hpp"
+#include "emulator/movie.hpp"
+#include "static_invaders/static_invaders.hpp"
+
+using namespace std;
+
+// Replay a movie on every engine and compare against golden hashes, or
+// record new ones with -record
+// usage: Golden -golden file [-movie file] [-rom file] [-engine name]
+//               [-record] [-frames n] [-interval n] [-pgm prefix]
+int main(int argc, char **argv)
+{
+    StaticInvaders::Register();
+
+    string golden_path;
+    string movie_path;
+    string rom_path = "./space_invaders_rom/invaders";
+    vector<string> engine_names;
+    bool record = false;
+    uint64_t frames = 3600;
+    uint64_t interval = 60;
+    string pgm_prefix = "golden";
+
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "-golden" && has_value)
+        {
+            golden_path = argv[++i];
+        }
+        else if (arg == "-movie" && has_value)
+        {
+            movie_path = argv[++i];
+        }
+        else if (arg == "-rom" && has_value)
+        {
+            rom_path = argv[++i];
+        }
+        else if (arg == "-engine" && has_value)
+        {
+            engine_names.push_back(argv[++i]);
+        }
+        else if (arg == "-record")
+        {
+            record = true;
+        }
+        else if (arg == "-frames" && has_value)
+        {
+            frames = strtoull(argv[++i], nullptr, 0);
+        }
+        else if (arg == "-interval" && has_value)
+        {
+            interval = strtoull(argv[++i], nullptr, 0);
+        }
+        else if (arg == "-pgm" && has_value)
+        {
+            pgm_prefix = argv[++i];
+        }
+        else
+        {
+            golden_path.clear();
+            break;
+        }
+    }
+    if (golden_path.empty())
+    {
+        cout << "usage: " << argv[0] << " -golden file [-movie file] [-rom file] [-engine name]"
+             << " [-record] [-frames n] [-interval n] [-pgm prefix]" << endl;
+        return 1;
+    }
+    if (engine_names.empty())
+    {
+        engine_names = record ? vector<string>(1, "interpreter") : EngineRegistry::Names();
+    }
+
+    InputMovie movie;
+    if (!movie_path.empty() && !movie.Load(movie_path))
+    {
+        cout << "Unable to read movie " << movie_path << endl;
+        return 1;
+    }
+    Emulator e;
+    if (e.LoadRom(rom_path) == 0)
+    {
+        return 1;
+    }
+    Snapshot power_on;
+    e.SaveState(&power_on);
+
+    GoldenFrames golden;
+    if (record)
+    {
+        const Engine *engine = EngineRegistry::Find(engine_names[0]);
+        if (engine == nullptr)
+        {
+            cout << "Unknown engine " << engine_names[0] << endl;
+            return 1;
+        }
+        golden.Record(power_on, engine->run, &movie, frames, interval);
+        if (!golden.Save(golden_path))
+        {
+            cout << "Unable to write " << golden_path << endl;
+            return 1;
+        }
+        cout << golden.Frames().size() << " golden frames recorded with " << engine->name << endl;
+        return 0;
+    }
+
+    if (!golden.Load(golden_path) || golden.Frames().empty())
+    {
+        cout << "Unable to read golden hashes " << golden_path << endl;
+        return 1;
+    }
+    int failures = 0;
+    for (size_t n = 0; n < engine_names.size(); n++)
+    {
+        const Engine *engine = EngineRegistry::Find(engine_names[n]);
+        if (engine == nullptr)
+        {
+            cout << "Unknown engine " << engine_names[n] << endl;
+            return 1;
+        }
+
+        GoldenMismatch mismatch;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        bool passed = golden.Check(power_on, engine->run, &movie, &mismatch);
+        chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+        if (passed)
+        {
+            cout << engine->name << ": " << golden.Frames().back().frame << " frames match ("
+                 << elapsed.count() << " s)" << endl;
+            continue;
+        }
+
+        ostringstream pgm_path;
+        pgm_path << pgm_prefix << '_' << engine->name << '_' << mismatch.actual.frame << ".pgm";
+        GoldenFrames::WritePgm(pgm_path.str(), mismatch.vram.data());
+        cout << engine->name << ": frame " << mismatch.actual.frame << " differs"
+             << (mismatch.actual.vram_hash != mismatch.expected.vram_hash ? " in video RAM" : "")
+             << (mismatch.actual.ram_hash != mismatch.expected.ram_hash ? " in work RAM" : "")
+             << ", screen written to " << pgm_path.str() << endl;
+        failures++;
+    }
+    return failures > 0 ? 2 : 0;
+}
@@ -0,0 +1,104 @@
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "emulator/engine.hpp"
+#include "emulator/opcode_bench.hpp"
+#include "static_invaders/static_invaders.hpp"
+
+using namespace std;
+
+// Time every opcode on every engine and print a heat table per engine
+// usage: OpcodeBench [-engine name] [-cycles n] [-color] [-host] [-csv file]
+int main(int argc, char **argv)
+{
+    StaticInvaders::Register();
+
+    vector<string> engine_names;
+    int cycles = 2000000;
+    bool color = false;
+    bool host_cycles = false;
+    string csv_path;
+
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "-engine" && has_value)
+        {
+            engine_names.push_back(argv[++i]);
+        }
+        else if (arg == "-cycles" && has_value)
+        {
+            cycles = atoi(argv[++i]);
+        }
+        else if (arg == "-color")
+        {
+            color = true;
+        }
+        else if (arg == "-host")
+        {
+            host_cycles = true;
+        }
+        else if (arg == "-csv" && has_value)
+        {
+            csv_path = argv[++i];
+        }
+        else
+        {
+            cout << "usage: " << argv[0] << " [-engine name] [-cycles n] [-color] [-host] [-csv file]" << endl
+                 << "engines:";
+            vector<string> names = EngineRegistry::Names();
+            for (size_t n = 0; n < names.size(); n++)
+            {
+                cout << ' ' << names[n];
+            }
+            cout << endl;
+            return 1;
+        }
+    }
+    if (engine_names.empty())
+    {
+        engine_names = EngineRegistry::Names();
+    }
+
+    ofstream csv;
+    if (!csv_path.empty())
+    {
+        csv.open(csv_path.c_str());
+        if (!csv)
+        {
+            cout << "Unable to write " << csv_path << endl;
+            return 1;
+        }
+    }
+
+    for (size_t n = 0; n < engine_names.size(); n++)
+    {
+        const Engine *engine = EngineRegistry::Find(engine_names[n]);
+        if (engine == nullptr)
+        {
+            cout << "Unknown engine " << engine_names[n] << endl;
+            return 1;
+        }
+
+        OpcodeBench bench(*engine);
+        bench.SetCycles(cycles);
+        bench.Run();
+        bench.PrintHeatTable(cout, false, color);
+        if (host_cycles)
+        {
+            cout << endl;
+            bench.PrintHeatTable(cout, true, color);
+        }
+        cout << endl;
+        bench.PrintSlowest(cout, 10);
+        cout << endl;
+        if (csv.is_open())
+        {
+            bench.WriteCsv(csv, n == 0);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,124 @@
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+#include "disassembler/control_flow.hpp"
+#include "emulator/recompiler.hpp"
+
+using namespace std;
+
+// Translate a ROM to C++ for the static engine, see emulator/recompiler.hpp
+// usage: Recompile -rom file -out file [-class name] [-header file] [-entry address]...
+//                  [-entry-table address count stride]...
+//
+// -entry-table adds the count addresses stored at address, address + stride,
+// ... of the ROM as entry points, such as the handlers of a table of records
+// reached through PCHL
+int main(int argc, char **argv)
+{
+    string rom_path;
+    string out_path;
+    string class_name = "StaticInvaders";
+    string header = "static_invaders/static_invaders.hpp";
+    vector<uint16_t> entry_points = ControlFlowGraph::DefaultEntryPoints();
+    struct EntryTable
+    {
+        uint16_t address;
+        int count;
+        int stride;
+    };
+    vector<EntryTable> entry_tables;
+
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "-rom" && has_value)
+        {
+            rom_path = argv[++i];
+        }
+        else if (arg == "-out" && has_value)
+        {
+            out_path = argv[++i];
+        }
+        else if (arg == "-class" && has_value)
+        {
+            class_name = argv[++i];
+        }
+        else if (arg == "-header" && has_value)
+        {
+            header = argv[++i];
+        }
+        else if (arg == "-entry" && has_value)
+        {
+            entry_points.push_back(static_cast<uint16_t>(strtoul(argv[++i], nullptr, 0)));
+        }
+        else if (arg == "-entry-table" && i + 3 < argc)
+        {
+            EntryTable table;
+            table.address = static_cast<uint16_t>(strtoul(argv[++i], nullptr, 0));
+            table.count = atoi(argv[++i]);
+            table.stride = atoi(argv[++i]);
+            entry_tables.push_back(table);
+        }
+        else
+        {
+            rom_path.clear();
+            break;
+        }
+    }
+    if (rom_path.empty() || out_path.empty())
+    {
+        cout << "usage: " << argv[0] << " -rom file -out file [-class name] [-header file] [-entry address]..."
+             << " [-entry-table address count stride]..." << endl;
+        return 1;
+    }
+
+    ifstream file(rom_path, ios::binary);
+    vector<uint8_t> rom((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+    if (!file.is_open() || rom.empty())
+    {
+        cout << "Unable to read ROM " << rom_path << endl;
+        return 1;
+    }
+
+    // a table that no longer lies in the ROM or holds an address outside it
+    // means the ROM changed, so fail rather than miss the code it points to
+    for (const EntryTable &table : entry_tables)
+    {
+        if (table.count <= 0 || table.stride < 2 ||
+            !ControlFlowGraph::TableEntryPoints(rom.data(), static_cast<int>(rom.size()), 0x0000, table.address,
+                                                table.count, table.stride, &entry_points))
+        {
+            cout << "Invalid entry table at 0x" << hex << table.address << dec << " in " << rom_path << endl;
+            return 1;
+        }
+    }
+
+    Recompiler recompiler;
+    recompiler.Analyze(rom.data(), static_cast<int>(rom.size()), entry_points);
+
+    // write to a temporary file first, so that a failed run leaves no
+    // half-written source for the build to pick up
+    string temporary = out_path + ".tmp";
+    {
+        ofstream out(temporary);
+        recompiler.Write(out, class_name, header);
+        if (!out.flush())
+        {
+            cout << "Unable to write " << temporary << endl;
+            return 1;
+        }
+    }
+    remove(out_path.c_str());
+    if (rename(temporary.c_str(), out_path.c_str()) != 0)
+    {
+        cout << "Unable to write " << out_path << endl;
+        return 1;
+    }
+    cout << recompiler.Blocks().size() << " blocks, " << recompiler.CodeBytes() << " bytes of code recompiled to "
+         << out_path << endl;
+    return 0;
+}
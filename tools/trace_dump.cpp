@@ -0,0 +1,79 @@
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include "emulator/trace.hpp"
+#include "disassembler/disassembler.hpp"
+
+using namespace std;
+
+// Expand a binary trace written by TraceRecorder into the text format of
+// the disassembler, one line per executed instruction
+// usage: TraceDump <trace file> [-state] [-limit n]
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        cout << "usage: " << argv[0] << " <trace file> [-state] [-limit n]" << endl;
+        return 1;
+    }
+
+    bool show_state = false;
+    uint64_t limit = UINT64_MAX;
+    for (int i = 2; i < argc; i++)
+    {
+        string arg = argv[i];
+        if (arg == "-state")
+        {
+            show_state = true;
+        }
+        else if (arg == "-limit" && i + 1 < argc)
+        {
+            limit = strtoull(argv[++i], nullptr, 0);
+        }
+        else
+        {
+            cout << "Unknown option " << arg << endl;
+            return 1;
+        }
+    }
+
+    TraceReader reader;
+    if (!reader.Open(argv[1]))
+    {
+        cout << "Unable to open trace " << argv[1] << endl;
+        return 1;
+    }
+
+    TraceRecord record;
+    ostringstream line;
+    for (uint64_t n = 0; n < limit && reader.Next(&record); n++)
+    {
+        line.str("");
+        if (record.flags & kTraceInterrupt)
+        {
+            line << hex << setfill('0') << setw(4) << record.pc << " INTERRUPT RST "
+                 << ((record.opcode >> 3) & 0x7) << '\n';
+        }
+        else
+        {
+            uint8_t bytes[3] = {record.opcode, record.operand1, record.operand2};
+            Disassembler::Disassemble(line, bytes, 3, record.pc);
+        }
+
+        string text = line.str();
+        if (show_state)
+        {
+            // replace the newline with the state after the instruction
+            text.erase(text.size() - 1);
+            ostringstream state;
+            state << hex << setfill('0') << "  A=" << setw(2) << static_cast<unsigned>(record.a)
+                  << " F=" << setw(2) << static_cast<unsigned>(record.flags & ~kTraceInterrupt)
+                  << " SP=" << setw(4) << record.sp << dec << " CYC=" << record.cycle << '\n';
+            text = (text + string(32, ' ')).substr(0, max(text.size(), static_cast<size_t>(28))) + state.str();
+        }
+        cout << text;
+    }
+    return 0;
+}